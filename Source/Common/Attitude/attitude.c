@@ -0,0 +1,475 @@
+/**
+  ******************************************************************************
+  * @file    attitude.c
+  * @brief   Complementary, Madgwick and error-state Kalman attitude filters.
+  *
+  *          Every filter compares the measured gravity direction with the one
+  *          predicted from the attitude,
+  *
+  *            v = R' [0 0 1]' = [2(xz - wy)  2(yz + wx)  w^2 - x^2 - y^2 + z^2]'
+  *
+  *          and only differs in how the difference steers the gyroscope
+  *          integration. Square roots in the update path go through
+  *          attitude_inv_sqrt and the only division is the reciprocal of the
+  *          Kalman innovation determinant, so an update is a few hundred
+  *          single precision multiply-accumulates on the Cortex-M4 FPU.
+  *
+  *          The Kalman filter keeps the nominal attitude as a quaternion and
+  *          a 6 by 6 covariance of the small attitude error in the body frame
+  *          and the bias error. Each accelerometer correction is injected into
+  *          the quaternion and the error reset to zero.
+  ******************************************************************************
+  */
+
+#include "attitude.h"
+
+#include <math.h>
+
+#define ATTITUDE_GRAVITY 9.80665f
+
+/* Accelerometer samples further than this from 1 g are not used for tilt */
+#define ATTITUDE_ACCEL_GATE 0.2f
+
+static const attitude_complementary_t default_complementary =
+{
+  .kp = 1.0f,
+  .ki = 0.02f,
+  .integral = {0.0f, 0.0f, 0.0f},
+};
+
+static const attitude_madgwick_t default_madgwick =
+{
+  .beta = 0.1f,
+};
+
+/* Gyroscope noise includes thruster vibration, the accelerometer noise vehicle acceleration */
+static const attitude_ekf_t default_ekf =
+{
+  .gyro_noise = 0.005f,
+  .bias_noise = 0.0001f,
+  .accel_noise = 0.05f,
+  .bias = {0.0f, 0.0f, 0.0f},
+  .covariance = {{0.0f}},
+};
+
+/* Initial standard deviations of the attitude error, rad, and the bias, rad/s */
+#define ATTITUDE_EKF_ANGLE_SIGMA 0.05f
+#define ATTITUDE_EKF_BIAS_SIGMA  0.02f
+
+static void attitude_normalize(float q[4])
+{
+  float scale = attitude_inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+
+  for (uint32_t i = 0; i < 4u; i++)
+  {
+    q[i] *= scale;
+  }
+}
+
+/* q += q * (0, w) / 2 * dt, then renormalized */
+static void attitude_integrate(float q[4], const float w[3], float dt)
+{
+  float h = 0.5f * dt;
+  float dw = (-q[1] * w[0] - q[2] * w[1] - q[3] * w[2]) * h;
+  float dx = (q[0] * w[0] + q[2] * w[2] - q[3] * w[1]) * h;
+  float dy = (q[0] * w[1] - q[1] * w[2] + q[3] * w[0]) * h;
+  float dz = (q[0] * w[2] + q[1] * w[1] - q[2] * w[0]) * h;
+
+  q[0] += dw;
+  q[1] += dx;
+  q[2] += dy;
+  q[3] += dz;
+
+  attitude_normalize(q);
+}
+
+/* World up in the body frame */
+static void attitude_gravity(const float q[4], float v[3])
+{
+  v[0] = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+  v[1] = 2.0f * (q[2] * q[3] + q[0] * q[1]);
+  v[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+/* Unit gravity direction, or false if the sample is too far from 1 g to be gravity */
+static bool attitude_direction(const float accel[3], float a[3])
+{
+  float squared = accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2];
+  float low = (1.0f - ATTITUDE_ACCEL_GATE) * ATTITUDE_GRAVITY;
+  float high = (1.0f + ATTITUDE_ACCEL_GATE) * ATTITUDE_GRAVITY;
+
+  if (squared < low * low || squared > high * high)
+  {
+    return false;
+  }
+
+  float scale = attitude_inv_sqrt(squared);
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    a[i] = accel[i] * scale;
+  }
+
+  return true;
+}
+
+/* Roll and pitch from the gravity direction, zero heading */
+static void attitude_align(float q[4], const float a[3])
+{
+  float roll = atan2f(a[1], a[2]);
+  float pitch = atan2f(-a[0], sqrtf(a[1] * a[1] + a[2] * a[2]));
+  float cr = cosf(0.5f * roll);
+  float sr = sinf(0.5f * roll);
+  float cp = cosf(0.5f * pitch);
+  float sp = sinf(0.5f * pitch);
+
+  q[0] = cr * cp;
+  q[1] = sr * cp;
+  q[2] = cr * sp;
+  q[3] = -sr * sp;
+}
+
+static void attitude_complementary_update(attitude_t *attitude, const float gyro[3], const float a[3], bool usable, float dt)
+{
+  attitude_complementary_t *filter = &attitude->complementary;
+  float w[3];
+
+  if (usable)
+  {
+    float v[3];
+    attitude_gravity(attitude->q, v);
+
+    /* Rotation taking the predicted direction onto the measured one */
+    float e[3] =
+    {
+      a[1] * v[2] - a[2] * v[1],
+      a[2] * v[0] - a[0] * v[2],
+      a[0] * v[1] - a[1] * v[0],
+    };
+
+    for (uint32_t i = 0; i < 3u; i++)
+    {
+      filter->integral[i] += filter->ki * e[i] * dt;
+      w[i] = gyro[i] + filter->integral[i] + filter->kp * e[i];
+    }
+  }
+  else
+  {
+    for (uint32_t i = 0; i < 3u; i++)
+    {
+      w[i] = gyro[i] + filter->integral[i];
+    }
+  }
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    attitude->rate[i] = gyro[i] + filter->integral[i];
+  }
+
+  attitude_integrate(attitude->q, w, dt);
+}
+
+static void attitude_madgwick_update(attitude_t *attitude, const float gyro[3], const float a[3], bool usable, float dt)
+{
+  float *q = attitude->q;
+  float h = 0.5f;
+
+  float rate[4] =
+  {
+    (-q[1] * gyro[0] - q[2] * gyro[1] - q[3] * gyro[2]) * h,
+    (q[0] * gyro[0] + q[2] * gyro[2] - q[3] * gyro[1]) * h,
+    (q[0] * gyro[1] - q[1] * gyro[2] + q[3] * gyro[0]) * h,
+    (q[0] * gyro[2] + q[1] * gyro[1] - q[2] * gyro[0]) * h,
+  };
+
+  if (usable)
+  {
+    float v[3];
+    attitude_gravity(q, v);
+
+    float f[3] = {v[0] - a[0], v[1] - a[1], v[2] - a[2]};
+
+    /* Gradient of |f|^2 / 2 with respect to q, J' f */
+    float s[4] =
+    {
+      -2.0f * q[2] * f[0] + 2.0f * q[1] * f[1],
+      2.0f * q[3] * f[0] + 2.0f * q[0] * f[1] - 4.0f * q[1] * f[2],
+      -2.0f * q[0] * f[0] + 2.0f * q[3] * f[1] - 4.0f * q[2] * f[2],
+      2.0f * q[1] * f[0] + 2.0f * q[2] * f[1],
+    };
+
+    float squared = s[0] * s[0] + s[1] * s[1] + s[2] * s[2] + s[3] * s[3];
+
+    if (squared > 1e-12f)
+    {
+      float step = attitude->madgwick.beta * attitude_inv_sqrt(squared);
+
+      for (uint32_t i = 0; i < 4u; i++)
+      {
+        rate[i] -= step * s[i];
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < 4u; i++)
+  {
+    q[i] += rate[i] * dt;
+  }
+
+  attitude_normalize(q);
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    attitude->rate[i] = gyro[i];
+  }
+}
+
+static void attitude_ekf_predict(attitude_t *attitude, const float gyro[3], float dt)
+{
+  attitude_ekf_t *filter = &attitude->ekf;
+  float (*p)[ATTITUDE_EKF_STATES] = filter->covariance;
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    attitude->rate[i] = gyro[i] - filter->bias[i];
+  }
+
+  attitude_integrate(attitude->q, attitude->rate, dt);
+
+  /* F = [I - [w dt]x  -I dt; 0  I] */
+  float f[ATTITUDE_EKF_STATES][ATTITUDE_EKF_STATES] = {{0.0f}};
+  float wx = attitude->rate[0] * dt;
+  float wy = attitude->rate[1] * dt;
+  float wz = attitude->rate[2] * dt;
+
+  f[0][1] = wz;
+  f[0][2] = -wy;
+  f[1][0] = -wz;
+  f[1][2] = wx;
+  f[2][0] = wy;
+  f[2][1] = -wx;
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    f[i][i] = 1.0f;
+    f[i][i + 3u] = -dt;
+    f[i + 3u][i + 3u] = 1.0f;
+  }
+
+  float fp[ATTITUDE_EKF_STATES][ATTITUDE_EKF_STATES];
+
+  for (uint32_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+  {
+    for (uint32_t j = 0; j < ATTITUDE_EKF_STATES; j++)
+    {
+      float sum = 0.0f;
+
+      for (uint32_t k = 0; k < ATTITUDE_EKF_STATES; k++)
+      {
+        sum += f[i][k] * p[k][j];
+      }
+
+      fp[i][j] = sum;
+    }
+  }
+
+  float angle_noise = filter->gyro_noise * filter->gyro_noise * dt;
+  float bias_noise = filter->bias_noise * filter->bias_noise * dt;
+
+  for (uint32_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+  {
+    for (uint32_t j = i; j < ATTITUDE_EKF_STATES; j++)
+    {
+      float sum = 0.0f;
+
+      for (uint32_t k = 0; k < ATTITUDE_EKF_STATES; k++)
+      {
+        sum += fp[i][k] * f[j][k];
+      }
+
+      if (i == j)
+      {
+        sum += (i < 3u) ? angle_noise : bias_noise;
+      }
+
+      p[i][j] = sum;
+      p[j][i] = sum;
+    }
+  }
+}
+
+static void attitude_ekf_correct(attitude_t *attitude, const float a[3])
+{
+  attitude_ekf_t *filter = &attitude->ekf;
+  float (*p)[ATTITUDE_EKF_STATES] = filter->covariance;
+
+  float v[3];
+  attitude_gravity(attitude->q, v);
+
+  /* The measurement only sees the attitude error, through H = [[v]x  0] */
+  float h[3][3] =
+  {
+    {0.0f, -v[2], v[1]},
+    {v[2], 0.0f, -v[0]},
+    {-v[1], v[0], 0.0f},
+  };
+
+  float hp[3][ATTITUDE_EKF_STATES];
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    for (uint32_t j = 0; j < ATTITUDE_EKF_STATES; j++)
+    {
+      hp[i][j] = h[i][0] * p[0][j] + h[i][1] * p[1][j] + h[i][2] * p[2][j];
+    }
+  }
+
+  float noise = filter->accel_noise * filter->accel_noise;
+  float s[3][3];
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    for (uint32_t k = 0; k < 3u; k++)
+    {
+      s[i][k] = hp[i][0] * h[k][0] + hp[i][1] * h[k][1] + hp[i][2] * h[k][2] + ((i == k) ? noise : 0.0f);
+    }
+  }
+
+  /* Inverse of the innovation covariance from its adjugate */
+  float c[3][3] =
+  {
+    {s[1][1] * s[2][2] - s[1][2] * s[2][1], s[0][2] * s[2][1] - s[0][1] * s[2][2], s[0][1] * s[1][2] - s[0][2] * s[1][1]},
+    {s[1][2] * s[2][0] - s[1][0] * s[2][2], s[0][0] * s[2][2] - s[0][2] * s[2][0], s[0][2] * s[1][0] - s[0][0] * s[1][2]},
+    {s[1][0] * s[2][1] - s[1][1] * s[2][0], s[0][1] * s[2][0] - s[0][0] * s[2][1], s[0][0] * s[1][1] - s[0][1] * s[1][0]},
+  };
+
+  float determinant = s[0][0] * c[0][0] + s[0][1] * c[1][0] + s[0][2] * c[2][0];
+
+  if (!(determinant > 1e-20f))
+  {
+    return;
+  }
+
+  float inverse = 1.0f / determinant;
+  float r[3] = {a[0] - v[0], a[1] - v[1], a[2] - v[2]};
+
+  /* K = P H' S^-1, and P H' is hp transposed because P is symmetric */
+  float k[ATTITUDE_EKF_STATES][3];
+  float dx[ATTITUDE_EKF_STATES];
+
+  for (uint32_t j = 0; j < ATTITUDE_EKF_STATES; j++)
+  {
+    for (uint32_t i = 0; i < 3u; i++)
+    {
+      k[j][i] = (hp[0][j] * c[0][i] + hp[1][j] * c[1][i] + hp[2][j] * c[2][i]) * inverse;
+    }
+
+    dx[j] = k[j][0] * r[0] + k[j][1] * r[1] + k[j][2] * r[2];
+  }
+
+  /* P -= K H P, kept symmetric */
+  for (uint32_t i = 0; i < ATTITUDE_EKF_STATES; i++)
+  {
+    for (uint32_t j = i; j < ATTITUDE_EKF_STATES; j++)
+    {
+      float sum = p[i][j] - (k[i][0] * hp[0][j] + k[i][1] * hp[1][j] + k[i][2] * hp[2][j]);
+
+      p[i][j] = sum;
+      p[j][i] = sum;
+    }
+  }
+
+  /* q = q * (1, dtheta / 2) */
+  float *q = attitude->q;
+  float ex = 0.5f * dx[0];
+  float ey = 0.5f * dx[1];
+  float ez = 0.5f * dx[2];
+  float w = q[0] - q[1] * ex - q[2] * ey - q[3] * ez;
+  float x = q[1] + q[0] * ex + q[2] * ez - q[3] * ey;
+  float y = q[2] + q[0] * ey - q[1] * ez + q[3] * ex;
+  float z = q[3] + q[0] * ez + q[1] * ey - q[2] * ex;
+
+  q[0] = w;
+  q[1] = x;
+  q[2] = y;
+  q[3] = z;
+
+  attitude_normalize(q);
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    filter->bias[i] += dx[i + 3u];
+  }
+}
+
+void attitude_init(attitude_t *attitude, attitude_filter_t filter)
+{
+  memset(attitude, 0, sizeof(*attitude));
+
+  attitude->filter = filter;
+  attitude->q[0] = 1.0f;
+
+  switch (filter)
+  {
+    case ATTITUDE_COMPLEMENTARY:
+      attitude->complementary = default_complementary;
+      break;
+
+    case ATTITUDE_MADGWICK:
+      attitude->madgwick = default_madgwick;
+      break;
+
+    case ATTITUDE_EKF:
+      attitude->ekf = default_ekf;
+
+      for (uint32_t i = 0; i < 3u; i++)
+      {
+        attitude->ekf.covariance[i][i] = ATTITUDE_EKF_ANGLE_SIGMA * ATTITUDE_EKF_ANGLE_SIGMA;
+        attitude->ekf.covariance[i + 3u][i + 3u] = ATTITUDE_EKF_BIAS_SIGMA * ATTITUDE_EKF_BIAS_SIGMA;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void attitude_update(attitude_t *attitude, const float gyro[3], const float accel[3], float dt)
+{
+  if (!(dt > 0.0f))
+  {
+    return;
+  }
+
+  float a[3];
+  bool usable = attitude_direction(accel, a);
+
+  if (usable && !attitude->aligned)
+  {
+    attitude_align(attitude->q, a);
+    attitude->aligned = true;
+  }
+
+  switch (attitude->filter)
+  {
+    case ATTITUDE_COMPLEMENTARY:
+      attitude_complementary_update(attitude, gyro, a, usable, dt);
+      break;
+
+    case ATTITUDE_MADGWICK:
+      attitude_madgwick_update(attitude, gyro, a, usable, dt);
+      break;
+
+    case ATTITUDE_EKF:
+      attitude_ekf_predict(attitude, gyro, dt);
+
+      if (usable)
+      {
+        attitude_ekf_correct(attitude, a);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
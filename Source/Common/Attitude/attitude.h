@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file    attitude.h
+  * @brief   Attitude estimation from gyroscope and accelerometer samples.
+  *          Shared by the firmware and the host so logged samples can be
+  *          replayed through the same filters.
+  *
+  *          Three filters with the same interface: a complementary filter
+  *          with a proportional-integral correction, Madgwick's gradient
+  *          descent filter and an error-state Kalman filter that also tracks
+  *          the gyroscope bias. All state is fixed size and lives in the
+  *          filter structure, nothing is allocated.
+  *
+  *          Quaternions are body to world, w x y z, with the world z axis up,
+  *          so a level accelerometer reads +g on z. Without a magnetometer
+  *          heading is the integrated gyroscope and starts at zero.
+  ******************************************************************************
+  */
+
+#ifndef __ATTITUDE_H
+#define __ATTITUDE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Error state: attitude error in the body frame, then gyroscope bias */
+#define ATTITUDE_EKF_STATES 6u
+
+typedef enum
+{
+  ATTITUDE_COMPLEMENTARY,
+  ATTITUDE_MADGWICK,
+  ATTITUDE_EKF
+} attitude_filter_t;
+
+typedef struct
+{
+  float kp;                     /* Correction gain, rad/s per unit of tilt error */
+  float ki;                     /* Bias gain, rad/s^2 per unit of tilt error */
+  float integral[3];            /* Integrated correction, the negated gyroscope bias */
+} attitude_complementary_t;
+
+typedef struct
+{
+  float beta;                   /* Gradient step, rad/s */
+} attitude_madgwick_t;
+
+typedef struct
+{
+  float gyro_noise;             /* Gyroscope noise density, rad/s/sqrt(Hz) */
+  float bias_noise;             /* Bias random walk, rad/s^2/sqrt(Hz) */
+  float accel_noise;            /* Accelerometer direction noise, in units of g */
+  float bias[3];                /* rad/s */
+  float covariance[ATTITUDE_EKF_STATES][ATTITUDE_EKF_STATES];
+} attitude_ekf_t;
+
+typedef struct
+{
+  attitude_filter_t filter;
+  bool aligned;                 /* Tilt taken from the first accelerometer sample */
+  float q[4];                   /* Body to world, w x y z */
+  float rate[3];                /* Bias corrected body rates of the last update, rad/s */
+  union
+  {
+    attitude_complementary_t complementary;
+    attitude_madgwick_t madgwick;
+    attitude_ekf_t ekf;
+  };
+} attitude_t;
+
+/**
+  * @brief  Starts a filter at rest with the default gains. The first update
+  *         with a usable accelerometer sample sets roll and pitch.
+  * @param  attitude: Filter to start
+  * @param  filter: Which filter
+  */
+void attitude_init(attitude_t *attitude, attitude_filter_t filter);
+
+/**
+  * @brief  Advances the filter by one sample. Accelerometer samples far from
+  *         1 g are taken as vehicle acceleration and only the gyroscope is used.
+  * @param  attitude: Filter
+  * @param  gyro: Body rates, rad/s
+  * @param  accel: Specific force, m/s^2
+  * @param  dt: Seconds since the previous sample
+  */
+void attitude_update(attitude_t *attitude, const float gyro[3], const float accel[3], float dt);
+
+/**
+  * @brief  Approximates 1 / sqrt(x) with a bit-level first guess and one
+  *         Newton step, relative error under 0.07%.
+  * @param  x: Positive value
+  * @retval 1 / sqrt(x)
+  */
+static inline float attitude_inv_sqrt(float x)
+{
+  uint32_t bits;
+  float y;
+
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5F1FFFF9u - (bits >> 1);
+  memcpy(&y, &bits, sizeof(y));
+
+  return 0.703952253f * y * (2.38924456f - x * y * y);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ATTITUDE_H */
@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file    cobs.c
+  * @brief   Block COBS encoder and decoder. Streams are decoded incrementally
+  *          by the frame parser in protocol.c instead.
+  ******************************************************************************
+  */
+
+#include "cobs.h"
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  size_t code_index = 0;
+  size_t out = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    if (src[i] != 0)
+    {
+      dst[out++] = src[i];
+      code++;
+    }
+
+    /* Close the group at a zero, or once it holds 254 data bytes */
+    if (src[i] == 0 || code == 0xFF)
+    {
+      dst[code_index] = code;
+      code = 1;
+      code_index = out++;
+
+      /* A full group at the very end needs no empty group after it */
+      if (src[i] != 0 && i + 1 == len)
+      {
+        return out - 1;
+      }
+    }
+  }
+
+  dst[code_index] = code;
+
+  return out;
+}
+
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  size_t in = 0;
+  size_t out = 0;
+
+  while (in < len)
+  {
+    uint8_t code = src[in++];
+
+    if (code == 0 || in + code - 1 > len)
+    {
+      return 0;
+    }
+
+    for (uint8_t i = 1; i < code; i++)
+    {
+      if (src[in] == 0)
+      {
+        return 0;
+      }
+
+      dst[out++] = src[in++];
+    }
+
+    if (code != 0xFF && in < len)
+    {
+      dst[out++] = 0;
+    }
+  }
+
+  return out;
+}
@@ -0,0 +1,46 @@
+/**
+  ******************************************************************************
+  * @file    cobs.h
+  * @brief   Consistent Overhead Byte Stuffing. Removes every zero from a block
+  *          so a single 0x00 can delimit frames on the wire.
+  ******************************************************************************
+  */
+
+#ifndef __PROTOCOL_COBS_H
+#define __PROTOCOL_COBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  * @brief  Worst case encoded size of a block, excluding the frame delimiter.
+  */
+#define COBS_MAX_ENCODED(len) ((len) + ((len) / 254u) + 1u)
+
+/**
+  * @brief  Encodes a block. The output never contains a zero byte.
+  * @param  src: Bytes to encode
+  * @param  len: Number of bytes
+  * @param  dst: Output buffer of at least COBS_MAX_ENCODED(len) bytes, must not overlap src
+  * @retval Number of bytes written
+  */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+/**
+  * @brief  Decodes a complete block, without its delimiter.
+  * @param  src: Encoded bytes
+  * @param  len: Number of encoded bytes
+  * @param  dst: Output buffer of at least len bytes, may be the same as src
+  * @retval Number of bytes written, or 0 if the block is malformed
+  */
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROTOCOL_COBS_H */
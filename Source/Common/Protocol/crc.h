@@ -0,0 +1,67 @@
+/**
+  ******************************************************************************
+  * @file    crc.h
+  * @brief   CRC-16/CCITT-FALSE and CRC-32 (IEEE 802.3) checksums shared by the
+  *          host and firmware.
+  ******************************************************************************
+  */
+
+#ifndef __PROTOCOL_CRC_H
+#define __PROTOCOL_CRC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  * @brief  Initial value for an incremental CRC-16 calculation.
+  */
+#define CRC16_INIT 0xFFFFu
+
+/**
+  * @brief  Initial value for an incremental CRC-32 calculation.
+  */
+#define CRC32_INIT 0xFFFFFFFFu
+
+/**
+  * @brief  Continues a CRC-16/CCITT-FALSE calculation (poly 0x1021, no reflection).
+  * @param  crc: Running CRC, CRC16_INIT for the first block
+  * @param  data: Bytes to checksum
+  * @param  len: Number of bytes
+  * @retval Updated CRC, final once all data has been added
+  */
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+  * @brief  Continues a CRC-32 calculation (poly 0xEDB88320, reflected).
+  * @param  crc: Running CRC, CRC32_INIT for the first block
+  * @param  data: Bytes to checksum
+  * @param  len: Number of bytes
+  * @retval Updated CRC. XOR with 0xFFFFFFFF once all data has been added.
+  */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+  * @brief  Computes the CRC-16/CCITT-FALSE of a single block.
+  */
+static inline uint16_t crc16(const uint8_t *data, size_t len)
+{
+  return crc16_update(CRC16_INIT, data, len);
+}
+
+/**
+  * @brief  Computes the CRC-32 of a single block.
+  */
+static inline uint32_t crc32(const uint8_t *data, size_t len)
+{
+  return crc32_update(CRC32_INIT, data, len) ^ 0xFFFFFFFFu;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROTOCOL_CRC_H */
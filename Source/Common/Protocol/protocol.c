@@ -0,0 +1,180 @@
+/**
+  ******************************************************************************
+  * @file    protocol.c
+  * @brief   Frame encoding and the incremental stream decoder.
+  ******************************************************************************
+  */
+
+#include "protocol.h"
+
+#include <string.h>
+
+int protocol_payload_size(uint8_t id)
+{
+  switch (id)
+  {
+    case PROTOCOL_ID_COMMAND:   return (int)sizeof(protocol_command_t);
+    case PROTOCOL_ID_PING:      return (int)sizeof(protocol_ping_t);
+    case PROTOCOL_ID_STATUS:    return (int)sizeof(protocol_status_t);
+    case PROTOCOL_ID_ATTITUDE:  return (int)sizeof(protocol_attitude_t);
+    case PROTOCOL_ID_DEPTH:     return (int)sizeof(protocol_depth_t);
+    case PROTOCOL_ID_THRUSTERS: return (int)sizeof(protocol_thrusters_t);
+    case PROTOCOL_ID_PONG:      return (int)sizeof(protocol_pong_t);
+    case PROTOCOL_ID_TIMING:    return (int)sizeof(protocol_timing_t);
+    case PROTOCOL_ID_IMU:       return (int)sizeof(protocol_imu_t);
+    default:                    return -1;
+  }
+}
+
+size_t protocol_encode(uint8_t id, uint8_t seq, const void *payload, size_t length, uint8_t *out, size_t capacity)
+{
+  uint8_t frame[PROTOCOL_MAX_FRAME];
+
+  if (length > PROTOCOL_MAX_PAYLOAD || capacity < COBS_MAX_ENCODED(PROTOCOL_HEADER_SIZE + length + PROTOCOL_CRC_SIZE) + 1u)
+  {
+    return 0;
+  }
+
+  frame[0] = id;
+  frame[1] = seq;
+
+  if (length > 0)
+  {
+    memcpy(&frame[PROTOCOL_HEADER_SIZE], payload, length);
+  }
+
+  size_t size = PROTOCOL_HEADER_SIZE + length;
+  uint16_t crc = crc16(frame, size);
+
+  frame[size++] = (uint8_t)(crc & 0xFF);
+  frame[size++] = (uint8_t)(crc >> 8);
+
+  size_t written = cobs_encode(frame, size, out);
+  out[written++] = 0;
+
+  return written;
+}
+
+void protocol_decoder_init(protocol_decoder_t *decoder)
+{
+  memset(decoder, 0, sizeof(*decoder));
+}
+
+/* Checks a fully unstuffed frame and fills in the caller's view of it */
+static protocol_result_t protocol_finish(protocol_decoder_t *decoder, protocol_frame_t *frame)
+{
+  uint8_t length = decoder->length;
+
+  if (length < PROTOCOL_HEADER_SIZE + PROTOCOL_CRC_SIZE)
+  {
+    return PROTOCOL_ERROR;
+  }
+
+  uint16_t received = (uint16_t)(decoder->buffer[length - 2] | (decoder->buffer[length - 1] << 8));
+
+  if (crc16(decoder->buffer, (size_t)length - PROTOCOL_CRC_SIZE) != received)
+  {
+    return PROTOCOL_ERROR;
+  }
+
+  uint8_t payload_length = (uint8_t)(length - PROTOCOL_HEADER_SIZE - PROTOCOL_CRC_SIZE);
+  int expected = protocol_payload_size(decoder->buffer[0]);
+
+  /* Unknown messages are passed through so newer peers can extend the protocol */
+  if (expected >= 0 && expected != payload_length)
+  {
+    return PROTOCOL_ERROR;
+  }
+
+  frame->id = decoder->buffer[0];
+  frame->seq = decoder->buffer[1];
+  frame->length = payload_length;
+  frame->payload = &decoder->buffer[PROTOCOL_HEADER_SIZE];
+
+  return PROTOCOL_FRAME;
+}
+
+protocol_result_t protocol_decode(protocol_decoder_t *decoder, const uint8_t *data, size_t length,
+                                  size_t *consumed, protocol_frame_t *frame)
+{
+  size_t i = 0;
+
+  while (i < length)
+  {
+    uint8_t byte = data[i++];
+
+    /* Delimiter, the end of a frame or resynchronisation after an error */
+    if (byte == 0)
+    {
+      bool discard = decoder->discard;
+      bool empty = decoder->code == 0;
+      bool truncated = decoder->remaining != 0;
+
+      protocol_result_t result = PROTOCOL_ERROR;
+
+      if (!discard && !empty && !truncated)
+      {
+        result = protocol_finish(decoder, frame);
+      }
+
+      decoder->length = 0;
+      decoder->code = 0;
+      decoder->remaining = 0;
+      decoder->discard = false;
+
+      /* Back to back delimiters are idle line, not errors */
+      if (empty && !discard)
+      {
+        continue;
+      }
+
+      if (result == PROTOCOL_FRAME)
+      {
+        decoder->frames++;
+      }
+      else
+      {
+        decoder->errors++;
+      }
+
+      *consumed = i;
+      return result;
+    }
+
+    if (decoder->discard)
+    {
+      continue;
+    }
+
+    if (decoder->remaining == 0)
+    {
+      /* New group. The previous one implied a zero unless it was full. */
+      if (decoder->code != 0 && decoder->code != 0xFF)
+      {
+        if (decoder->length >= PROTOCOL_MAX_FRAME)
+        {
+          decoder->discard = true;
+          continue;
+        }
+
+        decoder->buffer[decoder->length++] = 0;
+      }
+
+      decoder->code = byte;
+      decoder->remaining = (uint8_t)(byte - 1);
+      continue;
+    }
+
+    if (decoder->length >= PROTOCOL_MAX_FRAME)
+    {
+      decoder->discard = true;
+      continue;
+    }
+
+    decoder->buffer[decoder->length++] = byte;
+    decoder->remaining--;
+  }
+
+  *consumed = i;
+  return PROTOCOL_INCOMPLETE;
+}
@@ -0,0 +1,280 @@
+/**
+  ******************************************************************************
+  * @file    protocol.h
+  * @brief   Host <-> vehicle wire protocol. Shared by the firmware and the host
+  *          so both sides always agree on the layout of every message.
+  *
+  *          A frame before stuffing is
+  *            | id (1) | seq (1) | payload (0..PROTOCOL_MAX_PAYLOAD) | crc16 (2) |
+  *          with the CRC-16/CCITT-FALSE over id, seq and payload, little-endian.
+  *          The frame is COBS encoded and terminated with a single 0x00.
+  *
+  *          All multi-byte fields are little-endian, which is the native order
+  *          of both the STM32 and x86/ARM hosts, so payloads are used in place.
+  ******************************************************************************
+  */
+
+#ifndef __PROTOCOL_H
+#define __PROTOCOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cobs.h"
+#include "crc.h"
+
+#if defined(__GNUC__)
+#define PROTOCOL_PACKED __attribute__((packed))
+#else
+#error "Packed payloads need a compiler specific attribute"
+#endif
+
+#ifdef __cplusplus
+#define PROTOCOL_ASSERT_SIZE(type, size) static_assert(sizeof(type) == (size), #type " layout changed")
+#else
+#define PROTOCOL_ASSERT_SIZE(type, size) _Static_assert(sizeof(type) == (size), #type " layout changed")
+#endif
+
+#define PROTOCOL_HEADER_SIZE  2u
+#define PROTOCOL_CRC_SIZE     2u
+#define PROTOCOL_MAX_PAYLOAD  60u
+#define PROTOCOL_MAX_FRAME    (PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD + PROTOCOL_CRC_SIZE)
+
+/**
+  * @brief  Largest frame on the wire, including COBS overhead and the delimiter.
+  */
+#define PROTOCOL_MAX_ENCODED  (COBS_MAX_ENCODED(PROTOCOL_MAX_FRAME) + 1u)
+
+/* Message identifiers --------------------------------------------------------*/
+
+typedef enum
+{
+  /* Host to vehicle */
+  PROTOCOL_ID_COMMAND     = 0x01,
+  PROTOCOL_ID_PING        = 0x02,
+
+  /* Vehicle to host */
+  PROTOCOL_ID_STATUS      = 0x80,
+  PROTOCOL_ID_ATTITUDE    = 0x81,
+  PROTOCOL_ID_DEPTH       = 0x82,
+  PROTOCOL_ID_THRUSTERS   = 0x83,
+  PROTOCOL_ID_PONG        = 0x84,
+  PROTOCOL_ID_TIMING      = 0x85,
+  PROTOCOL_ID_IMU         = 0x86
+} protocol_id_t;
+
+/* Payloads -------------------------------------------------------------------*/
+
+/* In vehicle to host messages time_us is a tick of the vehicle's free-running 1 MHz counter,
+   which wraps every 71.6 minutes. The host maps it onto its own clock with the ping exchange. */
+
+#define PROTOCOL_AXIS_COUNT     6u
+#define PROTOCOL_THRUSTER_COUNT 8u
+#define PROTOCOL_TIMING_BINS    12u
+
+#define PROTOCOL_COMMAND_GAMEPAD 0x01u   /* A gamepad is connected, axes are live */
+
+#define PROTOCOL_IMU_DATA_READY 0u        /* One read per sample */
+#define PROTOCOL_IMU_FIFO       1u        /* One read per batch, on the FIFO watermark */
+
+/**
+  * @brief  Pilot input, sent by the host at a fixed rate.
+  */
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;                       /* Host sample time, wraps */
+  int16_t axes[PROTOCOL_AXIS_COUNT];      /* LX, LY, RX, RY, LT, RT after shaping */
+  uint32_t buttons;                       /* One bit per SDL gamepad button */
+  uint8_t flags;                          /* PROTOCOL_COMMAND_* */
+} protocol_command_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_command_t, 21);
+
+/**
+  * @brief  Vehicle health, sent periodically.
+  */
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  uint32_t uptime_ms;
+  uint16_t rx_frames;                     /* Good frames received, wraps */
+  uint16_t rx_errors;                     /* Bad CRC, bad length or overflow, wraps */
+  uint16_t command_age_ms;                /* Time since the last command, saturates */
+  uint8_t flags;
+} protocol_status_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_status_t, 15);
+
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  float q[4];                             /* Body to world quaternion, w x y z */
+  float rate[3];                          /* Body rates in rad/s */
+} protocol_attitude_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_attitude_t, 32);
+
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  float depth_m;
+  float velocity_mps;                     /* Positive down */
+  float pressure_pa;
+  float temperature_c;
+} protocol_depth_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_depth_t, 20);
+
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  uint16_t pulse_us[PROTOCOL_THRUSTER_COUNT];
+} protocol_thrusters_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_thrusters_t, 20);
+
+/**
+  * @brief  Control loop timing since the previous timing message. Bin 0 counts
+  *         samples under 1 us, bin n counts [2^(n-1), 2^n) us and the last bin
+  *         everything above. Counts saturate.
+  */
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  uint16_t rate_hz;
+  uint16_t overruns;                      /* Periods missed since start, wraps */
+  uint16_t jitter_max_us;                 /* Largest period error */
+  uint16_t execution_max_us;              /* Longest step */
+  uint16_t jitter[PROTOCOL_TIMING_BINS];  /* Wake-up period error */
+  uint16_t execution[PROTOCOL_TIMING_BINS];
+} protocol_timing_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_timing_t, 60);
+
+/**
+  * @brief  Inertial sensor acquisition and its interrupt load, sent periodically.
+  *         Rates and load are over the interval since the previous message.
+  */
+typedef struct PROTOCOL_PACKED
+{
+  uint32_t time_us;
+  uint32_t samples;                       /* Samples delivered since start, wraps */
+  uint16_t sample_rate_hz;
+  uint16_t interrupt_rate_hz;             /* Sensor bus interrupts */
+  uint16_t cpu_load;                      /* Share of the CPU in those interrupts, 1/10000 */
+  uint16_t overruns;                      /* Samples lost since start, wraps */
+  uint8_t mode;                           /* PROTOCOL_IMU_* */
+  uint8_t batch;                          /* Samples per data-ready interrupt */
+} protocol_imu_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_imu_t, 18);
+
+/**
+  * @brief  Clock synchronisation request, answered immediately with a pong.
+  */
+typedef struct PROTOCOL_PACKED
+{
+  uint64_t host_time_us;                  /* Host monotonic time when sent */
+} protocol_ping_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_ping_t, 8);
+
+typedef struct PROTOCOL_PACKED
+{
+  uint64_t host_time_us;                  /* Echoed from the ping */
+  uint32_t rx_time_us;                    /* Vehicle time the ping arrived */
+  uint32_t tx_time_us;                    /* Vehicle time the pong was queued */
+} protocol_pong_t;
+
+PROTOCOL_ASSERT_SIZE(protocol_pong_t, 16);
+
+/* Frames ---------------------------------------------------------------------*/
+
+/**
+  * @brief  A received frame. The payload points into the decoder and is valid
+  *         until the decoder is fed again.
+  */
+typedef struct
+{
+  uint8_t id;
+  uint8_t seq;
+  uint8_t length;
+  const uint8_t *payload;
+} protocol_frame_t;
+
+typedef enum
+{
+  PROTOCOL_INCOMPLETE = 0,      /* All input consumed, no frame yet */
+  PROTOCOL_FRAME,               /* A valid frame is available */
+  PROTOCOL_ERROR                /* A frame was discarded */
+} protocol_result_t;
+
+/**
+  * @brief  Incremental stream decoder. Holds at most one frame and no heap.
+  */
+typedef struct
+{
+  uint8_t buffer[PROTOCOL_MAX_FRAME];
+  uint8_t length;
+  uint8_t code;                 /* Current COBS group code, 0 at the start of a frame */
+  uint8_t remaining;            /* Data bytes left in the current group */
+  bool discard;                 /* Skipping to the next delimiter */
+
+  uint32_t frames;
+  uint32_t errors;
+} protocol_decoder_t;
+
+/**
+  * @brief  Gets the payload size of a known message.
+  * @param  id: Message identifier
+  * @retval Payload size in bytes, or -1 for an unknown identifier
+  */
+int protocol_payload_size(uint8_t id);
+
+/**
+  * @brief  Builds a complete wire frame.
+  * @param  id: Message identifier
+  * @param  seq: Sequence number, echoed back unchanged
+  * @param  payload: Payload bytes, may be NULL if length is 0
+  * @param  length: Payload size, at most PROTOCOL_MAX_PAYLOAD
+  * @param  out: Output buffer
+  * @param  capacity: Size of the output buffer, PROTOCOL_MAX_ENCODED is always enough
+  * @retval Number of bytes written including the delimiter, or 0 on error
+  */
+size_t protocol_encode(uint8_t id, uint8_t seq, const void *payload, size_t length, uint8_t *out, size_t capacity);
+
+/**
+  * @brief  Resets a decoder and its counters.
+  */
+void protocol_decoder_init(protocol_decoder_t *decoder);
+
+/**
+  * @brief  Feeds received bytes to the decoder, stopping after the first complete frame.
+  * @param  decoder: Decoder state
+  * @param  data: Received bytes, any amount from a single byte up
+  * @param  length: Number of received bytes
+  * @param  consumed: Set to the number of bytes used. Feed the rest after handling the result.
+  * @param  frame: Set when PROTOCOL_FRAME is returned
+  * @retval PROTOCOL_FRAME, PROTOCOL_ERROR or PROTOCOL_INCOMPLETE once all bytes are used
+  */
+protocol_result_t protocol_decode(protocol_decoder_t *decoder, const uint8_t *data, size_t length,
+                                  size_t *consumed, protocol_frame_t *frame);
+
+/**
+  * @brief  Gets a frame's payload as a message, checking its identifier.
+  * @retval Pointer into the frame, or NULL if the frame is a different message
+  * @note   Payloads are packed, so their fields may be unaligned.
+  */
+#define PROTOCOL_PAYLOAD(frame, type, msg_id) \
+  (((frame)->id == (msg_id)) ? (const type *)(const void *)(frame)->payload : NULL)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROTOCOL_H */
@@ -0,0 +1,252 @@
+#include "ClockSync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+// Samples kept for the fit, about 25 seconds at the default interval
+static constexpr size_t WindowSize = 128;
+
+// Samples needed before the first fit
+static constexpr size_t MinimumSamples = 8;
+
+// Fraction of the window, by shortest round trip, used in the fit
+static constexpr double FitFraction = 0.25;
+
+// Crystal tolerance, anything beyond this is a bad fit rather than real drift
+static constexpr double MaximumDrift = 500e-6;
+
+// Shortest sample span over which drift is estimated rather than assumed zero
+static constexpr int64_t MinimumDriftSpan = 2000000;
+
+ClockSync::ClockSync(SerialLink *LinkPtr, Metrics *StatsPtr, int64_t Interval)
+{
+    this->Link = LinkPtr;
+    this->Stats = StatsPtr;
+
+    this->PingInterval = (Interval > 0) ? Interval : 200000;
+    this->LastPingTime = 0;
+    this->Sequence = 0;
+
+    this->bHasVehicleTime = false;
+    this->LastVehicleTime = 0;
+
+    this->bIsValid = false;
+    this->HostReference = 0;
+    this->VehicleReference = 0;
+    this->Rate = 1.0;
+    this->ErrorBound = 0.0;
+    this->MinRoundTrip = 0.0;
+    this->FitSamples = 0;
+}
+
+// Any thread
+
+int64_t ClockSync::Unwrap(uint32_t Ticks, int64_t Reference) const
+{
+    // Signed difference from the reference's low 32 bits is correct within half a wrap
+    int32_t Delta = static_cast<int32_t>(Ticks - static_cast<uint32_t>(Reference));
+    return Reference + Delta;
+}
+
+bool ClockSync::ToHostTime(uint32_t VehicleTime, int64_t &HostTime, double *Error) const
+{
+    std::lock_guard<std::mutex> Lock(this->ModelMutex);
+
+    if (!this->bIsValid)
+        return false;
+
+    int64_t Vehicle = this->Unwrap(VehicleTime, this->VehicleReference);
+    HostTime = this->HostReference + static_cast<int64_t>(std::llround((Vehicle - this->VehicleReference) / this->Rate));
+
+    if (Error)
+        *Error = this->ErrorBound;
+
+    return true;
+}
+
+ClockEstimate ClockSync::GetEstimate() const
+{
+    std::lock_guard<std::mutex> Lock(this->ModelMutex);
+
+    ClockEstimate Estimate;
+    Estimate.bIsValid = this->bIsValid;
+    Estimate.Offset = static_cast<double>(this->VehicleReference - this->HostReference);
+    Estimate.Drift = (this->Rate - 1.0) * 1e6;
+    Estimate.ErrorBound = this->ErrorBound;
+    Estimate.MinRoundTrip = this->MinRoundTrip;
+    Estimate.Samples = this->FitSamples;
+
+    return Estimate;
+}
+
+// Serial transfer thread
+
+void ClockSync::HandleFrame(const protocol_frame_t &Frame, int64_t ReceiveTime)
+{
+    if (Frame.id == PROTOCOL_ID_PONG)
+    {
+        protocol_pong_t Pong;
+        memcpy(&Pong, Frame.payload, sizeof(Pong));
+
+        this->AddSample(Pong, ReceiveTime);
+    }
+    else if (Frame.id >= PROTOCOL_ID_STATUS && Frame.length >= sizeof(uint32_t))
+    {
+        // Every vehicle message starts with its sample time, so its downlink latency is measurable
+        uint32_t SampleTime;
+        memcpy(&SampleTime, Frame.payload, sizeof(SampleTime));
+
+        int64_t HostTime;
+
+        if (this->ToHostTime(SampleTime, HostTime))
+            this->Stats->Record(Timing::Downlink, (ReceiveTime - HostTime) / 1000.0);
+    }
+
+    int64_t Now = av_gettime_relative();
+
+    if (Now - this->LastPingTime >= this->PingInterval)
+        this->SendPing(Now);
+}
+
+void ClockSync::SendPing(int64_t Now)
+{
+    protocol_ping_t Ping;
+    Ping.host_time_us = static_cast<uint64_t>(av_gettime_relative());
+
+    uint8_t Frame[PROTOCOL_MAX_ENCODED];
+    size_t FrameSize = protocol_encode(PROTOCOL_ID_PING, this->Sequence++, &Ping, sizeof(Ping), Frame, sizeof(Frame));
+
+    if (FrameSize > 0 && this->Link->Write(Frame, FrameSize) == 0)
+        this->LastPingTime = Now;
+}
+
+void ClockSync::AddSample(const protocol_pong_t &Pong, int64_t ReceiveTime)
+{
+    int64_t SendTime = static_cast<int64_t>(Pong.host_time_us);
+
+    // Stale or corrupted echo
+    if (SendTime > ReceiveTime || ReceiveTime - SendTime > 10 * this->PingInterval)
+        return;
+
+    std::lock_guard<std::mutex> Lock(this->ModelMutex);
+
+    // Extend the vehicle's 32-bit counter, seeding from the first receive time
+    int64_t Reference = this->bHasVehicleTime ? this->LastVehicleTime : static_cast<int64_t>(Pong.rx_time_us);
+    int64_t VehicleReceive = this->Unwrap(Pong.rx_time_us, Reference);
+    int64_t VehicleTransmit = this->Unwrap(Pong.tx_time_us, VehicleReceive);
+
+    this->bHasVehicleTime = true;
+    this->LastVehicleTime = VehicleTransmit;
+
+    Sample NewSample;
+    NewSample.HostTime = SendTime + (ReceiveTime - SendTime) / 2;
+    NewSample.VehicleTime = VehicleReceive + (VehicleTransmit - VehicleReceive) / 2;
+    NewSample.RoundTrip = (ReceiveTime - SendTime) - (VehicleTransmit - VehicleReceive);
+
+    if (NewSample.RoundTrip < 0)
+        return;
+
+    this->Samples.push_back(NewSample);
+
+    if (this->Samples.size() > WindowSize)
+        this->Samples.pop_front();
+
+    this->Fit();
+}
+
+void ClockSync::Fit()
+{
+    if (this->Samples.size() < MinimumSamples)
+        return;
+
+    // Keep the exchanges least delayed by queuing, those are the most symmetric
+    std::vector<int64_t> RoundTrips;
+    RoundTrips.reserve(this->Samples.size());
+
+    for (const Sample& Each : this->Samples)
+        RoundTrips.push_back(Each.RoundTrip);
+
+    size_t Cutoff = static_cast<size_t>(RoundTrips.size() * FitFraction);
+    Cutoff = (Cutoff < MinimumSamples / 2) ? MinimumSamples / 2 : Cutoff;
+    std::nth_element(RoundTrips.begin(), RoundTrips.begin() + Cutoff, RoundTrips.end());
+    int64_t Threshold = RoundTrips[Cutoff];
+
+    std::vector<const Sample*> Selected;
+
+    for (const Sample& Each : this->Samples)
+    {
+        if (Each.RoundTrip <= Threshold)
+            Selected.push_back(&Each);
+    }
+
+    // Center on the means so the regression works on small numbers
+    double MeanHost = 0.0;
+    double MeanVehicle = 0.0;
+    int64_t HostBase = Selected.front()->HostTime;
+    int64_t VehicleBase = Selected.front()->VehicleTime;
+
+    for (const Sample* Each : Selected)
+    {
+        MeanHost += static_cast<double>(Each->HostTime - HostBase);
+        MeanVehicle += static_cast<double>(Each->VehicleTime - VehicleBase);
+    }
+
+    MeanHost /= Selected.size();
+    MeanVehicle /= Selected.size();
+
+    double CrossSum = 0.0;
+    double HostSum = 0.0;
+    int64_t FirstHost = Selected.front()->HostTime;
+    int64_t LastHost = Selected.front()->HostTime;
+    int64_t BestRoundTrip = Selected.front()->RoundTrip;
+
+    for (const Sample* Each : Selected)
+    {
+        double X = static_cast<double>(Each->HostTime - HostBase) - MeanHost;
+        double Y = static_cast<double>(Each->VehicleTime - VehicleBase) - MeanVehicle;
+
+        CrossSum += X * Y;
+        HostSum += X * X;
+
+        FirstHost = std::min(FirstHost, Each->HostTime);
+        LastHost = std::max(LastHost, Each->HostTime);
+        BestRoundTrip = std::min(BestRoundTrip, Each->RoundTrip);
+    }
+
+    // Too short a span to tell drift from jitter, assume the clocks run at the same rate
+    double NewRate = 1.0;
+
+    if (LastHost - FirstHost >= MinimumDriftSpan && HostSum > 0.0)
+        NewRate = CrossSum / HostSum;
+
+    NewRate = std::clamp(NewRate, 1.0 - MaximumDrift, 1.0 + MaximumDrift);
+
+    int64_t NewHostReference = HostBase + static_cast<int64_t>(std::llround(MeanHost));
+    int64_t NewVehicleReference = VehicleBase + static_cast<int64_t>(std::llround(MeanVehicle));
+
+    // A sample's true offset lies within half its round trip of the midpoint, so the slowest selected
+    // exchange, the threshold, bounds them all, plus whatever the line misses by
+    double MaxResidual = 0.0;
+
+    for (const Sample* Each : Selected)
+    {
+        double Predicted = NewVehicleReference + NewRate * (Each->HostTime - NewHostReference);
+        MaxResidual = std::max(MaxResidual, std::fabs(Each->VehicleTime - Predicted));
+    }
+
+    this->HostReference = NewHostReference;
+    this->VehicleReference = NewVehicleReference;
+    this->Rate = NewRate;
+    this->ErrorBound = Threshold / 2.0 + MaxResidual;
+    this->MinRoundTrip = static_cast<double>(BestRoundTrip);
+    this->FitSamples = Selected.size();
+    this->bIsValid = true;
+
+    this->Stats->Record(Timing::ClockError, this->ErrorBound / 1000.0);
+}
@@ -0,0 +1,105 @@
+#ifndef HOST_CLOCK_SYNC_HPP_
+#define HOST_CLOCK_SYNC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include <protocol.h>
+
+#include "Metrics.hpp"
+#include "SerialLink.hpp"
+
+// Current fit between the vehicle's 1 MHz counter and the host clock
+struct ClockEstimate
+{
+    bool bIsValid;
+    double Offset;          // Vehicle minus host time at the last sample, microseconds
+    double Drift;           // Vehicle clock rate error relative to the host, parts per million
+    double ErrorBound;      // Worst case error of a mapped time, microseconds
+    double MinRoundTrip;    // Best round trip in the window, microseconds
+    size_t Samples;         // Samples used in the fit
+};
+
+// NTP-style clock synchronization with the vehicle over the serial link. Each ping records the
+// host send time, the pong carries the vehicle's receive and transmit times, and the host's
+// receive time closes the exchange. Only the exchanges with the shortest round trips are fitted,
+// since queuing delay is what makes the rest asymmetric, and a least-squares line through them
+// gives both offset and drift. Vehicle timestamps can then be mapped into host time with a bound.
+
+class ClockSync
+{
+private:
+    struct Sample
+    {
+        int64_t HostTime;       // Midpoint of the host send and receive times
+        int64_t VehicleTime;    // Midpoint of the vehicle receive and transmit times, unwrapped
+        int64_t RoundTrip;      // Round trip excluding the vehicle's turnaround
+    };
+
+    SerialLink* Link;
+    Metrics* Stats;
+
+    int64_t PingInterval;
+    int64_t LastPingTime;
+    uint8_t Sequence;
+
+    mutable std::mutex ModelMutex;
+    std::deque<Sample> Samples;
+
+    // Last vehicle time seen, for extending the 32-bit counter
+    bool bHasVehicleTime;
+    int64_t LastVehicleTime;
+
+    // Fitted model: Vehicle = VehicleReference + Rate * (Host - HostReference)
+    bool bIsValid;
+    int64_t HostReference;
+    int64_t VehicleReference;
+    double Rate;
+    double ErrorBound;
+    double MinRoundTrip;
+    size_t FitSamples;
+
+    int64_t Unwrap(uint32_t Ticks, int64_t Reference) const;
+
+    void SendPing(int64_t Now);
+
+    void AddSample(const protocol_pong_t& Pong, int64_t ReceiveTime);
+
+    void Fit();
+
+public:
+    /**
+     * @brief Creates clock synchronizer.
+     * @param LinkPtr Pointer to serial link pings are sent over.
+     * @param StatsPtr Pointer to metrics object to record clock error and downlink latency in.
+     * @param Interval Microseconds between pings.
+	 */
+    ClockSync(SerialLink* LinkPtr, Metrics* StatsPtr, int64_t Interval = 200000);
+
+    /**
+     * @brief Handles a received frame. Meant to be added as a telemetry handler.
+     * @param Frame Received frame.
+     * @param ReceiveTime Time the frame was read, in microseconds (av_gettime_relative).
+     * @note Pings are sent from here, paced by the vehicle's own traffic.
+	 */
+    void HandleFrame(const protocol_frame_t& Frame, int64_t ReceiveTime);
+
+    /**
+     * @brief Maps a vehicle timestamp into host time.
+     * @param VehicleTime Vehicle counter value from a message, within 35 minutes of now.
+     * @param HostTime Set to the host time in microseconds (av_gettime_relative).
+     * @param Error Optional pointer to store the error bound in microseconds.
+     * @returns False if the clocks are not synchronized yet.
+	 */
+    bool ToHostTime(uint32_t VehicleTime, int64_t& HostTime, double* Error = nullptr) const;
+
+    /**
+     * @brief Gets the current clock fit.
+     * @returns Fit parameters as a ClockEstimate.
+	 */
+    ClockEstimate GetEstimate() const;
+};
+
+#endif // HOST_CLOCK_SYNC_HPP_
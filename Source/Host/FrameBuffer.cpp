@@ -1,23 +1,30 @@
 #include "FrameBuffer.hpp"
 
-FrameBuffer::FrameBuffer(size_t Size)
+#include "Trace.hpp"
+
+FrameBuffer::FrameBuffer(size_t Size, DropPolicy FullPolicy)
 {
     // Buffer cannot be smaller than 2
     this->BufferSize = (Size >= 2) ? Size : 2;
+    this->Policy = FullPolicy;
 
     this->Buffer = std::vector<AVFrame*>(this->BufferSize);
+    this->ReceiveTimes = std::vector<int64_t>(this->BufferSize, 0);
 
     for (size_t i = 0; i < this->BufferSize; i++)
         this->Buffer[i] = av_frame_alloc();
 
     this->ReadIndex = 0;
     this->WriteIndex = 0;
+    this->DroppedFrames = 0;
 }
 
 // Network thread
 
-int FrameBuffer::Push(AVFrame* Frame)
+int FrameBuffer::Push(AVFrame* Frame, int64_t ReceiveTime)
 {
+    TRACE_SCOPE("FrameBuffer::Push");
+
     if (!Frame) 
         return -1;
 
@@ -26,12 +33,20 @@ int FrameBuffer::Push(AVFrame* Frame)
     
     size_t NextWrite = (TempWrite + 1) % this->BufferSize;
 
-    // Check if next write index is read index. If so, increment read index to next oldest.
+    // Check if next write index is read index. If so, refuse the frame or increment read index to next oldest.
     if (NextWrite == TempRead)
+    {
+        this->DroppedFrames.fetch_add(1, std::memory_order_relaxed);
+
+        if (this->Policy == DropPolicy::DropNewest)
+            return -1;
+
         this->ReadIndex.store((TempRead + 1) % this->BufferSize, std::memory_order_release);
+    }
 
     av_frame_unref(this->Buffer[TempWrite]); // Previous data must be cleared so ref count can decrement
     int Status = av_frame_ref(this->Buffer[TempWrite], Frame);
+    this->ReceiveTimes[TempWrite] = ReceiveTime;
 
     this->WriteIndex.store(NextWrite, std::memory_order_release);
 
@@ -40,8 +55,10 @@ int FrameBuffer::Push(AVFrame* Frame)
 
 // Main thread
 
-int FrameBuffer::PopFrame(AVFrame *&RenderFrame)
+int FrameBuffer::PopFrame(AVFrame *&RenderFrame, int64_t *ReceiveTime)
 {
+    TRACE_SCOPE("FrameBuffer::PopFrame");
+
     size_t TempWrite = this->WriteIndex.load(std::memory_order_acquire);
     size_t TempRead = this->ReadIndex.load(std::memory_order_relaxed);
 
@@ -51,6 +68,9 @@ int FrameBuffer::PopFrame(AVFrame *&RenderFrame)
     
     int Status = av_frame_ref(RenderFrame, this->Buffer[TempRead]);
 
+    if (ReceiveTime)
+        *ReceiveTime = this->ReceiveTimes[TempRead];
+
     this->ReadIndex.store((TempRead + 1) % this->BufferSize, std::memory_order_release);
 
     return Status;
@@ -64,6 +84,11 @@ size_t FrameBuffer::GetOccupancy()
     return (TempWrite - TempRead + this->BufferSize) % this->BufferSize;
 }
 
+uint64_t FrameBuffer::GetDroppedFrames()
+{
+    return this->DroppedFrames.load(std::memory_order_relaxed);
+}
+
 FrameBuffer::~FrameBuffer()
 {
     for (AVFrame* Frame : Buffer)
@@ -10,37 +10,51 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+// What a full buffer does with a new frame
+enum class DropPolicy
+{
+    DropOldest,     // Overwrite the oldest frame, for consumers that want the latest picture
+    DropNewest      // Discard the new frame, for consumers that want contiguous runs
+};
+
 // This is a thread-safe SPSC ring buffer
 
 class FrameBuffer
 {
 private:
     size_t BufferSize;
+    DropPolicy Policy;
     std::vector<AVFrame*> Buffer;
+    std::vector<int64_t> ReceiveTimes;
     std::atomic<size_t> ReadIndex;
     std::atomic<size_t> WriteIndex;
+    std::atomic<uint64_t> DroppedFrames;
 
 public:
     /**
 	 * @brief Initializes decoded frame buffer.
 	 * @param Size Number of slots in the buffer (must be 2 or greater).
+     * @param FullPolicy What to do with a new frame when the buffer is full.
 	 */
-    FrameBuffer(size_t Size);
+    FrameBuffer(size_t Size, DropPolicy FullPolicy = DropPolicy::DropOldest);
 
     /**
 	 * @brief Pushes a frame into the buffer.
 	 * @param Frame Frame pointer to be pushed into the buffer.
+     * @param ReceiveTime Time in microseconds (av_gettime_relative) the frame's data arrived.
      * @returns Error status
-     * @note Buffer will continuously override old frames.
+     * @note With DropOldest the buffer continuously overrides old frames, with DropNewest it
+     *       returns an error and leaves the buffer untouched when full. Never blocks.
 	 */
-    int Push(AVFrame* Frame);
+    int Push(AVFrame* Frame, int64_t ReceiveTime = 0);
 
     /**
 	 * @brief Pops a frame from the buffer.
 	 * @param RenderFrame Frame pointer reference to pop the frame into.
+     * @param ReceiveTime Optional pointer to store the frame's receive time in.
      * @returns Error status
 	 */
-    int PopFrame(AVFrame*& RenderFrame);
+    int PopFrame(AVFrame*& RenderFrame, int64_t* ReceiveTime = nullptr);
 
     /**
 	 * @brief Gets the number of active frames in the buffer.
@@ -48,6 +62,12 @@ public:
 	 */
     size_t GetOccupancy();
 
+    /**
+	 * @brief Gets the number of frames overwritten before they could be popped.
+     * @returns The total number of dropped frames as a uint64_t.
+	 */
+    uint64_t GetDroppedFrames();
+
     ~FrameBuffer();
 };
 
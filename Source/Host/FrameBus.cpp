@@ -0,0 +1,86 @@
+#include "FrameBus.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "Trace.hpp"
+
+FrameBus::FrameBus()
+{
+    this->Subscribers = new std::vector<FrameBuffer*>();
+    this->Publishing = 0;
+    this->FramesPublished = 0;
+}
+
+FrameBus::~FrameBus()
+{
+    delete this->Subscribers.load();
+}
+
+// Any thread
+
+void FrameBus::Replace(const std::vector<FrameBuffer*>* NewSubscribers)
+{
+    const std::vector<FrameBuffer*>* OldSubscribers = this->Subscribers.exchange(NewSubscribers);
+
+    // A publish that loaded the old list was counted before it loaded it, so it is seen here.
+    // It may be pushing into a removed buffer, wait it out before freeing the list.
+    while (this->Publishing.load() != 0)
+        std::this_thread::yield();
+
+    delete OldSubscribers;
+}
+
+void FrameBus::Subscribe(FrameBuffer *Subscriber)
+{
+    std::lock_guard<std::mutex> Lock(this->SubscribeMutex);
+
+    auto* NewSubscribers = new std::vector<FrameBuffer*>(*this->Subscribers.load());
+
+    if (std::find(NewSubscribers->begin(), NewSubscribers->end(), Subscriber) == NewSubscribers->end())
+        NewSubscribers->push_back(Subscriber);
+
+    this->Replace(NewSubscribers);
+}
+
+void FrameBus::Unsubscribe(FrameBuffer *Subscriber)
+{
+    std::lock_guard<std::mutex> Lock(this->SubscribeMutex);
+
+    auto* NewSubscribers = new std::vector<FrameBuffer*>(*this->Subscribers.load());
+    NewSubscribers->erase(std::remove(NewSubscribers->begin(), NewSubscribers->end(), Subscriber), NewSubscribers->end());
+
+    this->Replace(NewSubscribers);
+}
+
+size_t FrameBus::GetSubscriberCount()
+{
+    // Lists are only freed with this held
+    std::lock_guard<std::mutex> Lock(this->SubscribeMutex);
+
+    return this->Subscribers.load()->size();
+}
+
+// Decode thread
+
+int FrameBus::Publish(AVFrame *Frame, int64_t ReceiveTime)
+{
+    TRACE_SCOPE("FrameBus::Publish");
+
+    this->Publishing.fetch_add(1);
+
+    const std::vector<FrameBuffer*>* CurrentSubscribers = this->Subscribers.load();
+
+    int Delivered = 0;
+
+    for (FrameBuffer* Subscriber : *CurrentSubscribers)
+    {
+        if (Subscriber->Push(Frame, ReceiveTime) == 0)
+            Delivered++;
+    }
+
+    this->Publishing.fetch_sub(1, std::memory_order_release);
+    this->FramesPublished.fetch_add(1, std::memory_order_relaxed);
+
+    return Delivered;
+}
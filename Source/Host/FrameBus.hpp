@@ -0,0 +1,67 @@
+#ifndef HOST_FRAME_BUS_HPP_
+#define HOST_FRAME_BUS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "FrameBuffer.hpp"
+
+// Broadcasts decoded frames from one producer to any number of subscribers. Each subscriber
+// owns a FrameBuffer with its own size and drop policy; publishing only adds a reference to
+// the frame in each, so pixels are never copied and a slow subscriber only loses its own frames.
+
+class FrameBus
+{
+private:
+    // Replaced whole on subscribe and unsubscribe. Publishers count themselves in before loading
+    // it, and the old list is freed once none are in progress, so publishing never takes a lock.
+    std::atomic<const std::vector<FrameBuffer*>*> Subscribers;
+    std::atomic<uint32_t> Publishing;
+    std::mutex SubscribeMutex;
+
+    std::atomic<uint64_t> FramesPublished;
+
+    void Replace(const std::vector<FrameBuffer*>* NewSubscribers);
+
+public:
+    FrameBus();
+
+    ~FrameBus();
+
+    /**
+     * @brief Starts delivering frames to a buffer.
+     * @param Subscriber Buffer to push frames into. Must stay alive until unsubscribed or the bus is destroyed.
+	 */
+    void Subscribe(FrameBuffer* Subscriber);
+
+    /**
+     * @brief Stops delivering frames to a buffer.
+     * @param Subscriber Previously subscribed buffer.
+     * @note Returns once any publish in progress is done with the buffer, so it can then be destroyed.
+	 */
+    void Unsubscribe(FrameBuffer* Subscriber);
+
+    /**
+     * @brief Pushes a reference to a frame into every subscriber's buffer. Never blocks.
+     * @param Frame Decoded frame, still owned by the caller.
+     * @param ReceiveTime Time in microseconds (av_gettime_relative) the frame's data arrived.
+     * @returns Number of subscribers that took the frame.
+	 */
+    int Publish(AVFrame* Frame, int64_t ReceiveTime = 0);
+
+    /**
+     * @brief Gets the number of subscribed buffers.
+     * @returns Number of subscribers as a size_t.
+	 */
+    size_t GetSubscriberCount();
+
+    /**
+     * @brief Gets the number of frames published.
+     * @returns Total frames published as a uint64_t.
+	 */
+    uint64_t GetFramesPublished() {return this->FramesPublished.load(std::memory_order_relaxed);}
+};
+
+#endif // HOST_FRAME_BUS_HPP_
@@ -0,0 +1,318 @@
+#include "FrameCapture.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+FrameCapture::FrameCapture(const char *Directory)
+{
+    this->OutputDirectory = Directory;
+    this->CaptureCount = 0;
+
+    for (Readback& Slot : this->Readbacks)
+    {
+        glGenBuffers(1, &Slot.PBO);
+        Slot.Fence = nullptr;
+        Slot.Width = 0;
+        Slot.Height = 0;
+        Slot.Format = CaptureFormat::PNG;
+        Slot.bInFlight = false;
+    }
+
+    this->bWorkerLoop = true;
+    this->WorkerThread = std::thread([this] { this->WorkerLoop(); });
+}
+
+// Main thread
+
+int FrameCapture::CaptureFramebuffer(int Width, int Height, CaptureFormat Format)
+{
+    if (Width <= 0 || Height <= 0)
+        return -1;
+
+    Readback* Slot = nullptr;
+
+    for (Readback& Candidate : this->Readbacks)
+    {
+        if (!Candidate.bInFlight)
+        {
+            Slot = &Candidate;
+            break;
+        }
+    }
+
+    // All slots waiting on the GPU, drop the request rather than stall
+    if (!Slot)
+    {
+        LOG_WARNING("Capture busy, request dropped");
+        return -2;
+    }
+
+    GLsizeiptr Size = static_cast<GLsizeiptr>(Width) * Height * 4;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, Slot->PBO);
+
+    // Orphan old storage so the driver never has to wait on a previous readback
+    glBufferData(GL_PIXEL_PACK_BUFFER, Size, nullptr, GL_STREAM_READ);
+
+    // With a pack buffer bound the pointer is an offset and the call returns immediately
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    Slot->Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    Slot->Width = Width;
+    Slot->Height = Height;
+    Slot->Format = Format;
+    Slot->bInFlight = true;
+
+    return 0;
+}
+
+int FrameCapture::CaptureFrame(const AVFrame *Frame, CaptureFormat Format)
+{
+    if (!Frame || !Frame->data[0])
+        return -1;
+
+    AVFrame* Ref = av_frame_alloc();
+
+    int Status = av_frame_ref(Ref, Frame);
+
+    if (Status < 0)
+    {
+        av_frame_free(&Ref);
+        return Status;
+    }
+
+    return this->Enqueue(Ref, Format);
+}
+
+void FrameCapture::Poll()
+{
+    for (Readback& Slot : this->Readbacks)
+    {
+        if (!Slot.bInFlight)
+            continue;
+
+        // Zero timeout, only checks whether the GPU has reached the fence
+        GLenum FenceStatus = glClientWaitSync(Slot.Fence, 0, 0);
+
+        if (FenceStatus == GL_TIMEOUT_EXPIRED)
+            continue;
+
+        glDeleteSync(Slot.Fence);
+        Slot.Fence = nullptr;
+        Slot.bInFlight = false;
+
+        if (FenceStatus == GL_WAIT_FAILED)
+            continue;
+
+        AVFrame* Frame = av_frame_alloc();
+        Frame->format = AV_PIX_FMT_RGBA;
+        Frame->width = Slot.Width;
+        Frame->height = Slot.Height;
+
+        if (av_frame_get_buffer(Frame, 0) < 0)
+        {
+            av_frame_free(&Frame);
+            continue;
+        }
+
+        size_t RowSize = static_cast<size_t>(Slot.Width) * 4;
+        GLsizeiptr Size = static_cast<GLsizeiptr>(RowSize) * Slot.Height;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, Slot.PBO);
+        const uint8_t* Pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, Size, GL_MAP_READ_BIT));
+
+        if (Pixels)
+        {
+            // GL rows are bottom-up, flip while copying out of the mapping
+            for (int Row = 0; Row < Slot.Height; Row++)
+                memcpy(Frame->data[0] + Row * Frame->linesize[0], Pixels + (Slot.Height - 1 - Row) * RowSize, RowSize);
+
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (Pixels)
+            this->Enqueue(Frame, Slot.Format);
+        else
+            av_frame_free(&Frame);
+    }
+}
+
+std::string FrameCapture::NextPath(CaptureFormat Format)
+{
+    char Stamp[32];
+    std::time_t Now = std::time(nullptr);
+    std::strftime(Stamp, sizeof(Stamp), "%Y%m%d_%H%M%S", std::localtime(&Now));
+
+    char Name[64];
+    snprintf(Name, sizeof(Name), "/Capture_%s_%u.%s", Stamp, this->CaptureCount++, (Format == CaptureFormat::PNG) ? "png" : "jpg");
+
+    return this->OutputDirectory + Name;
+}
+
+int FrameCapture::Enqueue(AVFrame *Frame, CaptureFormat Format)
+{
+    std::string Path = this->NextPath(Format);
+
+    {
+        std::lock_guard<std::mutex> Lock(this->JobMutex);
+        this->Jobs.push_back(EncodeJob{Frame, Format, Path});
+    }
+
+    this->JobCondition.notify_one();
+
+    return 0;
+}
+
+// Worker thread
+
+void FrameCapture::WorkerLoop()
+{
+    TRACE_THREAD("Capture");
+
+    while (true)
+    {
+        EncodeJob Job;
+
+        {
+            std::unique_lock<std::mutex> Lock(this->JobMutex);
+            this->JobCondition.wait(Lock, [this] { return !this->Jobs.empty() || !this->bWorkerLoop; });
+
+            // Finish outstanding captures before exiting
+            if (this->Jobs.empty())
+                return;
+
+            Job = this->Jobs.front();
+            this->Jobs.pop_front();
+        }
+
+        TRACE_SCOPE("Encode");
+
+        if (this->Encode(Job) == 0)
+            LOG_INFO("Captured %s", Job.Path.c_str());
+        else
+            LOG_ERROR("Failed to write capture %s", Job.Path.c_str());
+
+        av_frame_free(&Job.Frame);
+    }
+}
+
+int FrameCapture::Encode(const EncodeJob &Job)
+{
+    bool bIsPNG = Job.Format == CaptureFormat::PNG;
+
+    AVPixelFormat OutputFormat = bIsPNG ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_YUVJ420P;
+
+    const AVCodec* Codec = avcodec_find_encoder(bIsPNG ? AV_CODEC_ID_PNG : AV_CODEC_ID_MJPEG);
+
+    if (!Codec)
+        return -1;
+
+    AVCodecContext* CodecContext = avcodec_alloc_context3(Codec);
+    CodecContext->width = Job.Frame->width;
+    CodecContext->height = Job.Frame->height;
+    CodecContext->pix_fmt = OutputFormat;
+    CodecContext->time_base = AVRational{1, 1};
+
+    if (!bIsPNG)
+    {
+        CodecContext->flags |= AV_CODEC_FLAG_QSCALE;
+        CodecContext->global_quality = FF_QP2LAMBDA * 2;
+    }
+
+    AVFrame* Converted = av_frame_alloc();
+    AVPacket* Packet = av_packet_alloc();
+    SwsContext* Scaler = nullptr;
+
+    int Status = avcodec_open2(CodecContext, Codec, nullptr);
+
+    // Convert from the capture's native layout to what the encoder accepts
+
+    if (Status >= 0)
+    {
+        Converted->format = OutputFormat;
+        Converted->width = Job.Frame->width;
+        Converted->height = Job.Frame->height;
+
+        Status = av_frame_get_buffer(Converted, 0);
+    }
+
+    if (Status >= 0)
+    {
+        Scaler = sws_getContext(Job.Frame->width, Job.Frame->height, static_cast<AVPixelFormat>(Job.Frame->format),
+                                Converted->width, Converted->height, OutputFormat, SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+        if (!Scaler)
+            Status = -1;
+    }
+
+    // Single image, so send the frame and flush right away
+
+    if (Status >= 0)
+    {
+        sws_scale(Scaler, Job.Frame->data, Job.Frame->linesize, 0, Job.Frame->height, Converted->data, Converted->linesize);
+
+        Converted->pts = 0;
+        Converted->quality = CodecContext->global_quality;
+
+        Status = avcodec_send_frame(CodecContext, Converted);
+    }
+
+    if (Status >= 0)
+    {
+        avcodec_send_frame(CodecContext, nullptr);
+        Status = avcodec_receive_packet(CodecContext, Packet);
+    }
+
+    if (Status >= 0)
+    {
+        FILE* File = fopen(Job.Path.c_str(), "wb");
+
+        if (!File || fwrite(Packet->data, 1, Packet->size, File) != static_cast<size_t>(Packet->size))
+            Status = -1;
+
+        if (File)
+            fclose(File);
+    }
+
+    sws_freeContext(Scaler);
+    av_packet_free(&Packet);
+    av_frame_free(&Converted);
+    avcodec_free_context(&CodecContext);
+
+    return Status < 0 ? Status : 0;
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        std::lock_guard<std::mutex> Lock(this->JobMutex);
+        this->bWorkerLoop = false;
+    }
+
+    this->JobCondition.notify_one();
+
+    // Wait for queued captures to be written out
+    if (this->WorkerThread.joinable())
+        this->WorkerThread.join();
+
+    for (Readback& Slot : this->Readbacks)
+    {
+        if (Slot.Fence)
+            glDeleteSync(Slot.Fence);
+
+        glDeleteBuffers(1, &Slot.PBO);
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef HOST_FRAME_CAPTURE_HPP_
+#define HOST_FRAME_CAPTURE_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <glad/gl.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+}
+
+enum class CaptureSource
+{
+    Framebuffer,    // What is currently drawn to the window
+    SourceFrame     // The decoded frame at stream resolution
+};
+
+enum class CaptureFormat
+{
+    PNG,
+    JPEG
+};
+
+// Asynchronous still capture. Framebuffer readbacks go through pixel pack buffers guarded
+// by fences, and all encoding and file IO happens on a worker thread.
+
+class FrameCapture
+{
+private:
+    static constexpr int ReadbackSlots = 2;
+
+    struct Readback
+    {
+        GLuint PBO;
+        GLsync Fence;
+        int Width;
+        int Height;
+        CaptureFormat Format;
+        bool bInFlight;
+    };
+
+    struct EncodeJob
+    {
+        AVFrame* Frame;
+        CaptureFormat Format;
+        std::string Path;
+    };
+
+    Readback Readbacks[ReadbackSlots];
+
+    std::string OutputDirectory;
+    unsigned int CaptureCount;
+
+    std::mutex JobMutex;
+    std::condition_variable JobCondition;
+    std::deque<EncodeJob> Jobs;
+
+    bool bWorkerLoop;
+    std::thread WorkerThread;
+
+    std::string NextPath(CaptureFormat Format);
+
+    int Enqueue(AVFrame* Frame, CaptureFormat Format);
+
+    void WorkerLoop();
+
+    int Encode(const EncodeJob& Job);
+
+public:
+    /**
+     * @brief Creates capture pixel buffers and starts the encoding thread.
+     * @param Directory Directory captured images are written to.
+     * @note Must be constructed on the thread that owns the GL context.
+	 */
+    FrameCapture(const char* Directory);
+
+    /**
+     * @brief Starts an asynchronous readback of the currently bound framebuffer.
+     * @param Width Width of the region to read, starting from the origin.
+     * @param Height Height of the region to read, starting from the origin.
+     * @param Format Image format to encode the capture as.
+     * @returns Error status
+     * @note Call after drawing and before swapping buffers.
+	 */
+    int CaptureFramebuffer(int Width, int Height, CaptureFormat Format);
+
+    /**
+     * @brief Queues a decoded frame for encoding.
+     * @param Frame Frame to capture. The frame is referenced, not copied.
+     * @param Format Image format to encode the capture as.
+     * @returns Error status
+	 */
+    int CaptureFrame(const AVFrame* Frame, CaptureFormat Format);
+
+    /**
+     * @brief Hands completed readbacks to the encoding thread without waiting on the GPU.
+     * @note Should be called once per rendered frame.
+	 */
+    void Poll();
+
+    ~FrameCapture();
+};
+
+#endif // HOST_FRAME_CAPTURE_HPP_
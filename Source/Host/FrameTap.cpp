@@ -0,0 +1,179 @@
+#include "FrameTap.hpp"
+
+#include <chrono>
+#include <memory>
+
+#include "Trace.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+// Frames held for the dispatch thread, the newest replace older ones
+static constexpr size_t TapBufferSize = 2;
+
+// Dispatch poll interval in microseconds when no frame is waiting
+static constexpr int64_t TapPollInterval = 2000;
+
+FrameTap::FrameTap(FrameBus *BusPtr, ThreadPool *PoolPtr, Metrics *StatsPtr, std::vector<VisionKernel> Chain) : Input(TapBufferSize, DropPolicy::DropOldest)
+{
+    this->Bus = BusPtr;
+    this->Pool = PoolPtr;
+    this->Stats = StatsPtr;
+
+    this->Kernels = std::move(Chain);
+
+    this->Latest = VisionResult();
+    this->bHasResult = false;
+
+    this->InFlight = 0;
+    this->FramesAnalyzed = 0;
+    this->FramesDropped = 0;
+    this->bDispatchLoop = false;
+
+    this->Bus->Subscribe(&this->Input);
+}
+
+void FrameTap::SetResultHandler(VisionHandler NewHandler)
+{
+    this->Handler = std::move(NewHandler);
+}
+
+void FrameTap::StartTapLoop()
+{
+    this->bDispatchLoop = true;
+
+    // Start thread
+    this->DispatchThread = std::thread([this] { this->DispatchLoop(); });
+}
+
+// Any thread
+
+bool FrameTap::GetLatestResult(VisionResult &Result)
+{
+    std::lock_guard<std::mutex> Lock(this->ResultMutex);
+
+    if (!this->bHasResult)
+        return false;
+
+    Result = this->Latest;
+    return true;
+}
+
+// Dispatch thread
+
+void FrameTap::DispatchLoop()
+{
+    TRACE_THREAD("FrameTap");
+
+    while (this->bDispatchLoop)
+    {
+        AVFrame* Frame = av_frame_alloc();
+        int64_t ReceiveTime = 0;
+
+        if (this->Input.PopFrame(Frame, &ReceiveTime) < 0)
+        {
+            av_frame_free(&Frame);
+            std::this_thread::sleep_for(std::chrono::microseconds(TapPollInterval));
+            continue;
+        }
+
+        // Tasks must be copyable, the reference is released by whichever copy goes last
+        std::shared_ptr<AVFrame> Shared(Frame, [](AVFrame* Owned) { av_frame_free(&Owned); });
+
+        this->InFlight.fetch_add(1, std::memory_order_acq_rel);
+
+        bool bAccepted = this->Pool->TrySubmit([this, Shared, ReceiveTime]
+        {
+            this->Analyze(Shared.get(), ReceiveTime);
+            this->InFlight.fetch_sub(1, std::memory_order_acq_rel);
+        });
+
+        if (!bAccepted)
+        {
+            this->InFlight.fetch_sub(1, std::memory_order_acq_rel);
+            this->FramesDropped.fetch_add(1, std::memory_order_relaxed);
+            this->Stats->Add(Counter::VisionDropped, 1);
+        }
+    }
+}
+
+// Pool threads
+
+void FrameTap::Analyze(AVFrame *Frame, int64_t ReceiveTime)
+{
+    TRACE_SCOPE("FrameTap::Analyze");
+
+    // Every planar and semi-planar YUV format the decoders output starts with 8-bit luma
+    switch (Frame->format)
+    {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P:
+        case AV_PIX_FMT_NV12:
+        case AV_PIX_FMT_GRAY8:
+            break;
+
+        default:
+            return;
+    }
+
+    int64_t Start = av_gettime_relative();
+
+    // Reused across frames by each worker, so the chain does not allocate once warm
+    static thread_local VisionImage Image;
+
+    Image.Data = Frame->data[0];
+    Image.Width = Frame->width;
+    Image.Height = Frame->height;
+    Image.Stride = Frame->linesize[0];
+
+    VisionResult Result = VisionResult();
+    Result.Pts = (Frame->pts != AV_NOPTS_VALUE) ? Frame->pts : Frame->best_effort_timestamp;
+    Result.ReceiveTime = ReceiveTime;
+    Result.Width = Frame->width;
+    Result.Height = Frame->height;
+
+    for (VisionKernel Kernel : this->Kernels)
+        Kernel(Image, Result);
+
+    Result.ProcessTime = (av_gettime_relative() - Start) / 1000.0;
+
+    this->FramesAnalyzed.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> Lock(this->ResultMutex);
+
+        // Recorded under the lock, a timing takes one writer at a time
+        this->Stats->Record(Timing::Vision, Result.ProcessTime);
+
+        // A later frame already finished on another worker
+        if (this->bHasResult && Result.Pts < this->Latest.Pts)
+            return;
+
+        this->Latest = Result;
+        this->bHasResult = true;
+    }
+
+    if (this->Handler)
+        this->Handler(Result);
+}
+
+FrameTap::~FrameTap()
+{
+    // No more frames into the buffer once this returns
+    this->Bus->Unsubscribe(&this->Input);
+
+    this->bDispatchLoop = false;
+
+    // Wait for dispatch thread to finish
+    if (this->DispatchThread.joinable())
+        this->DispatchThread.join();
+
+    // Jobs refer to this tap, wait for the ones already on the pool
+    while (this->InFlight.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+}
@@ -0,0 +1,94 @@
+#ifndef HOST_FRAME_TAP_HPP_
+#define HOST_FRAME_TAP_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameBuffer.hpp"
+#include "FrameBus.hpp"
+#include "ImageKernels.hpp"
+#include "Metrics.hpp"
+#include "ThreadPool.hpp"
+
+using VisionHandler = std::function<void(const VisionResult&)>;
+
+// Runs a chain of image kernels on decoded frames off the render path. Subscribes its own
+// small buffer to the frame bus and hands each frame, by reference, to a thread pool; when
+// the pool is saturated the frame is dropped instead of queueing, so analysis lags by at
+// most the pool's depth and the decoder and renderer never wait on it.
+
+class FrameTap
+{
+private:
+    FrameBus* Bus;
+    ThreadPool* Pool;
+    Metrics* Stats;
+
+    FrameBuffer Input;
+    std::vector<VisionKernel> Kernels;
+
+    // Newest result by source PTS, jobs can finish out of order
+    std::mutex ResultMutex;
+    VisionResult Latest;
+    bool bHasResult;
+    VisionHandler Handler;
+
+    std::atomic<size_t> InFlight;
+    std::atomic<uint64_t> FramesAnalyzed;
+    std::atomic<uint64_t> FramesDropped;
+
+    std::atomic<bool> bDispatchLoop;
+    std::thread DispatchThread;
+
+    void DispatchLoop();
+
+    void Analyze(AVFrame* Frame, int64_t ReceiveTime);
+
+public:
+    /**
+     * @brief Creates the tap and subscribes it to the bus.
+     * @param BusPtr Pointer to the frame bus decoded frames are published on.
+     * @param PoolPtr Pointer to the thread pool kernels run on. Must outlive the tap.
+     * @param StatsPtr Pointer to metrics object to record to.
+     * @param Chain Kernels to run on each frame, in order.
+	 */
+    FrameTap(FrameBus* BusPtr, ThreadPool* PoolPtr, Metrics* StatsPtr, std::vector<VisionKernel> Chain = GetDefaultVisionChain());
+
+    /**
+     * @brief Sets a function called with each result newer than the last.
+     * @param NewHandler Function to call, on a pool thread. Must be set before the tap loop is started.
+	 */
+    void SetResultHandler(VisionHandler NewHandler);
+
+    /**
+     * @brief Spawns new thread to take frames off the bus and submit them to the pool.
+	 */
+    void StartTapLoop();
+
+    /**
+     * @brief Gets the result of the newest frame analyzed so far.
+     * @param Result Reference to store the result in.
+     * @returns True if any frame has been analyzed.
+	 */
+    bool GetLatestResult(VisionResult& Result);
+
+    /**
+     * @brief Gets the number of frames analyzed.
+     * @returns Total frames analyzed as a uint64_t.
+	 */
+    uint64_t GetFramesAnalyzed() {return this->FramesAnalyzed.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief Gets the number of frames dropped because the pool was saturated.
+     * @returns Total frames dropped as a uint64_t.
+	 */
+    uint64_t GetFramesDropped() {return this->FramesDropped.load(std::memory_order_relaxed);}
+
+    ~FrameTap();
+};
+
+#endif // HOST_FRAME_TAP_HPP_
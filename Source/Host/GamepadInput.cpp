@@ -0,0 +1,143 @@
+#include "GamepadInput.hpp"
+
+#include <chrono>
+#include <cmath>
+
+#include "Trace.hpp"
+
+static const SDL_GamepadAxis SampledAxes[] =
+{
+    SDL_GAMEPAD_AXIS_LEFTX,
+    SDL_GAMEPAD_AXIS_LEFTY,
+    SDL_GAMEPAD_AXIS_RIGHTX,
+    SDL_GAMEPAD_AXIS_RIGHTY,
+    SDL_GAMEPAD_AXIS_LEFT_TRIGGER,
+    SDL_GAMEPAD_AXIS_RIGHT_TRIGGER
+};
+
+GamepadInput::GamepadInput(SerialLink *LinkPtr, Metrics *StatsPtr, double Rate)
+{
+    this->Gamepad = nullptr;
+    this->Link = LinkPtr;
+    this->Stats = StatsPtr;
+
+    this->SampleRate = (Rate > 0.0) ? Rate : 100.0;
+    this->Sequence = 0;
+
+    this->PendingMotionTime = 0;
+    this->bInputLoop = false;
+}
+
+// Main thread
+
+void GamepadInput::SetGamepad(SDL_Gamepad *NewGamepad)
+{
+    std::lock_guard<std::mutex> Lock(this->GamepadMutex);
+    this->Gamepad = NewGamepad;
+}
+
+void GamepadInput::SetShaping(const InputShaping &NewShaping)
+{
+    std::lock_guard<std::mutex> Lock(this->GamepadMutex);
+    this->Shaping = NewShaping;
+}
+
+void GamepadInput::NotifyAxisMotion(uint64_t Timestamp)
+{
+    // Keep the oldest unsent event so the measurement covers the worst case
+    uint64_t Expected = 0;
+    this->PendingMotionTime.compare_exchange_strong(Expected, Timestamp, std::memory_order_relaxed);
+}
+
+void GamepadInput::StartInputLoop()
+{
+    this->bInputLoop = true;
+
+    // Start thread
+    this->InputThread = std::thread([this] { this->InputLoop(); });
+}
+
+// Input thread
+
+float GamepadInput::Shape(int16_t Raw)
+{
+    float Value = static_cast<float>(Raw) / 32767.0f;
+    float Magnitude = std::fabs(Value);
+
+    if (Magnitude <= this->Shaping.Deadband)
+        return 0.0f;
+
+    // Rescale so output starts from zero at the deadband edge
+    Magnitude = (Magnitude - this->Shaping.Deadband) / (1.0f - this->Shaping.Deadband);
+    Magnitude = (Magnitude > 1.0f) ? 1.0f : Magnitude;
+
+    Magnitude = (1.0f - this->Shaping.Expo) * Magnitude + this->Shaping.Expo * Magnitude * Magnitude * Magnitude;
+
+    return std::copysign(Magnitude, Value);
+}
+
+void GamepadInput::InputLoop()
+{
+    TRACE_THREAD("Input");
+
+    auto Period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / this->SampleRate));
+    auto NextSample = std::chrono::steady_clock::now();
+
+    uint8_t Frame[PROTOCOL_MAX_ENCODED];
+
+    while (this->bInputLoop)
+    {
+        // Absolute deadlines so the rate does not drift with loop cost
+        NextSample += Period;
+        std::this_thread::sleep_until(NextSample);
+
+        TRACE_SCOPE("SampleGamepad");
+
+        uint64_t SampleTime = SDL_GetTicksNS();
+        uint64_t MotionTime = this->PendingMotionTime.exchange(0, std::memory_order_relaxed);
+
+        protocol_command_t Command = {};
+        Command.time_us = static_cast<uint32_t>(SampleTime / 1000);
+
+        {
+            std::lock_guard<std::mutex> Lock(this->GamepadMutex);
+
+            if (this->Gamepad)
+            {
+                Command.flags |= PROTOCOL_COMMAND_GAMEPAD;
+
+                for (size_t i = 0; i < PROTOCOL_AXIS_COUNT; i++)
+                    Command.axes[i] = static_cast<int16_t>(this->Shape(SDL_GetGamepadAxis(this->Gamepad, SampledAxes[i])) * 32767.0f);
+
+                for (int Button = 0; Button < SDL_GAMEPAD_BUTTON_COUNT && Button < 32; Button++)
+                {
+                    if (SDL_GetGamepadButton(this->Gamepad, static_cast<SDL_GamepadButton>(Button)))
+                        Command.buttons |= 1u << Button;
+                }
+            }
+        }
+
+        size_t FrameSize = protocol_encode(PROTOCOL_ID_COMMAND, this->Sequence++, &Command, sizeof(Command), Frame, sizeof(Frame));
+
+        if (FrameSize == 0 || this->Link->Write(Frame, FrameSize) < 0)
+            continue;
+
+        this->Stats->Add(Counter::CommandsSent, 1);
+
+        if (MotionTime != 0)
+            this->Stats->Record(Timing::StickToWire, (SDL_GetTicksNS() - MotionTime) / 1e6);
+
+        // Fell more than a period behind, resynchronize instead of bursting
+        if (std::chrono::steady_clock::now() > NextSample + Period)
+            NextSample = std::chrono::steady_clock::now();
+    }
+}
+
+GamepadInput::~GamepadInput()
+{
+    this->bInputLoop = false;
+
+    // Wait for input thread to finish
+    if (this->InputThread.joinable())
+        this->InputThread.join();
+}
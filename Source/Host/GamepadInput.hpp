@@ -0,0 +1,83 @@
+#ifndef HOST_GAMEPAD_INPUT_HPP_
+#define HOST_GAMEPAD_INPUT_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <SDL3/SDL.h>
+
+#include <protocol.h>
+
+#include "Metrics.hpp"
+#include "SerialLink.hpp"
+
+// Response curve applied to every axis
+struct InputShaping
+{
+    float Deadband = 0.08f;     // Fraction of travel around center that reads as zero
+    float Expo = 0.3f;          // 0 is linear, 1 is fully cubic
+};
+
+// Samples the gamepad on a dedicated thread at a fixed rate and sends protocol command messages to the vehicle
+
+class GamepadInput
+{
+private:
+    std::mutex GamepadMutex;
+    SDL_Gamepad* Gamepad;
+
+    SerialLink* Link;
+    Metrics* Stats;
+
+    InputShaping Shaping;
+    double SampleRate;
+    uint8_t Sequence;
+
+    // Timestamp (SDL_GetTicksNS) of the oldest axis event not yet sent, 0 if none
+    std::atomic<uint64_t> PendingMotionTime;
+
+    std::atomic<bool> bInputLoop;
+    std::thread InputThread;
+
+    float Shape(int16_t Raw);
+
+    void InputLoop();
+
+public:
+    /**
+     * @brief Creates fixed-rate gamepad sampler.
+     * @param LinkPtr Pointer to serial link command frames are sent over.
+     * @param StatsPtr Pointer to metrics object to record stick-to-wire latency in.
+     * @param Rate Sampling and transmit rate in Hz.
+	 */
+    GamepadInput(SerialLink* LinkPtr, Metrics* StatsPtr, double Rate);
+
+    /**
+     * @brief Sets the gamepad to sample.
+     * @param NewGamepad Gamepad to sample, or nullptr to send neutral commands.
+     * @note Must be called with nullptr before the current gamepad is closed.
+	 */
+    void SetGamepad(SDL_Gamepad* NewGamepad);
+
+    /**
+     * @brief Sets the deadband and expo applied to every axis.
+	 */
+    void SetShaping(const InputShaping& NewShaping);
+
+    /**
+     * @brief Marks that an axis moved, starting a stick-to-wire latency measurement.
+     * @param Timestamp Event timestamp in nanoseconds (SDL_GetTicksNS clock).
+	 */
+    void NotifyAxisMotion(uint64_t Timestamp);
+
+    /**
+     * @brief Spawns new thread to sample the gamepad and send commands at the fixed rate.
+	 */
+    void StartInputLoop();
+
+    ~GamepadInput();
+};
+
+#endif // HOST_GAMEPAD_INPUT_HPP_
@@ -0,0 +1,70 @@
+#include "GpuTimer.hpp"
+
+GpuTimer::GpuTimer(Metrics *StatsPtr, Timing Target)
+{
+    this->Stats = StatsPtr;
+    this->Which = Target;
+
+    glGenQueries(QueryCount, this->Queries);
+
+    for (size_t i = 0; i < QueryCount; i++)
+        this->bIsPending[i] = false;
+
+    this->NextQuery = 0;
+    this->bIsActive = false;
+}
+
+// Main thread
+
+void GpuTimer::Poll()
+{
+    // Oldest first, results complete in submission order
+    for (size_t i = 0; i < QueryCount; i++)
+    {
+        size_t Index = (this->NextQuery + i) % QueryCount;
+
+        if (!this->bIsPending[Index])
+            continue;
+
+        GLint bIsAvailable = GL_FALSE;
+        glGetQueryObjectiv(this->Queries[Index], GL_QUERY_RESULT_AVAILABLE, &bIsAvailable);
+
+        if (!bIsAvailable)
+            break;
+
+        GLuint64 Elapsed = 0;
+        glGetQueryObjectui64v(this->Queries[Index], GL_QUERY_RESULT, &Elapsed);
+
+        this->Stats->Record(this->Which, Elapsed / 1e6);
+        this->bIsPending[Index] = false;
+    }
+}
+
+void GpuTimer::Begin()
+{
+    this->Poll();
+
+    // GPU is more than a ring behind, drop this sample rather than wait for it
+    if (this->bIsPending[this->NextQuery])
+        return;
+
+    glBeginQuery(GL_TIME_ELAPSED, this->Queries[this->NextQuery]);
+    this->bIsActive = true;
+}
+
+void GpuTimer::End()
+{
+    if (!this->bIsActive)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+
+    this->bIsPending[this->NextQuery] = true;
+    this->NextQuery = (this->NextQuery + 1) % QueryCount;
+    this->bIsActive = false;
+}
+
+GpuTimer::~GpuTimer()
+{
+    glDeleteQueries(QueryCount, this->Queries);
+}
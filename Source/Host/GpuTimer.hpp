@@ -0,0 +1,73 @@
+#ifndef HOST_GPU_TIMER_HPP_
+#define HOST_GPU_TIMER_HPP_
+
+#include <cstddef>
+
+#include <glad/gl.h>
+
+#include "Metrics.hpp"
+
+// Measures GPU execution time of a span of GL commands with GL_TIME_ELAPSED queries.
+// Each frame's query goes into a ring and is read back only once the GPU reports it done,
+// a few frames later, so measuring never waits on the GPU. Spans of different timers must
+// not overlap, since only one elapsed time query can be active at once.
+
+class GpuTimer
+{
+private:
+    static constexpr size_t QueryCount = 4;
+
+    GLuint Queries[QueryCount];
+    bool bIsPending[QueryCount];
+    size_t NextQuery;
+    bool bIsActive;
+
+    Metrics* Stats;
+    Timing Which;
+
+public:
+    /**
+     * @brief Creates the timer's queries. Requires a current GL context.
+     * @param StatsPtr Pointer to metrics object to record GPU times in.
+     * @param Target Timing to record to.
+	 */
+    GpuTimer(Metrics* StatsPtr, Timing Target);
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    /**
+     * @brief Starts timing. Records any earlier results that have become available.
+     * @note Skips the frame rather than stall if every query is still in flight.
+	 */
+    void Begin();
+
+    /**
+     * @brief Stops timing the commands issued since Begin.
+	 */
+    void End();
+
+    /**
+     * @brief Records results that are available, without waiting.
+	 */
+    void Poll();
+
+    ~GpuTimer();
+};
+
+// Times the enclosing scope on the GPU
+class GpuTimerScope
+{
+private:
+    GpuTimer& Timer;
+
+public:
+    explicit GpuTimerScope(GpuTimer& ScopeTimer) : Timer(ScopeTimer) {this->Timer.Begin();}
+
+    GpuTimerScope(const GpuTimerScope&) = delete;
+    GpuTimerScope& operator=(const GpuTimerScope&) = delete;
+
+    ~GpuTimerScope() {this->Timer.End();}
+};
+
+#endif // HOST_GPU_TIMER_HPP_
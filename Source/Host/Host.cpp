@@ -1,12 +1,128 @@
-#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
 
 #include <glad/gl.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
+#include "ClockSync.hpp"
 #include "FrameBuffer.hpp"
+#include "FrameBus.hpp"
+#include "FrameTap.hpp"
+#include "GamepadInput.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "PacketRelay.hpp"
 #include "Renderer.hpp"
+#include "ReplayClock.hpp"
+#include "SerialLink.hpp"
+#include "Telemetry.hpp"
+#include "TelemetryLog.hpp"
+#include "TelemetryReplayer.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 #include "VideoReceiver.hpp"
+#include "VideoReplayer.hpp"
+
+// Disk reserved for each telemetry log, roughly ten hours at full telemetry rate
+static constexpr uint64_t TelemetryLogCapacity = 1ull << 30;
+
+// Replay seek steps in microseconds, the larger one with shift held
+static constexpr int64_t ReplaySeekStep = 5000000;
+static constexpr int64_t ReplayLongSeekStep = 60000000;
+
+// Color correction adjustment per key press, and the most of any strength
+static constexpr float CorrectionStep = 0.25f;
+static constexpr float MaximumCorrection = 2.0f;
+
+std::string GetTimestampedPath(const char* Directory, const char* Prefix, const char* Extension)
+{
+    char Stamp[32];
+    std::time_t Now = std::time(nullptr);
+    std::strftime(Stamp, sizeof(Stamp), "%Y%m%d_%H%M%S", std::localtime(&Now));
+
+    return std::string(Directory) + "/" + Prefix + "_" + Stamp + "." + Extension;
+}
+
+void HandleReplayKey(const SDL_KeyboardEvent& Key, ReplayClock& Clock, VideoReplayer& Replayer)
+{
+    int64_t SeekStep = (Key.mod & SDL_KMOD_SHIFT) ? ReplayLongSeekStep : ReplaySeekStep;
+
+    switch (Key.key)
+    {
+        case SDLK_SPACE:
+            Clock.TogglePaused();
+            break;
+
+        case SDLK_LEFT:
+            Clock.Seek(Clock.Now() - SeekStep);
+            break;
+
+        case SDLK_RIGHT:
+            Clock.Seek(Clock.Now() + SeekStep);
+            break;
+
+        case SDLK_HOME:
+            Clock.Seek(Clock.GetStartTime());
+            break;
+
+        case SDLK_COMMA:
+            Replayer.Step(-1);
+            break;
+
+        case SDLK_PERIOD:
+            Replayer.Step(1);
+            break;
+
+        case SDLK_LEFTBRACKET:
+            Clock.SetSpeed(Clock.GetSpeed() / 2.0);
+            break;
+
+        case SDLK_RIGHTBRACKET:
+            Clock.SetSpeed(Clock.GetSpeed() * 2.0);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void HandleCorrectionKey(const SDL_KeyboardEvent& Key, Renderer& FrameRenderer)
+{
+    ColorCorrection Correction = FrameRenderer.GetColorCorrection();
+
+    // Shift adjusts dehaze instead of local contrast, ctrl the red compensation
+    float* Strength = &Correction.LocalContrast;
+
+    if (Key.mod & SDL_KMOD_SHIFT)
+        Strength = &Correction.Dehaze;
+    else if (Key.mod & SDL_KMOD_CTRL)
+        Strength = &Correction.RedCompensation;
+
+    switch (Key.key)
+    {
+        case SDLK_F2:
+            Correction.bEnabled = !Correction.bEnabled;
+            break;
+
+        case SDLK_F3:
+            *Strength = std::max(*Strength - CorrectionStep, 0.0f);
+            break;
+
+        case SDLK_F4:
+            *Strength = std::min(*Strength + CorrectionStep, MaximumCorrection);
+            break;
+
+        default:
+            return;
+    }
+
+    FrameRenderer.SetColorCorrection(Correction);
+}
 
 void Cleanup(SDL_Window* Window)
 {
@@ -16,27 +132,37 @@ void Cleanup(SDL_Window* Window)
 
 int main(int argc, char* argv[]) 
 {
+    TRACE_THREAD("Main");
+
+    // Replay mode plays back a recording and telemetry log instead of connecting to the vehicle
+    bool bIsReplay = argc >= 3 && strcmp(argv[1], "--replay") == 0;
+
     const char* URL = argc >= 2 ? argv[1] : "tcp://127.0.0.1:1234";
+    const char* SerialDevice = argc >= 5 ? argv[4] : "/dev/ttyACM0";
+    uint16_t RelayPort = (!bIsReplay && argc >= 6) ? static_cast<uint16_t>(std::stoi(argv[5])) : 0;
+
+    const char* RecordingPath = bIsReplay ? argv[2] : nullptr;
+    const char* TelemetryPath = (bIsReplay && argc >= 4) ? argv[3] : nullptr;
 
     uint16_t BufferSize = 4;
     uint16_t BufferingCutoff = 0;
 
-    if (argc >= 3)
+    if (!bIsReplay && argc >= 3)
     {
         uint16_t NewBufferSize = static_cast<uint16_t>(std::stoi(argv[2]));
 
         if (NewBufferSize <= 0)
-            fprintf(stderr, "Buffer size is too small, setting to default: 4\n");
+            LOG_WARNING("Buffer size is too small, setting to default: 4");
         else
             BufferSize = NewBufferSize;
     }
 
-    if (argc >= 4)
+    if (!bIsReplay && argc >= 4)
     {
         uint16_t NewBufferingCutoff = static_cast<uint16_t>(std::stoi(argv[3]));
 
         if (NewBufferingCutoff >= BufferSize)
-            fprintf(stderr, "Buffering cutoff is too big, setting to default: 0\n");
+            LOG_WARNING("Buffering cutoff is too big, setting to default: 0");
         else
             BufferingCutoff = NewBufferingCutoff;
     }
@@ -80,18 +206,123 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    printf("Press keys or controller buttons. ESC or window close to quit.\n\n");
+    LOG_INFO("Press keys or controller buttons. ESC or window close to quit.");
 
+    Metrics Stats;
     FrameBuffer Buffer = FrameBuffer(BufferSize);
-    VideoReceiver Receiver = VideoReceiver(URL, &Buffer);
+
+    // Decoded frames are published once and fanned out, the display is one subscriber
+    FrameBus Bus;
+    Bus.Subscribe(&Buffer);
+
+    // Vision analysis gets half the cores and one frame per worker, so it skips frames rather than lagging
+    size_t VisionThreads = std::max<size_t>(2, std::thread::hardware_concurrency() / 2);
+    ThreadPool VisionPool = ThreadPool(VisionThreads, VisionThreads);
+
+    FrameTap Tap = FrameTap(&Bus, &VisionPool, &Stats);
+    Tap.StartTapLoop();
+
+    // Telemetry is used by the link and replay threads, so it is declared first to outlive them
+    Telemetry VehicleTelemetry = Telemetry(&Stats);
+
+    // Video comes from the network live, or from a recording paced by the replay clock
+    std::unique_ptr<ReplayClock> Clock;
+    std::unique_ptr<PacketRelay> Relay;
+    std::unique_ptr<VideoReceiver> Receiver;
+    std::unique_ptr<VideoReplayer> Replayer;
+    std::unique_ptr<TelemetryReplayer> TelemetryPlayback;
+
+    if (bIsReplay)
+    {
+        Replayer = std::make_unique<VideoReplayer>(RecordingPath, &Bus, &Stats);
+
+        if (TelemetryPath)
+            TelemetryPlayback = std::make_unique<TelemetryReplayer>(TelemetryPath, &VehicleTelemetry);
+    }
+    else
+    {
+        Receiver = std::make_unique<VideoReceiver>(URL, &Bus, &Stats);
+
+        // Re-serve the received stream to viewers on the local network, the relay outlives the receiver
+        if (RelayPort != 0)
+        {
+            Relay = std::make_unique<PacketRelay>(RelayPort);
+
+            if (Relay->IsOpen())
+            {
+                Receiver->SetRelay(Relay.get());
+                Relay->StartRelayLoop();
+            }
+        }
+    }
 
     // Get video resolution from stream
-    int Width = Receiver.GetVideoWidth();
-    int Height = Receiver.GetVideoHeight();
-    
-    Renderer FrameRenderer = Renderer(Width, Height, BufferingCutoff, &Buffer, "../Shaders/YUVToRGB");
+    int Width = bIsReplay ? Replayer->GetVideoWidth() : Receiver->GetVideoWidth();
+    int Height = bIsReplay ? Replayer->GetVideoHeight() : Receiver->GetVideoHeight();
     
-    Receiver.StartReceiveLoop();
+    // Owns every GL object, so it is released explicitly before the context goes
+    std::unique_ptr<Renderer> FrameRenderer = std::make_unique<Renderer>(Width, Height, BufferingCutoff, &Buffer, &Stats, "../Shaders");
+    FrameRenderer->SetTelemetry(&VehicleTelemetry);
+    FrameRenderer->SetFrameTap(&Tap);
+
+    if (bIsReplay)
+    {
+        bool bHasTelemetry = TelemetryPlayback && TelemetryPlayback->IsOpen();
+
+        // Video sets the timeline, telemetry alone is replayed over its own span
+        int64_t Start = Replayer->IsOpen() ? Replayer->GetStartTime() : (bHasTelemetry ? TelemetryPlayback->GetStartTime() : 0);
+        int64_t End = Replayer->IsOpen() ? Replayer->GetEndTime() : (bHasTelemetry ? TelemetryPlayback->GetEndTime() : 0);
+
+        Clock = std::make_unique<ReplayClock>(Start, End);
+        FrameRenderer->SetReplayClock(Clock.get());
+
+        if (Replayer->IsOpen())
+            Replayer->StartReplayLoop(Clock.get());
+
+        if (bHasTelemetry)
+            TelemetryPlayback->StartReplayLoop(Clock.get());
+
+        Clock->SetPaused(false);
+    }
+    else
+    {
+        Receiver->StartReceiveLoop();
+    }
+
+    std::unique_ptr<TelemetryLog> Log;
+    std::unique_ptr<ClockSync> Sync;
+
+    // Command uplink and telemetry downlink with the vehicle, independent of the render rate
+    std::unique_ptr<SerialLink> Link;
+    std::unique_ptr<GamepadInput> Input;
+
+    if (!bIsReplay)
+    {
+        Link = std::make_unique<SerialLink>(SerialDevice, 115200);
+        Input = std::make_unique<GamepadInput>(Link.get(), &Stats, 100.0);
+
+        Link->SetReceiveHandler([&VehicleTelemetry](const uint8_t* Data, size_t Size) { return VehicleTelemetry.Receive(Data, Size); });
+    }
+
+    if (Link && Link->IsOpen())
+    {
+        // Record every telemetry message for replay
+        Log = std::make_unique<TelemetryLog>(GetTimestampedPath(".", "Telemetry", "tlog").c_str(), TelemetryLogCapacity);
+
+        if (Log->IsOpen())
+        {
+            TelemetryLog* LogPtr = Log.get();
+            VehicleTelemetry.AddHandler([LogPtr](const protocol_frame_t& Frame, int64_t ReceiveTime) { LogPtr->Append(Frame, ReceiveTime); });
+        }
+
+        // Map vehicle timestamps into host time, pinging over the link as telemetry arrives
+        Sync = std::make_unique<ClockSync>(Link.get(), &Stats);
+        ClockSync* SyncPtr = Sync.get();
+        VehicleTelemetry.AddHandler([SyncPtr](const protocol_frame_t& Frame, int64_t ReceiveTime) { SyncPtr->HandleFrame(Frame, ReceiveTime); });
+
+        Link->StartTransferLoop();
+        Input->StartInputLoop();
+    }
     
     bool IsRunning = true;
 
@@ -107,6 +338,8 @@ int main(int argc, char* argv[])
         SDL_Event Event;
         while (SDL_PollEvent(&Event)) 
         {
+            TRACE_SCOPE("Event");
+
             switch (Event.type) 
             {
                 case SDL_EVENT_QUIT:
@@ -116,78 +349,97 @@ int main(int argc, char* argv[])
                 case SDL_EVENT_WINDOW_RESIZED:
                     Width = Event.window.data1;
                     Height = Event.window.data2;
-                    FrameRenderer.UpdateViewport(Width, Height);
+                    FrameRenderer->UpdateViewport(Width, Height);
                     break;
 
                 case SDL_EVENT_KEY_DOWN:
-                    printf("Key down: %s\n", SDL_GetKeyName(Event.key.key));
+                    LOG_INFO("Key down: %s", SDL_GetKeyName(Event.key.key));
                     if (Event.key.key == SDLK_ESCAPE)
                         IsRunning = false;
+
+                    if (Event.key.key == SDLK_F1)
+                        FrameRenderer->ToggleOverlay();
+
+                    // F2 toggles color correction, F3 and F4 adjust it
+                    HandleCorrectionKey(Event.key, *FrameRenderer);
+
+                    // F9 starts and stops recording the live stream for replay
+                    if (Event.key.key == SDLK_F9 && Receiver)
+                    {
+                        if (Receiver->IsRecording())
+                        {
+                            Receiver->StopRecording();
+                        }
+                        else
+                        {
+                            std::string RecordingFile = GetTimestampedPath(".", "Recording", "mkv");
+                            LOG_INFO("Recording to %s", RecordingFile.c_str());
+                            Receiver->StartRecording(RecordingFile.c_str());
+                        }
+                    }
+
+                    // F8 exports the recent trace zones, Chrome JSON or with shift a Perfetto trace
+                    if (Event.key.key == SDLK_F8)
+                    {
+                        if (Event.key.mod & SDL_KMOD_SHIFT)
+                            Trace::ExportPerfetto(GetTimestampedPath(".", "Trace", "perfetto-trace").c_str());
+                        else
+                            Trace::ExportChrome(GetTimestampedPath(".", "Trace", "json").c_str());
+                    }
+
+                    if (Clock)
+                        HandleReplayKey(Event.key, *Clock, *Replayer);
+
+                    // F12 captures the window, F11 the decoded source frame. Hold shift for JPEG.
+                    if (Event.key.key == SDLK_F12 || Event.key.key == SDLK_F11)
+                    {
+                        CaptureSource Source = (Event.key.key == SDLK_F12) ? CaptureSource::Framebuffer : CaptureSource::SourceFrame;
+                        CaptureFormat Format = (Event.key.mod & SDL_KMOD_SHIFT) ? CaptureFormat::JPEG : CaptureFormat::PNG;
+                        FrameRenderer->RequestCapture(Source, Format);
+                    }
                     break;
 
                 case SDL_EVENT_KEY_UP:
-                    printf("Key up: %s\n", SDL_GetKeyName(Event.key.key));
+                    LOG_INFO("Key up: %s", SDL_GetKeyName(Event.key.key));
                     break;
 
                 case SDL_EVENT_GAMEPAD_ADDED:
                     if (Gamepad == nullptr) 
                     {
-                        printf("Gamepad connected: id=%d\n", Event.gdevice.which);
+                        LOG_INFO("Gamepad connected: id=%u", (unsigned int) Event.gdevice.which);
                         Gamepad = SDL_OpenGamepad(Event.gdevice.which);
                         
                         if (!Gamepad) 
-                            fprintf(stderr, "Failed to open gamepad ID %u: %s", (unsigned int) Event.gdevice.which, SDL_GetError());
+                            LOG_ERROR("Failed to open gamepad ID %u: %s", (unsigned int) Event.gdevice.which, SDL_GetError());
+                        else if (Input)
+                            Input->SetGamepad(Gamepad);
                     }
                     break;
 
                 case SDL_EVENT_GAMEPAD_REMOVED:
                     if (Gamepad && (SDL_GetGamepadID(Gamepad) == Event.gdevice.which)) 
                     {
-                        printf("Gamepad disconnected: id=%d\n", Event.gdevice.which);
+                        LOG_INFO("Gamepad disconnected: id=%u", (unsigned int) Event.gdevice.which);
+                        if (Input)
+                            Input->SetGamepad(nullptr);
+
                         SDL_CloseGamepad(Gamepad);
                         Gamepad = nullptr;
                     }
                     break;
 
                 case SDL_EVENT_GAMEPAD_BUTTON_DOWN:
-                    printf("Gamepad button down: %d\n", Event.gbutton.button);
+                    LOG_INFO("Gamepad button down: %d", Event.gbutton.button);
                     break;
 
                 case SDL_EVENT_GAMEPAD_BUTTON_UP:
-                    printf("Gamepad button up:   %d\n", Event.gbutton.button);
+                    LOG_INFO("Gamepad button up:   %d", Event.gbutton.button);
                     break;
 
                 case SDL_EVENT_GAMEPAD_AXIS_MOTION:
-                    switch(Event.gaxis.axis)
-                    {
-                        case SDL_GAMEPAD_AXIS_LEFTX:
-                            printf("Gamepad left stick horizontal: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        case SDL_GAMEPAD_AXIS_LEFTY:
-                            printf("Gamepad left stick vertical: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        case SDL_GAMEPAD_AXIS_RIGHTX:
-                            printf("Gamepad right stick horizontal: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        case SDL_GAMEPAD_AXIS_RIGHTY:
-                            printf("Gamepad right stick vertical: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        case SDL_GAMEPAD_AXIS_LEFT_TRIGGER:
-                            printf("Gamepad left trigger: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        case SDL_GAMEPAD_AXIS_RIGHT_TRIGGER:
-                            printf("Gamepad right trigger: %f\n", static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                        
-                        default:
-                            printf("Gamepad axis %d: %f\n", Event.gaxis.axis, static_cast<float>(Event.gaxis.value) / 32767.0f);
-                            break;
-                    }
+                    // Axes are sampled by the input thread, only the event time is needed here
+                    if (Input)
+                        Input->NotifyAxisMotion(Event.gaxis.timestamp);
                     break;
 
                 default:
@@ -198,12 +450,23 @@ int main(int argc, char* argv[])
         // Render video
         if (CurrentTime >= NextRenderTime)
         {
-            if (FrameRenderer.Render(CurrentTime, NextRenderTime) >= 0)
+            if (FrameRenderer->Render(CurrentTime, NextRenderTime) >= 0)
+            {
+                TRACE_SCOPE("Swap");
                 SDL_GL_SwapWindow(Window);
+            }
         }
     }
 
+    // Input thread outlives the event loop, stop it touching the gamepad before SDL shuts down
+    if (Input)
+        Input->SetGamepad(nullptr);
+
+    // GL objects are deleted while the context is current, then the context itself
+    FrameRenderer.reset();
+    SDL_GL_DestroyContext(GLContext);
+
     Cleanup(Window);
-    printf("Program exit.\n");
+    LOG_INFO("Program exit.");
     return 0;
 }
@@ -0,0 +1,228 @@
+#include "ImageKernels.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Gradient a pixel must exceed to count as an edge, at analysis resolution
+static constexpr uint8_t EdgeThreshold = 24;
+
+// Typical edge density of a clear scene at analysis resolution, turbidity is the loss below it
+static constexpr float ClearWaterEdgeDensity = 0.08f;
+
+// Primitives
+
+void DownsampleHalf(const uint8_t *Source, int SourceStride, int Width, int Height, uint8_t *Destination, int DestinationStride)
+{
+    int OutWidth = Width / 2;
+    int OutHeight = Height / 2;
+
+    for (int y = 0; y < OutHeight; y++)
+    {
+        const uint8_t* Row0 = Source + static_cast<ptrdiff_t>(2 * y) * SourceStride;
+        const uint8_t* Row1 = Row0 + SourceStride;
+        uint8_t* Out = Destination + static_cast<ptrdiff_t>(y) * DestinationStride;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128i EvenMask = _mm_set1_epi16(0x00FF);
+        const __m128i One = _mm_set1_epi16(1);
+
+        // 16 output pixels from 32 source columns of both rows
+        for (; x + 16 <= OutWidth; x += 16)
+        {
+            __m128i Left = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + 2 * x)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + 2 * x)));
+            __m128i Right = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + 2 * x + 16)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + 2 * x + 16)));
+
+            // Average even and odd columns in 16 bits, rounding up like _mm_avg_epu8
+            __m128i LeftSum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(Left, EvenMask), _mm_srli_epi16(Left, 8)), One);
+            __m128i RightSum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(Right, EvenMask), _mm_srli_epi16(Right, 8)), One);
+
+            __m128i Packed = _mm_packus_epi16(_mm_srli_epi16(LeftSum, 1), _mm_srli_epi16(RightSum, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(Out + x), Packed);
+        }
+#endif
+
+        for (; x < OutWidth; x++)
+        {
+            unsigned int Even = (Row0[2 * x] + Row1[2 * x] + 1) >> 1;
+            unsigned int Odd = (Row0[2 * x + 1] + Row1[2 * x + 1] + 1) >> 1;
+            Out[x] = static_cast<uint8_t>((Even + Odd + 1) >> 1);
+        }
+    }
+}
+
+void MeasureLuma(const uint8_t *Image, int Stride, int Width, int Height, double &Mean, double &StdDev)
+{
+    uint64_t Sum = 0;
+    uint64_t SumSquares = 0;
+
+    for (int y = 0; y < Height; y++)
+    {
+        const uint8_t* Row = Image + static_cast<ptrdiff_t>(y) * Stride;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128i Zero = _mm_setzero_si128();
+        __m128i RowSum = _mm_setzero_si128();
+        __m128i RowSquares = _mm_setzero_si128();
+
+        // 32-bit square lanes cannot overflow within a row of any sane width, flushed per row
+        for (; x + 16 <= Width; x += 16)
+        {
+            __m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row + x));
+            __m128i Low = _mm_unpacklo_epi8(Pixels, Zero);
+            __m128i High = _mm_unpackhi_epi8(Pixels, Zero);
+
+            RowSum = _mm_add_epi64(RowSum, _mm_sad_epu8(Pixels, Zero));
+            RowSquares = _mm_add_epi32(RowSquares, _mm_add_epi32(_mm_madd_epi16(Low, Low), _mm_madd_epi16(High, High)));
+        }
+
+        alignas(16) uint64_t SumLanes[2];
+        alignas(16) uint32_t SquareLanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(SumLanes), RowSum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(SquareLanes), RowSquares);
+
+        Sum += SumLanes[0] + SumLanes[1];
+        SumSquares += static_cast<uint64_t>(SquareLanes[0]) + SquareLanes[1] + SquareLanes[2] + SquareLanes[3];
+#endif
+
+        for (; x < Width; x++)
+        {
+            Sum += Row[x];
+            SumSquares += static_cast<uint32_t>(Row[x]) * Row[x];
+        }
+    }
+
+    uint64_t Count = static_cast<uint64_t>(Width > 0 ? Width : 0) * (Height > 0 ? Height : 0);
+
+    if (Count == 0)
+    {
+        Mean = 0.0;
+        StdDev = 0.0;
+        return;
+    }
+
+    Mean = static_cast<double>(Sum) / Count;
+    double Variance = static_cast<double>(SumSquares) / Count - Mean * Mean;
+    StdDev = std::sqrt(std::max(Variance, 0.0));
+}
+
+uint64_t CountEdges(const uint8_t *Image, int Stride, int Width, int Height, uint8_t Threshold)
+{
+    uint64_t Count = 0;
+
+    // Every counted pixel needs a right and a lower neighbour
+    for (int y = 0; y + 1 < Height; y++)
+    {
+        const uint8_t* Row = Image + static_cast<ptrdiff_t>(y) * Stride;
+        const uint8_t* Below = Row + Stride;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        // Unsigned g > Threshold as max(g, Threshold + 1) == g, so a threshold of 255 never matches
+        const __m128i Limit = _mm_set1_epi8(static_cast<char>(Threshold < 255 ? Threshold + 1 : 255));
+        const bool bCanMatch = Threshold < 255;
+
+        for (; bCanMatch && x + 17 <= Width; x += 16)
+        {
+            __m128i Center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row + x));
+            __m128i Right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row + x + 1));
+            __m128i Down = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Below + x));
+
+            __m128i Dx = _mm_or_si128(_mm_subs_epu8(Center, Right), _mm_subs_epu8(Right, Center));
+            __m128i Dy = _mm_or_si128(_mm_subs_epu8(Center, Down), _mm_subs_epu8(Down, Center));
+            __m128i Gradient = _mm_adds_epu8(Dx, Dy);
+
+            int Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(Gradient, Limit), Gradient));
+            Count += std::bitset<16>(static_cast<unsigned int>(Mask)).count();
+        }
+#endif
+
+        for (; x + 1 < Width; x++)
+        {
+            int Gradient = std::abs(Row[x] - Row[x + 1]) + std::abs(Row[x] - Below[x]);
+
+            if (std::min(Gradient, 255) > Threshold)
+                Count++;
+        }
+    }
+
+    return Count;
+}
+
+// Chain stages
+
+void DownsampleKernel(VisionImage &Image, VisionResult &Result)
+{
+    int OutWidth = Image.Width / 2;
+    int OutHeight = Image.Height / 2;
+
+    if (OutWidth < 1 || OutHeight < 1)
+        return;
+
+    // Written to the spare buffer since the source may be Pixels itself
+    Image.Scratch.resize(static_cast<size_t>(OutWidth) * OutHeight);
+    DownsampleHalf(Image.Data, Image.Stride, Image.Width, Image.Height, Image.Scratch.data(), OutWidth);
+
+    Image.Pixels.swap(Image.Scratch);
+    Image.Data = Image.Pixels.data();
+    Image.Width = OutWidth;
+    Image.Height = OutHeight;
+    Image.Stride = OutWidth;
+
+    Result.Width = OutWidth;
+    Result.Height = OutHeight;
+}
+
+void LumaKernel(VisionImage &Image, VisionResult &Result)
+{
+    double Mean;
+    double StdDev;
+    MeasureLuma(Image.Data, Image.Stride, Image.Width, Image.Height, Mean, StdDev);
+
+    Result.Mean = static_cast<float>(Mean);
+    Result.StdDev = static_cast<float>(StdDev);
+}
+
+void EdgeKernel(VisionImage &Image, VisionResult &Result)
+{
+    uint64_t Total = static_cast<uint64_t>(std::max(Image.Width - 1, 0)) * std::max(Image.Height - 1, 0);
+
+    if (Total == 0)
+    {
+        Result.EdgeDensity = 0.0f;
+        return;
+    }
+
+    uint64_t Edges = CountEdges(Image.Data, Image.Stride, Image.Width, Image.Height, EdgeThreshold);
+    Result.EdgeDensity = static_cast<float>(static_cast<double>(Edges) / Total);
+}
+
+void ClarityKernel(VisionImage &Image, VisionResult &Result)
+{
+    (void) Image;
+
+    // RMS contrast, a full range image scores 1
+    float Contrast = (Result.Mean > 0.0f) ? Result.StdDev / Result.Mean : 0.0f;
+    Result.Visibility = std::min(Contrast, 1.0f);
+
+    // Suspended particles scatter light and wash out fine detail first
+    float Detail = std::min(Result.EdgeDensity / ClearWaterEdgeDensity, 1.0f);
+    Result.Turbidity = 1.0f - Detail;
+}
+
+std::vector<VisionKernel> GetDefaultVisionChain()
+{
+    return {DownsampleKernel, DownsampleKernel, LumaKernel, EdgeKernel, ClarityKernel};
+}
@@ -0,0 +1,104 @@
+#ifndef HOST_IMAGE_KERNELS_HPP_
+#define HOST_IMAGE_KERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 8-bit luma image a kernel chain works on. Starts as a view of the decoded frame's luma
+// plane and points into Pixels once a kernel has produced a new image.
+struct VisionImage
+{
+    const uint8_t* Data;
+    int Width;
+    int Height;
+    int Stride;
+
+    std::vector<uint8_t> Pixels;
+    std::vector<uint8_t> Scratch;
+};
+
+// Measurements of one frame, filled in by the kernels of a chain
+struct VisionResult
+{
+    int64_t Pts;                // Source frame presentation timestamp, in stream time base
+    int64_t ReceiveTime;        // Time in microseconds (av_gettime_relative) the frame's data arrived
+    int Width;                  // Resolution the measurements were taken at
+    int Height;
+    float Mean;                 // Mean luma, 0 to 255
+    float StdDev;               // Luma standard deviation
+    float EdgeDensity;          // Fraction of pixels on an edge
+    float Visibility;           // 0 (washed out) to 1 (full contrast)
+    float Turbidity;            // 0 (clear) to 1 (no detail left)
+    double ProcessTime;         // Chain run time in milliseconds
+};
+
+// One stage of a chain, may replace the image and/or fill in result fields
+using VisionKernel = void (*)(VisionImage& Image, VisionResult& Result);
+
+// Chain stages
+
+/**
+ * @brief Halves the image resolution with a 2x2 box filter.
+ */
+void DownsampleKernel(VisionImage& Image, VisionResult& Result);
+
+/**
+ * @brief Measures mean and standard deviation of the luma.
+ */
+void LumaKernel(VisionImage& Image, VisionResult& Result);
+
+/**
+ * @brief Measures the fraction of pixels whose gradient is above the edge threshold.
+ */
+void EdgeKernel(VisionImage& Image, VisionResult& Result);
+
+/**
+ * @brief Estimates visibility and turbidity, must run after the luma and edge kernels.
+ * @note Both are heuristics: visibility is the RMS contrast, turbidity is the loss of edges
+ *       relative to what clear water typically shows at analysis resolution.
+ */
+void ClarityKernel(VisionImage& Image, VisionResult& Result);
+
+/**
+ * @brief Gets the default chain: two downsamples to quarter resolution, then all measurements.
+ * @returns Kernels in run order.
+ */
+std::vector<VisionKernel> GetDefaultVisionChain();
+
+// Primitives, SSE2 where available with a bit exact scalar fallback
+
+/**
+ * @brief Halves an image with a 2x2 box filter, rounding each vertical then horizontal average up.
+ * @param Source Source pixels.
+ * @param SourceStride Bytes between source rows.
+ * @param Width Source width, an odd last column is dropped.
+ * @param Height Source height, an odd last row is dropped.
+ * @param Destination Destination pixels, Width / 2 by Height / 2.
+ * @param DestinationStride Bytes between destination rows.
+ */
+void DownsampleHalf(const uint8_t* Source, int SourceStride, int Width, int Height, uint8_t* Destination, int DestinationStride);
+
+/**
+ * @brief Measures the mean and standard deviation of an image.
+ * @param Image Image pixels.
+ * @param Stride Bytes between rows.
+ * @param Width Image width.
+ * @param Height Image height.
+ * @param Mean Reference to store the mean in.
+ * @param StdDev Reference to store the standard deviation in.
+ */
+void MeasureLuma(const uint8_t* Image, int Stride, int Width, int Height, double& Mean, double& StdDev);
+
+/**
+ * @brief Counts pixels whose gradient |dx| + |dy| (saturated to 255) is above a threshold.
+ * @param Image Image pixels.
+ * @param Stride Bytes between rows.
+ * @param Width Image width.
+ * @param Height Image height.
+ * @param Threshold Gradient a pixel must exceed to count.
+ * @returns Number of edge pixels out of (Width - 1) * (Height - 1).
+ */
+uint64_t CountEdges(const uint8_t* Image, int Stride, int Width, int Height, uint8_t Threshold);
+
+#endif // HOST_IMAGE_KERNELS_HPP_
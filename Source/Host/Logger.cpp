@@ -0,0 +1,234 @@
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+// Longest a record waits in a ring before being written
+static constexpr int64_t WriteInterval = 5000;
+
+// Default records per second for each call site
+static constexpr uint32_t DefaultRateLimit = 20;
+
+static const char* const LevelNames[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+Logger::RingOwner::~RingOwner()
+{
+    if (this->Owned)
+        this->Owned->bIsRetired = true;
+}
+
+Logger::Logger()
+{
+    this->MinimumLevel = LogLevel::Info;
+    this->RateLimit = DefaultRateLimit;
+    this->DroppedRecords = 0;
+
+    this->StartTime = GetTime();
+
+    this->bWriteLoop = true;
+
+    // Start thread
+    this->WriteThread = std::thread([this] { this->WriteLoop(); });
+}
+
+Logger& Logger::Get()
+{
+    static Logger Instance;
+    return Instance;
+}
+
+int64_t Logger::GetTime()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Any thread
+
+Logger::Ring* Logger::GetThreadRing()
+{
+    thread_local RingOwner Owner;
+
+    if (!Owner.Owned)
+    {
+        // Only the first record from each thread takes the lock
+        std::lock_guard<std::mutex> Lock(this->RingMutex);
+
+        this->Rings.push_back(std::make_unique<Ring>());
+        Owner.Owned = this->Rings.back().get();
+    }
+
+    return Owner.Owned;
+}
+
+LogRecord* Logger::BeginRecord(LogLevel Level, LogSite &Site, uint32_t &Suppressed)
+{
+    if (Level < this->MinimumLevel.load(std::memory_order_relaxed))
+        return nullptr;
+
+    uint32_t Limit = this->RateLimit.load(std::memory_order_relaxed);
+
+    if (Limit > 0)
+    {
+        int64_t Now = GetTime();
+        int64_t WindowStart = Site.WindowStart.load(std::memory_order_relaxed);
+
+        // One second windows, whichever thread notices the window is over starts the next
+        if (Now - WindowStart >= 1000000 && Site.WindowStart.compare_exchange_strong(WindowStart, Now, std::memory_order_relaxed))
+            Site.WindowCount.store(0, std::memory_order_relaxed);
+
+        if (Site.WindowCount.fetch_add(1, std::memory_order_relaxed) >= Limit)
+        {
+            Site.Suppressed.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+
+    Ring* ThreadRing = this->GetThreadRing();
+
+    size_t WriteIndex = ThreadRing->WriteIndex.load(std::memory_order_relaxed);
+    size_t ReadIndex = ThreadRing->ReadIndex.load(std::memory_order_acquire);
+
+    if (WriteIndex - ReadIndex >= Ring::Capacity)
+    {
+        this->DroppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Suppressed = Site.Suppressed.exchange(0, std::memory_order_relaxed);
+
+    return &ThreadRing->Records[WriteIndex % Ring::Capacity];
+}
+
+void Logger::CommitRecord()
+{
+    Ring* ThreadRing = this->GetThreadRing();
+
+    // Publish the record to the logger thread
+    ThreadRing->WriteIndex.store(ThreadRing->WriteIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Logger thread
+
+bool Logger::Drain()
+{
+    struct Pending
+    {
+        Ring* Source;
+        const LogRecord* Record;
+    };
+
+    std::vector<Ring*> Sources;
+
+    {
+        std::lock_guard<std::mutex> Lock(this->RingMutex);
+
+        Sources.reserve(this->Rings.size());
+
+        for (const std::unique_ptr<Ring>& Each : this->Rings)
+            Sources.push_back(Each.get());
+    }
+
+    // Take what is published now, later records wait for the next pass
+    std::vector<Pending> Records;
+    std::vector<size_t> Ends;
+
+    for (Ring* Source : Sources)
+    {
+        size_t ReadIndex = Source->ReadIndex.load(std::memory_order_relaxed);
+        size_t WriteIndex = Source->WriteIndex.load(std::memory_order_acquire);
+
+        Ends.push_back(WriteIndex);
+
+        for (size_t i = ReadIndex; i != WriteIndex; i++)
+            Records.push_back({Source, &Source->Records[i % Ring::Capacity]});
+    }
+
+    // Each ring is in order already, merge them so threads interleave by time
+    std::stable_sort(Records.begin(), Records.end(), [](const Pending& A, const Pending& B) { return A.Record->Time < B.Record->Time; });
+
+    bool bWroteError = false;
+    bool bWroteOutput = false;
+
+    for (const Pending& Each : Records)
+    {
+        const LogRecord* Record = Each.Record;
+
+        char Message[1024];
+        int Length = Record->Formatter(*Record, Message, sizeof(Message));
+
+        if (Length < 0)
+            continue;
+
+        // Records carry their own line ending
+        size_t End = std::min(static_cast<size_t>(Length), sizeof(Message) - 1);
+
+        while (End > 0 && Message[End - 1] == '\n')
+            End--;
+
+        Message[End] = '\0';
+
+        FILE* Stream = (Record->Level >= LogLevel::Warning) ? stderr : stdout;
+        double Seconds = (Record->Time - this->StartTime) / 1e6;
+
+        if (Record->Suppressed > 0)
+            fprintf(Stream, "%10.6f %s %s (%u similar suppressed)\n", Seconds, LevelNames[static_cast<size_t>(Record->Level)], Message, Record->Suppressed);
+        else
+            fprintf(Stream, "%10.6f %s %s\n", Seconds, LevelNames[static_cast<size_t>(Record->Level)], Message);
+
+        bWroteError |= (Stream == stderr);
+        bWroteOutput |= (Stream == stdout);
+    }
+
+    if (bWroteOutput)
+        fflush(stdout);
+
+    if (bWroteError)
+        fflush(stderr);
+
+    // Hand the slots back to their threads
+    for (size_t i = 0; i < Sources.size(); i++)
+        Sources[i]->ReadIndex.store(Ends[i], std::memory_order_release);
+
+    // Free the rings of exited threads once they are empty
+    {
+        std::lock_guard<std::mutex> Lock(this->RingMutex);
+
+        this->Rings.erase(std::remove_if(this->Rings.begin(), this->Rings.end(), [](const std::unique_ptr<Ring>& Each)
+        {
+            return Each->bIsRetired && Each->ReadIndex.load(std::memory_order_relaxed) == Each->WriteIndex.load(std::memory_order_acquire);
+        }), this->Rings.end());
+    }
+
+    return !Records.empty();
+}
+
+void Logger::WriteLoop()
+{
+    uint64_t ReportedDrops = 0;
+
+    while (this->bWriteLoop)
+    {
+        if (!this->Drain())
+            std::this_thread::sleep_for(std::chrono::microseconds(WriteInterval));
+
+        uint64_t Drops = this->DroppedRecords;
+
+        if (Drops != ReportedDrops)
+        {
+            fprintf(stderr, "Logger dropped %llu records\n", static_cast<unsigned long long>(Drops - ReportedDrops));
+            ReportedDrops = Drops;
+        }
+    }
+
+    // Write out whatever was logged before shutdown
+    while (this->Drain());
+}
+
+Logger::~Logger()
+{
+    this->bWriteLoop = false;
+
+    // Wait for logger thread to finish
+    if (this->WriteThread.joinable())
+        this->WriteThread.join();
+}
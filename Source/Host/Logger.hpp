@@ -0,0 +1,269 @@
+#ifndef HOST_LOGGER_HPP_
+#define HOST_LOGGER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// Log macros, formatted like printf. Arguments are copied into a fixed-size record and
+// formatted later on the logger thread, so the caller never blocks on the console.
+// Strings are copied (truncated to fit the record), everything else must be trivially copyable.
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#define LOG_AT(Level, ...)                                          \
+    do                                                              \
+    {                                                               \
+        if (false)                                                  \
+            Logger::CheckFormat(__VA_ARGS__);                       \
+        static LogSite LogCallSite;                                 \
+        Logger::Get().Write(Level, LogCallSite, __VA_ARGS__);       \
+    } while (0)
+
+enum class LogLevel : uint8_t
+{
+    Debug,
+    Info,
+    Warning,        // Warnings and errors go to stderr, the rest to stdout
+    Error
+};
+
+// Per call site rate limit state, one is made by each use of the log macros
+struct LogSite
+{
+    std::atomic<int64_t> WindowStart{0};
+    std::atomic<uint32_t> WindowCount{0};
+    std::atomic<uint32_t> Suppressed{0};
+};
+
+struct LogRecord;
+
+using LogFormatter = int (*)(const LogRecord& Record, char* Output, size_t Size);
+
+static constexpr size_t LogRecordSize = 256;
+static constexpr size_t LogArgumentsSize = LogRecordSize - 32;
+
+struct LogRecord
+{
+    int64_t Time;               // Steady clock microseconds
+    const char* Format;
+    LogFormatter Formatter;
+    uint32_t Suppressed;        // Records dropped by the call site's rate limit before this one
+    LogLevel Level;
+    uint8_t Reserved[3];
+    uint8_t Arguments[LogArgumentsSize];
+};
+
+static_assert(sizeof(LogRecord) == LogRecordSize, "Log record layout changed");
+
+// How each argument type is stored in a record
+
+template <typename T, typename Enable = void>
+struct LogArgument
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Log arguments must be strings or trivially copyable");
+
+    static constexpr size_t MinimumSize = sizeof(T);
+
+    static void Pack(uint8_t*& Cursor, const uint8_t* End, T Value)
+    {
+        (void) End;
+        memcpy(Cursor, &Value, sizeof(T));
+        Cursor += sizeof(T);
+    }
+
+    static T Unpack(const uint8_t*& Cursor)
+    {
+        T Value;
+        memcpy(&Value, Cursor, sizeof(T));
+        Cursor += sizeof(T);
+        return Value;
+    }
+};
+
+template <typename T>
+struct LogArgument<T, typename std::enable_if<std::is_same<T, const char*>::value || std::is_same<T, char*>::value>::type>
+{
+    // Room for at least the terminator, the string takes whatever else is left
+    static constexpr size_t MinimumSize = 1;
+
+    static void Pack(uint8_t*& Cursor, const uint8_t* End, const char* Value)
+    {
+        // Reserve space for the fixed-size arguments that follow
+        size_t Length = Value ? strlen(Value) : 0;
+        size_t Space = static_cast<size_t>(End - Cursor) - 1;
+        Length = (Length < Space) ? Length : Space;
+
+        if (Length > 0)
+            memcpy(Cursor, Value, Length);
+
+        Cursor[Length] = '\0';
+        Cursor += Length + 1;
+    }
+
+    static const char* Unpack(const uint8_t*& Cursor)
+    {
+        const char* Value = reinterpret_cast<const char*>(Cursor);
+        Cursor += strlen(Value) + 1;
+        return Value;
+    }
+};
+
+// Rebuilds the arguments of a record and formats them, instantiated per call signature
+template <typename... Args>
+int FormatLogRecord(const LogRecord& Record, char* Output, size_t Size)
+{
+    const uint8_t* Cursor = Record.Arguments;
+
+    // Braced initialization unpacks left to right
+    std::tuple<decltype(LogArgument<Args>::Unpack(Cursor))...> Values{LogArgument<Args>::Unpack(Cursor)...};
+    (void) Cursor;
+
+    return std::apply([&](auto... Value) { return snprintf(Output, Size, Record.Format, Value...); }, Values);
+}
+
+// Without arguments the format is the message, copied so a stray % is not read as a conversion
+template <>
+inline int FormatLogRecord<>(const LogRecord& Record, char* Output, size_t Size)
+{
+    return snprintf(Output, Size, "%s", Record.Format);
+}
+
+// Asynchronous logger. Each thread writes records into its own lock-free single producer
+// ring and a background thread merges them in time order, formats and writes them out.
+// Logging from a hot thread costs a copy of its arguments; if its ring is full the record
+// is dropped and counted rather than blocking.
+
+class Logger
+{
+private:
+    struct Ring
+    {
+        static constexpr size_t Capacity = 256;
+
+        alignas(64) std::atomic<size_t> ReadIndex{0};
+        alignas(64) std::atomic<size_t> WriteIndex{0};
+        std::atomic<bool> bIsRetired{false};
+        LogRecord Records[Capacity];
+    };
+
+    // Retires the thread's ring when the thread exits, the logger frees it once drained
+    struct RingOwner
+    {
+        Ring* Owned = nullptr;
+
+        ~RingOwner();
+    };
+
+    std::mutex RingMutex;
+    std::vector<std::unique_ptr<Ring>> Rings;
+
+    std::atomic<LogLevel> MinimumLevel;
+    std::atomic<uint32_t> RateLimit;
+    std::atomic<uint64_t> DroppedRecords;
+
+    int64_t StartTime;
+
+    std::atomic<bool> bWriteLoop;
+    std::thread WriteThread;
+
+    Logger();
+
+    static int64_t GetTime();
+
+    Ring* GetThreadRing();
+
+    LogRecord* BeginRecord(LogLevel Level, LogSite& Site, uint32_t& Suppressed);
+
+    void CommitRecord();
+
+    bool Drain();
+
+    void WriteLoop();
+
+public:
+    /**
+     * @brief Gets the process-wide logger, starting its thread on first use.
+     * @returns Reference to the logger.
+	 */
+    static Logger& Get();
+
+    /**
+     * @brief Never called, lets the compiler check format strings passed to the log macros.
+	 */
+#if defined(__GNUC__)
+    __attribute__((format(printf, 1, 2)))
+#endif
+    static void CheckFormat(const char* Format, ...) {(void) Format;}
+
+    /**
+     * @brief Queues a record. Use the log macros rather than calling this directly.
+     * @param Level Severity of the record.
+     * @param Site Rate limit state of the call site.
+     * @param Format printf format string, must be a string literal.
+     * @param Arguments Format arguments.
+	 */
+    template <typename... Args>
+    void Write(LogLevel Level, LogSite& Site, const char* Format, Args... Arguments)
+    {
+        static_assert((size_t(0) + ... + LogArgument<typename std::decay<Args>::type>::MinimumSize) <= LogArgumentsSize, "Too many log arguments");
+
+        uint32_t Suppressed;
+        LogRecord* Record = this->BeginRecord(Level, Site, Suppressed);
+
+        if (!Record)
+            return;
+
+        Record->Time = GetTime();
+        Record->Format = Format;
+        Record->Formatter = &FormatLogRecord<typename std::decay<Args>::type...>;
+        Record->Suppressed = Suppressed;
+        Record->Level = Level;
+
+        // Each argument leaves room for the minimum size of those after it
+        uint8_t* Cursor = Record->Arguments;
+        size_t Remaining = 0;
+        ((Remaining += LogArgument<typename std::decay<Args>::type>::MinimumSize), ...);
+        ((Remaining -= LogArgument<typename std::decay<Args>::type>::MinimumSize,
+          LogArgument<typename std::decay<Args>::type>::Pack(Cursor, Record->Arguments + LogArgumentsSize - Remaining, Arguments)), ...);
+        (void) Cursor;
+        (void) Remaining;
+
+        this->CommitRecord();
+    }
+
+    /**
+     * @brief Sets the lowest level that is recorded. Lower levels cost only a comparison.
+     * @param Level Minimum level.
+	 */
+    void SetLevel(LogLevel Level) {this->MinimumLevel = Level;}
+
+    /**
+     * @brief Sets the most records a single call site may write per second.
+     * @param RecordsPerSecond Limit, 0 for none.
+	 */
+    void SetRateLimit(uint32_t RecordsPerSecond) {this->RateLimit = RecordsPerSecond;}
+
+    /**
+     * @brief Gets the number of records dropped because a thread's ring was full.
+     * @returns Number of dropped records.
+	 */
+    uint64_t GetDroppedRecords() const {return this->DroppedRecords;}
+
+    /**
+     * @brief Writes out everything queued and stops the logger thread.
+	 */
+    ~Logger();
+};
+
+#endif // HOST_LOGGER_HPP_
@@ -0,0 +1,39 @@
+#include "Metrics.hpp"
+
+// Weight of each new sample in the exponential moving average
+static constexpr double SmoothingFactor = 0.1;
+
+Metrics::Metrics()
+{
+    for (std::atomic<double>& Value : this->Timings)
+        Value.store(0.0, std::memory_order_relaxed);
+
+    for (std::atomic<uint64_t>& Value : this->Counters)
+        Value.store(0, std::memory_order_relaxed);
+}
+
+void Metrics::Record(Timing Which, double Milliseconds)
+{
+    std::atomic<double>& Value = this->Timings[static_cast<size_t>(Which)];
+
+    // Single writer per timing, so a plain load and store is enough
+    double Previous = Value.load(std::memory_order_relaxed);
+    double Next = (Previous == 0.0) ? Milliseconds : Previous + SmoothingFactor * (Milliseconds - Previous);
+
+    Value.store(Next, std::memory_order_relaxed);
+}
+
+void Metrics::Add(Counter Which, uint64_t Amount)
+{
+    this->Counters[static_cast<size_t>(Which)].fetch_add(Amount, std::memory_order_relaxed);
+}
+
+double Metrics::Get(Timing Which) const
+{
+    return this->Timings[static_cast<size_t>(Which)].load(std::memory_order_relaxed);
+}
+
+uint64_t Metrics::Get(Counter Which) const
+{
+    return this->Counters[static_cast<size_t>(Which)].load(std::memory_order_relaxed);
+}
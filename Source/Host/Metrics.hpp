@@ -0,0 +1,80 @@
+#ifndef HOST_METRICS_HPP_
+#define HOST_METRICS_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Smoothed timings, all in milliseconds
+enum class Timing
+{
+    Decode,         // Packet send to frame receive in the decoder
+    Upload,         // CPU time to upload a frame's textures
+    Latency,        // Packet received to frame displayed
+    Overlay,        // CPU time to update and draw the overlay
+    StickToWire,    // Gamepad axis event to command frame written to the serial link
+    Downlink,       // Vehicle sample time to host receive, on the synchronized clock
+    ClockError,     // Error bound of the host to vehicle clock mapping
+    GpuUpload,      // GPU time of the YUV texture upload
+    GpuConvert,     // GPU time of the YUV to RGB and color correction draw
+    GpuReduce,      // GPU time of the color statistics reduction
+    GpuOverlay,     // GPU time of the overlay draw
+    Vision,         // Frame tap kernel chain run time per frame
+    Count
+};
+
+// Monotonically increasing totals
+enum class Counter
+{
+    FramesDecoded,
+    BytesReceived,
+    CommandsSent,
+    TelemetryFrames,    // Valid frames received from the vehicle
+    TelemetryErrors,    // Frames discarded for a bad CRC, length or overflow
+    VisionDropped,      // Frames the frame tap skipped with its thread pool saturated
+    Count
+};
+
+// Shared metrics surface that worker threads write to and diagnostics read from.
+// Each timing is expected to have a single writer thread; any thread can read.
+
+class Metrics
+{
+private:
+    std::atomic<double> Timings[static_cast<size_t>(Timing::Count)];
+    std::atomic<uint64_t> Counters[static_cast<size_t>(Counter::Count)];
+
+public:
+    /**
+     * @brief Initializes all timings and counters to zero.
+	 */
+    Metrics();
+
+    /**
+     * @brief Folds a new sample into a smoothed timing.
+     * @param Which Timing to update.
+     * @param Milliseconds Newly measured duration in milliseconds.
+	 */
+    void Record(Timing Which, double Milliseconds);
+
+    /**
+     * @brief Adds to a counter.
+     * @param Which Counter to update.
+     * @param Amount Amount to add to the counter.
+	 */
+    void Add(Counter Which, uint64_t Amount);
+
+    /**
+     * @brief Gets the current smoothed value of a timing.
+     * @returns Smoothed timing in milliseconds as a double.
+	 */
+    double Get(Timing Which) const;
+
+    /**
+     * @brief Gets the current total of a counter.
+     * @returns Counter total as a uint64_t.
+	 */
+    uint64_t Get(Counter Which) const;
+};
+
+#endif // HOST_METRICS_HPP_
@@ -0,0 +1,202 @@
+#include "Overlay.hpp"
+
+#include <cctype>
+
+// Each glyph is 5x7 pixels in a 6x8 cell, leaving a column and row for spacing
+static constexpr int GlyphWidth = 6;
+static constexpr int GlyphHeight = 8;
+static constexpr int GlyphCount = 64;
+
+// On-screen size of one atlas pixel
+static constexpr int PixelScale = 2;
+static constexpr int Margin = 8;
+
+// Printable ASCII from space (32) to underscore (95), one byte per row with the
+// leftmost pixel in bit 4
+static const unsigned char Font[GlyphCount][7] =
+{
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+    {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, // "
+    {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // #
+    {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, // $
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, // &
+    {0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00}, // '
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+    {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // *
+    {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // +
+    {0x00, 0x00, 0x00, 0x00, 0x06, 0x04, 0x08}, // ,
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // .
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // :
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, // ;
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // =
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+    {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, // @
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // A
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // B
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // C
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, // D
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // E
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // F
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, // G
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // H
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // L
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // O
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // P
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // Q
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // R
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // S
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // W
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // Y
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // Z
+    {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // [
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // backslash
+    {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // ]
+    {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // _
+};
+
+Overlay::Overlay(const char *ShaderName)
+{
+    this->ShaderProgram = std::make_unique<Shader>(ShaderName);
+    this->ShaderProgram->Bind();
+
+    glUniform1i(glGetUniformLocation(this->ShaderProgram->GetProgram(), "Atlas"), 0);
+    glUniform2f(glGetUniformLocation(this->ShaderProgram->GetProgram(), "CellSize"),
+                static_cast<float>(GlyphWidth * PixelScale), static_cast<float>(GlyphHeight * PixelScale));
+
+    this->ViewportLocation = glGetUniformLocation(this->ShaderProgram->GetProgram(), "Viewport");
+
+    // Quad corners come from gl_VertexID, so only per-instance attributes are needed
+
+    glGenVertexArrays(1, &this->VAO);
+    glGenBuffers(1, &this->InstanceVBO);
+
+    glBindVertexArray(this->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, this->InstanceVBO);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)(2*sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+
+    glBindVertexArray(0);
+
+    this->CreateAtlas();
+
+    this->InstanceCount = 0;
+    this->bIsVisible = false;
+}
+
+void Overlay::CreateAtlas()
+{
+    // Unpack font bits into a single row of glyph cells
+
+    std::vector<unsigned char> Pixels(GlyphCount * GlyphWidth * GlyphHeight, 0);
+    int AtlasWidth = GlyphCount * GlyphWidth;
+
+    for (int Glyph = 0; Glyph < GlyphCount; Glyph++)
+    {
+        for (int Row = 0; Row < 7; Row++)
+        {
+            for (int Column = 0; Column < 5; Column++)
+            {
+                if (Font[Glyph][Row] & (0x10 >> Column))
+                    Pixels[Row * AtlasWidth + Glyph * GlyphWidth + Column] = 255;
+            }
+        }
+    }
+
+    glGenTextures(1, &this->AtlasTexture);
+    glBindTexture(GL_TEXTURE_2D, this->AtlasTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, AtlasWidth, GlyphHeight, 0, GL_RED, GL_UNSIGNED_BYTE, Pixels.data());
+}
+
+void Overlay::SetText(const std::vector<std::string> &Lines)
+{
+    this->Instances.clear();
+
+    // Pad every line to the longest so the background forms one rectangle
+    size_t Columns = 0;
+
+    for (const std::string& Line : Lines)
+        Columns = (Line.size() > Columns) ? Line.size() : Columns;
+
+    for (size_t Row = 0; Row < Lines.size(); Row++)
+    {
+        for (size_t Column = 0; Column < Columns; Column++)
+        {
+            int Character = (Column < Lines[Row].size()) ? std::toupper(static_cast<unsigned char>(Lines[Row][Column])) : ' ';
+
+            if (Character < 32 || Character >= 32 + GlyphCount)
+                Character = '?';
+
+            this->Instances.push_back(static_cast<float>(Margin + Column * GlyphWidth * PixelScale));
+            this->Instances.push_back(static_cast<float>(Margin + Row * GlyphHeight * PixelScale));
+            this->Instances.push_back(static_cast<float>(Character - 32));
+        }
+    }
+
+    this->InstanceCount = static_cast<GLsizei>(this->Instances.size() / 3);
+
+    // Orphan and refill, the previous contents may still be in flight
+    glBindBuffer(GL_ARRAY_BUFFER, this->InstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, this->Instances.size() * sizeof(float), this->Instances.data(), GL_STREAM_DRAW);
+}
+
+void Overlay::Draw(int ViewportWidth, int ViewportHeight)
+{
+    if (!this->bIsVisible || this->InstanceCount == 0)
+        return;
+
+    this->ShaderProgram->Bind();
+    glUniform2f(this->ViewportLocation, static_cast<float>(ViewportWidth), static_cast<float>(ViewportHeight));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, this->AtlasTexture);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glBindVertexArray(this->VAO);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, this->InstanceCount);
+
+    glDisable(GL_BLEND);
+}
+
+Overlay::~Overlay()
+{
+    glDeleteTextures(1, &this->AtlasTexture);
+    glDeleteBuffers(1, &this->InstanceVBO);
+    glDeleteVertexArrays(1, &this->VAO);
+}
@@ -0,0 +1,67 @@
+#ifndef HOST_OVERLAY_HPP_
+#define HOST_OVERLAY_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "Shader.hpp"
+
+// Text overlay drawn from a single glyph atlas with one instanced draw call
+
+class Overlay
+{
+private:
+    GLuint VAO;
+    GLuint InstanceVBO;
+    GLuint AtlasTexture;
+
+    std::unique_ptr<Shader> ShaderProgram;
+    GLint ViewportLocation;
+
+    // Interleaved X, Y and glyph index for each character cell
+    std::vector<float> Instances;
+    GLsizei InstanceCount;
+
+    bool bIsVisible;
+
+    void CreateAtlas();
+
+public:
+    /**
+     * @brief Creates overlay glyph atlas and instance buffers.
+     * @param ShaderName Name of shader program the overlay will use.
+	 */
+    Overlay(const char* ShaderName);
+
+    /**
+     * @brief Replaces the text shown by the overlay.
+     * @param Lines Lines of text, drawn top to bottom from the top-left corner.
+     * @note Only uploads to the GPU here, so call when the text changes rather than every frame.
+	 */
+    void SetText(const std::vector<std::string>& Lines);
+
+    /**
+     * @brief Draws the overlay on top of the current framebuffer contents.
+     * @param ViewportWidth Width of the viewport in pixels.
+     * @param ViewportHeight Height of the viewport in pixels.
+	 */
+    void Draw(int ViewportWidth, int ViewportHeight);
+
+    /**
+     * @brief Shows or hides the overlay.
+	 */
+    void Toggle() {this->bIsVisible = !this->bIsVisible;}
+
+    /**
+     * @brief Gets whether the overlay is shown.
+     * @returns True if the overlay is visible.
+	 */
+    bool IsVisible() {return this->bIsVisible;}
+
+    ~Overlay();
+};
+
+#endif // HOST_OVERLAY_HPP_
@@ -0,0 +1,465 @@
+#include "PacketRelay.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+// Viewers served at once, more are turned away
+static constexpr size_t MaximumClients = 8;
+
+// Bytes queued for one viewer before its backlog is discarded, about a second of video
+static constexpr size_t ClientQueueSize = 4 * 1024 * 1024;
+
+PacketRelay::PacketRelay(uint16_t Port)
+{
+    this->ListenSocket = -1;
+    this->EpollDescriptor = -1;
+    this->WakeDescriptor = -1;
+
+    for (size_t i = 0; i < RingCapacity; i++)
+        this->Ring[i] = av_packet_alloc();
+
+    this->RingRead = 0;
+    this->RingWrite = 0;
+
+    this->ClientCount = 0;
+    this->PacketsRelayed = 0;
+    this->PacketsDropped = 0;
+    this->PacketsSkipped = 0;
+    this->BytesSent = 0;
+
+    this->bRelayLoop = false;
+
+#if defined(__linux__)
+    this->ListenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (this->ListenSocket < 0)
+    {
+        LOG_ERROR("Failed to create relay socket: %s", strerror(errno));
+        return;
+    }
+
+    int Enable = 1;
+    setsockopt(this->ListenSocket, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable));
+
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_ANY);
+    Address.sin_port = htons(Port);
+
+    if (bind(this->ListenSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) < 0 || listen(this->ListenSocket, static_cast<int>(MaximumClients)) < 0)
+    {
+        LOG_ERROR("Failed to listen for relay viewers on port %u: %s", static_cast<unsigned int>(Port), strerror(errno));
+        close(this->ListenSocket);
+        this->ListenSocket = -1;
+        return;
+    }
+
+    // Event descriptor wakes the relay thread for new packets and shutdown
+
+    this->EpollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    this->WakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event Event{};
+    Event.events = EPOLLIN;
+    Event.data.fd = this->WakeDescriptor;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_ADD, this->WakeDescriptor, &Event);
+
+    Event.events = EPOLLIN;
+    Event.data.fd = this->ListenSocket;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_ADD, this->ListenSocket, &Event);
+
+    LOG_INFO("Relaying video to viewers on port %u", static_cast<unsigned int>(Port));
+#else
+    LOG_ERROR("Packet relay is not supported on this platform: port %u", static_cast<unsigned int>(Port));
+#endif
+}
+
+void PacketRelay::SetCodecParameters(const AVCodecParameters *Parameters)
+{
+    if (Parameters && Parameters->extradata && Parameters->extradata_size > 0)
+        this->Extradata.assign(Parameters->extradata, Parameters->extradata + Parameters->extradata_size);
+    else
+        this->Extradata.clear();
+}
+
+void PacketRelay::StartRelayLoop()
+{
+    if (this->ListenSocket < 0)
+        return;
+
+    this->bRelayLoop = true;
+
+    // Start thread
+    this->RelayThread = std::thread([this] { this->RelayLoop(); });
+}
+
+RelayStatistics PacketRelay::GetStatistics()
+{
+    RelayStatistics Statistics;
+
+    Statistics.Clients = this->ClientCount.load(std::memory_order_relaxed);
+    Statistics.PacketsRelayed = this->PacketsRelayed.load(std::memory_order_relaxed);
+    Statistics.PacketsDropped = this->PacketsDropped.load(std::memory_order_relaxed);
+    Statistics.PacketsSkipped = this->PacketsSkipped.load(std::memory_order_relaxed);
+    Statistics.BytesSent = this->BytesSent.load(std::memory_order_relaxed);
+
+    return Statistics;
+}
+
+// Network thread
+
+int PacketRelay::Publish(const AVPacket *Packet)
+{
+    if (!this->bRelayLoop)
+        return -1;
+
+    size_t TempWrite = this->RingWrite.load(std::memory_order_relaxed);
+    size_t TempRead = this->RingRead.load(std::memory_order_acquire);
+
+    // Relay thread is a full ring behind, losing packets here is the same as a client skipping
+    if (TempWrite - TempRead >= RingCapacity)
+    {
+        this->PacketsDropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    // Reference counted, the compressed data is shared rather than copied
+    if (av_packet_ref(this->Ring[TempWrite % RingCapacity], Packet) < 0)
+        return -1;
+
+    this->RingWrite.store(TempWrite + 1, std::memory_order_release);
+
+#if defined(__linux__)
+    uint64_t One = 1;
+    ssize_t Status = write(this->WakeDescriptor, &One, sizeof(One));
+    (void) Status;
+#endif
+
+    return 0;
+}
+
+// Relay thread
+
+void PacketRelay::RelayLoop()
+{
+#if defined(__linux__)
+    TRACE_THREAD("Relay");
+
+    epoll_event Events[MaximumClients + 2];
+
+    while (this->bRelayLoop)
+    {
+        int Count = epoll_wait(this->EpollDescriptor, Events, static_cast<int>(MaximumClients + 2), -1);
+
+        if (Count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        for (int i = 0; i < Count; i++)
+        {
+            int Descriptor = Events[i].data.fd;
+
+            if (Descriptor == this->WakeDescriptor)
+            {
+                uint64_t Value;
+                ssize_t Status = read(this->WakeDescriptor, &Value, sizeof(Value));
+                (void) Status;
+
+                TRACE_SCOPE("Distribute");
+
+                size_t TempRead = this->RingRead.load(std::memory_order_relaxed);
+                size_t TempWrite = this->RingWrite.load(std::memory_order_acquire);
+
+                for (; TempRead != TempWrite; TempRead++)
+                {
+                    AVPacket* Packet = av_packet_alloc();
+                    av_packet_move_ref(Packet, this->Ring[TempRead % RingCapacity]);
+
+                    // Slot is free again as soon as the reference has been moved out
+                    this->RingRead.store(TempRead + 1, std::memory_order_release);
+
+                    this->Distribute(Packet);
+                }
+
+                continue;
+            }
+
+            if (Descriptor == this->ListenSocket)
+            {
+                this->Accept();
+                continue;
+            }
+
+            auto Found = std::find_if(this->Clients.begin(), this->Clients.end(), [Descriptor](const std::unique_ptr<Client>& Each) { return Each->Socket == Descriptor; });
+
+            if (Found == this->Clients.end())
+                continue;
+
+            Client& Target = **Found;
+
+            // Viewers never send anything, so readable means closed
+            if (Events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                char Discard[256];
+                ssize_t Received = recv(Target.Socket, Discard, sizeof(Discard), 0);
+
+                if (Received == 0 || (Received < 0 && errno != EAGAIN && errno != EINTR))
+                {
+                    this->Close(Target);
+                    continue;
+                }
+            }
+
+            if (Events[i].events & EPOLLOUT)
+                this->Flush(Target);
+        }
+
+        this->Clients.erase(std::remove_if(this->Clients.begin(), this->Clients.end(), [](const std::unique_ptr<Client>& Each) { return Each->Socket < 0; }), this->Clients.end());
+        this->ClientCount.store(this->Clients.size(), std::memory_order_relaxed);
+    }
+#endif
+}
+
+void PacketRelay::Accept()
+{
+#if defined(__linux__)
+    while (true)
+    {
+        sockaddr_in Address{};
+        socklen_t AddressSize = sizeof(Address);
+
+        int Socket = accept4(this->ListenSocket, reinterpret_cast<sockaddr*>(&Address), &AddressSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (Socket < 0)
+            return;
+
+        char Name[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &Address.sin_addr, Name, sizeof(Name));
+
+        if (this->Clients.size() >= MaximumClients)
+        {
+            LOG_WARNING("Relay is full, refusing viewer %s", Name);
+            close(Socket);
+            continue;
+        }
+
+        // Packets are already whole frames, send them as soon as they are queued
+        int Enable = 1;
+        setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, &Enable, sizeof(Enable));
+
+        auto NewClient = std::make_unique<Client>();
+        NewClient->Socket = Socket;
+        NewClient->QueuedBytes = 0;
+        NewClient->FrontOffset = 0;
+        NewClient->bWaitingForKeyframe = true;
+        NewClient->bWaitingWritable = false;
+
+        epoll_event Event{};
+        Event.events = EPOLLIN;
+        Event.data.fd = Socket;
+        epoll_ctl(this->EpollDescriptor, EPOLL_CTL_ADD, Socket, &Event);
+
+        // Parameter sets first, the stream itself starts at the next keyframe
+        if (!this->Extradata.empty())
+        {
+            std::shared_ptr<AVPacket> Header(av_packet_alloc(), [](AVPacket* Packet) { av_packet_free(&Packet); });
+
+            if (av_new_packet(Header.get(), static_cast<int>(this->Extradata.size())) == 0)
+            {
+                memcpy(Header->data, this->Extradata.data(), this->Extradata.size());
+                NewClient->Queue.push_back(Header);
+                NewClient->QueuedBytes += this->Extradata.size();
+            }
+        }
+
+        LOG_INFO("Relay viewer connected from %s", Name);
+
+        this->Flush(*NewClient);
+        this->Clients.push_back(std::move(NewClient));
+    }
+#endif
+}
+
+void PacketRelay::Distribute(AVPacket *Packet)
+{
+    std::shared_ptr<AVPacket> Shared(Packet, [](AVPacket* Each) { av_packet_free(&Each); });
+
+    this->PacketsRelayed.fetch_add(1, std::memory_order_relaxed);
+
+    bool bIsKeyframe = (Packet->flags & AV_PKT_FLAG_KEY) != 0;
+    size_t Size = static_cast<size_t>(Packet->size);
+
+    for (std::unique_ptr<Client>& Each : this->Clients)
+    {
+        Client& Target = *Each;
+
+        if (Target.Socket < 0)
+            continue;
+
+        // Fell behind, drop the backlog and pick the stream up again at the next keyframe
+        if (!Target.bWaitingForKeyframe && Target.QueuedBytes + Size > ClientQueueSize)
+        {
+            // A packet already partly sent has to be finished or the stream is corrupted
+            size_t Keep = (Target.FrontOffset > 0) ? 1 : 0;
+
+            this->PacketsSkipped.fetch_add(Target.Queue.size() - Keep, std::memory_order_relaxed);
+
+            while (Target.Queue.size() > Keep)
+            {
+                Target.QueuedBytes -= static_cast<size_t>(Target.Queue.back()->size);
+                Target.Queue.pop_back();
+            }
+
+            Target.bWaitingForKeyframe = true;
+        }
+
+        if (Target.bWaitingForKeyframe && !bIsKeyframe)
+        {
+            this->PacketsSkipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        Target.bWaitingForKeyframe = false;
+        Target.Queue.push_back(Shared);
+        Target.QueuedBytes += Size;
+
+        // Already waiting on the socket, epoll will resume the flush
+        if (!Target.bWaitingWritable)
+            this->Flush(Target);
+    }
+}
+
+void PacketRelay::Flush(Client &Target)
+{
+#if defined(__linux__)
+    while (!Target.Queue.empty())
+    {
+        const AVPacket* Front = Target.Queue.front().get();
+        size_t Size = static_cast<size_t>(Front->size);
+
+        ssize_t Sent = send(Target.Socket, Front->data + Target.FrontOffset, Size - Target.FrontOffset, MSG_NOSIGNAL);
+
+        if (Sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Viewer's socket buffer is full, resume when epoll reports it writable
+            if (errno == EAGAIN)
+                this->SetWaitWritable(Target, true);
+            else
+                this->Close(Target);
+
+            return;
+        }
+
+        this->BytesSent.fetch_add(static_cast<uint64_t>(Sent), std::memory_order_relaxed);
+        Target.FrontOffset += static_cast<size_t>(Sent);
+
+        if (Target.FrontOffset < Size)
+            continue;
+
+        Target.QueuedBytes -= Size;
+        Target.FrontOffset = 0;
+        Target.Queue.pop_front();
+    }
+
+    this->SetWaitWritable(Target, false);
+#else
+    (void) Target;
+#endif
+}
+
+void PacketRelay::SetWaitWritable(Client &Target, bool bEnable)
+{
+#if defined(__linux__)
+    if (Target.bWaitingWritable == bEnable || Target.Socket < 0)
+        return;
+
+    epoll_event Event{};
+    Event.events = EPOLLIN;
+
+    if (bEnable)
+        Event.events |= EPOLLOUT;
+
+    Event.data.fd = Target.Socket;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_MOD, Target.Socket, &Event);
+
+    Target.bWaitingWritable = bEnable;
+#else
+    (void) Target;
+    (void) bEnable;
+#endif
+}
+
+void PacketRelay::Close(Client &Target)
+{
+#if defined(__linux__)
+    if (Target.Socket < 0)
+        return;
+
+    LOG_INFO("Relay viewer disconnected");
+
+    // Removed from the client list at the end of the current pass
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_DEL, Target.Socket, nullptr);
+    close(Target.Socket);
+
+    Target.Socket = -1;
+    Target.Queue.clear();
+    Target.QueuedBytes = 0;
+#else
+    (void) Target;
+#endif
+}
+
+PacketRelay::~PacketRelay()
+{
+#if defined(__linux__)
+    if (this->bRelayLoop)
+    {
+        this->bRelayLoop = false;
+
+        uint64_t One = 1;
+        ssize_t Status = write(this->WakeDescriptor, &One, sizeof(One));
+        (void) Status;
+    }
+
+    // Wait for relay thread to finish
+    if (this->RelayThread.joinable())
+        this->RelayThread.join();
+
+    for (std::unique_ptr<Client>& Each : this->Clients)
+        this->Close(*Each);
+
+    if (this->ListenSocket >= 0)
+        close(this->ListenSocket);
+
+    if (this->WakeDescriptor >= 0)
+        close(this->WakeDescriptor);
+
+    if (this->EpollDescriptor >= 0)
+        close(this->EpollDescriptor);
+#endif
+
+    for (size_t i = 0; i < RingCapacity; i++)
+        av_packet_free(&this->Ring[i]);
+}
@@ -0,0 +1,125 @@
+#ifndef HOST_PACKET_RELAY_HPP_
+#define HOST_PACKET_RELAY_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Snapshot of relay counters
+struct RelayStatistics
+{
+    size_t Clients;
+    uint64_t PacketsRelayed;    // Packets taken from the receiver
+    uint64_t PacketsDropped;    // Packets the relay thread was too far behind to take
+    uint64_t PacketsSkipped;    // Packets not sent to a client while it caught up to a keyframe
+    uint64_t BytesSent;
+};
+
+// Re-serves the received compressed video to local TCP viewers (e.g. ffplay tcp://host:port),
+// without decoding or re-encoding. The receiver hands packets over through a lock-free ring
+// and never waits; the relay thread gives each client its own bounded queue, and a client
+// that falls behind has its backlog discarded and resumes at the next keyframe, so a slow
+// viewer only ever degrades its own picture.
+
+class PacketRelay
+{
+private:
+    struct Client
+    {
+        int Socket;
+        std::deque<std::shared_ptr<AVPacket>> Queue;
+        size_t QueuedBytes;
+        size_t FrontOffset;             // Bytes of the front packet already sent
+        bool bWaitingForKeyframe;
+        bool bWaitingWritable;
+    };
+
+    static constexpr size_t RingCapacity = 256;
+
+    int ListenSocket;
+    int EpollDescriptor;
+    int WakeDescriptor;
+
+    // Receiver to relay thread handoff, single producer and single consumer
+    AVPacket* Ring[RingCapacity];
+    std::atomic<size_t> RingRead;
+    std::atomic<size_t> RingWrite;
+
+    // Codec configuration (parameter sets) sent to each client before its first keyframe
+    std::vector<uint8_t> Extradata;
+
+    // Owned by the relay thread
+    std::vector<std::unique_ptr<Client>> Clients;
+
+    std::atomic<size_t> ClientCount;
+    std::atomic<uint64_t> PacketsRelayed;
+    std::atomic<uint64_t> PacketsDropped;
+    std::atomic<uint64_t> PacketsSkipped;
+    std::atomic<uint64_t> BytesSent;
+
+    std::atomic<bool> bRelayLoop;
+    std::thread RelayThread;
+
+    void RelayLoop();
+
+    void Accept();
+
+    void Distribute(AVPacket* Packet);
+
+    void Flush(Client& Target);
+
+    void SetWaitWritable(Client& Target, bool bEnable);
+
+    void Close(Client& Target);
+
+public:
+    /**
+     * @brief Starts listening for viewers.
+     * @param Port TCP port to listen on, on all interfaces.
+	 */
+    PacketRelay(uint16_t Port);
+
+    /**
+     * @brief Gets whether the relay is listening.
+     * @returns True if the listen socket is open.
+	 */
+    bool IsOpen() {return this->ListenSocket >= 0;}
+
+    /**
+     * @brief Sets the codec configuration sent to new viewers ahead of the stream.
+     * @param Parameters Stream codec parameters, whose extradata must be in Annex B form.
+     * @note Must be set before the relay loop is started.
+	 */
+    void SetCodecParameters(const AVCodecParameters* Parameters);
+
+    /**
+     * @brief Hands a packet to the relay. Never blocks; drops the packet if the relay is behind.
+     * @param Packet Received packet, only a reference is taken.
+     * @returns Error status
+     * @note Single producer, call from the receiving thread only.
+	 */
+    int Publish(const AVPacket* Packet);
+
+    /**
+     * @brief Spawns new thread to accept viewers and send them packets.
+	 */
+    void StartRelayLoop();
+
+    /**
+     * @brief Gets a snapshot of the relay counters.
+     * @returns Counter values as a RelayStatistics.
+	 */
+    RelayStatistics GetStatistics();
+
+    ~PacketRelay();
+};
+
+#endif // HOST_PACKET_RELAY_HPP_
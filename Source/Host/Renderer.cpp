@@ -1,12 +1,49 @@
 #include "Renderer.hpp"
 
-Renderer::Renderer(int Width, int Height, size_t Cutoff, FrameBuffer *BufferPtr, const char *ShaderName)
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+// How often the overlay text is regenerated and re-uploaded
+static constexpr double OverlayUpdateInterval = 0.25;
+
+static constexpr double RadiansToDegrees = 180.0 / 3.14159265358979323846;
+
+// Side of the statistics target, a power of two so every mip level averages exactly 2x2 texels
+static constexpr int StatisticsSize = 64;
+static constexpr int StatisticsLevel = 6;
+
+// Texture unit the statistics are sampled from, after the Y, U and V planes
+static constexpr int StatisticsUnit = 3;
+
+Renderer::Renderer(int Width, int Height, size_t Cutoff, FrameBuffer *BufferPtr, Metrics *StatsPtr, const char *ShaderDirectory)
 {
     this->Buffer = BufferPtr;
+    this->Stats = StatsPtr;
+    this->VehicleTelemetry = nullptr;
+    this->Clock = nullptr;
+    this->Tap = nullptr;
+
+    GLint Viewport[4];
+    glGetIntegerv(GL_VIEWPORT, Viewport);
+
+    this->ViewportWidth = Viewport[2];
+    this->ViewportHeight = Viewport[3];
 
     this->Frame = av_frame_alloc();
 
-    this->ShaderProgram = std::make_unique<Shader>(ShaderName);
+    std::string ShaderPath(ShaderDirectory);
+
+    this->StatsOverlay = std::make_unique<Overlay>((ShaderPath + "/Overlay").c_str());
+
+    this->ShaderProgram = std::make_unique<Shader>((ShaderPath + "/YUVToRGB").c_str());
     this->ShaderProgram->Bind();
 
     // Set YUV to textures 0, 1, and 2 respectively
@@ -15,6 +52,27 @@ Renderer::Renderer(int Width, int Height, size_t Cutoff, FrameBuffer *BufferPtr,
     glUniform1i(glGetUniformLocation(this->ShaderProgram->GetProgram(),"texU"), 1);
     glUniform1i(glGetUniformLocation(this->ShaderProgram->GetProgram(),"texV"), 2);
 
+    // Correction parameters are set every frame, statistics are fixed
+
+    GLuint Program = this->ShaderProgram->GetProgram();
+
+    glUniform1i(glGetUniformLocation(Program, "Statistics"), StatisticsUnit);
+    glUniform1i(glGetUniformLocation(Program, "StatisticsLevel"), StatisticsLevel);
+
+    this->ModeUniform = glGetUniformLocation(Program, "Mode");
+    this->RedCompensationUniform = glGetUniformLocation(Program, "RedCompensation");
+    this->WhiteBalanceUniform = glGetUniformLocation(Program, "WhiteBalance");
+    this->DehazeUniform = glGetUniformLocation(Program, "Dehaze");
+    this->LocalContrastUniform = glGetUniformLocation(Program, "LocalContrast");
+    this->LocalRadiusUniform = glGetUniformLocation(Program, "LocalRadius");
+
+    this->Correction.bEnabled = true;
+    this->Correction.RedCompensation = 1.0f;
+    this->Correction.WhiteBalance = 1.0f;
+    this->Correction.Dehaze = 0.5f;
+    this->Correction.LocalContrast = 0.5f;
+    this->Correction.LocalRadius = 4.0f;
+
     // Fullscreen quad (flipped vertically)
     float Vertices[] = 
     {
@@ -61,25 +119,107 @@ Renderer::Renderer(int Width, int Height, size_t Cutoff, FrameBuffer *BufferPtr,
     InitTexture(this->TextureU, Width/2, Height/2);
     InitTexture(this->TextureV, Width/2, Height/2);
 
+    // Setup statistics target, half floats so the sum of squares keeps its precision
+
+    glGenTextures(1, &this->StatisticsTexture);
+    glActiveTexture(GL_TEXTURE0 + StatisticsUnit);
+    glBindTexture(GL_TEXTURE_2D, this->StatisticsTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, StatisticsSize, StatisticsSize, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE0);
+
+    glGenFramebuffers(1, &this->StatisticsFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->StatisticsFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->StatisticsTexture, 0);
+
+    this->bCanReduce = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    this->bHasStatistics = false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!this->bCanReduce)
+        LOG_WARNING("Statistics target unsupported, color correction disabled");
+
     this->BufferingCutoff = Cutoff;
     this->bIsBuffering = true;
+
+    this->Capture = std::make_unique<FrameCapture>(".");
+    this->bCapturePending = false;
+    this->PendingCaptureSource = CaptureSource::Framebuffer;
+    this->PendingCaptureFormat = CaptureFormat::PNG;
+
+    this->UploadTimer = std::make_unique<GpuTimer>(this->Stats, Timing::GpuUpload);
+    this->ConvertTimer = std::make_unique<GpuTimer>(this->Stats, Timing::GpuConvert);
+    this->ReduceTimer = std::make_unique<GpuTimer>(this->Stats, Timing::GpuReduce);
+    this->OverlayTimer = std::make_unique<GpuTimer>(this->Stats, Timing::GpuOverlay);
+
+    this->LastOverlayUpdate = std::chrono::steady_clock::now();
+    this->LastFramesDecoded = 0;
+    this->LastBytesReceived = 0;
 }
 
 void Renderer::UpdateViewport(int Width, int Height)
 {
+    this->ViewportWidth = Width;
+    this->ViewportHeight = Height;
+
     glViewport(0, 0, Width, Height);
 }
 
+void Renderer::RequestCapture(CaptureSource Source, CaptureFormat Format)
+{
+    this->bCapturePending = true;
+    this->PendingCaptureSource = Source;
+    this->PendingCaptureFormat = Format;
+}
+
+void Renderer::SetTelemetry(Telemetry *TelemetryPtr)
+{
+    this->VehicleTelemetry = TelemetryPtr;
+}
+
+void Renderer::SetReplayClock(ReplayClock *ClockPtr)
+{
+    this->Clock = ClockPtr;
+}
+
+void Renderer::SetFrameTap(FrameTap *TapPtr)
+{
+    this->Tap = TapPtr;
+}
+
+void Renderer::SetColorCorrection(const ColorCorrection &NewCorrection)
+{
+    this->Correction = NewCorrection;
+}
+
+void Renderer::ToggleOverlay()
+{
+    this->StatsOverlay->Toggle();
+
+    // Force the text to refresh on the next draw
+    this->LastOverlayUpdate = std::chrono::steady_clock::time_point();
+}
+
 int Renderer::Render(double CurrentTime, double &NextRenderTime)
 {
+    TRACE_SCOPE("Render");
+
     // NOTE: Render assumes all video frames are in YUV420P pixel format
 
+    // Hand finished readbacks to the encoder, never waits on the GPU
+    this->Capture->Poll();
+
     int BufferingStatus = this->CheckBufferingStatus();
 
     if (BufferingStatus < 0)
         return BufferingStatus;
 
-    if (this->Buffer->PopFrame(this->Frame) == 0)
+    int64_t ReceiveTime = 0;
+
+    if (this->Buffer->PopFrame(this->Frame, &ReceiveTime) == 0)
     {
         // Fix this for now assuming H.264/H.265
         AVRational Timebase{1, 90000};
@@ -88,8 +228,28 @@ int Renderer::Render(double CurrentTime, double &NextRenderTime)
         
         NextRenderTime = CurrentTime + FrameDuration;
 
+        auto UploadStart = std::chrono::steady_clock::now();
         this->UpdateFullscreenQuadTexture();
+        std::chrono::duration<double, std::milli> UploadTime = std::chrono::steady_clock::now() - UploadStart;
+
+        this->Stats->Record(Timing::Upload, UploadTime.count());
+
         this->Draw();
+        this->Reduce();
+        this->DrawOverlay();
+
+        if (ReceiveTime > 0)
+            this->Stats->Record(Timing::Latency, (av_gettime_relative() - ReceiveTime) / 1000.0);
+
+        if (this->bCapturePending)
+        {
+            if (this->PendingCaptureSource == CaptureSource::SourceFrame)
+                this->Capture->CaptureFrame(this->Frame, this->PendingCaptureFormat);
+            else
+                this->Capture->CaptureFramebuffer(this->ViewportWidth, this->ViewportHeight, this->PendingCaptureFormat);
+
+            this->bCapturePending = false;
+        }
     }
 
     av_frame_unref(this->Frame);
@@ -122,6 +282,9 @@ int Renderer::CheckBufferingStatus()
 
 void Renderer::UpdateFullscreenQuadTexture()
 {
+    TRACE_SCOPE("Upload");
+    GpuTimerScope GpuTime(*this->UploadTimer);
+
     // Ensure 1-byte alignment
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     
@@ -148,6 +311,19 @@ void Renderer::UpdateFullscreenQuadTexture()
 
 void Renderer::Draw()
 {
+    TRACE_SCOPE("Draw");
+    GpuTimerScope GpuTime(*this->ConvertTimer);
+
+    // Correct only once a previous frame has been reduced to statistics
+    bool bCorrect = this->Correction.bEnabled && this->bHasStatistics;
+
+    glUniform1i(this->ModeUniform, bCorrect ? 1 : 0);
+    glUniform1f(this->RedCompensationUniform, this->Correction.RedCompensation);
+    glUniform1f(this->WhiteBalanceUniform, this->Correction.WhiteBalance);
+    glUniform1f(this->DehazeUniform, this->Correction.Dehaze);
+    glUniform1f(this->LocalContrastUniform, this->Correction.LocalContrast);
+    glUniform1f(this->LocalRadiusUniform, this->Correction.LocalRadius);
+
     // Render fullscreen quad to the screen
 
     glClear(GL_COLOR_BUFFER_BIT);
@@ -157,7 +333,218 @@ void Renderer::Draw()
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 }
 
+void Renderer::Reduce()
+{
+    // Statistics are only read while correcting, stale ones are not used after re-enabling
+    if (!this->Correction.bEnabled || !this->bCanReduce)
+    {
+        this->bHasStatistics = false;
+        return;
+    }
+
+    TRACE_SCOPE("Reduce");
+    GpuTimerScope GpuTime(*this->ReduceTimer);
+
+    // Unbind the target from sampling while rendering into it
+    glActiveTexture(GL_TEXTURE0 + StatisticsUnit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, this->StatisticsFBO);
+    glViewport(0, 0, StatisticsSize, StatisticsSize);
+
+    glUniform1i(this->ModeUniform, 2);
+    glBindVertexArray(this->VAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, this->ViewportWidth, this->ViewportHeight);
+
+    // Box filter the mip chain down to a single texel of frame means, all on the GPU
+    glBindTexture(GL_TEXTURE_2D, this->StatisticsTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE0);
+
+    this->bHasStatistics = true;
+}
+
+void Renderer::AddTelemetryText(std::vector<std::string> &Lines)
+{
+    char Line[64];
+
+    if (this->Clock)
+    {
+        double Position = (this->Clock->Now() - this->Clock->GetStartTime()) / 1e6;
+        double Length = (this->Clock->GetEndTime() - this->Clock->GetStartTime()) / 1e6;
+
+        snprintf(Line, sizeof(Line), "REPLAY  %02d:%04.1f/%02d:%02d %.2fX%s", static_cast<int>(Position) / 60, std::fmod(Position, 60.0),
+                 static_cast<int>(Length) / 60, static_cast<int>(Length) % 60, this->Clock->GetSpeed(), this->Clock->IsPaused() ? " PAUSED" : "");
+        Lines.emplace_back(Line);
+    }
+
+    if (!this->VehicleTelemetry)
+        return;
+
+    TelemetryState State = this->VehicleTelemetry->GetState();
+
+    if (State.LastReceiveTime == 0)
+        return;
+
+    // Quaternion to roll, pitch and yaw in degrees
+    float W = State.Attitude.q[0];
+    float X = State.Attitude.q[1];
+    float Y = State.Attitude.q[2];
+    float Z = State.Attitude.q[3];
+
+    float SinPitch = 2.0f * (W * Y - Z * X);
+    SinPitch = (SinPitch > 1.0f) ? 1.0f : ((SinPitch < -1.0f) ? -1.0f : SinPitch);
+
+    double Roll = std::atan2(2.0f * (W * X + Y * Z), 1.0f - 2.0f * (X * X + Y * Y)) * RadiansToDegrees;
+    double Pitch = std::asin(SinPitch) * RadiansToDegrees;
+    double Yaw = std::atan2(2.0f * (W * Z + X * Y), 1.0f - 2.0f * (Y * Y + Z * Z)) * RadiansToDegrees;
+
+    snprintf(Line, sizeof(Line), "DEPTH   %7.2f M", State.Depth.depth_m);
+    Lines.emplace_back(Line);
+    snprintf(Line, sizeof(Line), "ATTITUDE R%6.1f P%6.1f Y%6.1f", Roll, Pitch, Yaw);
+    Lines.emplace_back(Line);
+
+    // Payload is packed, so copy the fields out rather than pointing into it
+    unsigned int Pulses[PROTOCOL_THRUSTER_COUNT];
+
+    for (size_t i = 0; i < PROTOCOL_THRUSTER_COUNT; i++)
+        Pulses[i] = State.Thrusters.pulse_us[i];
+
+    snprintf(Line, sizeof(Line), "THRUST  %4u %4u %4u %4u", Pulses[0], Pulses[1], Pulses[2], Pulses[3]);
+    Lines.emplace_back(Line);
+    snprintf(Line, sizeof(Line), "        %4u %4u %4u %4u", Pulses[4], Pulses[5], Pulses[6], Pulses[7]);
+    Lines.emplace_back(Line);
+
+    if (State.Timing.rate_hz > 0)
+    {
+        unsigned int Rate = State.Timing.rate_hz;
+        unsigned int Jitter = State.Timing.jitter_max_us;
+        unsigned int Execution = State.Timing.execution_max_us;
+        unsigned int Overruns = State.Timing.overruns;
+
+        snprintf(Line, sizeof(Line), "LOOP    %uHZ JIT %uUS EXEC %uUS MISS %u", Rate, Jitter, Execution, Overruns);
+        Lines.emplace_back(Line);
+    }
+
+    if (State.Imu.batch > 0)
+    {
+        const char *Mode = (State.Imu.mode == PROTOCOL_IMU_FIFO) ? "FIFO" : "DRDY";
+        unsigned int Batch = State.Imu.batch;
+        unsigned int Rate = State.Imu.sample_rate_hz;
+        unsigned int Interrupts = State.Imu.interrupt_rate_hz;
+        double Load = State.Imu.cpu_load / 100.0;
+
+        snprintf(Line, sizeof(Line), "IMU     %s X%u %uHZ IRQ %u/S CPU %.2f%%", Mode, Batch, Rate, Interrupts, Load);
+        Lines.emplace_back(Line);
+    }
+}
+
+void Renderer::DrawOverlay()
+{
+    if (!this->StatsOverlay->IsVisible())
+        return;
+
+    TRACE_SCOPE("Overlay");
+
+    auto Start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> SinceUpdate = Start - this->LastOverlayUpdate;
+
+    // Rates are computed over the update interval so the text stays readable
+    if (SinceUpdate.count() >= OverlayUpdateInterval)
+    {
+        uint64_t FramesDecoded = this->Stats->Get(Counter::FramesDecoded);
+        uint64_t BytesReceived = this->Stats->Get(Counter::BytesReceived);
+
+        // First update after toggling has no valid interval
+        bool bHasInterval = SinceUpdate.count() < 10.0 * OverlayUpdateInterval;
+
+        double Fps = bHasInterval ? (FramesDecoded - this->LastFramesDecoded) / SinceUpdate.count() : 0.0;
+        double Mbps = bHasInterval ? (BytesReceived - this->LastBytesReceived) * 8.0 / SinceUpdate.count() / 1e6 : 0.0;
+
+        char Line[64];
+        std::vector<std::string> Lines;
+
+        snprintf(Line, sizeof(Line), "STREAM  %7.2f FPS", Fps);
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "DECODE  %7.2f MS", this->Stats->Get(Timing::Decode));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "UPLOAD  %7.2f MS", this->Stats->Get(Timing::Upload));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "BUFFER  %7zu", this->Buffer->GetOccupancy());
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "DROPS   %7llu", static_cast<unsigned long long>(this->Buffer->GetDroppedFrames()));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "BITRATE %7.2f MBPS", Mbps);
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "LATENCY %7.2f MS", this->Stats->Get(Timing::Latency));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "INPUT   %7.2f MS", this->Stats->Get(Timing::StickToWire));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "LINK    %7llu/%llu", static_cast<unsigned long long>(this->Stats->Get(Counter::TelemetryFrames)), static_cast<unsigned long long>(this->Stats->Get(Counter::TelemetryErrors)));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "DOWNLNK %7.2f MS", this->Stats->Get(Timing::Downlink));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "SYNC    %7.3f MS", this->Stats->Get(Timing::ClockError));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "OVERLAY %7.3f MS", this->Stats->Get(Timing::Overlay));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "GPU UPL %7.3f MS", this->Stats->Get(Timing::GpuUpload));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "GPU CNV %7.3f MS", this->Stats->Get(Timing::GpuConvert));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "GPU RED %7.3f MS", this->Stats->Get(Timing::GpuReduce));
+        Lines.emplace_back(Line);
+        snprintf(Line, sizeof(Line), "GPU OVL %7.3f MS", this->Stats->Get(Timing::GpuOverlay));
+        Lines.emplace_back(Line);
+
+        if (this->Correction.bEnabled)
+            snprintf(Line, sizeof(Line), "COLOR   RC%4.2f DH%4.2f LC%4.2f", this->Correction.RedCompensation, this->Correction.Dehaze, this->Correction.LocalContrast);
+        else
+            snprintf(Line, sizeof(Line), "COLOR   OFF");
+
+        Lines.emplace_back(Line);
+
+        VisionResult Vision;
+
+        if (this->Tap && this->Tap->GetLatestResult(Vision))
+        {
+            snprintf(Line, sizeof(Line), "VISION  %7.3f MS %llu DROP", this->Stats->Get(Timing::Vision), static_cast<unsigned long long>(this->Stats->Get(Counter::VisionDropped)));
+            Lines.emplace_back(Line);
+            snprintf(Line, sizeof(Line), "CLARITY V%5.2f T%5.2f E%5.3f", Vision.Visibility, Vision.Turbidity, Vision.EdgeDensity);
+            Lines.emplace_back(Line);
+        }
+
+        this->AddTelemetryText(Lines);
+
+        this->StatsOverlay->SetText(Lines);
+
+        this->LastOverlayUpdate = Start;
+        this->LastFramesDecoded = FramesDecoded;
+        this->LastBytesReceived = BytesReceived;
+    }
+
+    {
+        GpuTimerScope GpuTime(*this->OverlayTimer);
+        this->StatsOverlay->Draw(this->ViewportWidth, this->ViewportHeight);
+    }
+
+    // Restore state the video pass relies on
+    this->ShaderProgram->Bind();
+
+    std::chrono::duration<double, std::milli> OverlayTime = std::chrono::steady_clock::now() - Start;
+    this->Stats->Record(Timing::Overlay, OverlayTime.count());
+}
+
 Renderer::~Renderer()
 {
+    // Flush pending captures while the GL context is still alive
+    this->Capture.reset();
+
+    glDeleteFramebuffers(1, &this->StatisticsFBO);
+    glDeleteTextures(1, &this->StatisticsTexture);
+
     av_frame_free(&this->Frame);
 }
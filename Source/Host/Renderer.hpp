@@ -1,12 +1,31 @@
 #ifndef HOST_RENDERER_HPP_
 #define HOST_RENDERER_HPP_
 
+#include <chrono>
 #include <memory>
 
 #include <glad/gl.h>
 
 #include "FrameBuffer.hpp"
+#include "FrameCapture.hpp"
+#include "FrameTap.hpp"
+#include "GpuTimer.hpp"
+#include "Metrics.hpp"
+#include "Overlay.hpp"
+#include "ReplayClock.hpp"
 #include "Shader.hpp"
+#include "Telemetry.hpp"
+
+// Runtime parameters of the fused underwater color correction, see YUVToRGB.frag
+struct ColorCorrection
+{
+    bool bEnabled;
+    float RedCompensation;      // Strength of restoring red from green, 0 disables
+    float WhiteBalance;         // Blend from none (0) to full gray-world balance (1)
+    float Dehaze;               // Blend from none (0) to full global contrast stretch (1)
+    float LocalContrast;        // Amount of luma detail added back, 0 disables
+    float LocalRadius;          // Radius of the local mean in source luma pixels
+};
 
 class Renderer
 {
@@ -20,20 +39,69 @@ private:
     GLuint TextureU;
     GLuint TextureV;
 
+    // Tiny render target of the frame, mipmapped down to its means for the next frame's correction
+    GLuint StatisticsFBO;
+    GLuint StatisticsTexture;
+    bool bHasStatistics;
+    bool bCanReduce;
+
+    ColorCorrection Correction;
+
+    GLint ModeUniform;
+    GLint RedCompensationUniform;
+    GLint WhiteBalanceUniform;
+    GLint DehazeUniform;
+    GLint LocalContrastUniform;
+    GLint LocalRadiusUniform;
+
     std::unique_ptr<Shader> ShaderProgram;
+    std::unique_ptr<FrameCapture> Capture;
+    std::unique_ptr<Overlay> StatsOverlay;
+
+    // GPU time of each pass, read back a few frames late
+    std::unique_ptr<GpuTimer> UploadTimer;
+    std::unique_ptr<GpuTimer> ConvertTimer;
+    std::unique_ptr<GpuTimer> ReduceTimer;
+    std::unique_ptr<GpuTimer> OverlayTimer;
 
     FrameBuffer* Buffer;
     AVFrame* Frame;
 
+    Metrics* Stats;
+
+    // Optional sources of overlay text
+    Telemetry* VehicleTelemetry;
+    ReplayClock* Clock;
+    FrameTap* Tap;
+
     size_t BufferingCutoff;
     bool bIsBuffering;
 
+    int ViewportWidth;
+    int ViewportHeight;
+
+    // Capture requested for the next drawn frame
+    bool bCapturePending;
+    CaptureSource PendingCaptureSource;
+    CaptureFormat PendingCaptureFormat;
+
+    // Counter values at the last overlay text update, for computing rates
+    std::chrono::steady_clock::time_point LastOverlayUpdate;
+    uint64_t LastFramesDecoded;
+    uint64_t LastBytesReceived;
+
     int CheckBufferingStatus();
 
     void UpdateFullscreenQuadTexture();
 
     void Draw();
 
+    void Reduce();
+
+    void DrawOverlay();
+
+    void AddTelemetryText(std::vector<std::string>& Lines);
+
 public:
     /**
      * @brief Creates OpenGL renderer.
@@ -41,9 +109,10 @@ public:
      * @param Height Vertical resolution of the video stream to be rendered.
      * @param Cutoff Number of frames to buffer before rendering.
      * @param BufferPtr Pointer to frame buffer object from which frames are received.
-     * @param ShaderName Name of shader program the renderer will use.
+     * @param StatsPtr Pointer to metrics object shown on the overlay and recorded to.
+     * @param ShaderDirectory Directory containing the renderer's shader programs.
 	 */
-    Renderer(int Width, int Height, size_t Cutoff, FrameBuffer* BufferPtr, const char* ShaderName);
+    Renderer(int Width, int Height, size_t Cutoff, FrameBuffer* BufferPtr, Metrics* StatsPtr, const char* ShaderDirectory);
 
     /**
      * @brief Updates OpenGL viewport size.
@@ -61,6 +130,49 @@ public:
 	 */
     int Render(double CurrentTime, double &NextRenderTime);
 
+    /**
+     * @brief Requests a still capture of the next rendered frame.
+     * @param Source Whether to capture the window contents or the decoded source frame.
+     * @param Format Image format to encode the capture as.
+     * @note Readback and encoding are asynchronous and never block rendering.
+	 */
+    void RequestCapture(CaptureSource Source, CaptureFormat Format);
+
+    /**
+     * @brief Shows or hides the performance overlay.
+	 */
+    void ToggleOverlay();
+
+    /**
+     * @brief Sets the telemetry shown on the overlay.
+     * @param TelemetryPtr Pointer to telemetry object, or nullptr to hide vehicle state.
+	 */
+    void SetTelemetry(Telemetry* TelemetryPtr);
+
+    /**
+     * @brief Sets the replay clock whose position is shown on the overlay.
+     * @param ClockPtr Pointer to replay clock, or nullptr when showing a live stream.
+	 */
+    void SetReplayClock(ReplayClock* ClockPtr);
+
+    /**
+     * @brief Sets the frame tap whose latest vision results are shown on the overlay.
+     * @param TapPtr Pointer to frame tap, or nullptr to hide vision results.
+	 */
+    void SetFrameTap(FrameTap* TapPtr);
+
+    /**
+     * @brief Sets the color correction applied to the video, takes effect on the next frame.
+     * @param NewCorrection Correction parameters.
+	 */
+    void SetColorCorrection(const ColorCorrection& NewCorrection);
+
+    /**
+     * @brief Gets the current color correction parameters.
+     * @returns Correction parameters as a ColorCorrection.
+	 */
+    ColorCorrection GetColorCorrection() {return this->Correction;}
+
     ~Renderer();
 };
 
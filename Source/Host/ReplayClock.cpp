@@ -0,0 +1,125 @@
+#include "ReplayClock.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+ReplayClock::ReplayClock(int64_t Start, int64_t End)
+{
+    this->StartTime = Start;
+    this->EndTime = (End > Start) ? End : Start;
+
+    this->BaseTime = Start;
+    this->BaseWallTime = av_gettime_relative();
+    this->Speed = 1.0;
+    this->bIsPaused = true;
+
+    this->SeekGeneration = 0;
+}
+
+int64_t ReplayClock::NowLocked(int64_t WallTime) const
+{
+    if (this->bIsPaused)
+        return this->BaseTime;
+
+    return this->Clamp(this->BaseTime + static_cast<int64_t>((WallTime - this->BaseWallTime) * this->Speed));
+}
+
+void ReplayClock::Rebase(int64_t WallTime)
+{
+    // Fold elapsed time into the base so speed and pause changes apply from now on
+    this->BaseTime = this->NowLocked(WallTime);
+    this->BaseWallTime = WallTime;
+}
+
+int64_t ReplayClock::Clamp(int64_t Time) const
+{
+    if (Time < this->StartTime)
+        return this->StartTime;
+
+    if (Time > this->EndTime)
+        return this->EndTime;
+
+    return Time;
+}
+
+int64_t ReplayClock::Now() const
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+    return this->NowLocked(av_gettime_relative());
+}
+
+void ReplayClock::Seek(int64_t Time)
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+
+    this->BaseTime = this->Clamp(Time);
+    this->BaseWallTime = av_gettime_relative();
+    this->SeekGeneration++;
+}
+
+void ReplayClock::SetTime(int64_t Time)
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+
+    this->BaseTime = this->Clamp(Time);
+    this->BaseWallTime = av_gettime_relative();
+}
+
+void ReplayClock::SetPaused(bool bPaused)
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+
+    this->Rebase(av_gettime_relative());
+    this->bIsPaused = bPaused;
+}
+
+void ReplayClock::TogglePaused()
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+
+    int64_t WallTime = av_gettime_relative();
+    this->Rebase(WallTime);
+
+    // Playing from the end restarts the recording
+    if (this->bIsPaused && this->BaseTime >= this->EndTime)
+    {
+        this->BaseTime = this->StartTime;
+        this->SeekGeneration++;
+    }
+
+    this->bIsPaused = !this->bIsPaused;
+}
+
+void ReplayClock::SetSpeed(double NewSpeed)
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+
+    this->Rebase(av_gettime_relative());
+
+    if (NewSpeed < MinimumSpeed)
+        NewSpeed = MinimumSpeed;
+
+    if (NewSpeed > MaximumSpeed)
+        NewSpeed = MaximumSpeed;
+
+    this->Speed = NewSpeed;
+}
+
+bool ReplayClock::IsPaused() const
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+    return this->bIsPaused;
+}
+
+double ReplayClock::GetSpeed() const
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+    return this->Speed;
+}
+
+uint64_t ReplayClock::GetSeekGeneration() const
+{
+    std::lock_guard<std::mutex> Lock(this->ClockMutex);
+    return this->SeekGeneration;
+}
@@ -0,0 +1,88 @@
+#ifndef HOST_REPLAY_CLOCK_HPP_
+#define HOST_REPLAY_CLOCK_HPP_
+
+#include <cstdint>
+#include <mutex>
+
+// Shared timeline for replaying a recording. Media time is in the recording's own clock,
+// monotonic host microseconds (av_gettime_relative) at the time it was recorded, so video
+// and telemetry recorded in the same session line up without any conversion.
+
+class ReplayClock
+{
+private:
+    static constexpr double MinimumSpeed = 0.25;
+    static constexpr double MaximumSpeed = 8.0;
+
+    mutable std::mutex ClockMutex;
+
+    // Media time is BaseTime at wall time BaseWallTime, advancing at Speed unless paused
+    int64_t BaseTime;
+    int64_t BaseWallTime;
+    double Speed;
+    bool bIsPaused;
+
+    int64_t StartTime;
+    int64_t EndTime;
+
+    // Incremented on every discontinuity so consumers know to reposition
+    uint64_t SeekGeneration;
+
+    int64_t NowLocked(int64_t WallTime) const;
+
+    void Rebase(int64_t WallTime);
+
+    int64_t Clamp(int64_t Time) const;
+
+public:
+    /**
+     * @brief Creates a paused clock at the start of a recording.
+     * @param Start Media time of the start of the recording in microseconds.
+     * @param End Media time of the end of the recording in microseconds.
+	 */
+    ReplayClock(int64_t Start, int64_t End);
+
+    /**
+     * @brief Gets the current media time.
+     * @returns Media time in microseconds, clamped to the recording.
+	 */
+    int64_t Now() const;
+
+    /**
+     * @brief Jumps to a media time, notifying consumers of the discontinuity.
+     * @param Time Media time in microseconds, clamped to the recording.
+	 */
+    void Seek(int64_t Time);
+
+    /**
+     * @brief Moves to a media time without a discontinuity, for stepping forward.
+     * @param Time Media time in microseconds, clamped to the recording.
+	 */
+    void SetTime(int64_t Time);
+
+    void SetPaused(bool bPaused);
+
+    void TogglePaused();
+
+    /**
+     * @brief Sets the playback rate.
+     * @param NewSpeed Playback rate, clamped between 0.25x and 8x.
+	 */
+    void SetSpeed(double NewSpeed);
+
+    bool IsPaused() const;
+
+    double GetSpeed() const;
+
+    int64_t GetStartTime() const {return this->StartTime;}
+
+    int64_t GetEndTime() const {return this->EndTime;}
+
+    /**
+     * @brief Gets the discontinuity counter.
+     * @returns A value that changes every time the clock is seeked.
+	 */
+    uint64_t GetSeekGeneration() const;
+};
+
+#endif // HOST_REPLAY_CLOCK_HPP_
@@ -0,0 +1,482 @@
+#include "SerialLink.hpp"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+// Receive ring size, rounded up to a page multiple when mapped
+static constexpr size_t ReceiveRingSize = 64 * 1024;
+
+// Transmit bytes allowed to queue before further writes are dropped
+static constexpr size_t TransmitQueueSize = 64 * 1024;
+
+SerialLink::SerialLink(const char *Device, int BaudRate)
+{
+    this->FileDescriptor = -1;
+    this->bIsConnected = false;
+    this->EpollDescriptor = -1;
+    this->WakeDescriptor = -1;
+
+    this->Ring = nullptr;
+    this->RingSize = 0;
+    this->RingRead = 0;
+    this->RingWrite = 0;
+
+    this->TxCapacity = TransmitQueueSize;
+    this->TxPending.reserve(this->TxCapacity);
+    this->TxActive.reserve(this->TxCapacity);
+    this->TxActiveOffset = 0;
+    this->bWaitingWritable = false;
+
+    this->BytesSent = 0;
+    this->BytesReceived = 0;
+    this->WriteCalls = 0;
+    this->ReadCalls = 0;
+    this->DroppedBytes = 0;
+    this->OverflowBytes = 0;
+    this->TxLatencySamples = 0;
+    this->TxLatencyTotal = 0.0;
+    this->TxLatencyMax = 0.0;
+
+    this->bTransferLoop = false;
+
+#if defined(__linux__)
+    this->FileDescriptor = open(Device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (this->FileDescriptor < 0)
+    {
+        LOG_ERROR("Failed to open serial device %s: %s", Device, strerror(errno));
+        return;
+    }
+
+    if (this->Configure(BaudRate) < 0 || this->CreateRing(ReceiveRingSize) < 0)
+    {
+        LOG_ERROR("Failed to configure serial device %s: %s", Device, strerror(errno));
+        close(this->FileDescriptor);
+        this->FileDescriptor = -1;
+        return;
+    }
+
+    // Event descriptor wakes the transfer thread for new writes and shutdown
+
+    this->EpollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    this->WakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event Event{};
+    Event.events = EPOLLIN;
+    Event.data.fd = this->WakeDescriptor;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_ADD, this->WakeDescriptor, &Event);
+
+    Event.events = EPOLLIN;
+    Event.data.fd = this->FileDescriptor;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_ADD, this->FileDescriptor, &Event);
+
+    this->bIsConnected = true;
+#else
+    (void) BaudRate;
+    LOG_ERROR("Serial links are not supported on this platform: %s", Device);
+#endif
+}
+
+int SerialLink::Configure(int BaudRate)
+{
+#if defined(__linux__)
+    termios Options;
+
+    if (tcgetattr(this->FileDescriptor, &Options) < 0)
+        return -1;
+
+    // No echo, line editing or character translation
+    cfmakeraw(&Options);
+
+    speed_t Speed = B115200;
+
+    switch (BaudRate)
+    {
+        case 9600:   Speed = B9600;   break;
+        case 57600:  Speed = B57600;  break;
+        case 230400: Speed = B230400; break;
+        default: break;
+    }
+
+    cfsetispeed(&Options, Speed);
+    cfsetospeed(&Options, Speed);
+
+    Options.c_cflag |= CLOCAL | CREAD;
+
+    // Return whatever is available immediately, epoll does the waiting
+    Options.c_cc[VMIN] = 0;
+    Options.c_cc[VTIME] = 0;
+
+    if (tcsetattr(this->FileDescriptor, TCSANOW, &Options) < 0)
+        return -1;
+
+    tcflush(this->FileDescriptor, TCIOFLUSH);
+#else
+    (void) BaudRate;
+#endif
+
+    return 0;
+}
+
+int SerialLink::CreateRing(size_t Size)
+{
+#if defined(__linux__)
+    long PageSize = sysconf(_SC_PAGESIZE);
+    Size = (Size + PageSize - 1) / PageSize * PageSize;
+
+    int MemoryDescriptor = memfd_create("SerialRing", MFD_CLOEXEC);
+
+    if (MemoryDescriptor < 0)
+        return -1;
+
+    if (ftruncate(MemoryDescriptor, Size) < 0)
+    {
+        close(MemoryDescriptor);
+        return -1;
+    }
+
+    // Reserve twice the size, then map the same pages into both halves
+    void* Base = mmap(nullptr, 2 * Size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (Base == MAP_FAILED)
+    {
+        close(MemoryDescriptor);
+        return -1;
+    }
+
+    uint8_t* Bytes = static_cast<uint8_t*>(Base);
+
+    void* First = mmap(Bytes, Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, MemoryDescriptor, 0);
+    void* Second = mmap(Bytes + Size, Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, MemoryDescriptor, 0);
+
+    close(MemoryDescriptor);
+
+    if (First == MAP_FAILED || Second == MAP_FAILED)
+    {
+        munmap(Base, 2 * Size);
+        return -1;
+    }
+
+    this->Ring = Bytes;
+    this->RingSize = Size;
+#else
+    (void) Size;
+#endif
+
+    return 0;
+}
+
+void SerialLink::SetReceiveHandler(ReceiveHandler NewHandler)
+{
+    this->Handler = std::move(NewHandler);
+}
+
+// Any thread
+
+int SerialLink::Write(const uint8_t *Data, size_t Size)
+{
+    if (!this->bIsConnected)
+        return -1;
+
+    bool bWasEmpty;
+
+    {
+        std::lock_guard<std::mutex> Lock(this->TxMutex);
+
+        if (this->TxPending.size() + Size > this->TxCapacity)
+        {
+            this->DroppedBytes.fetch_add(Size, std::memory_order_relaxed);
+            return -2;
+        }
+
+        bWasEmpty = this->TxPending.empty();
+
+        if (bWasEmpty)
+            this->TxPendingSince = std::chrono::steady_clock::now();
+
+        this->TxPending.insert(this->TxPending.end(), Data, Data + Size);
+    }
+
+    // Only the first write into an empty queue needs to wake the transfer thread,
+    // later ones are coalesced into the same flush
+#if defined(__linux__)
+    if (bWasEmpty)
+    {
+        uint64_t One = 1;
+        ssize_t Status = write(this->WakeDescriptor, &One, sizeof(One));
+        (void) Status;
+    }
+#endif
+
+    return 0;
+}
+
+void SerialLink::StartTransferLoop()
+{
+    if (!this->bIsConnected)
+        return;
+
+    this->bTransferLoop = true;
+
+    // Start thread
+    this->TransferThread = std::thread([this] { this->TransferLoop(); });
+}
+
+SerialStatistics SerialLink::GetStatistics()
+{
+    SerialStatistics Statistics;
+
+    Statistics.BytesSent = this->BytesSent.load(std::memory_order_relaxed);
+    Statistics.BytesReceived = this->BytesReceived.load(std::memory_order_relaxed);
+    Statistics.WriteCalls = this->WriteCalls.load(std::memory_order_relaxed);
+    Statistics.ReadCalls = this->ReadCalls.load(std::memory_order_relaxed);
+    Statistics.DroppedBytes = this->DroppedBytes.load(std::memory_order_relaxed);
+    Statistics.OverflowBytes = this->OverflowBytes.load(std::memory_order_relaxed);
+
+    uint64_t Samples = this->TxLatencySamples.load(std::memory_order_relaxed);
+    Statistics.AverageTxLatency = (Samples > 0) ? this->TxLatencyTotal.load(std::memory_order_relaxed) / Samples : 0.0;
+    Statistics.MaxTxLatency = this->TxLatencyMax.load(std::memory_order_relaxed);
+
+    return Statistics;
+}
+
+// Transfer thread
+
+void SerialLink::TransferLoop()
+{
+#if defined(__linux__)
+    TRACE_THREAD("Serial");
+
+    epoll_event Events[4];
+
+    while (this->bTransferLoop)
+    {
+        int Count = epoll_wait(this->EpollDescriptor, Events, 4, -1);
+
+        if (Count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        bool bShouldFlush = false;
+
+        for (int i = 0; i < Count; i++)
+        {
+            if (Events[i].data.fd == this->WakeDescriptor)
+            {
+                uint64_t Value;
+                ssize_t Status = read(this->WakeDescriptor, &Value, sizeof(Value));
+                (void) Status;
+
+                bShouldFlush = true;
+                continue;
+            }
+
+            if (Events[i].events & EPOLLIN)
+            {
+                TRACE_SCOPE("SerialRead");
+                this->ReadAvailable();
+            }
+
+            if (Events[i].events & EPOLLOUT)
+                bShouldFlush = true;
+
+            // Device unplugged or pseudo-terminal peer closed. A hung up terminal also reports
+            // readable and reads return 0, so this cannot wait for EPOLLIN to clear; whatever
+            // was left has just been read above.
+            if (Events[i].events & (EPOLLHUP | EPOLLERR))
+                this->Disconnect();
+        }
+
+        if (bShouldFlush && this->bIsConnected)
+            this->FlushTx();
+    }
+#endif
+}
+
+void SerialLink::ReadAvailable()
+{
+#if defined(__linux__)
+    while (this->bIsConnected)
+    {
+        size_t Used = this->RingWrite - this->RingRead;
+        size_t Free = this->RingSize - Used;
+
+        // Handler fell a full ring behind, discard the oldest data to keep the link moving
+        if (Free == 0)
+        {
+            this->OverflowBytes.fetch_add(Used, std::memory_order_relaxed);
+            this->RingRead = this->RingWrite;
+            Free = this->RingSize;
+        }
+
+        // Mirror mapping makes the whole free region contiguous from the write position
+        ssize_t Received = read(this->FileDescriptor, this->Ring + (this->RingWrite % this->RingSize), Free);
+
+        if (Received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN)
+                this->Disconnect();
+
+            return;
+        }
+
+        if (Received == 0)
+            return;
+
+        this->ReadCalls.fetch_add(1, std::memory_order_relaxed);
+        this->BytesReceived.fetch_add(Received, std::memory_order_relaxed);
+        this->RingWrite += static_cast<size_t>(Received);
+
+        // Offer everything unconsumed, partial frames stay in place for the next read
+        if (this->Handler)
+        {
+            size_t Available = this->RingWrite - this->RingRead;
+            size_t Consumed = this->Handler(this->Ring + (this->RingRead % this->RingSize), Available);
+
+            this->RingRead += (Consumed < Available) ? Consumed : Available;
+        }
+        else
+        {
+            this->RingRead = this->RingWrite;
+        }
+    }
+#endif
+}
+
+void SerialLink::FlushTx()
+{
+#if defined(__linux__)
+    while (true)
+    {
+        // Take everything queued since the last flush in one go
+        if (this->TxActiveOffset >= this->TxActive.size())
+        {
+            std::lock_guard<std::mutex> Lock(this->TxMutex);
+
+            if (this->TxPending.empty())
+                break;
+
+            this->TxActive.swap(this->TxPending);
+            this->TxPending.clear();
+            this->TxActiveOffset = 0;
+            this->TxActiveSince = this->TxPendingSince;
+        }
+
+        ssize_t Written = write(this->FileDescriptor, this->TxActive.data() + this->TxActiveOffset, this->TxActive.size() - this->TxActiveOffset);
+
+        if (Written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Device buffer full, resume when epoll reports it writable
+            if (errno == EAGAIN)
+                this->SetWaitWritable(true);
+            else
+                this->Disconnect();
+
+            return;
+        }
+
+        this->WriteCalls.fetch_add(1, std::memory_order_relaxed);
+        this->BytesSent.fetch_add(Written, std::memory_order_relaxed);
+        this->TxActiveOffset += static_cast<size_t>(Written);
+
+        if (this->TxActiveOffset < this->TxActive.size())
+            continue;
+
+        std::chrono::duration<double, std::milli> Latency = std::chrono::steady_clock::now() - this->TxActiveSince;
+
+        this->TxLatencySamples.fetch_add(1, std::memory_order_relaxed);
+        this->TxLatencyTotal.store(this->TxLatencyTotal.load(std::memory_order_relaxed) + Latency.count(), std::memory_order_relaxed);
+
+        if (Latency.count() > this->TxLatencyMax.load(std::memory_order_relaxed))
+            this->TxLatencyMax.store(Latency.count(), std::memory_order_relaxed);
+    }
+
+    this->SetWaitWritable(false);
+#endif
+}
+
+void SerialLink::SetWaitWritable(bool bEnable)
+{
+#if defined(__linux__)
+    if (this->bWaitingWritable == bEnable || !this->bIsConnected)
+        return;
+
+    epoll_event Event{};
+    Event.events = EPOLLIN;
+
+    if (bEnable)
+        Event.events |= EPOLLOUT;
+
+    Event.data.fd = this->FileDescriptor;
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_MOD, this->FileDescriptor, &Event);
+
+    this->bWaitingWritable = bEnable;
+#else
+    (void) bEnable;
+#endif
+}
+
+void SerialLink::Disconnect()
+{
+#if defined(__linux__)
+    if (!this->bIsConnected)
+        return;
+
+    LOG_ERROR("Serial device disconnected");
+
+    // Descriptor stays open until destruction so other threads never see it reused
+    epoll_ctl(this->EpollDescriptor, EPOLL_CTL_DEL, this->FileDescriptor, nullptr);
+    this->bIsConnected = false;
+#endif
+}
+
+SerialLink::~SerialLink()
+{
+#if defined(__linux__)
+    if (this->bTransferLoop)
+    {
+        this->bTransferLoop = false;
+
+        uint64_t One = 1;
+        ssize_t Status = write(this->WakeDescriptor, &One, sizeof(One));
+        (void) Status;
+    }
+
+    // Wait for transfer thread to finish
+    if (this->TransferThread.joinable())
+        this->TransferThread.join();
+
+    if (this->FileDescriptor >= 0)
+        close(this->FileDescriptor);
+
+    if (this->WakeDescriptor >= 0)
+        close(this->WakeDescriptor);
+
+    if (this->EpollDescriptor >= 0)
+        close(this->EpollDescriptor);
+
+    if (this->Ring)
+        munmap(this->Ring, 2 * this->RingSize);
+#endif
+}
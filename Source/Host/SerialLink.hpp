@@ -0,0 +1,137 @@
+#ifndef HOST_SERIAL_LINK_HPP_
+#define HOST_SERIAL_LINK_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Called on the transfer thread with every unconsumed received byte.
+ * @param Data Pointer to contiguous received data, valid only during the call.
+ * @param Size Number of bytes available.
+ * @returns Number of bytes consumed. Unconsumed bytes are offered again with the next read.
+ */
+using ReceiveHandler = std::function<size_t(const uint8_t* Data, size_t Size)>;
+
+// Snapshot of transfer counters
+struct SerialStatistics
+{
+    uint64_t BytesSent;
+    uint64_t BytesReceived;
+    uint64_t WriteCalls;        // write() syscalls, lower than Write() calls when coalescing
+    uint64_t ReadCalls;
+    uint64_t DroppedBytes;      // Transmit bytes dropped because the queue was full
+    uint64_t OverflowBytes;     // Received bytes discarded because the handler fell behind
+    double AverageTxLatency;    // Milliseconds from Write() to the bytes reaching the kernel
+    double MaxTxLatency;
+};
+
+// Non-blocking serial transport to the vehicle's USB CDC device. A transfer thread waits
+// on epoll, coalesces queued writes into as few syscalls as possible, and reads straight
+// into a mirrored ring buffer so received data is always contiguous and never copied.
+
+class SerialLink
+{
+private:
+    int FileDescriptor;
+    std::atomic<bool> bIsConnected;
+    int EpollDescriptor;
+    int WakeDescriptor;
+
+    // Ring buffer mapped twice back to back so any span up to its size is contiguous
+    uint8_t* Ring;
+    size_t RingSize;
+    size_t RingRead;
+    size_t RingWrite;
+
+    ReceiveHandler Handler;
+
+    // Transmit queue filled by Write() and swapped out by the transfer thread
+    std::mutex TxMutex;
+    std::vector<uint8_t> TxPending;
+    std::chrono::steady_clock::time_point TxPendingSince;
+    size_t TxCapacity;
+
+    // Owned by the transfer thread
+    std::vector<uint8_t> TxActive;
+    size_t TxActiveOffset;
+    std::chrono::steady_clock::time_point TxActiveSince;
+    bool bWaitingWritable;
+
+    std::atomic<uint64_t> BytesSent;
+    std::atomic<uint64_t> BytesReceived;
+    std::atomic<uint64_t> WriteCalls;
+    std::atomic<uint64_t> ReadCalls;
+    std::atomic<uint64_t> DroppedBytes;
+    std::atomic<uint64_t> OverflowBytes;
+    std::atomic<uint64_t> TxLatencySamples;
+    std::atomic<double> TxLatencyTotal;
+    std::atomic<double> TxLatencyMax;
+
+    std::atomic<bool> bTransferLoop;
+    std::thread TransferThread;
+
+    int Configure(int BaudRate);
+
+    int CreateRing(size_t Size);
+
+    void TransferLoop();
+
+    void ReadAvailable();
+
+    void FlushTx();
+
+    void SetWaitWritable(bool bEnable);
+
+    void Disconnect();
+
+public:
+    /**
+     * @brief Opens and configures a serial device for raw, non-blocking binary transfer.
+     * @param Device Path to the serial device (e.g. /dev/ttyACM0, or a pseudo-terminal).
+     * @param BaudRate Line rate in bits per second. Ignored by USB CDC devices.
+	 */
+    SerialLink(const char* Device, int BaudRate);
+
+    /**
+     * @brief Gets whether the device is open and has not been disconnected.
+     * @returns True if the device is open.
+	 */
+    bool IsOpen() {return this->bIsConnected;}
+
+    /**
+     * @brief Sets the function received data is passed to.
+     * @param NewHandler Handler called on the transfer thread.
+     * @note Must be set before the transfer loop is started.
+	 */
+    void SetReceiveHandler(ReceiveHandler NewHandler);
+
+    /**
+     * @brief Queues bytes to be written to the device. Never blocks on the device.
+     * @param Data Pointer to bytes to write.
+     * @param Size Number of bytes to write.
+     * @returns Error status
+     * @note Writes queued close together are sent with a single syscall.
+	 */
+    int Write(const uint8_t* Data, size_t Size);
+
+    /**
+     * @brief Spawns new thread to transfer data to and from the device.
+	 */
+    void StartTransferLoop();
+
+    /**
+     * @brief Gets a snapshot of the transfer counters.
+     * @returns Counter values as a SerialStatistics.
+	 */
+    SerialStatistics GetStatistics();
+
+    ~SerialLink();
+};
+
+#endif // HOST_SERIAL_LINK_HPP_
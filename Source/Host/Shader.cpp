@@ -1,9 +1,10 @@
 #include "Shader.hpp"
 
-#include <cstdio>
 #include <fstream>
 #include <sstream>
 
+#include "Logger.hpp"
+
 Shader::Shader(const char* ShaderString)
 {
     // Get shader code from file
@@ -35,7 +36,7 @@ std::string Shader::ReadFile(const char* FilePath)
     std::ifstream FileStream(FilePath);
 
     if (!FileStream)
-        fprintf(stderr, "Could not find file: %s\n", FilePath);
+        LOG_ERROR("Could not find file: %s", FilePath);
 
     std::string StringLine;
     std::stringstream StringStream;
@@ -68,7 +69,7 @@ GLuint Shader::Compile(GLenum ShaderType, const char* ShaderSource)
         char TempBuf[512];
         glGetShaderInfoLog(ShaderID, 512, nullptr, TempBuf);
         
-        fprintf(stderr, "Shader error: %s\n", TempBuf);
+        LOG_ERROR("Shader error: %s", TempBuf);
     }
 
     return ShaderID;
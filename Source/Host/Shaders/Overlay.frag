@@ -0,0 +1,14 @@
+#version 330 core
+
+in vec2 AtlasCoord;
+out vec4 FragColor;
+
+uniform sampler2D Atlas;
+
+void main() 
+{
+    float Coverage = texelFetch(Atlas, ivec2(AtlasCoord), 0).r;
+
+    // Text over a translucent panel so it stays readable on bright footage
+    FragColor = mix(vec4(0.0, 0.0, 0.0, 0.6), vec4(1.0, 1.0, 1.0, 1.0), Coverage);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+layout (location = 0) in vec2 CellPosition;
+layout (location = 1) in float Glyph;
+
+uniform vec2 Viewport;
+uniform vec2 CellSize;
+
+out vec2 AtlasCoord;
+
+void main() 
+{
+    // Triangle strip corners (0,0), (1,0), (0,1), (1,1)
+    vec2 Corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 Pixel = CellPosition + Corner * CellSize;
+
+    // Pixel coordinates have their origin at the top-left of the window
+    gl_Position = vec4(Pixel.x / Viewport.x * 2.0 - 1.0, 1.0 - Pixel.y / Viewport.y * 2.0, 0.0, 1.0);
+
+    // Atlas is a single row of 6x8 glyph cells
+    AtlasCoord = vec2((Glyph + Corner.x) * 6.0, Corner.y * 8.0);
+}
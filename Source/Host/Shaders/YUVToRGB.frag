@@ -7,17 +7,81 @@ uniform sampler2D texY;
 uniform sampler2D texU;
 uniform sampler2D texV;
 
-void main() 
-{
-    float y = texture(texY, TexCoord).r;
-    float u = texture(texU, TexCoord).r - 0.5;
-    float v = texture(texV, TexCoord).r - 0.5;
+// 0 plain conversion, 1 corrected, 2 statistics (raw RGB and luma squared for the reduction)
+uniform int Mode;
 
-    FragColor = vec4
+// Reduction of the previous frame, its last mip level holds the frame means
+uniform sampler2D Statistics;
+uniform int StatisticsLevel;
+
+uniform float RedCompensation;  // Strength of restoring red from green, 0 disables
+uniform float WhiteBalance;     // Blend from none (0) to full gray-world balance (1)
+uniform float Dehaze;           // Blend from none (0) to full global contrast stretch (1)
+uniform float LocalContrast;    // Amount of luma detail added back, 0 disables
+uniform float LocalRadius;      // Radius of the local mean in luma texels
+
+vec3 ToRGB(float y, float u, float v)
+{
+    return vec3
     (
         y + 1.402 * v,
         y - 0.344136 * u - 0.714136 * v,
-        y + 1.772 * u,
-        1.0
+        y + 1.772 * u
     );
 }
+
+void main()
+{
+    float y = texture(texY, TexCoord).r;
+    float u = texture(texU, TexCoord).r - 0.5;
+    float v = texture(texV, TexCoord).r - 0.5;
+
+    vec3 Color = clamp(ToRGB(y, u, v), 0.0, 1.0);
+
+    if (Mode == 2)
+    {
+        FragColor = vec4(Color, y * y);
+        return;
+    }
+
+    if (Mode == 0)
+    {
+        FragColor = vec4(Color, 1.0);
+        return;
+    }
+
+    vec4 Frame = texelFetch(Statistics, ivec2(0, 0), StatisticsLevel);
+    vec3 Mean = max(Frame.rgb, vec3(1.0 / 255.0));
+
+    // Haze lifts the black level and flattens the frame, stretch it back towards a typical spread
+    float MeanLuma = dot(Frame.rgb, vec3(0.299, 0.587, 0.114));
+    float Spread = sqrt(max(Frame.a - MeanLuma * MeanLuma, 1e-6));
+    float Stretch = mix(1.0, clamp(0.2 / Spread, 1.0, 3.0), Dehaze);
+
+    // Red is absorbed first with depth, add back green where red is weak (Ancuti et al.)
+    float RedGain = RedCompensation * (Mean.g - Mean.r);
+    Color.r += RedGain * (1.0 - Color.r) * Color.g;
+    Mean.r += RedGain * (1.0 - Mean.r) * Mean.g;
+
+    // Gray world: the scene should average to neutral, gains are limited so flat scenes stay sane
+    vec3 Gains = clamp(vec3(dot(Mean, vec3(1.0 / 3.0))) / Mean, 0.5, 4.0);
+    Color *= mix(vec3(1.0), Gains, WhiteBalance);
+
+    // Local contrast from four luma taps, scaled into RGB so hue is kept
+    if (LocalContrast > 0.0)
+    {
+        vec2 Offset = LocalRadius / vec2(textureSize(texY, 0));
+
+        float LocalMean = 0.25 * (texture(texY, TexCoord + vec2(-Offset.x, -Offset.y)).r +
+                                  texture(texY, TexCoord + vec2( Offset.x, -Offset.y)).r +
+                                  texture(texY, TexCoord + vec2(-Offset.x,  Offset.y)).r +
+                                  texture(texY, TexCoord + vec2( Offset.x,  Offset.y)).r);
+
+        float Boosted = y + LocalContrast * (y - LocalMean);
+        Color *= clamp(Boosted, 0.0, 1.0) / max(y, 1.0 / 255.0);
+    }
+
+    Color = MeanLuma + (Color - MeanLuma) * Stretch;
+
+    FragColor = vec4(clamp(Color, 0.0, 1.0), 1.0);
+}
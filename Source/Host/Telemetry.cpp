@@ -0,0 +1,113 @@
+#include "Telemetry.hpp"
+
+#include <cstring>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+Telemetry::Telemetry(Metrics *StatsPtr)
+{
+    this->Stats = StatsPtr;
+
+    protocol_decoder_init(&this->Decoder);
+    memset(&this->State, 0, sizeof(this->State));
+}
+
+// Main thread
+
+void Telemetry::AddHandler(TelemetryHandler Handler)
+{
+    this->Handlers.push_back(Handler);
+}
+
+TelemetryState Telemetry::GetState()
+{
+    std::lock_guard<std::mutex> Lock(this->StateMutex);
+    return this->State;
+}
+
+// Serial transfer thread, or the replay thread when replaying a log
+
+size_t Telemetry::Receive(const uint8_t *Data, size_t Size)
+{
+    int64_t ReceiveTime = av_gettime_relative();
+
+    size_t Offset = 0;
+
+    // The decoder stops after each frame, whose payload lives in the decoder until it is fed again
+    while (Offset < Size)
+    {
+        size_t Consumed = 0;
+        protocol_frame_t Frame;
+
+        protocol_result_t Result = protocol_decode(&this->Decoder, Data + Offset, Size - Offset, &Consumed, &Frame);
+        Offset += Consumed;
+
+        if (Result == PROTOCOL_FRAME)
+        {
+            this->Stats->Add(Counter::TelemetryFrames, 1);
+            this->Dispatch(Frame, ReceiveTime);
+        }
+        else if (Result == PROTOCOL_ERROR)
+        {
+            this->Stats->Add(Counter::TelemetryErrors, 1);
+        }
+    }
+
+    return Size;
+}
+
+void Telemetry::Inject(const protocol_frame_t &Frame, int64_t ReceiveTime)
+{
+    // Frames from a log were validated when received, but guard against a mismatched version
+    int Expected = protocol_payload_size(Frame.id);
+
+    if (Expected >= 0 && Expected != Frame.length)
+        return;
+
+    this->Dispatch(Frame, ReceiveTime);
+}
+
+void Telemetry::Dispatch(const protocol_frame_t &Frame, int64_t ReceiveTime)
+{
+    {
+        std::lock_guard<std::mutex> Lock(this->StateMutex);
+
+        // Lengths were checked by the decoder for every known message
+        switch (Frame.id)
+        {
+            case PROTOCOL_ID_STATUS:
+                memcpy(&this->State.Status, Frame.payload, sizeof(this->State.Status));
+                break;
+
+            case PROTOCOL_ID_ATTITUDE:
+                memcpy(&this->State.Attitude, Frame.payload, sizeof(this->State.Attitude));
+                break;
+
+            case PROTOCOL_ID_DEPTH:
+                memcpy(&this->State.Depth, Frame.payload, sizeof(this->State.Depth));
+                break;
+
+            case PROTOCOL_ID_THRUSTERS:
+                memcpy(&this->State.Thrusters, Frame.payload, sizeof(this->State.Thrusters));
+                break;
+
+            case PROTOCOL_ID_TIMING:
+                memcpy(&this->State.Timing, Frame.payload, sizeof(this->State.Timing));
+                break;
+
+            case PROTOCOL_ID_IMU:
+                memcpy(&this->State.Imu, Frame.payload, sizeof(this->State.Imu));
+                break;
+
+            default:
+                break;
+        }
+
+        this->State.LastReceiveTime = ReceiveTime;
+    }
+
+    for (TelemetryHandler& Handler : this->Handlers)
+        Handler(Frame, ReceiveTime);
+}
@@ -0,0 +1,86 @@
+#ifndef HOST_TELEMETRY_HPP_
+#define HOST_TELEMETRY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <protocol.h>
+
+#include "Metrics.hpp"
+
+/**
+ * @brief Called on the serial transfer thread for every valid frame.
+ * @param Frame Decoded frame. The payload is only valid during the call.
+ * @param ReceiveTime Time the bytes were read, in microseconds (av_gettime_relative clock).
+ */
+using TelemetryHandler = std::function<void(const protocol_frame_t& Frame, int64_t ReceiveTime)>;
+
+// Latest copy of every vehicle telemetry message
+struct TelemetryState
+{
+    protocol_status_t Status;
+    protocol_attitude_t Attitude;
+    protocol_depth_t Depth;
+    protocol_thrusters_t Thrusters;
+    protocol_timing_t Timing;
+    protocol_imu_t Imu;
+    int64_t LastReceiveTime;    // Microseconds, 0 until the first frame arrives
+};
+
+// Parses the vehicle's byte stream into protocol frames as it arrives from the serial link,
+// keeps the latest state and hands each frame to any registered handlers
+
+class Telemetry
+{
+private:
+    protocol_decoder_t Decoder;
+
+    Metrics* Stats;
+
+    std::mutex StateMutex;
+    TelemetryState State;
+
+    std::vector<TelemetryHandler> Handlers;
+
+    void Dispatch(const protocol_frame_t& Frame, int64_t ReceiveTime);
+
+public:
+    /**
+     * @brief Creates telemetry parser.
+     * @param StatsPtr Pointer to metrics object to count frames and errors in.
+	 */
+    Telemetry(Metrics* StatsPtr);
+
+    /**
+     * @brief Adds a function to be called with each received frame.
+     * @param Handler Handler called on the serial transfer thread.
+     * @note Must be called before the serial transfer loop is started.
+	 */
+    void AddHandler(TelemetryHandler Handler);
+
+    /**
+     * @brief Parses received bytes. Meant to be set as the serial link's receive handler.
+     * @param Data Pointer to received bytes.
+     * @param Size Number of bytes available.
+     * @returns Number of bytes consumed, always all of them.
+	 */
+    size_t Receive(const uint8_t* Data, size_t Size);
+
+    /**
+     * @brief Handles an already decoded frame as if it had just been received, for replay.
+     * @param Frame Frame to handle.
+     * @param ReceiveTime Time the frame was originally received, in microseconds.
+	 */
+    void Inject(const protocol_frame_t& Frame, int64_t ReceiveTime);
+
+    /**
+     * @brief Gets a copy of the latest telemetry.
+     * @returns Latest values as a TelemetryState.
+	 */
+    TelemetryState GetState();
+};
+
+#endif // HOST_TELEMETRY_HPP_
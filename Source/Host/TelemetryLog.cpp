@@ -0,0 +1,371 @@
+#include "TelemetryLog.hpp"
+
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+// Header occupies a full page so the index and data regions stay page aligned
+static constexpr uint64_t HeaderRegionSize = 4096;
+
+// One index slot per this many bytes of data capacity
+static constexpr uint64_t BytesPerIndexEntry = 1024;
+
+static constexpr uint64_t MinimumIndexCapacity = 1024;
+
+static constexpr uint64_t RecordAlignment = 8;
+
+static uint64_t AlignRecord(uint64_t Size)
+{
+    return (Size + RecordAlignment - 1) & ~(RecordAlignment - 1);
+}
+
+TelemetryLog::TelemetryLog(const char *Path, uint64_t Capacity, int64_t IndexInterval)
+{
+    this->FileDescriptor = -1;
+    this->Mapping = nullptr;
+    this->MappingSize = 0;
+    this->Header = nullptr;
+    this->Index = nullptr;
+    this->Data = nullptr;
+
+    this->IndexCount = 0;
+    this->DataSize = 0;
+    this->NextIndexTime = 0;
+    this->DroppedRecords = 0;
+
+#if defined(__linux__)
+    uint64_t DataCapacity = AlignRecord(Capacity);
+    uint64_t IndexCapacity = DataCapacity / BytesPerIndexEntry;
+    IndexCapacity = (IndexCapacity < MinimumIndexCapacity) ? MinimumIndexCapacity : IndexCapacity;
+
+    uint64_t IndexOffset = HeaderRegionSize;
+    uint64_t DataOffset = IndexOffset + ((IndexCapacity * sizeof(TelemetryLogIndexEntry) + HeaderRegionSize - 1) & ~(HeaderRegionSize - 1));
+    uint64_t FileSize = DataOffset + DataCapacity;
+
+    this->FileDescriptor = open(Path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (this->FileDescriptor < 0)
+    {
+        LOG_ERROR("Failed to create telemetry log %s: %s", Path, strerror(errno));
+        return;
+    }
+
+    // Reserve the blocks now so a full disk is reported here rather than as SIGBUS while appending
+    int Status = posix_fallocate(this->FileDescriptor, 0, static_cast<off_t>(FileSize));
+
+    if (Status != 0)
+    {
+        LOG_ERROR("Failed to reserve %llu bytes for telemetry log %s: %s", static_cast<unsigned long long>(FileSize), Path, strerror(Status));
+        close(this->FileDescriptor);
+        this->FileDescriptor = -1;
+        return;
+    }
+
+    void* Address = mmap(nullptr, FileSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->FileDescriptor, 0);
+
+    if (Address == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map telemetry log %s: %s", Path, strerror(errno));
+        close(this->FileDescriptor);
+        this->FileDescriptor = -1;
+        return;
+    }
+
+    // Appends are strictly sequential
+    madvise(Address, FileSize, MADV_SEQUENTIAL);
+
+    this->Mapping = static_cast<uint8_t*>(Address);
+    this->MappingSize = FileSize;
+
+    TelemetryLogHeader* NewHeader = new (this->Mapping) TelemetryLogHeader();
+    memcpy(NewHeader->Magic, TelemetryLogMagic, sizeof(NewHeader->Magic));
+    NewHeader->Version = TelemetryLogVersion;
+    NewHeader->HeaderSize = sizeof(TelemetryLogHeader);
+    NewHeader->IndexOffset = IndexOffset;
+    NewHeader->IndexCapacity = IndexCapacity;
+    NewHeader->DataOffset = DataOffset;
+    NewHeader->DataCapacity = DataCapacity;
+    NewHeader->IndexInterval = (IndexInterval > 0) ? IndexInterval : 100000;
+    NewHeader->CreateTime = av_gettime_relative();
+    NewHeader->CreateWallTime = av_gettime();
+    NewHeader->IndexCount.store(0, std::memory_order_relaxed);
+    NewHeader->DataSize.store(0, std::memory_order_release);
+
+    this->Header = NewHeader;
+    this->Index = reinterpret_cast<TelemetryLogIndexEntry*>(this->Mapping + IndexOffset);
+    this->Data = this->Mapping + DataOffset;
+#else
+    (void) Path;
+    (void) Capacity;
+    (void) IndexInterval;
+    LOG_ERROR("Telemetry logs are not supported on this platform");
+#endif
+}
+
+// Serial transfer thread
+
+int TelemetryLog::Append(int64_t Timestamp, uint8_t Id, uint8_t Seq, const uint8_t *Payload, uint16_t Length)
+{
+    if (!this->Header)
+        return -1;
+
+    uint64_t RecordSize = AlignRecord(sizeof(TelemetryLogRecordHeader) + Length);
+
+    if (this->DataSize + RecordSize > this->Header->DataCapacity)
+    {
+        this->DroppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return -2;
+    }
+
+    uint8_t* Record = this->Data + this->DataSize;
+
+    TelemetryLogRecordHeader RecordHeader{};
+    RecordHeader.Timestamp = Timestamp;
+    RecordHeader.Length = Length;
+    RecordHeader.Id = Id;
+    RecordHeader.Seq = Seq;
+
+    memcpy(Record, &RecordHeader, sizeof(RecordHeader));
+    memcpy(Record + sizeof(RecordHeader), Payload, Length);
+
+    // Index points at this record, so publish the data first
+    uint64_t Offset = this->DataSize;
+    this->DataSize += RecordSize;
+    this->Header->DataSize.store(this->DataSize, std::memory_order_release);
+
+    // Once the index is full, readers walk forward from the last entry instead
+    if (Timestamp >= this->NextIndexTime && this->IndexCount < this->Header->IndexCapacity)
+    {
+        this->Index[this->IndexCount] = TelemetryLogIndexEntry{Timestamp, Offset};
+        this->IndexCount++;
+        this->Header->IndexCount.store(this->IndexCount, std::memory_order_release);
+
+        this->NextIndexTime = Timestamp + this->Header->IndexInterval;
+    }
+
+    return 0;
+}
+
+TelemetryLog::~TelemetryLog()
+{
+#if defined(__linux__)
+    uint64_t UsedSize = this->Header ? this->Header->DataOffset + this->DataSize : 0;
+
+    if (this->Mapping)
+    {
+        msync(this->Mapping, this->MappingSize, MS_SYNC);
+        munmap(this->Mapping, this->MappingSize);
+    }
+
+    // Give back the unused part of the reservation
+    if (this->FileDescriptor >= 0)
+    {
+        if (UsedSize > 0 && ftruncate(this->FileDescriptor, static_cast<off_t>(UsedSize)) < 0)
+            LOG_ERROR("Failed to trim telemetry log: %s", strerror(errno));
+
+        close(this->FileDescriptor);
+    }
+#endif
+}
+
+// Reader
+
+TelemetryLogReader::TelemetryLogReader(const char *Path)
+{
+    this->FileDescriptor = -1;
+    this->Mapping = nullptr;
+    this->MappingSize = 0;
+    this->Header = nullptr;
+    this->Index = nullptr;
+    this->Data = nullptr;
+    this->IndexCapacity = 0;
+    this->DataCapacity = 0;
+
+#if defined(__linux__)
+    this->FileDescriptor = open(Path, O_RDONLY | O_CLOEXEC);
+
+    if (this->FileDescriptor < 0)
+    {
+        LOG_ERROR("Failed to open telemetry log %s: %s", Path, strerror(errno));
+        return;
+    }
+
+    struct stat FileStatus;
+
+    if (fstat(this->FileDescriptor, &FileStatus) < 0 || static_cast<uint64_t>(FileStatus.st_size) < HeaderRegionSize)
+    {
+        LOG_ERROR("Telemetry log %s is too small", Path);
+        return;
+    }
+
+    size_t FileSize = static_cast<size_t>(FileStatus.st_size);
+    void* Address = mmap(nullptr, FileSize, PROT_READ, MAP_SHARED, this->FileDescriptor, 0);
+
+    if (Address == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map telemetry log %s: %s", Path, strerror(errno));
+        return;
+    }
+
+    // Seeks jump around, only the pages actually touched should be read
+    madvise(Address, FileSize, MADV_RANDOM);
+
+    this->Mapping = static_cast<const uint8_t*>(Address);
+    this->MappingSize = FileSize;
+
+    const TelemetryLogHeader* MappedHeader = reinterpret_cast<const TelemetryLogHeader*>(this->Mapping);
+
+    bool bIsValid = memcmp(MappedHeader->Magic, TelemetryLogMagic, sizeof(TelemetryLogMagic)) == 0
+                    && MappedHeader->Version == TelemetryLogVersion
+                    && MappedHeader->IndexOffset + MappedHeader->IndexCapacity * sizeof(TelemetryLogIndexEntry) <= MappedHeader->DataOffset
+                    && MappedHeader->DataOffset <= FileSize;
+
+    if (!bIsValid)
+    {
+        LOG_ERROR("Telemetry log %s is not a valid version %u log", Path, TelemetryLogVersion);
+        return;
+    }
+
+    // A closed log is trimmed to its used size, so clamp to what is actually in the file
+    this->IndexCapacity = MappedHeader->IndexCapacity;
+    this->DataCapacity = FileSize - MappedHeader->DataOffset;
+
+    this->Header = MappedHeader;
+    this->Index = reinterpret_cast<const TelemetryLogIndexEntry*>(this->Mapping + MappedHeader->IndexOffset);
+    this->Data = this->Mapping + MappedHeader->DataOffset;
+#else
+    LOG_ERROR("Telemetry logs are not supported on this platform: %s", Path);
+#endif
+}
+
+uint64_t TelemetryLogReader::GetIndexCount() const
+{
+    uint64_t Count = this->Header->IndexCount.load(std::memory_order_acquire);
+    return (Count < this->IndexCapacity) ? Count : this->IndexCapacity;
+}
+
+uint64_t TelemetryLogReader::GetDataSize() const
+{
+    uint64_t Size = this->Header->DataSize.load(std::memory_order_acquire);
+    return (Size < this->DataCapacity) ? Size : this->DataCapacity;
+}
+
+uint64_t TelemetryLogReader::Seek(int64_t Timestamp) const
+{
+    if (!this->Header)
+        return 0;
+
+    // Binary search for the last index entry at or before the timestamp
+    uint64_t Low = 0;
+    uint64_t High = this->GetIndexCount();
+
+    while (Low < High)
+    {
+        uint64_t Middle = Low + (High - Low) / 2;
+
+        if (this->Index[Middle].Timestamp <= Timestamp)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    uint64_t Cursor = (Low == 0) ? 0 : this->Index[Low - 1].Offset;
+
+    // Walk the few records between index entries
+    uint64_t Candidate = Cursor;
+    TelemetryRecord Record;
+
+    while (this->Next(Candidate, Record))
+    {
+        if (Record.Timestamp >= Timestamp)
+            break;
+
+        Cursor = Candidate;
+    }
+
+    return Cursor;
+}
+
+bool TelemetryLogReader::Next(uint64_t &Cursor, TelemetryRecord &Record) const
+{
+    if (!this->Header)
+        return false;
+
+    uint64_t DataSize = this->GetDataSize();
+
+    if (Cursor + sizeof(TelemetryLogRecordHeader) > DataSize)
+        return false;
+
+    const TelemetryLogRecordHeader* RecordHeader = reinterpret_cast<const TelemetryLogRecordHeader*>(this->Data + Cursor);
+    uint64_t RecordSize = AlignRecord(sizeof(TelemetryLogRecordHeader) + RecordHeader->Length);
+
+    if (Cursor + RecordSize > DataSize)
+        return false;
+
+    Record.Timestamp = RecordHeader->Timestamp;
+    Record.Id = RecordHeader->Id;
+    Record.Seq = RecordHeader->Seq;
+    Record.Length = RecordHeader->Length;
+    Record.Payload = this->Data + Cursor + sizeof(TelemetryLogRecordHeader);
+
+    Cursor += RecordSize;
+
+    return true;
+}
+
+int64_t TelemetryLogReader::GetStartTime() const
+{
+    uint64_t Cursor = 0;
+    TelemetryRecord Record;
+
+    return this->Next(Cursor, Record) ? Record.Timestamp : 0;
+}
+
+int64_t TelemetryLogReader::GetEndTime() const
+{
+    if (!this->Header)
+        return 0;
+
+    uint64_t Count = this->GetIndexCount();
+    uint64_t Cursor = (Count == 0) ? 0 : this->Index[Count - 1].Offset;
+
+    int64_t EndTime = 0;
+    TelemetryRecord Record;
+
+    while (this->Next(Cursor, Record))
+        EndTime = Record.Timestamp;
+
+    return EndTime;
+}
+
+int64_t TelemetryLogReader::ToWallTime(int64_t Timestamp) const
+{
+    if (!this->Header)
+        return Timestamp;
+
+    return this->Header->CreateWallTime + (Timestamp - this->Header->CreateTime);
+}
+
+TelemetryLogReader::~TelemetryLogReader()
+{
+#if defined(__linux__)
+    if (this->Mapping)
+        munmap(const_cast<uint8_t*>(this->Mapping), this->MappingSize);
+
+    if (this->FileDescriptor >= 0)
+        close(this->FileDescriptor);
+#endif
+}
@@ -0,0 +1,208 @@
+#ifndef HOST_TELEMETRY_LOG_HPP_
+#define HOST_TELEMETRY_LOG_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <protocol.h>
+
+// Log file layout, all fields little-endian:
+//   Header    One page, TelemetryLogHeader
+//   Index     IndexCapacity TelemetryLogIndexEntry, one every IndexInterval of log time
+//   Data      Records of TelemetryLogRecordHeader followed by the payload, padded to 8 bytes
+//
+// The writer publishes the index and data by advancing the counters in the header, so a
+// reader (even one in another process) never sees a partially written record.
+
+static constexpr char TelemetryLogMagic[8] = {'U', 'U', 'V', 'T', 'L', 'O', 'G', '1'};
+static constexpr uint32_t TelemetryLogVersion = 1;
+
+struct TelemetryLogHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint64_t IndexOffset;
+    uint64_t IndexCapacity;
+    uint64_t DataOffset;
+    uint64_t DataCapacity;
+    int64_t IndexInterval;              // Microseconds of log time between index entries
+    int64_t CreateTime;                 // Monotonic microseconds (av_gettime_relative) when created
+    int64_t CreateWallTime;             // Microseconds since the Unix epoch when created
+    std::atomic<uint64_t> IndexCount;   // Published index entries
+    std::atomic<uint64_t> DataSize;     // Published data bytes
+};
+
+struct TelemetryLogIndexEntry
+{
+    int64_t Timestamp;                  // Timestamp of the first record at Offset
+    uint64_t Offset;                    // Byte offset into the data region
+};
+
+struct TelemetryLogRecordHeader
+{
+    int64_t Timestamp;                  // Receive time, monotonic microseconds
+    uint16_t Length;                    // Payload bytes following the header
+    uint8_t Id;
+    uint8_t Seq;
+    uint32_t Reserved;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Log counters must be lock-free to be shared through the file");
+static_assert(sizeof(TelemetryLogRecordHeader) == 16, "Record header layout changed");
+static_assert(sizeof(TelemetryLogIndexEntry) == 16, "Index entry layout changed");
+
+// A record as seen through the reader. Payload points into the mapped file.
+struct TelemetryRecord
+{
+    int64_t Timestamp;
+    uint8_t Id;
+    uint8_t Seq;
+    uint16_t Length;
+    const uint8_t* Payload;
+};
+
+// Append-only telemetry log written through a preallocated memory-mapped file.
+// Appending never locks, allocates or makes a syscall, so it is safe to call from the serial
+// transfer thread at full message rate. Only one thread may append.
+
+class TelemetryLog
+{
+private:
+    int FileDescriptor;
+
+    uint8_t* Mapping;
+    size_t MappingSize;
+
+    TelemetryLogHeader* Header;
+    TelemetryLogIndexEntry* Index;
+    uint8_t* Data;
+
+    // Writer's own copies of the published counters
+    uint64_t IndexCount;
+    uint64_t DataSize;
+    int64_t NextIndexTime;
+
+    std::atomic<uint64_t> DroppedRecords;
+
+public:
+    /**
+     * @brief Creates a log file and maps it, reserving all of its disk space up front.
+     * @param Path Path of the log file to create. An existing file is replaced.
+     * @param Capacity Bytes reserved for records. Records past this are dropped.
+     * @param IndexInterval Microseconds of log time between index entries.
+	 */
+    TelemetryLog(const char* Path, uint64_t Capacity, int64_t IndexInterval = 100000);
+
+    /**
+     * @brief Gets whether the log file is open for appending.
+     * @returns True if the log is open.
+	 */
+    bool IsOpen() {return this->Header != nullptr;}
+
+    /**
+     * @brief Appends a record. Lock-free, single writer only.
+     * @param Timestamp Receive time in monotonic microseconds, must not decrease between calls.
+     * @param Id Message identifier.
+     * @param Seq Message sequence number.
+     * @param Payload Payload bytes.
+     * @param Length Payload size.
+     * @returns Error status
+	 */
+    int Append(int64_t Timestamp, uint8_t Id, uint8_t Seq, const uint8_t* Payload, uint16_t Length);
+
+    /**
+     * @brief Appends a protocol frame. Lock-free, single writer only.
+     * @param Frame Decoded frame to log.
+     * @param Timestamp Receive time in monotonic microseconds.
+     * @returns Error status
+	 */
+    int Append(const protocol_frame_t& Frame, int64_t Timestamp) {return this->Append(Timestamp, Frame.id, Frame.seq, Frame.payload, Frame.length);}
+
+    /**
+     * @brief Gets the number of records dropped because the log was full.
+     * @returns Number of dropped records.
+	 */
+    uint64_t GetDroppedRecords() {return this->DroppedRecords;}
+
+    /**
+     * @brief Flushes the log and trims the unused reservation from the file.
+	 */
+    ~TelemetryLog();
+};
+
+// Read-only view of a log file. Seeking uses the time index and records are read in place,
+// so opening and scrubbing a multi-gigabyte log costs no more than touching the pages used.
+// A log that is still being written can be read; new records appear as they are published.
+
+class TelemetryLogReader
+{
+private:
+    int FileDescriptor;
+
+    const uint8_t* Mapping;
+    size_t MappingSize;
+
+    const TelemetryLogHeader* Header;
+    const TelemetryLogIndexEntry* Index;
+    const uint8_t* Data;
+
+    uint64_t IndexCapacity;
+    uint64_t DataCapacity;
+
+    uint64_t GetIndexCount() const;
+
+    uint64_t GetDataSize() const;
+
+public:
+    /**
+     * @brief Opens and maps a log file.
+     * @param Path Path of the log file.
+	 */
+    TelemetryLogReader(const char* Path);
+
+    /**
+     * @brief Gets whether the log file was opened and is valid.
+     * @returns True if the log is open.
+	 */
+    bool IsOpen() const {return this->Header != nullptr;}
+
+    /**
+     * @brief Finds the first record at or after a timestamp in O(log n).
+     * @param Timestamp Log time in monotonic microseconds.
+     * @returns Cursor to pass to Next.
+	 */
+    uint64_t Seek(int64_t Timestamp) const;
+
+    /**
+     * @brief Reads the record at a cursor and advances the cursor past it.
+     * @param Cursor Cursor from Seek or a previous call to Next.
+     * @param Record Set to the record, which points into the mapped file.
+     * @returns False once there are no more published records.
+	 */
+    bool Next(uint64_t& Cursor, TelemetryRecord& Record) const;
+
+    /**
+     * @brief Gets the timestamp of the first record.
+     * @returns Timestamp in monotonic microseconds, or 0 if the log is empty.
+	 */
+    int64_t GetStartTime() const;
+
+    /**
+     * @brief Gets the timestamp of the last record. Walks forward from the last index entry.
+     * @returns Timestamp in monotonic microseconds, or 0 if the log is empty.
+	 */
+    int64_t GetEndTime() const;
+
+    /**
+     * @brief Converts a log timestamp to wall-clock time using the time the log was created.
+     * @param Timestamp Log time in monotonic microseconds.
+     * @returns Microseconds since the Unix epoch.
+	 */
+    int64_t ToWallTime(int64_t Timestamp) const;
+
+    ~TelemetryLogReader();
+};
+
+#endif // HOST_TELEMETRY_LOG_HPP_
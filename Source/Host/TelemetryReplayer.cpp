@@ -0,0 +1,88 @@
+#include "TelemetryReplayer.hpp"
+
+#include <chrono>
+
+#include "Trace.hpp"
+
+// Replay granularity, fine enough for 100 Hz telemetry
+static constexpr int64_t ReplayInterval = 5000;
+
+// After a seek, messages this far before the target are replayed at once to restore state
+static constexpr int64_t SeekPreroll = 1000000;
+
+TelemetryReplayer::TelemetryReplayer(const char *Path, Telemetry *TargetPtr) : Reader(Path)
+{
+    this->Target = TargetPtr;
+    this->Clock = nullptr;
+    this->bReplayLoop = false;
+}
+
+// Main thread
+
+void TelemetryReplayer::StartReplayLoop(ReplayClock *ClockPtr)
+{
+    this->Clock = ClockPtr;
+    this->bReplayLoop = true;
+
+    // Start thread
+    this->ReplayThread = std::thread([this] { this->ReplayLoop(); });
+}
+
+// Replay thread
+
+void TelemetryReplayer::ReplayLoop()
+{
+    TRACE_THREAD("TelemetryReplay");
+
+    uint64_t Generation = this->Clock->GetSeekGeneration();
+    uint64_t Cursor = this->Reader.Seek(this->Clock->Now() - SeekPreroll);
+
+    TelemetryRecord Record;
+    bool bHasRecord = false;
+
+    while (this->bReplayLoop)
+    {
+        uint64_t CurrentGeneration = this->Clock->GetSeekGeneration();
+
+        if (CurrentGeneration != Generation)
+        {
+            Generation = CurrentGeneration;
+            Cursor = this->Reader.Seek(this->Clock->Now() - SeekPreroll);
+            bHasRecord = false;
+        }
+
+        int64_t Now = this->Clock->Now();
+
+        // Records are read in place from the log, nothing is copied until Telemetry keeps a message
+        while (true)
+        {
+            if (!bHasRecord && !this->Reader.Next(Cursor, Record))
+                break;
+
+            bHasRecord = true;
+
+            if (Record.Timestamp > Now)
+                break;
+
+            protocol_frame_t Frame;
+            Frame.id = Record.Id;
+            Frame.seq = Record.Seq;
+            Frame.length = static_cast<uint8_t>(Record.Length);
+            Frame.payload = Record.Payload;
+
+            this->Target->Inject(Frame, Record.Timestamp);
+            bHasRecord = false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(ReplayInterval));
+    }
+}
+
+TelemetryReplayer::~TelemetryReplayer()
+{
+    this->bReplayLoop = false;
+
+    // Wait for replay thread to finish
+    if (this->ReplayThread.joinable())
+        this->ReplayThread.join();
+}
@@ -0,0 +1,55 @@
+#ifndef HOST_TELEMETRY_REPLAYER_HPP_
+#define HOST_TELEMETRY_REPLAYER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "ReplayClock.hpp"
+#include "Telemetry.hpp"
+#include "TelemetryLog.hpp"
+
+// Feeds logged telemetry back through a Telemetry object in time with a replay clock,
+// so everything downstream sees the same messages it would have seen live.
+
+class TelemetryReplayer
+{
+private:
+    TelemetryLogReader Reader;
+
+    Telemetry* Target;
+    ReplayClock* Clock;
+
+    std::atomic<bool> bReplayLoop;
+    std::thread ReplayThread;
+
+    void ReplayLoop();
+
+public:
+    /**
+     * @brief Opens a telemetry log for replay.
+     * @param Path Path of the telemetry log.
+     * @param TargetPtr Pointer to the telemetry object replayed messages are passed to.
+	 */
+    TelemetryReplayer(const char* Path, Telemetry* TargetPtr);
+
+    /**
+     * @brief Gets whether the log was opened.
+     * @returns True if the log is open.
+	 */
+    bool IsOpen() {return this->Reader.IsOpen();}
+
+    int64_t GetStartTime() {return this->Reader.GetStartTime();}
+
+    int64_t GetEndTime() {return this->Reader.GetEndTime();}
+
+    /**
+     * @brief Spawns new thread to replay messages as the clock passes them.
+     * @param ClockPtr Pointer to the clock shared with the rest of the replay.
+	 */
+    void StartReplayLoop(ReplayClock* ClockPtr);
+
+    ~TelemetryReplayer();
+};
+
+#endif // HOST_TELEMETRY_REPLAYER_HPP_
@@ -0,0 +1,140 @@
+#include "ThreadPool.hpp"
+
+#include "Trace.hpp"
+
+// Worker the calling thread belongs to, or none
+static thread_local const ThreadPool* CurrentPool = nullptr;
+static thread_local size_t CurrentWorker = 0;
+
+ThreadPool::ThreadPool(size_t ThreadCount, size_t MaximumTasks)
+{
+    this->MaximumPending = (MaximumTasks > 0) ? MaximumTasks : 1;
+    this->Pending = 0;
+    this->Queued = 0;
+    this->NextWorker = 0;
+    this->bWorkerLoop = true;
+
+    size_t Count = (ThreadCount > 0) ? ThreadCount : 1;
+
+    for (size_t i = 0; i < Count; i++)
+        this->Workers.push_back(std::make_unique<Worker>());
+
+    // Start threads once every deque exists, since workers steal from each other
+    for (size_t i = 0; i < Count; i++)
+        this->Workers[i]->Thread = std::thread([this, i] { this->WorkerLoop(i); });
+}
+
+// Any thread
+
+bool ThreadPool::TrySubmit(PoolTask Task)
+{
+    if (this->Pending.fetch_add(1, std::memory_order_acq_rel) >= this->MaximumPending)
+    {
+        this->Pending.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Keep work submitted by a task on its own worker, cache warm, others spread round robin
+    size_t Index = (CurrentPool == this) ? CurrentWorker : this->NextWorker.fetch_add(1, std::memory_order_relaxed) % this->Workers.size();
+
+    {
+        std::lock_guard<std::mutex> Lock(this->Workers[Index]->Mutex);
+        this->Workers[Index]->Tasks.push_back(std::move(Task));
+    }
+
+    this->Queued.fetch_add(1, std::memory_order_release);
+
+    {
+        // Taken so a worker between checking for work and sleeping cannot miss the wake
+        std::lock_guard<std::mutex> Lock(this->WakeMutex);
+    }
+
+    this->WakeCondition.notify_one();
+
+    return true;
+}
+
+// Worker threads
+
+bool ThreadPool::TryPop(size_t Index, PoolTask &Task)
+{
+    // Own deque newest first
+    {
+        Worker& Own = *this->Workers[Index];
+        std::lock_guard<std::mutex> Lock(Own.Mutex);
+
+        if (!Own.Tasks.empty())
+        {
+            Task = std::move(Own.Tasks.back());
+            Own.Tasks.pop_back();
+            this->Queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of another worker
+    for (size_t i = 1; i < this->Workers.size(); i++)
+    {
+        Worker& Victim = *this->Workers[(Index + i) % this->Workers.size()];
+        std::lock_guard<std::mutex> Lock(Victim.Mutex);
+
+        if (!Victim.Tasks.empty())
+        {
+            Task = std::move(Victim.Tasks.front());
+            Victim.Tasks.pop_front();
+            this->Queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::WorkerLoop(size_t Index)
+{
+    TRACE_THREAD("Worker");
+
+    CurrentPool = this;
+    CurrentWorker = Index;
+
+    while (true)
+    {
+        PoolTask Task;
+
+        if (this->TryPop(Index, Task))
+        {
+            Task();
+            this->Pending.fetch_sub(1, std::memory_order_acq_rel);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> Lock(this->WakeMutex);
+
+        // Finish outstanding tasks before exiting
+        if (!this->bWorkerLoop && this->Queued.load(std::memory_order_acquire) == 0)
+            return;
+
+        // Checked under the lock submitters take before notifying, so a wake cannot be missed
+        if (this->Queued.load(std::memory_order_acquire) > 0)
+            continue;
+
+        this->WakeCondition.wait(Lock);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> Lock(this->WakeMutex);
+        this->bWorkerLoop = false;
+    }
+
+    this->WakeCondition.notify_all();
+
+    // Wait for worker threads to finish
+    for (std::unique_ptr<Worker>& Each : this->Workers)
+    {
+        if (Each->Thread.joinable())
+            Each->Thread.join();
+    }
+}
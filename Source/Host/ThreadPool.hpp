@@ -0,0 +1,80 @@
+#ifndef HOST_THREAD_POOL_HPP_
+#define HOST_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using PoolTask = std::function<void()>;
+
+// Fixed-size work-stealing thread pool. Each worker has its own deque: tasks submitted from a
+// worker go on its own deque and it takes its newest first, while idle workers steal the
+// oldest tasks from the others. Submission is bounded and fails instead of queueing without
+// limit, so callers can drop work when the pool is saturated.
+
+class ThreadPool
+{
+private:
+    struct Worker
+    {
+        std::mutex Mutex;
+        std::deque<PoolTask> Tasks;
+        std::thread Thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> Workers;
+
+    size_t MaximumPending;
+    std::atomic<size_t> Pending;        // Queued or running, for the submission bound
+    std::atomic<size_t> Queued;         // Waiting in a deque, for waking workers
+    std::atomic<size_t> NextWorker;
+
+    std::mutex WakeMutex;
+    std::condition_variable WakeCondition;
+
+    std::atomic<bool> bWorkerLoop;
+
+    bool TryPop(size_t Index, PoolTask& Task);
+
+    void WorkerLoop(size_t Index);
+
+public:
+    /**
+     * @brief Starts the worker threads.
+     * @param ThreadCount Number of workers, at least 1.
+     * @param MaximumTasks Most tasks queued or running at once.
+	 */
+    ThreadPool(size_t ThreadCount, size_t MaximumTasks);
+
+    /**
+     * @brief Queues a task unless the pool is saturated. Never blocks.
+     * @param Task Function to run on a worker.
+     * @returns True if queued, false if the pool already has its maximum tasks.
+	 */
+    bool TrySubmit(PoolTask Task);
+
+    /**
+     * @brief Gets the number of tasks queued or running.
+     * @returns Number of tasks as a size_t.
+	 */
+    size_t GetPending() {return this->Pending.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief Gets the number of worker threads.
+     * @returns Number of workers as a size_t.
+	 */
+    size_t GetThreadCount() {return this->Workers.size();}
+
+    /**
+     * @brief Runs the remaining queued tasks and stops the workers.
+	 */
+    ~ThreadPool();
+};
+
+#endif // HOST_THREAD_POOL_HPP_
@@ -0,0 +1,390 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+
+#if defined(HOST_TRACE)
+// Zones kept, the oldest are overwritten. About ten seconds of every zone at 60 FPS.
+static constexpr size_t TraceCapacity = 1 << 18;
+#else
+static constexpr size_t TraceCapacity = 1;
+#endif
+
+// Each slot is a seqlock so export can run while zones are being written. Fields are
+// relaxed atomics only so the concurrent read is defined; on x86 they are plain moves.
+struct TraceSlot
+{
+    std::atomic<uint64_t> Sequence;     // 2 * index + 1 while writing, 2 * index + 2 when complete
+    std::atomic<int64_t> Start;
+    std::atomic<int64_t> End;
+    std::atomic<const char*> Name;
+    std::atomic<uint32_t> ThreadId;
+};
+
+struct TraceZone
+{
+    int64_t Start;
+    int64_t End;
+    const char* Name;
+    uint32_t ThreadId;
+};
+
+static TraceSlot Slots[TraceCapacity];
+static std::atomic<uint64_t> NextSlot{0};
+
+static std::atomic<uint32_t> NextThreadId{1};
+
+static std::mutex ThreadNameMutex;
+static std::vector<std::pair<uint32_t, const char*>> ThreadNames;
+
+static uint32_t GetThreadId()
+{
+    thread_local uint32_t ThreadId = NextThreadId.fetch_add(1, std::memory_order_relaxed);
+    return ThreadId;
+}
+
+bool Trace::IsEnabled()
+{
+#if defined(HOST_TRACE)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Any thread
+
+int64_t Trace::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::Record(const char *Name, int64_t Start, int64_t End)
+{
+    uint64_t Index = NextSlot.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& Slot = Slots[Index % TraceCapacity];
+
+    Slot.Sequence.store(2 * Index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Slot.Start.store(Start, std::memory_order_relaxed);
+    Slot.End.store(End, std::memory_order_relaxed);
+    Slot.Name.store(Name, std::memory_order_relaxed);
+    Slot.ThreadId.store(GetThreadId(), std::memory_order_relaxed);
+
+    Slot.Sequence.store(2 * Index + 2, std::memory_order_release);
+}
+
+void Trace::SetThreadName(const char *Name)
+{
+    uint32_t ThreadId = GetThreadId();
+
+    std::lock_guard<std::mutex> Lock(ThreadNameMutex);
+
+    for (auto& Each : ThreadNames)
+    {
+        if (Each.first == ThreadId)
+        {
+            Each.second = Name;
+            return;
+        }
+    }
+
+    ThreadNames.emplace_back(ThreadId, Name);
+}
+
+// Export
+
+// Copies out every complete zone still in the ring, skipping any being overwritten
+static std::vector<TraceZone> CollectZones()
+{
+    std::vector<TraceZone> Zones;
+
+    uint64_t End = NextSlot.load(std::memory_order_acquire);
+    uint64_t Begin = (End > TraceCapacity) ? End - TraceCapacity : 0;
+
+    Zones.reserve(static_cast<size_t>(End - Begin));
+
+    for (uint64_t Index = Begin; Index < End; Index++)
+    {
+        TraceSlot& Slot = Slots[Index % TraceCapacity];
+
+        uint64_t Sequence = Slot.Sequence.load(std::memory_order_acquire);
+
+        if (Sequence != 2 * Index + 2)
+            continue;
+
+        TraceZone Zone;
+        Zone.Start = Slot.Start.load(std::memory_order_relaxed);
+        Zone.End = Slot.End.load(std::memory_order_relaxed);
+        Zone.Name = Slot.Name.load(std::memory_order_relaxed);
+        Zone.ThreadId = Slot.ThreadId.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (Slot.Sequence.load(std::memory_order_relaxed) != Sequence)
+            continue;
+
+        Zones.push_back(Zone);
+    }
+
+    // Outer zones first when nested zones start together, so viewers nest them properly
+    std::sort(Zones.begin(), Zones.end(), [](const TraceZone& A, const TraceZone& B)
+    {
+        if (A.ThreadId != B.ThreadId)
+            return A.ThreadId < B.ThreadId;
+
+        if (A.Start != B.Start)
+            return A.Start < B.Start;
+
+        return A.End > B.End;
+    });
+
+    return Zones;
+}
+
+static std::vector<std::pair<uint32_t, const char*>> CollectThreadNames()
+{
+    std::lock_guard<std::mutex> Lock(ThreadNameMutex);
+    return ThreadNames;
+}
+
+static std::string EscapeJson(const char* Text)
+{
+    std::string Escaped;
+
+    for (const char* Each = Text; *Each; Each++)
+    {
+        if (*Each == '"' || *Each == '\\')
+            Escaped += '\\';
+
+        Escaped += *Each;
+    }
+
+    return Escaped;
+}
+
+int Trace::ExportChrome(const char *Path)
+{
+    if (!IsEnabled())
+    {
+        LOG_WARNING("Tracing is not compiled in, configure with -DHOST_TRACE=ON");
+        return -1;
+    }
+
+    std::vector<TraceZone> Zones = CollectZones();
+
+    FILE* File = fopen(Path, "w");
+
+    if (!File)
+    {
+        LOG_ERROR("Failed to create trace %s", Path);
+        return -1;
+    }
+
+    int64_t Origin = Zones.empty() ? 0 : std::min_element(Zones.begin(), Zones.end(), [](const TraceZone& A, const TraceZone& B) { return A.Start < B.Start; })->Start;
+
+    fprintf(File, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool bIsFirst = true;
+
+    for (const auto& Each : CollectThreadNames())
+    {
+        fprintf(File, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", bIsFirst ? "" : ",\n", Each.first, EscapeJson(Each.second).c_str());
+        bIsFirst = false;
+    }
+
+    // Complete events in microseconds, with nanosecond fractions
+    for (const TraceZone& Zone : Zones)
+    {
+        fprintf(File, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", bIsFirst ? "" : ",\n", EscapeJson(Zone.Name).c_str(), Zone.ThreadId, (Zone.Start - Origin) / 1000.0, (Zone.End - Zone.Start) / 1000.0);
+        bIsFirst = false;
+    }
+
+    fprintf(File, "\n]}\n");
+
+    if (fclose(File) != 0)
+    {
+        LOG_ERROR("Failed to write trace %s", Path);
+        return -1;
+    }
+
+    LOG_INFO("Wrote %zu trace zones to %s", Zones.size(), Path);
+
+    return 0;
+}
+
+// Minimal protobuf encoding for the few Perfetto messages used
+
+static void PutVarint(std::string& Out, uint64_t Value)
+{
+    while (Value >= 0x80)
+    {
+        Out += static_cast<char>((Value & 0x7F) | 0x80);
+        Value >>= 7;
+    }
+
+    Out += static_cast<char>(Value);
+}
+
+static void PutVarintField(std::string& Out, uint32_t Field, uint64_t Value)
+{
+    PutVarint(Out, (static_cast<uint64_t>(Field) << 3) | 0);
+    PutVarint(Out, Value);
+}
+
+static void PutBytesField(std::string& Out, uint32_t Field, const std::string& Value)
+{
+    PutVarint(Out, (static_cast<uint64_t>(Field) << 3) | 2);
+    PutVarint(Out, Value.size());
+    Out += Value;
+}
+
+// Field numbers from perfetto/protos/perfetto/trace
+enum PerfettoField : uint32_t
+{
+    TracePacketField = 1,                   // Trace.packet
+
+    PacketTimestamp = 8,                    // TracePacket
+    PacketSequenceId = 10,
+    PacketTrackEvent = 11,
+    PacketSequenceFlags = 13,
+    PacketTrackDescriptor = 60,
+
+    EventType = 9,                          // TrackEvent
+    EventTrackUuid = 11,
+    EventName = 23,
+
+    DescriptorUuid = 1,                     // TrackDescriptor
+    DescriptorName = 2,
+    DescriptorThread = 4,
+
+    ThreadPid = 1,                          // ThreadDescriptor
+    ThreadTid = 2,
+    ThreadName = 5
+};
+
+static constexpr uint64_t SliceBegin = 1;
+static constexpr uint64_t SliceEnd = 2;
+static constexpr uint64_t IncrementalStateCleared = 1;
+
+static void PutSliceEvent(std::string& Out, uint32_t ThreadId, int64_t Time, uint64_t Type, const char* Name)
+{
+    std::string Event;
+    PutVarintField(Event, EventType, Type);
+    PutVarintField(Event, EventTrackUuid, ThreadId);
+
+    if (Name)
+        PutBytesField(Event, EventName, Name);
+
+    std::string Packet;
+    PutVarintField(Packet, PacketTimestamp, static_cast<uint64_t>(Time));
+    PutVarintField(Packet, PacketSequenceId, ThreadId);
+    PutBytesField(Packet, PacketTrackEvent, Event);
+
+    PutBytesField(Out, TracePacketField, Packet);
+}
+
+int Trace::ExportPerfetto(const char *Path)
+{
+    if (!IsEnabled())
+    {
+        LOG_WARNING("Tracing is not compiled in, configure with -DHOST_TRACE=ON");
+        return -1;
+    }
+
+    std::vector<TraceZone> Zones = CollectZones();
+    std::vector<std::pair<uint32_t, const char*>> Names = CollectThreadNames();
+
+    std::string Out;
+
+    // One track per thread, each on its own packet sequence. Track uuids are the thread ids.
+    std::vector<uint32_t> Threads;
+
+    for (const TraceZone& Zone : Zones)
+    {
+        if (Threads.empty() || Threads.back() != Zone.ThreadId)
+            Threads.push_back(Zone.ThreadId);
+    }
+
+    for (uint32_t ThreadId : Threads)
+    {
+        const char* Name = "Thread";
+
+        for (const auto& Each : Names)
+        {
+            if (Each.first == ThreadId)
+                Name = Each.second;
+        }
+
+        std::string Thread;
+        PutVarintField(Thread, ThreadPid, 1);
+        PutVarintField(Thread, ThreadTid, ThreadId);
+        PutBytesField(Thread, ThreadName, Name);
+
+        std::string Descriptor;
+        PutVarintField(Descriptor, DescriptorUuid, ThreadId);
+        PutBytesField(Descriptor, DescriptorName, Name);
+        PutBytesField(Descriptor, DescriptorThread, Thread);
+
+        std::string Packet;
+        PutVarintField(Packet, PacketSequenceId, ThreadId);
+        PutVarintField(Packet, PacketSequenceFlags, IncrementalStateCleared);
+        PutBytesField(Packet, PacketTrackDescriptor, Descriptor);
+
+        PutBytesField(Out, TracePacketField, Packet);
+    }
+
+    // Zones become begin and end pairs, so nested zones must close innermost first
+    std::vector<int64_t> OpenEnds;
+    uint32_t CurrentThread = 0;
+
+    for (const TraceZone& Zone : Zones)
+    {
+        if (Zone.ThreadId != CurrentThread)
+        {
+            for (; !OpenEnds.empty(); OpenEnds.pop_back())
+                PutSliceEvent(Out, CurrentThread, OpenEnds.back(), SliceEnd, nullptr);
+
+            CurrentThread = Zone.ThreadId;
+        }
+
+        for (; !OpenEnds.empty() && OpenEnds.back() <= Zone.Start; OpenEnds.pop_back())
+            PutSliceEvent(Out, CurrentThread, OpenEnds.back(), SliceEnd, nullptr);
+
+        PutSliceEvent(Out, CurrentThread, Zone.Start, SliceBegin, Zone.Name);
+
+        // A zone overlapping its parent's end can only come from clock skew, clip it
+        OpenEnds.push_back(OpenEnds.empty() ? Zone.End : std::min(Zone.End, OpenEnds.back()));
+    }
+
+    for (; !OpenEnds.empty(); OpenEnds.pop_back())
+        PutSliceEvent(Out, CurrentThread, OpenEnds.back(), SliceEnd, nullptr);
+
+    FILE* File = fopen(Path, "wb");
+
+    if (!File)
+    {
+        LOG_ERROR("Failed to create trace %s", Path);
+        return -1;
+    }
+
+    size_t Written = fwrite(Out.data(), 1, Out.size(), File);
+
+    if (fclose(File) != 0 || Written != Out.size())
+    {
+        LOG_ERROR("Failed to write trace %s", Path);
+        return -1;
+    }
+
+    LOG_INFO("Wrote %zu trace zones to %s", Zones.size(), Path);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef HOST_TRACE_HPP_
+#define HOST_TRACE_HPP_
+
+#include <cstdint>
+
+// Scoped trace zones, compiled in with the HOST_TRACE CMake option. Without it the macros
+// expand to nothing and the hot paths carry no trace code at all.
+//
+//   TRACE_THREAD("Decode");     Names the calling thread in exported traces
+//   TRACE_SCOPE("Upload");      Records a zone from here to the end of the enclosing scope
+//
+// Names must be string literals, only the pointer is stored.
+
+#if defined(HOST_TRACE)
+
+#define TRACE_CONCAT_INNER(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_INNER(A, B)
+
+#define TRACE_SCOPE(Name) TraceScope TRACE_CONCAT(TraceZone, __LINE__)(Name)
+#define TRACE_THREAD(Name) Trace::SetThreadName(Name)
+
+#else
+
+#define TRACE_SCOPE(Name) ((void) 0)
+#define TRACE_THREAD(Name) ((void) 0)
+
+#endif
+
+// Process-wide trace buffer. Zones are written to a fixed ring with one atomic increment and
+// no locks, so the most recent zones are always available to export when a stall is reported.
+
+class Trace
+{
+public:
+    /**
+     * @brief Gets whether tracing was compiled in.
+     * @returns True if built with HOST_TRACE.
+	 */
+    static bool IsEnabled();
+
+    /**
+     * @brief Gets the trace clock.
+     * @returns Steady clock time in nanoseconds.
+	 */
+    static int64_t Now();
+
+    /**
+     * @brief Records a completed zone. Lock-free, any thread.
+     * @param Name Zone name, must be a string literal.
+     * @param Start Zone start time from Now.
+     * @param End Zone end time from Now.
+	 */
+    static void Record(const char* Name, int64_t Start, int64_t End);
+
+    /**
+     * @brief Names the calling thread in exported traces.
+     * @param Name Thread name, must be a string literal.
+	 */
+    static void SetThreadName(const char* Name);
+
+    /**
+     * @brief Writes the zones in the buffer as Chrome trace event JSON (chrome://tracing, Perfetto UI).
+     * @param Path Path of the file to write.
+     * @returns Error status
+	 */
+    static int ExportChrome(const char* Path);
+
+    /**
+     * @brief Writes the zones in the buffer as a Perfetto protobuf trace (ui.perfetto.dev, trace_processor).
+     * @param Path Path of the file to write.
+     * @returns Error status
+	 */
+    static int ExportPerfetto(const char* Path);
+};
+
+// Records the zone it is alive for, use through TRACE_SCOPE
+class TraceScope
+{
+private:
+    const char* Name;
+    int64_t Start;
+
+public:
+    explicit TraceScope(const char* ZoneName) : Name(ZoneName), Start(Trace::Now()) {}
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope() {Trace::Record(this->Name, this->Start, Trace::Now());}
+};
+
+#endif // HOST_TRACE_HPP_
@@ -1,19 +1,29 @@
 #include "VideoReceiver.hpp"
 
-#include <cstdio>
+#include "Logger.hpp"
+#include "Trace.hpp"
 
-VideoReceiver::VideoReceiver(const char *Url, FrameBuffer *BufferPtr)
+extern "C" {
+#include <libavutil/time.h>
+}
+
+VideoReceiver::VideoReceiver(const char *Url, FrameBus *BusPtr, Metrics *StatsPtr)
 {
     this->FormatContext = nullptr;
     this->CodecContext = nullptr;
     this->VideoStream = nullptr;
     this->VideoStreamIndex = 0;
     
-    this->Buffer = BufferPtr;
+    this->Bus = BusPtr;
+    this->Stats = StatsPtr;
+    this->Relay = nullptr;
 
     this->Packet = av_packet_alloc();
     this->Frame = av_frame_alloc();
 
+    this->bRecordChanged = false;
+    this->bIsRecording = false;
+
     // Init FFMpeg stuff, ignore errors for now
     this->Init(Url);
 }
@@ -27,14 +37,14 @@ int VideoReceiver::Init(const char *Url)
     // Autodetects global stream format
     if (avformat_open_input(&this->FormatContext, Url, nullptr, nullptr) < 0) 
     {
-        fprintf(stderr, "Failed to open stream\n");
+        LOG_ERROR("Failed to open stream");
         return -1;
     }
 
     // Reads packets to infer stream-specific format info
     if (avformat_find_stream_info(this->FormatContext, nullptr) < 0) 
     {
-        fprintf(stderr, "No stream info\n");
+        LOG_ERROR("No stream info");
         return -1;
     }
 
@@ -55,7 +65,7 @@ int VideoReceiver::Init(const char *Url)
 
     if (this->VideoStreamIndex < 0)
     {
-        fprintf(stderr, "No video stream\n");
+        LOG_ERROR("No video stream");
         return -1;
     }
 
@@ -104,14 +114,81 @@ void VideoReceiver::StartReceiveLoop()
     this->NetThread = std::thread([this] { this->DecodeLoop(); });
 }
 
+void VideoReceiver::SetRelay(PacketRelay *RelayPtr)
+{
+    this->Relay = RelayPtr;
+
+    if (this->Relay && this->VideoStream)
+        this->Relay->SetCodecParameters(this->VideoStream->codecpar);
+}
+
+void VideoReceiver::StartRecording(const char *Path)
+{
+    {
+        std::lock_guard<std::mutex> Lock(this->RecordMutex);
+        this->RecordPath = Path;
+    }
+
+    this->bIsRecording = true;
+    this->bRecordChanged = true;
+}
+
+void VideoReceiver::StopRecording()
+{
+    {
+        std::lock_guard<std::mutex> Lock(this->RecordMutex);
+        this->RecordPath.clear();
+    }
+
+    this->bIsRecording = false;
+    this->bRecordChanged = true;
+}
+
+// Network thread
+
+void VideoReceiver::UpdateRecorder()
+{
+    std::string Path;
+
+    {
+        std::lock_guard<std::mutex> Lock(this->RecordMutex);
+        Path = this->RecordPath;
+    }
+
+    // Finish the previous file before starting a new one
+    this->Recorder.reset();
+
+    if (!Path.empty() && this->VideoStream)
+    {
+        this->Recorder = std::make_unique<VideoRecorder>(Path.c_str(), this->VideoStream->codecpar);
+
+        if (!this->Recorder->IsOpen())
+        {
+            this->Recorder.reset();
+            this->bIsRecording = false;
+        }
+    }
+}
+
 void VideoReceiver::DecodeLoop()
 {
+    TRACE_THREAD("Decode");
+
     while(this->bNetLoop)
     {
         // Get packet from the network
-        if (av_read_frame(this->FormatContext, this->Packet) < 0)
+        int ReadStatus;
+
+        {
+            TRACE_SCOPE("ReadPacket");
+            ReadStatus = av_read_frame(this->FormatContext, this->Packet);
+        }
+
+        if (ReadStatus < 0)
             continue;
         
+        int64_t ReceiveTime = av_gettime_relative();
+
         // Check packet contains video info
         if (this->Packet->stream_index != this->VideoStreamIndex)
         {
@@ -119,6 +196,23 @@ void VideoReceiver::DecodeLoop()
             continue;
         }
 
+        this->Stats->Add(Counter::BytesReceived, this->Packet->size);
+
+        if (this->bRecordChanged.exchange(false))
+            this->UpdateRecorder();
+
+        if (this->Recorder && this->Recorder->Write(this->Packet, ReceiveTime) < 0)
+        {
+            this->Recorder.reset();
+            this->bIsRecording = false;
+        }
+
+        // Only takes a reference, never waits on viewers
+        if (this->Relay)
+            this->Relay->Publish(this->Packet);
+
+        TRACE_SCOPE("Decode");
+
         // Enqueue packet for decoding
         if (avcodec_send_packet(this->CodecContext, this->Packet) != 0)
         {
@@ -131,7 +225,10 @@ void VideoReceiver::DecodeLoop()
 
         while (avcodec_receive_frame(this->CodecContext, this->Frame) == 0)
         {
-            Buffer->Push(this->Frame);
+            this->Stats->Record(Timing::Decode, (av_gettime_relative() - ReceiveTime) / 1000.0);
+            this->Stats->Add(Counter::FramesDecoded, 1);
+
+            this->Bus->Publish(this->Frame, ReceiveTime);
             av_frame_unref(this->Frame);
         }
     }
@@ -145,6 +242,9 @@ VideoReceiver::~VideoReceiver()
     if (this->NetThread.joinable())
         this->NetThread.join();
 
+    // Finish any recording before the stream it refers to is closed
+    this->Recorder.reset();
+
     av_packet_free(&this->Packet);
     av_frame_free(&this->Frame);
     avcodec_free_context(&this->CodecContext);
@@ -2,9 +2,15 @@
 #define HOST_VIDEO_RECEIVER_HPP_
 
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 
-#include "FrameBuffer.hpp"
+#include "FrameBus.hpp"
+#include "Metrics.hpp"
+#include "PacketRelay.hpp"
+#include "VideoRecorder.hpp"
 
 // Asynchronous video receiver using FFMpeg
 
@@ -16,7 +22,9 @@ private:
     AVStream* VideoStream;
     int VideoStreamIndex;
 
-    FrameBuffer* Buffer;
+    FrameBus* Bus;
+    Metrics* Stats;
+    PacketRelay* Relay;
 
     AVPacket* Packet;
     AVFrame* Frame;
@@ -24,18 +32,30 @@ private:
     std::atomic<bool> bNetLoop;
     std::thread NetThread;
 
+    // Recording requests from the main thread, applied by the network thread between packets
+    std::mutex RecordMutex;
+    std::string RecordPath;
+    std::atomic<bool> bRecordChanged;
+    std::atomic<bool> bIsRecording;
+
+    // Owned by the network thread
+    std::unique_ptr<VideoRecorder> Recorder;
+
     // Init FFMpeg data objects
     int Init(const char* Url);
 
+    void UpdateRecorder();
+
     void DecodeLoop();
     
 public:
     /**
      * @brief Creates asynchronous FFMpeg video receiver.
      * @param Url Url for network connection to video server.
-     * @param BufferPtr Pointer to frame buffer object to put frame objects in.
+     * @param BusPtr Pointer to frame bus to publish decoded frames on.
+     * @param StatsPtr Pointer to metrics object to record decode statistics in.
 	 */
-    VideoReceiver(const char* Url, FrameBuffer* BufferPtr);
+    VideoReceiver(const char* Url, FrameBus* BusPtr, Metrics* StatsPtr);
     
     int GetVideoWidth();
     
@@ -46,6 +66,30 @@ public:
 	 */
     void StartReceiveLoop();
 
+    /**
+     * @brief Sets a relay to re-serve received packets to other viewers.
+     * @param RelayPtr Pointer to packet relay, which must outlive the receiver.
+     * @note Must be set before the receive loop is started.
+	 */
+    void SetRelay(PacketRelay* RelayPtr);
+
+    /**
+     * @brief Starts remuxing received packets to a file, replacing any current recording.
+     * @param Path Path of the Matroska file to write.
+	 */
+    void StartRecording(const char* Path);
+
+    /**
+     * @brief Stops recording and finishes the file.
+	 */
+    void StopRecording();
+
+    /**
+     * @brief Gets whether a recording has been requested.
+     * @returns True if recording.
+	 */
+    bool IsRecording() {return this->bIsRecording;}
+
     ~VideoReceiver();
 };
 
@@ -0,0 +1,127 @@
+#include "VideoRecorder.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "Logger.hpp"
+
+static constexpr AVRational Microseconds = {1, 1000000};
+
+VideoRecorder::VideoRecorder(const char *OutputPath, const AVCodecParameters *Parameters)
+{
+    this->OutputContext = nullptr;
+    this->OutputStream = nullptr;
+    this->Path = OutputPath;
+
+    this->StartTime = 0;
+    this->LastTime = -1;
+    this->bHeaderWritten = false;
+    this->bFailed = false;
+
+    if (avformat_alloc_output_context2(&this->OutputContext, nullptr, "matroska", OutputPath) < 0)
+    {
+        LOG_ERROR("Failed to create recording %s", OutputPath);
+        this->OutputContext = nullptr;
+        return;
+    }
+
+    this->OutputStream = avformat_new_stream(this->OutputContext, nullptr);
+
+    if (!this->OutputStream || avcodec_parameters_copy(this->OutputStream->codecpar, Parameters) < 0)
+    {
+        LOG_ERROR("Failed to create recording stream %s", OutputPath);
+        avformat_free_context(this->OutputContext);
+        this->OutputContext = nullptr;
+        return;
+    }
+
+    this->OutputStream->codecpar->codec_tag = 0;
+    this->OutputStream->time_base = Microseconds;
+
+    if (avio_open(&this->OutputContext->pb, OutputPath, AVIO_FLAG_WRITE) < 0)
+    {
+        LOG_ERROR("Failed to open recording %s", OutputPath);
+        avformat_free_context(this->OutputContext);
+        this->OutputContext = nullptr;
+        return;
+    }
+}
+
+int VideoRecorder::WriteHeader(int64_t FirstReceiveTime)
+{
+    // Header is deferred to the first keyframe, whose receive time anchors the recording's timeline
+    char Value[32];
+    snprintf(Value, sizeof(Value), "%" PRId64, FirstReceiveTime);
+    av_dict_set(&this->OutputContext->metadata, RecordingStartTimeKey, Value, 0);
+
+    if (avformat_write_header(this->OutputContext, nullptr) < 0)
+        return -1;
+
+    this->StartTime = FirstReceiveTime;
+    this->bHeaderWritten = true;
+
+    return 0;
+}
+
+// Network thread
+
+int VideoRecorder::Write(const AVPacket *Packet, int64_t ReceiveTime)
+{
+    if (!this->IsOpen())
+        return -1;
+
+    if (!this->bHeaderWritten)
+    {
+        if (!(Packet->flags & AV_PKT_FLAG_KEY))
+            return 0;
+
+        if (this->WriteHeader(ReceiveTime) < 0)
+        {
+            LOG_ERROR("Failed to write recording header %s", this->Path.c_str());
+            this->bFailed = true;
+            return -1;
+        }
+    }
+
+    AVPacket* Copy = av_packet_clone(Packet);
+
+    if (!Copy)
+        return -1;
+
+    // Live stream is low latency with no reordering, so receive order is presentation order
+    int64_t Time = ReceiveTime - this->StartTime;
+    Time = (Time > this->LastTime) ? Time : this->LastTime + 1;
+    this->LastTime = Time;
+
+    Copy->stream_index = this->OutputStream->index;
+    Copy->pts = av_rescale_q(Time, Microseconds, this->OutputStream->time_base);
+    Copy->dts = Copy->pts;
+    Copy->duration = 0;
+    Copy->pos = -1;
+
+    int Status = av_interleaved_write_frame(this->OutputContext, Copy);
+    av_packet_free(&Copy);
+
+    if (Status < 0)
+    {
+        LOG_ERROR("Failed to write recording %s, stopping", this->Path.c_str());
+        this->bFailed = true;
+        return Status;
+    }
+
+    return 0;
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    if (!this->OutputContext)
+        return;
+
+    if (this->bHeaderWritten)
+        av_write_trailer(this->OutputContext);
+
+    avio_closep(&this->OutputContext->pb);
+    avformat_free_context(this->OutputContext);
+
+    LOG_INFO("Recorded %s", this->Path.c_str());
+}
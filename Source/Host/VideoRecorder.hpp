@@ -0,0 +1,63 @@
+#ifndef HOST_VIDEO_RECORDER_HPP_
+#define HOST_VIDEO_RECORDER_HPP_
+
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+// Metadata key holding the receive time of the first recorded packet
+static constexpr const char* RecordingStartTimeKey = "HOST_START_TIME";
+
+// Remuxes received video packets to a Matroska file without re-encoding. Packets are timestamped
+// with their receive time (av_gettime_relative), the same clock telemetry is logged against, so a
+// recording and a telemetry log from the same session can be replayed in sync. Matroska is used
+// for its keyframe cue index, which makes seeking in long recordings instant.
+
+class VideoRecorder
+{
+private:
+    AVFormatContext* OutputContext;
+    AVStream* OutputStream;
+
+    std::string Path;
+
+    int64_t StartTime;
+    int64_t LastTime;
+    bool bHeaderWritten;
+    bool bFailed;
+
+    int WriteHeader(int64_t FirstReceiveTime);
+
+public:
+    /**
+     * @brief Creates a recording file for a video stream.
+     * @param OutputPath Path of the Matroska file to create.
+     * @param Parameters Codec parameters of the video stream being received.
+	 */
+    VideoRecorder(const char* OutputPath, const AVCodecParameters* Parameters);
+
+    /**
+     * @brief Gets whether the recording file was created and is still being written.
+     * @returns True if the recording is open.
+	 */
+    bool IsOpen() {return this->OutputContext != nullptr && !this->bFailed;}
+
+    /**
+     * @brief Writes a packet. Recording starts at the first keyframe.
+     * @param Packet Packet to write, which is not modified.
+     * @param ReceiveTime Time in microseconds (av_gettime_relative) the packet arrived.
+     * @returns Error status
+	 */
+    int Write(const AVPacket* Packet, int64_t ReceiveTime);
+
+    /**
+     * @brief Finishes the file, writing the keyframe index.
+	 */
+    ~VideoRecorder();
+};
+
+#endif // HOST_VIDEO_RECORDER_HPP_
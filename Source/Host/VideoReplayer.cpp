@@ -0,0 +1,357 @@
+#include "VideoReplayer.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+
+#include "Logger.hpp"
+#include "Trace.hpp"
+#include "VideoRecorder.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+static constexpr AVRational Microseconds = {1, 1000000};
+
+// Longest the replay thread sleeps before checking for seeks, steps and pause
+static constexpr int64_t MaximumWait = 5000;
+
+VideoReplayer::VideoReplayer(const char *Path, FrameBus *BusPtr, Metrics *StatsPtr)
+{
+    this->FormatContext = nullptr;
+    this->CodecContext = nullptr;
+    this->VideoStream = nullptr;
+    this->VideoStreamIndex = -1;
+
+    this->Bus = BusPtr;
+    this->Stats = StatsPtr;
+    this->Clock = nullptr;
+
+    this->Packet = av_packet_alloc();
+
+    this->StartTime = 0;
+    this->Duration = 0;
+
+    this->ShownTime = 0;
+    this->StepRequest = 0;
+    this->bReplayLoop = false;
+
+    if (this->Init(Path) < 0)
+        avcodec_free_context(&this->CodecContext);
+}
+
+int VideoReplayer::Init(const char *Path)
+{
+    if (avformat_open_input(&this->FormatContext, Path, nullptr, nullptr) < 0)
+    {
+        LOG_ERROR("Failed to open recording %s", Path);
+        return -1;
+    }
+
+    if (avformat_find_stream_info(this->FormatContext, nullptr) < 0)
+    {
+        LOG_ERROR("No stream info in recording %s", Path);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < this->FormatContext->nb_streams; i++)
+    {
+        AVStream* TempStream = this->FormatContext->streams[i];
+
+        if (TempStream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            this->VideoStream = TempStream;
+            this->VideoStreamIndex = static_cast<int>(i);
+            break;
+        }
+    }
+
+    if (this->VideoStreamIndex < 0)
+    {
+        LOG_ERROR("No video stream in recording %s", Path);
+        return -1;
+    }
+
+    const AVCodec* Codec = avcodec_find_decoder(this->VideoStream->codecpar->codec_id);
+
+    if (!Codec)
+    {
+        LOG_ERROR("No decoder for recording %s", Path);
+        return -1;
+    }
+
+    this->CodecContext = avcodec_alloc_context3(Codec);
+
+    if (avcodec_parameters_to_context(this->CodecContext, this->VideoStream->codecpar) < 0 || avcodec_open2(this->CodecContext, Codec, nullptr) < 0)
+    {
+        LOG_ERROR("Failed to open decoder for recording %s", Path);
+        return -1;
+    }
+
+    // Anchor the recording on the host clock it was received with, so it lines up with telemetry
+    AVDictionaryEntry* Entry = av_dict_get(this->FormatContext->metadata, RecordingStartTimeKey, nullptr, 0);
+
+    if (Entry)
+        this->StartTime = strtoll(Entry->value, nullptr, 10);
+    else
+        LOG_ERROR("Recording %s has no start time, telemetry will not be in sync", Path);
+
+    if (this->FormatContext->duration != AV_NOPTS_VALUE)
+        this->Duration = this->FormatContext->duration;
+
+    this->ShownTime = this->StartTime;
+
+    return 0;
+}
+
+int VideoReplayer::GetVideoWidth()
+{
+    if (this->CodecContext != nullptr)
+        return this->CodecContext->width;
+    else
+        return 0;
+}
+
+int VideoReplayer::GetVideoHeight()
+{
+    if (this->CodecContext != nullptr)
+        return this->CodecContext->height;
+    else
+        return 0;
+}
+
+// Main thread
+
+void VideoReplayer::Step(int Direction)
+{
+    this->StepRequest = (Direction < 0) ? -1 : 1;
+}
+
+void VideoReplayer::StartReplayLoop(ReplayClock *ClockPtr)
+{
+    this->Clock = ClockPtr;
+    this->bReplayLoop = true;
+
+    // Start thread
+    this->ReplayThread = std::thread([this] { this->ReplayLoop(); });
+}
+
+// Replay thread
+
+int64_t VideoReplayer::GetFrameTime(const AVFrame *Frame)
+{
+    int64_t Timestamp = (Frame->best_effort_timestamp != AV_NOPTS_VALUE) ? Frame->best_effort_timestamp : Frame->pts;
+
+    if (Timestamp == AV_NOPTS_VALUE)
+        return this->ShownTime;
+
+    if (this->VideoStream->start_time != AV_NOPTS_VALUE)
+        Timestamp -= this->VideoStream->start_time;
+
+    return this->StartTime + av_rescale_q(Timestamp, this->VideoStream->time_base, Microseconds);
+}
+
+int VideoReplayer::DecodeNext(AVFrame *Frame)
+{
+    TRACE_SCOPE("Decode");
+
+    int64_t DecodeStart = av_gettime_relative();
+
+    while (true)
+    {
+        int Status = avcodec_receive_frame(this->CodecContext, Frame);
+
+        if (Status == 0)
+        {
+            this->Stats->Record(Timing::Decode, (av_gettime_relative() - DecodeStart) / 1000.0);
+            this->Stats->Add(Counter::FramesDecoded, 1);
+        }
+
+        if (Status != AVERROR(EAGAIN))
+            return Status;
+
+        // Decoder needs more input, at the end of the file drain what it has buffered
+        if (av_read_frame(this->FormatContext, this->Packet) < 0)
+        {
+            avcodec_send_packet(this->CodecContext, nullptr);
+            continue;
+        }
+
+        if (this->Packet->stream_index == this->VideoStreamIndex)
+        {
+            this->Stats->Add(Counter::BytesReceived, this->Packet->size);
+            avcodec_send_packet(this->CodecContext, this->Packet);
+        }
+
+        av_packet_unref(this->Packet);
+    }
+}
+
+int VideoReplayer::SeekTo(int64_t Time)
+{
+    int64_t Target = av_rescale_q(Time - this->StartTime, Microseconds, this->VideoStream->time_base);
+
+    if (this->VideoStream->start_time != AV_NOPTS_VALUE)
+        Target += this->VideoStream->start_time;
+
+    // Lands on the closest keyframe at or before the target using the container's index
+    int Status = av_seek_frame(this->FormatContext, this->VideoStreamIndex, Target, AVSEEK_FLAG_BACKWARD);
+
+    avcodec_flush_buffers(this->CodecContext);
+
+    return Status;
+}
+
+void VideoReplayer::Show(AVFrame *Frame)
+{
+    this->ShownTime = this->GetFrameTime(Frame);
+
+    this->Bus->Publish(Frame, av_gettime_relative());
+    av_frame_unref(Frame);
+}
+
+void VideoReplayer::ReplayLoop()
+{
+    TRACE_THREAD("Replay");
+
+    AVFrame* Pending = av_frame_alloc();    // Decoded but not yet due
+    AVFrame* Held = av_frame_alloc();       // Latest frame at or before a seek target
+    bool bHasPending = false;
+    bool bHasHeld = false;
+
+    // Start by showing the frame at the clock's current time
+    uint64_t Generation = this->Clock->GetSeekGeneration();
+    int64_t SeekTarget = this->Clock->Now();
+    bool bSeeking = true;
+    bool bStepForward = false;
+
+    if (SeekTarget > this->StartTime)
+        this->SeekTo(SeekTarget);
+
+    while (this->bReplayLoop)
+    {
+        uint64_t CurrentGeneration = this->Clock->GetSeekGeneration();
+
+        if (CurrentGeneration != Generation)
+        {
+            Generation = CurrentGeneration;
+            SeekTarget = this->Clock->Now();
+            this->SeekTo(SeekTarget);
+
+            av_frame_unref(Pending);
+            av_frame_unref(Held);
+            bHasPending = false;
+            bHasHeld = false;
+            bSeeking = true;
+            bStepForward = false;
+        }
+
+        int Step = this->StepRequest.exchange(0);
+
+        if (Step != 0)
+        {
+            this->Clock->SetPaused(true);
+
+            // Stepping back is a seek to just before the frame on screen
+            if (Step < 0)
+            {
+                this->Clock->Seek(this->ShownTime - 1);
+                continue;
+            }
+
+            bStepForward = true;
+        }
+
+        if (!bHasPending)
+        {
+            int Status = this->DecodeNext(Pending);
+
+            if (Status < 0)
+            {
+                // End of the recording while seeking past the last frame, show the last one
+                if (bSeeking && bHasHeld)
+                {
+                    this->Show(Held);
+                    bHasHeld = false;
+                }
+
+                bSeeking = false;
+                bStepForward = false;
+
+                // Wait for a seek
+                std::this_thread::sleep_for(std::chrono::microseconds(MaximumWait));
+                continue;
+            }
+
+            bHasPending = true;
+        }
+
+        int64_t FrameTime = this->GetFrameTime(Pending);
+
+        if (bSeeking)
+        {
+            // Decode forward from the keyframe, keeping the frame that would be on screen at the target
+            if (FrameTime <= SeekTarget)
+            {
+                av_frame_unref(Held);
+                av_frame_move_ref(Held, Pending);
+                bHasHeld = true;
+                bHasPending = false;
+                continue;
+            }
+
+            if (bHasHeld)
+            {
+                this->Show(Held);
+                bHasHeld = false;
+            }
+            else
+            {
+                this->Show(Pending);
+                bHasPending = false;
+            }
+
+            bSeeking = false;
+            continue;
+        }
+
+        if (bStepForward)
+        {
+            this->Show(Pending);
+            bHasPending = false;
+            bStepForward = false;
+
+            this->Clock->SetTime(FrameTime);
+            continue;
+        }
+
+        int64_t Now = this->Clock->Now();
+
+        if (FrameTime > Now)
+        {
+            int64_t Wait = this->Clock->IsPaused() ? MaximumWait : static_cast<int64_t>((FrameTime - Now) / this->Clock->GetSpeed());
+            std::this_thread::sleep_for(std::chrono::microseconds((Wait < MaximumWait) ? Wait : MaximumWait));
+            continue;
+        }
+
+        this->Show(Pending);
+        bHasPending = false;
+    }
+
+    av_frame_free(&Pending);
+    av_frame_free(&Held);
+}
+
+VideoReplayer::~VideoReplayer()
+{
+    this->bReplayLoop = false;
+
+    // Wait for replay thread to finish
+    if (this->ReplayThread.joinable())
+        this->ReplayThread.join();
+
+    av_packet_free(&this->Packet);
+    avcodec_free_context(&this->CodecContext);
+    avformat_close_input(&this->FormatContext);
+}
@@ -0,0 +1,98 @@
+#ifndef HOST_VIDEO_REPLAYER_HPP_
+#define HOST_VIDEO_REPLAYER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "FrameBus.hpp"
+#include "Metrics.hpp"
+#include "ReplayClock.hpp"
+
+// Plays a recording made by VideoRecorder onto a frame bus, paced by a replay clock.
+// Seeks jump to the nearest earlier keyframe through the container's index and decode forward
+// to the exact frame, so seeking costs at most one group of pictures regardless of length.
+
+class VideoReplayer
+{
+private:
+    AVFormatContext* FormatContext;
+    AVCodecContext* CodecContext;
+    AVStream* VideoStream;
+    int VideoStreamIndex;
+
+    FrameBus* Bus;
+    Metrics* Stats;
+    ReplayClock* Clock;
+
+    AVPacket* Packet;
+
+    // Media time of the recording's first packet, from the recording metadata
+    int64_t StartTime;
+    int64_t Duration;
+
+    std::atomic<int64_t> ShownTime;
+    std::atomic<int> StepRequest;
+
+    std::atomic<bool> bReplayLoop;
+    std::thread ReplayThread;
+
+    int Init(const char* Path);
+
+    int64_t GetFrameTime(const AVFrame* Frame);
+
+    int DecodeNext(AVFrame* Frame);
+
+    int SeekTo(int64_t Time);
+
+    void Show(AVFrame* Frame);
+
+    void ReplayLoop();
+
+public:
+    /**
+     * @brief Opens a recording for replay.
+     * @param Path Path of the recording.
+     * @param BusPtr Pointer to frame bus to publish decoded frames on.
+     * @param StatsPtr Pointer to metrics object to record decode statistics in.
+	 */
+    VideoReplayer(const char* Path, FrameBus* BusPtr, Metrics* StatsPtr);
+
+    /**
+     * @brief Gets whether the recording was opened.
+     * @returns True if the recording is open.
+	 */
+    bool IsOpen() {return this->CodecContext != nullptr;}
+
+    int GetVideoWidth();
+
+    int GetVideoHeight();
+
+    /**
+     * @brief Gets the media time of the start of the recording.
+     * @returns Time in microseconds on the recording host's monotonic clock.
+	 */
+    int64_t GetStartTime() {return this->StartTime;}
+
+    /**
+     * @brief Gets the media time of the end of the recording.
+     * @returns Time in microseconds on the recording host's monotonic clock.
+	 */
+    int64_t GetEndTime() {return this->StartTime + this->Duration;}
+
+    /**
+     * @brief Pauses and moves one frame forward or back.
+     * @param Direction Positive to step forward, negative to step back.
+	 */
+    void Step(int Direction);
+
+    /**
+     * @brief Spawns new thread to decode frames in time with a clock.
+     * @param ClockPtr Pointer to the clock shared with the rest of the replay.
+	 */
+    void StartReplayLoop(ReplayClock* ClockPtr);
+
+    ~VideoReplayer();
+};
+
+#endif // HOST_VIDEO_REPLAYER_HPP_
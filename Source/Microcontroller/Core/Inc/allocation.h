@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file    allocation.h
+  * @brief   Thrust allocation. Maps a body frame wrench onto the eight
+  *          thrusters through an allocation matrix, then scales the whole
+  *          command down if any thruster would exceed its limit, so the
+  *          direction of the wrench is kept when the vehicle saturates.
+  *
+  *          Wrench axes are surge, sway, heave (positive forward, right, down)
+  *          and roll, pitch, yaw, each normalized to -1..1. Thrust is
+  *          normalized to -1..1 of each thruster's full range.
+  *
+  *          Float, Q15 and Q31 variants share one configuration. Q15 uses the
+  *          Cortex-M4 dual multiply-accumulate (SMLAD) where it is available
+  *          and plain C elsewhere, with identical results.
+  ******************************************************************************
+  */
+
+#ifndef __ALLOCATION_H
+#define __ALLOCATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define ALLOCATION_AXES      6u
+#define ALLOCATION_THRUSTERS PROTOCOL_THRUSTER_COUNT
+
+/* Scale returned by the fixed point variants when no thruster saturated */
+#define ALLOCATION_Q15_ONE   32768
+
+typedef struct
+{
+  float matrix[ALLOCATION_THRUSTERS][ALLOCATION_AXES];  /* Thrust per unit wrench */
+  float limit[ALLOCATION_THRUSTERS];                    /* Largest thrust magnitude, 0..1 */
+} allocation_config_t;
+
+/**
+  * @brief  Loads an allocation matrix and converts it for the fixed point
+  *         variants. Not safe to call while an allocation is running.
+  * @param  config: Configuration to copy, NULL for the default vectored
+  *         layout (four horizontal thrusters at 45 degrees, four vertical)
+  */
+void allocation_init(const allocation_config_t *config);
+
+/**
+  * @brief  Gets the configuration in use.
+  * @retval Current configuration
+  */
+const allocation_config_t *allocation_get_config(void);
+
+/**
+  * @brief  Allocates a wrench in floating point.
+  * @param  wrench: Surge, sway, heave, roll, pitch, yaw
+  * @param  thrust: Set to the thrust per thruster, within its limit
+  * @retval Scale applied to keep every thruster within its limit, 1 if none saturated
+  */
+float allocation_solve_f32(const float wrench[ALLOCATION_AXES], float thrust[ALLOCATION_THRUSTERS]);
+
+/**
+  * @brief  Allocates a wrench in Q15.
+  * @param  wrench: Surge, sway, heave, roll, pitch, yaw in Q15
+  * @param  thrust: Set to the thrust per thruster in Q15, within its limit
+  * @retval Scale applied in Q15, ALLOCATION_Q15_ONE if none saturated
+  */
+int32_t allocation_solve_q15(const int16_t wrench[ALLOCATION_AXES], int16_t thrust[ALLOCATION_THRUSTERS]);
+
+/**
+  * @brief  Allocates a wrench in Q31.
+  * @param  wrench: Surge, sway, heave, roll, pitch, yaw in Q31
+  * @param  thrust: Set to the thrust per thruster in Q31, within its limit
+  * @retval Scale applied in Q15, ALLOCATION_Q15_ONE if none saturated
+  */
+int32_t allocation_solve_q31(const int32_t wrench[ALLOCATION_AXES], int32_t thrust[ALLOCATION_THRUSTERS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ALLOCATION_H */
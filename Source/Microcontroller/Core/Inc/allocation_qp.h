@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file    allocation_qp.h
+  * @brief   Constrained thrust allocation. Finds the thrust within each
+  *          thruster's limits that comes closest to the wrench, as the box
+  *          constrained quadratic program
+  *
+  *            minimize   (B u - w)' W (B u - w) + e u' u
+  *            subject to -limit <= u <= limit
+  *
+  *          where B is the wrench per unit thrust, the pseudo-inverse of the
+  *          allocation matrix. Unlike scaling the pseudo-inverse solution it
+  *          moves load onto thrusters with margin left, and a failed thruster
+  *          is held at zero while the others make up for it.
+  *
+  *          Solved by ADMM with a fixed penalty, so the only factorization is
+  *          done at init, with a bounded iteration count and a warm start from
+  *          the previous solution.
+  ******************************************************************************
+  */
+
+#ifndef __ALLOCATION_QP_H
+#define __ALLOCATION_QP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "allocation.h"
+
+typedef struct
+{
+  float axis_weight[ALLOCATION_AXES];   /* Cost of missing each wrench axis (W) */
+  float thrust_weight;                  /* Cost of thrust (e), picks the least effort solution */
+  float penalty;                        /* ADMM penalty, trades primal and dual convergence */
+  float tolerance;                      /* Largest residual, normalized thrust, to stop early */
+  uint32_t max_iterations;              /* Iteration bound per solve */
+} allocation_qp_config_t;
+
+/**
+  * @brief  Builds the wrench matrix from the allocation matrix in use and
+  *         factorizes the problem. Call after allocation_init, and again
+  *         whenever the allocation configuration changes.
+  * @param  qp_config: Configuration to copy, NULL for the defaults
+  * @retval false if the allocation matrix cannot reach every axis
+  */
+bool allocation_qp_init(const allocation_qp_config_t *qp_config);
+
+/**
+  * @brief  Marks thrusters as failed, they are held at zero from the next solve.
+  * @param  mask: One bit per thruster, set if failed
+  */
+void allocation_qp_set_failed(uint8_t mask);
+
+/**
+  * @brief  Forgets the previous solution, the next solve starts from zero.
+  */
+void allocation_qp_reset(void);
+
+/**
+  * @brief  Allocates a wrench. Always returns thrust within the limits, even
+  *         when the iteration bound is reached first.
+  * @param  wrench: Surge, sway, heave, roll, pitch, yaw
+  * @param  thrust: Set to the thrust per thruster
+  * @retval Iterations used, max_iterations if not converged
+  */
+uint32_t allocation_solve_qp(const float wrench[ALLOCATION_AXES], float thrust[ALLOCATION_THRUSTERS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ALLOCATION_QP_H */
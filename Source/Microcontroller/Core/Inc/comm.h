@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file    comm.h
+  * @brief   Host link over USB CDC. Decodes command frames as they arrive and
+  *          batches outgoing telemetry frames into USB transfers.
+  ******************************************************************************
+  */
+
+#ifndef __COMM_H
+#define __COMM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/**
+  * @brief  Resets the decoder, transmit buffers and counters.
+  */
+void comm_init(void);
+
+/**
+  * @brief  Feeds bytes received from the host. Called from the USB interrupt.
+  * @param  data: Received bytes
+  * @param  len: Number of received bytes
+  */
+void comm_receive(const uint8_t *data, uint32_t len);
+
+/**
+  * @brief  Starts the next queued transfer. Called from the USB interrupt
+  *         when the previous transfer completes.
+  */
+void comm_transmit_complete(void);
+
+/**
+  * @brief  Queues a message for the host. Never blocks.
+  * @param  id: Message identifier
+  * @param  payload: Payload bytes
+  * @param  len: Payload size
+  * @retval true if queued, false if the transmit buffer is full
+  */
+bool comm_send(uint8_t id, const void *payload, uint8_t len);
+
+/**
+  * @brief  Queues a status message with the link counters.
+  * @retval true if queued
+  */
+bool comm_send_status(void);
+
+/**
+  * @brief  Gets the latest command from the host.
+  * @param  command: Set to a copy of the latest command
+  * @param  age_ms: Set to the milliseconds since it arrived, may be NULL
+  * @retval false if no command has been received yet
+  */
+bool comm_get_command(protocol_command_t *command, uint32_t *age_ms);
+
+/**
+  * @brief  Makes a command the latest, for commands that arrive over another
+  *         link. Safe from tasks and interrupts.
+  * @param  command: Command to copy
+  */
+void comm_set_command(const protocol_command_t *command);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __COMM_H */
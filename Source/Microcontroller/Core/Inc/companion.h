@@ -0,0 +1,149 @@
+/**
+  ******************************************************************************
+  * @file    companion.h
+  * @brief   SPI2 slave link to a companion computer. The companion, as
+  *          master, clocks one fixed-size frame each way per chip select
+  *          assertion: a command frame in on MOSI and a telemetry frame out on
+  *          MISO. Both directions run on circular double-buffered DMA, frames
+  *          are built and parsed where DMA reads and writes them, and the
+  *          buffers are swapped on the rising edge of NSS (PB9).
+  *
+  *          The link reaches the SPI and DMA only through companion_ops_t, so
+  *          it also runs on the host against a simulated slave.
+  ******************************************************************************
+  */
+
+#ifndef __COMPANION_H
+#define __COMPANION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/* Frames waiting to go out, at most */
+#define COMPANION_TX_SLOTS 8u
+
+/**
+  * @brief  One frame on the wire, in either direction. The companion must
+  *         clock exactly sizeof(companion_frame_t) bytes per assertion of NSS.
+  *         An identifier of zero is an idle frame: sent when nothing is
+  *         queued, and ignored unchecked when received. A frame queued now
+  *         goes out in the second transaction from now at the earliest.
+  */
+typedef struct
+{
+  uint8_t id;
+  uint8_t seq;
+  uint8_t payload[PROTOCOL_MAX_PAYLOAD];  /* The message, zero padded */
+  uint16_t crc;                           /* CRC-16/CCITT-FALSE of the bytes before it, little-endian */
+} companion_frame_t;
+
+PROTOCOL_ASSERT_SIZE(companion_frame_t, PROTOCOL_MAX_FRAME);
+
+typedef struct
+{
+  uint32_t frames;              /* Frames received with a good CRC and a known message */
+  uint32_t errors;              /* Frames received with a bad CRC or an unknown message */
+  uint32_t idle;                /* Idle frames sent because nothing was queued */
+  uint32_t dropped;             /* Sends refused because every slot was taken */
+  uint32_t resyncs;             /* Transactions that were not a whole frame */
+} companion_stats_t;
+
+/**
+  * @brief  SPI slave and DMA operations. Each direction is a circular,
+  *         double-buffered stream of one frame per buffer that switches
+  *         buffers at the end of each frame. The port calls
+  *         companion_nss_edge from the NSS rising edge interrupt.
+  */
+typedef struct
+{
+  /* Masks interrupts, returning the state for unlock */
+  uint32_t (*lock)(void);
+  void (*unlock)(uint32_t state);
+
+  /* Enables the DMA clock */
+  void (*init)(void);
+
+  /* Resets the SPI and restarts both streams on buffer 0, receiving into rx[0] and rx[1] and sending tx from both */
+  void (*start)(companion_frame_t rx[2], const companion_frame_t *tx);
+
+  /* Points a transmit buffer at a frame, sent the next time the stream switches to that buffer */
+  void (*load)(uint32_t buffer, const companion_frame_t *frame);
+
+  /* Enables the NSS rising edge interrupt */
+  void (*enable)(void);
+
+  /* Timestamp in microseconds */
+  uint32_t (*time_us)(void);
+} companion_ops_t;
+
+/* SPI2 on DMA1 stream 3 (RX) and stream 4 (TX), NSS on EXTI line 9 */
+extern const companion_ops_t companion_stm32_ops;
+
+/**
+  * @brief  Starts both DMA streams and the NSS edge interrupt. On the
+  *         vehicle call with &companion_stm32_ops after MX_SPI2_Init and
+  *         timestamp_init, and the port takes SPI2 over from the HAL. The
+  *         companion must leave NSS high for a few microseconds between
+  *         frames, for the edge interrupt to run.
+  * @param  ops: SPI and DMA operations, kept for the link's lifetime
+  */
+void companion_init(const companion_ops_t *ops);
+
+/**
+  * @brief  Takes the next free transmit slot, to build a message in place,
+  *         and gives it the next sequence number. Slots go out in the order
+  *         they are taken, so a slot held long holds up the ones after it.
+  *         Safe from tasks and interrupts at or below the kernel's syscall
+  *         priority.
+  * @retval Frame to fill, or NULL if every slot is taken
+  */
+companion_frame_t *companion_acquire(void);
+
+/**
+  * @brief  Queues the frame taken by companion_acquire. Sets the identifier
+  *         and the CRC; the sequence number was set by companion_acquire.
+  * @param  frame: Frame from companion_acquire, payload filled
+  * @param  id: Message identifier
+  */
+void companion_commit(companion_frame_t *frame, uint8_t id);
+
+/**
+  * @brief  Copies a message into a transmit slot and queues it. Safe from
+  *         tasks and interrupts at or below the kernel's syscall priority.
+  * @param  id: Message identifier
+  * @param  payload: Payload bytes
+  * @param  length: Payload size, at most PROTOCOL_MAX_PAYLOAD
+  * @retval false if every slot is taken
+  */
+bool companion_send(uint8_t id, const void *payload, uint8_t length);
+
+/**
+  * @brief  Services the link at the end of a frame: acts on the frame
+  *         received and loads the next one to send. Called by the port from
+  *         the NSS rising edge interrupt, after clearing it.
+  * @param  time_us: Timestamp of the edge
+  * @param  rx_buffer: Buffer the receive stream is on now, 0 or 1
+  * @param  tx_buffer: Buffer the transmit stream is on now, 0 or 1
+  * @param  rx_remaining: Bytes the receive stream has left in its buffer
+  * @param  tx_remaining: Bytes the transmit stream has left in its buffer
+  */
+void companion_nss_edge(uint32_t time_us, uint32_t rx_buffer, uint32_t tx_buffer, uint32_t rx_remaining,
+                        uint32_t tx_remaining);
+
+/**
+  * @brief  Gets the link counters.
+  * @param  stats: Set to the counters since companion_init. Counts wrap.
+  */
+void companion_get_stats(companion_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __COMPANION_H */
@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file    control.h
+  * @brief   Fixed rate control loop. TIM7 interrupts at the loop rate and
+  *          notifies a statically allocated task at the highest priority,
+  *          which runs one control step: pilot command to wrench, constrained
+  *          allocation and thruster outputs, after running the attitude
+  *          filter over the new IMU samples. Wake-up jitter and step time are
+  *          measured with the DWT cycle counter and kept as histograms.
+  ******************************************************************************
+  */
+
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "protocol.h"
+
+#define CONTROL_RATE_HZ 1000u
+
+/**
+  * @brief  Loads the allocation, starts the attitude filter and creates the
+  *         control task. TIM7 is started by the task itself, so no
+  *         notification arrives before the scheduler runs. Call before
+  *         osKernelStart, after timestamp_init and thrusters_init.
+  * @param  rate_hz: Loop rate, clamped to 16 Hz to 10 kHz
+  */
+void control_init(uint32_t rate_hz);
+
+/**
+  * @brief  Gets the latest attitude estimate.
+  * @param  attitude: Set to the estimate as of the newest IMU sample, all
+  *         zero until the first one
+  */
+void control_get_attitude(protocol_attitude_t *attitude);
+
+/**
+  * @brief  Copies the timing histograms and starts new ones.
+  * @param  timing: Set to the timing since the previous call
+  */
+void control_get_timing(protocol_timing_t *timing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CONTROL_H */
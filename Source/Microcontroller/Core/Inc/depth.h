@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    depth.h
+  * @brief   MS5837-30BA pressure sensor on the I2C1 transaction queue. TIM14
+  *          paces the convert, wait and read cycle from its interrupt, and a
+  *          two-state Kalman filter turns each pressure sample into depth and
+  *          vertical velocity. No task waits on the sensor.
+  ******************************************************************************
+  */
+
+#ifndef __DEPTH_H
+#define __DEPTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "protocol.h"
+
+/* Conversions per second. Most are pressure, one in DEPTH_TEMPERATURE_EVERY is temperature. */
+#define DEPTH_RATE_HZ 100u
+
+/**
+  * @brief  Starts TIM14 and queues the sensor reset; calibration and the
+  *         first conversion follow from the timer. Returns at once. Call
+  *         after i2c_bus_init and timestamp_init.
+  */
+void depth_init(void);
+
+/**
+  * @brief  Gets the latest filtered depth.
+  * @param  depth: Set to the estimate as of the newest pressure sample, all
+  *         zero until the first one. Depth is from the pressure at the first
+  *         sample, so the vehicle should power up at the surface.
+  */
+void depth_get(protocol_depth_t *depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEPTH_H */
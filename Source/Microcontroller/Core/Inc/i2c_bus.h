@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * @file    i2c_bus.h
+  * @brief   I2C1 transaction queue. A transaction writes some bytes, reads
+  *          some bytes, or writes then reads after a repeated start. They run
+  *          one after another from the I2C event interrupt, with reads of two
+  *          bytes or more received by DMA, and each ends by calling its
+  *          handler from the interrupt, so no task ever waits on the bus.
+  ******************************************************************************
+  */
+
+#ifndef __I2C_BUS_H
+#define __I2C_BUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+#define I2C_BUS_QUEUE 8u
+
+/**
+  * @brief  Called from the bus interrupt when a transaction ends.
+  * @param  ok: false if the device did not acknowledge or the bus failed
+  * @param  context: Pointer given with the transaction
+  */
+typedef void (*i2c_bus_handler_t)(bool ok, void *context);
+
+typedef struct
+{
+  uint8_t address;              /* 7-bit device address */
+  const uint8_t *tx;            /* Written first, owned by the bus until the handler runs */
+  uint16_t tx_length;
+  uint8_t *rx;                  /* Filled by the read, owned by the bus until the handler runs */
+  uint16_t rx_length;
+  i2c_bus_handler_t handler;    /* May be NULL */
+  void *context;
+} i2c_bus_transfer_t;
+
+typedef struct
+{
+  uint32_t transfers;           /* Transactions completed */
+  uint32_t errors;              /* Not acknowledged, bus errors and aborts */
+  uint32_t dropped;             /* Submitted to a full queue */
+} i2c_bus_stats_t;
+
+/**
+  * @brief  Sets up DMA1 stream 0 for I2C1 reception and enables the bus
+  *         interrupts. Call after MX_I2C1_Init.
+  */
+void i2c_bus_init(void);
+
+/**
+  * @brief  Queues a transaction. Safe from tasks and interrupts at or below
+  *         the kernel's syscall priority, including the handlers.
+  * @param  transfer: Transaction to copy
+  * @retval false if the queue is full or the transaction is empty
+  */
+bool i2c_bus_submit(const i2c_bus_transfer_t *transfer);
+
+/**
+  * @brief  Ends the active transaction with a stop condition and fails it
+  *         and every queued one, for a device that holds the bus.
+  */
+void i2c_bus_abort(void);
+
+/**
+  * @brief  Gets the bus counters.
+  * @param  stats: Set to the counters since i2c_bus_init. Counts wrap.
+  */
+void i2c_bus_get_stats(i2c_bus_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I2C_BUS_H */
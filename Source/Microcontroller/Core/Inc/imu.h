@@ -0,0 +1,70 @@
+/**
+  ******************************************************************************
+  * @file    imu.h
+  * @brief   ICM-42688-P inertial sensor on the SPI1 sensor bus, chip select
+  *          0 with INT1 on PC0. Either every sample raises a data-ready
+  *          interrupt and is read on its own, or the sensor's FIFO collects
+  *          a batch and a watermark interrupt drains it in one DMA transfer,
+  *          with each sample's time interpolated back from the interrupt.
+  ******************************************************************************
+  */
+
+#ifndef __IMU_H
+#define __IMU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "protocol.h"
+
+#define IMU_RATE_HZ 1000u       /* 1000, 2000, 4000 or 8000 */
+#define IMU_BATCH   8u          /* Samples per watermark interrupt in FIFO mode */
+
+typedef enum
+{
+  IMU_MODE_DATA_READY = PROTOCOL_IMU_DATA_READY,
+  IMU_MODE_FIFO = PROTOCOL_IMU_FIFO
+} imu_mode_t;
+
+typedef struct
+{
+  uint32_t time_us;             /* When the sensor sampled, in timestamp_us ticks */
+  float accel[3];               /* m/s^2, sensor frame */
+  float gyro[3];                /* rad/s, sensor frame */
+  float temperature;            /* Degrees Celsius */
+} imu_sample_t;
+
+/**
+  * @brief  Resets and configures the sensor and registers its read on the
+  *         bus. Blocks for about 50 ms. Call after spi_bus_init and before
+  *         spi_bus_start.
+  * @param  mode: One read per sample, or one per FIFO batch
+  * @retval false if the sensor did not answer
+  */
+bool imu_init(imu_mode_t mode);
+
+/**
+  * @brief  Takes the oldest samples not read yet. Only one task may read.
+  * @param  samples: Set to the samples, oldest first
+  * @param  max: Room in samples
+  * @retval Samples copied
+  */
+uint32_t imu_read(imu_sample_t *samples, uint32_t max);
+
+/**
+  * @brief  Gets the acquisition rates and the bus interrupt load since the
+  *         previous call.
+  * @param  status: Set to the status
+  */
+void imu_get_status(protocol_imu_t *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __IMU_H */
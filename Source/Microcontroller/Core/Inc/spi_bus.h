@@ -0,0 +1,186 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus.h
+  * @brief   SPI1 sensor bus. Register burst reads are registered once, queued
+  *          by a data-ready input (PC0-PC2) or on request, and run back to
+  *          back by DMA, with the chip select raised and the next read started
+  *          from the DMA completion interrupt. Each read owns two buffers: DMA
+  *          fills one while consumers read the other, and they are swapped by
+  *          index when a read completes, so the CPU never copies sensor data.
+  *
+  *          The bus reaches the SPI, DMA, chip selects and data-ready inputs
+  *          only through spi_bus_ops_t, so its queue runs on the host against
+  *          a simulation.
+  ******************************************************************************
+  */
+
+#ifndef __SPI_BUS_H
+#define __SPI_BUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPI_BUS_DEVICES    4u       /* SPI1_CS0-SPI1_CS3 */
+#define SPI_BUS_TRIGGERS   3u       /* Data-ready inputs PC0-PC2, EXTI lines 0-2 */
+#define SPI_BUS_MAX_READS  8u
+#define SPI_BUS_NO_TRIGGER 0xFFu
+
+/* Command byte reading from a register, for devices that set the top bit to read */
+#define SPI_BUS_READ(reg) ((uint8_t)((reg) | 0x80u))
+
+/* Bytes of storage a read of length bytes needs, both buffers and the command byte each */
+#define SPI_BUS_STORAGE(length) (2u * ((length) + 1u))
+
+/**
+  * @brief  Called from the DMA interrupt when a read completes, after the swap.
+  * @param  read: Read handle
+  * @param  context: Pointer given when the read was added
+  */
+typedef void (*spi_bus_handler_t)(int32_t read, void *context);
+
+typedef struct
+{
+  uint8_t device;               /* Chip select, 0-3 */
+  uint8_t command;              /* First byte sent, usually SPI_BUS_READ(register) */
+  uint16_t length;              /* Bytes read after the command */
+  uint8_t trigger;              /* Data-ready input that queues the read, or SPI_BUS_NO_TRIGGER */
+  uint8_t *storage;             /* SPI_BUS_STORAGE(length) bytes, owned by the bus from then on */
+  spi_bus_handler_t handler;    /* May be NULL */
+  void *context;
+} spi_bus_read_t;
+
+typedef struct
+{
+  uint32_t interrupts;          /* Data-ready and DMA interrupts taken */
+  uint32_t transfers;           /* Reads completed */
+  uint32_t dropped;             /* Requests ignored: already queued, or both buffers in use */
+  uint32_t cycles;              /* CPU cycles in those interrupts and the read handlers, wraps */
+} spi_bus_stats_t;
+
+/**
+  * @brief  SPI, DMA, chip select, data-ready and clock operations. The port
+  *         calls spi_bus_trigger from the data-ready interrupts and
+  *         spi_bus_complete from the DMA interrupt, both at the kernel's
+  *         syscall priority.
+  */
+typedef struct
+{
+  /* Masks interrupts, returning the state for unlock */
+  uint32_t (*lock)(void);
+  void (*unlock)(uint32_t state);
+
+  /* Raises every chip select, sets up both DMA streams and the completion interrupt and enables the SPI */
+  void (*init)(void);
+
+  /* Lowers or raises a chip select */
+  void (*select)(uint8_t device, bool selected);
+
+  /* Sends command and length dummy bytes by DMA, receiving all length + 1 bytes into rx */
+  void (*start)(uint8_t command, uint8_t *rx, uint16_t length);
+
+  /* Ends the DMA transfer, after an error stopping the TX stream too */
+  void (*finish)(bool error);
+
+  /* Sends and receives length bytes by polling, rx may be NULL */
+  void (*exchange)(const uint8_t *tx, uint8_t *rx, uint16_t length);
+
+  /* Clears and enables, or disables, a data-ready interrupt */
+  void (*enable_trigger)(uint32_t line, bool enable);
+
+  /* Timestamp in microseconds and CPU cycle count */
+  uint32_t (*time_us)(void);
+  uint32_t (*cycles)(void);
+} spi_bus_ops_t;
+
+/* SPI1 on DMA2 stream 0 (RX) and stream 3 (TX), data-ready on EXTI lines 0-2 */
+extern const spi_bus_ops_t spi_bus_stm32_ops;
+
+/**
+  * @brief  Forgets every read, raises every chip select and sets up the SPI
+  *         and DMA. On the vehicle call with &spi_bus_stm32_ops after
+  *         MX_SPI1_Init.
+  * @param  ops: Bus operations, kept for the bus's lifetime
+  */
+void spi_bus_init(const spi_bus_ops_t *ops);
+
+/**
+  * @brief  Registers a read. Only while the bus is stopped.
+  * @param  read: Read to copy
+  * @retval Read handle, or -1 if the table is full or the read is invalid
+  */
+int32_t spi_bus_add_read(const spi_bus_read_t *read);
+
+/**
+  * @brief  Enables the data-ready interrupts of every input with a read.
+  */
+void spi_bus_start(void);
+
+/**
+  * @brief  Disables the data-ready interrupts and waits for queued reads to finish.
+  */
+void spi_bus_stop(void);
+
+/**
+  * @brief  Queues a read. Safe from tasks and interrupts at or below the
+  *         kernel's syscall priority.
+  * @param  read: Read handle
+  * @retval false if the read was already queued or has no free buffer
+  */
+bool spi_bus_request(int32_t read);
+
+/**
+  * @brief  Takes the newest completed buffer of a read. It is not written
+  *         until released; a read completing meanwhile fills the other
+  *         buffer, and further requests are dropped until the release.
+  * @param  read: Read handle
+  * @param  time_us: Set to the time the read was requested, may be NULL
+  * @param  sequence: Set to the number of reads completed, may be NULL
+  * @retval The bytes read, or NULL if none has completed yet
+  */
+const uint8_t *spi_bus_acquire(int32_t read, uint32_t *time_us, uint32_t *sequence);
+
+/**
+  * @brief  Gives back the buffer taken by spi_bus_acquire.
+  * @param  read: Read handle
+  */
+void spi_bus_release(int32_t read);
+
+/**
+  * @brief  Runs one transfer by polling, for configuring devices. Only while
+  *         the bus is stopped.
+  * @param  device: Chip select, 0-3
+  * @param  tx: Bytes to send
+  * @param  rx: Set to the bytes received, may be NULL
+  * @param  length: Bytes in each direction
+  */
+void spi_bus_transfer(uint8_t device, const uint8_t *tx, uint8_t *rx, uint16_t length);
+
+/**
+  * @brief  Queues the read of a data-ready input. Called by the port from
+  *         the input's interrupt, after clearing it.
+  * @param  line: Data-ready input, 0-2
+  */
+void spi_bus_trigger(uint32_t line);
+
+/**
+  * @brief  Hands over the buffer of the active read and starts the next.
+  *         Called by the port from the DMA interrupt, after clearing it.
+  * @param  error: The transfer failed, the previous buffer is kept
+  */
+void spi_bus_complete(bool error);
+
+/**
+  * @brief  Gets the bus counters.
+  * @param  stats: Set to the counters since spi_bus_init. Counts wrap.
+  */
+void spi_bus_get_stats(spi_bus_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPI_BUS_H */
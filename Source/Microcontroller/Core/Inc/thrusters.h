@@ -0,0 +1,144 @@
+/**
+  ******************************************************************************
+  * @file    thrusters.h
+  * @brief   Thruster ESC outputs on TIM2 (thrusters 0-3) and TIM3 (4-7).
+  *          A command for all eight thrusters is written by one DMA burst per
+  *          timer, triggered by the update event, so it always lands within a
+  *          single PWM period on every channel. Standard and 400 Hz PWM,
+  *          OneShot125 and DShot300/600 share the same command interface.
+  *
+  *          The driver reaches the timers and DMA only through
+  *          thrusters_ops_t, so it also runs on the host against a mock.
+  ******************************************************************************
+  */
+
+#ifndef __THRUSTERS_H
+#define __THRUSTERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define THRUSTER_COUNT PROTOCOL_THRUSTER_COUNT
+
+/* Pulse widths in microseconds, neutral is stopped for bidirectional ESCs */
+#define THRUSTER_PULSE_MIN     1100u
+#define THRUSTER_PULSE_NEUTRAL 1500u
+#define THRUSTER_PULSE_MAX     1900u
+
+typedef enum
+{
+  THRUSTER_MODE_PWM50,              /* Standard servo PWM, up to 20 ms of latency */
+  THRUSTER_MODE_PWM400,
+  THRUSTER_MODE_ONESHOT125,         /* Pulses an eighth as wide, at 2 kHz */
+  THRUSTER_MODE_DSHOT300,           /* Digital, 3D throttle, one frame per write */
+  THRUSTER_MODE_DSHOT600
+} thruster_mode_t;
+
+/* Each timer drives four thrusters from CCR1-CCR4 */
+#define THRUSTER_TIMERS        2u
+#define THRUSTER_TIMER_OUTPUTS 4u
+
+/**
+  * @brief  Timer and DMA operations. Timer 0 is the master and drives
+  *         thrusters 0-3, timer 1 starts with it and drives 4-7. Each timer
+  *         has a DMA stream that writes its DMA burst register (DMAR) on the
+  *         timer's update event.
+  */
+typedef struct
+{
+  /* Masks interrupts, returning the state for unlock */
+  uint32_t (*lock)(void);
+  void (*unlock)(uint32_t state);
+
+  /* Enables compare outputs with preload, sets DCR, points each stream at DMAR and slaves timer 1 to timer 0 */
+  void (*init)(uint32_t dcr);
+
+  /* Stops both counters */
+  void (*stop)(void);
+
+  /* Stops the timer's stream and loads the period and compare values before the next start */
+  void (*load)(uint32_t timer, uint16_t prescaler, uint16_t period, const uint32_t compare[THRUSTER_TIMER_OUTPUTS]);
+
+  /* Starts timer 0, and timer 1 with it */
+  void (*start)(void);
+
+  /* Takes back the timer's stream and arms it to write length words through DMAR, a burst per update */
+  void (*arm)(uint32_t timer, const uint32_t *burst, uint32_t length);
+
+  /* True while either stream has words left to write */
+  bool (*busy)(void);
+
+  /* Counter of timer 0 */
+  uint32_t (*count)(void);
+} thrusters_ops_t;
+
+/* TIM2 and TIM3 on DMA1 streams 1 and 2 */
+extern const thrusters_ops_t thrusters_stm32_ops;
+
+/**
+  * @brief  Sets up the burst writes, slaves timer 1 to timer 0 so both
+  *         periods start together, and starts the outputs at neutral in 50 Hz
+  *         PWM. On the vehicle call with &thrusters_stm32_ops after
+  *         MX_TIM2_Init and MX_TIM3_Init.
+  * @param  ops: Timer and DMA operations, kept for the driver's lifetime
+  */
+void thrusters_init(const thrusters_ops_t *ops);
+
+/**
+  * @brief  Changes the output protocol. Restarts both timers and sets every
+  *         output to neutral. The ESCs must be configured for the same mode.
+  * @param  new_mode: Output protocol
+  */
+void thrusters_set_mode(thruster_mode_t new_mode);
+
+/**
+  * @brief  Gets the output protocol.
+  * @retval Current mode
+  */
+thruster_mode_t thrusters_get_mode(void);
+
+/**
+  * @brief  Queues pulse widths for all thrusters. In the pulse modes they are
+  *         written at the next update event and output from the period after,
+  *         waiting at most a few tens of microseconds. In the DShot modes the
+  *         frame starts straight away. Call only after thrusters_init.
+  * @param  pulse_us: Pulse width per thruster in microseconds, clamped to
+  *         THRUSTER_PULSE_MIN..THRUSTER_PULSE_MAX. DShot maps it onto the 3D
+  *         throttle range around neutral.
+  * @retval false if the previous DShot frame is still being sent
+  */
+bool thrusters_write(const uint16_t pulse_us[THRUSTER_COUNT]);
+
+/**
+  * @brief  Gets the pulse widths most recently queued.
+  * @param  pulse_us: Set to the pulse width per thruster in microseconds
+  */
+void thrusters_get(uint16_t pulse_us[THRUSTER_COUNT]);
+
+/**
+  * @brief  Builds a DShot frame: 11-bit value, telemetry request bit and a
+  *         4-bit checksum, sent most significant bit first.
+  * @param  value: Throttle (48-2047) or command (0-47)
+  * @param  telemetry: Request telemetry from the ESC
+  * @retval Frame bits
+  */
+uint16_t thrusters_dshot_frame(uint16_t value, bool telemetry);
+
+/**
+  * @brief  Maps a pulse width onto the DShot 3D throttle range.
+  * @param  pulse_us: Pulse width in microseconds
+  * @retval 0 (stop) near neutral, 48-1047 reverse, 1048-2047 forward
+  */
+uint16_t thrusters_dshot_throttle(uint16_t pulse_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __THRUSTERS_H */
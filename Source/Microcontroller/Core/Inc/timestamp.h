@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file    timestamp.h
+  * @brief   Free-running 1 MHz timestamp counter on TIM5. Every time sent to
+  *          the host is in these ticks, which the host maps onto its own clock.
+  *          The DWT cycle counter is started alongside for measuring short
+  *          intervals on the CPU.
+  ******************************************************************************
+  */
+
+#ifndef __TIMESTAMP_H
+#define __TIMESTAMP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/**
+  * @brief  Starts TIM5 counting microseconds over its full 32-bit range, and
+  *         the cycle counter.
+  */
+void timestamp_init(void);
+
+/**
+  * @brief  Gets the current timestamp. Wraps every 71.6 minutes.
+  * @retval Microseconds since timestamp_init
+  */
+static inline uint32_t timestamp_us(void)
+{
+  return TIM5->CNT;
+}
+
+/**
+  * @brief  Gets the CPU cycle count. Wraps every 25.6 s at 168 MHz.
+  * @retval Cycles since timestamp_init
+  */
+static inline uint32_t timestamp_cycles(void)
+{
+  return DWT->CYCCNT;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMESTAMP_H */
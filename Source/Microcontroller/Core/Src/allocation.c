@@ -0,0 +1,277 @@
+/**
+  ******************************************************************************
+  * @file    allocation.c
+  * @brief   Thrust allocation in float, Q15 and Q31.
+  *
+  *          The fixed point matrices hold the float matrix divided by a power
+  *          of two, chosen so the largest entry fits, and the shift is undone
+  *          after accumulating. Q15 packs axis pairs into words for the
+  *          dual 16-bit multiply-accumulate and accumulates in 64 bits, so a
+  *          full scale wrench on every axis cannot wrap.
+  ******************************************************************************
+  */
+
+#include "allocation.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_compiler.h"
+#define ALLOCATION_SMLALD 1
+#endif
+
+/* Axis pairs per row in the packed Q15 matrix */
+#define ALLOCATION_PAIRS (ALLOCATION_AXES / 2u)
+
+/* Largest power of two the matrix is divided by, entries up to 128 */
+#define ALLOCATION_MAX_SHIFT 7u
+
+/* Q31 products are shifted down before summing so six of them fit in 64 bits */
+#define ALLOCATION_Q31_HEADROOM 3u
+
+/*
+ * Default layout: horizontal thrusters 0-3 front right, front left, rear right
+ * and rear left, angled 45 degrees inwards so positive thrust is forwards.
+ * Vertical thrusters 4-7 in the same order, positive thrust is downwards.
+ * A propeller mounted the other way round has its row negated.
+ */
+static const allocation_config_t default_config =
+{
+  .matrix =
+  {
+    /* Surge, sway, heave, roll, pitch, yaw */
+    {1.0f, -1.0f, 0.0f, 0.0f, 0.0f, -1.0f},
+    {1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    {1.0f, 1.0f, 0.0f, 0.0f, 0.0f, -1.0f},
+    {1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f},
+    {0.0f, 0.0f, 1.0f, 1.0f, -1.0f, 0.0f},
+    {0.0f, 0.0f, 1.0f, -1.0f, -1.0f, 0.0f},
+    {0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f},
+    {0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f},
+  },
+  .limit = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f},
+};
+
+static allocation_config_t config;
+
+static uint32_t shift;
+static uint32_t matrix_q15[ALLOCATION_THRUSTERS][ALLOCATION_PAIRS];
+static int32_t matrix_q31[ALLOCATION_THRUSTERS][ALLOCATION_AXES];
+static int32_t limit_q15[ALLOCATION_THRUSTERS];
+static int32_t limit_q31[ALLOCATION_THRUSTERS];
+
+/* Rounds to fixed point with saturation. Only used when loading a configuration. */
+static int32_t allocation_to_fixed(float value, double one, int32_t max)
+{
+  double scaled = (double)value * one;
+
+  if (scaled >= (double)max)
+  {
+    return max;
+  }
+
+  if (scaled <= -(double)max - 1.0)
+  {
+    return -max - 1;
+  }
+
+  return (int32_t)(scaled + ((scaled < 0.0) ? -0.5 : 0.5));
+}
+
+static uint32_t allocation_pack(int16_t low, int16_t high)
+{
+  return (uint32_t)(uint16_t)low | ((uint32_t)(uint16_t)high << 16);
+}
+
+/* Scale in Q15 bringing every value within its limit, both in the same format */
+static int32_t allocation_fixed_scale(const int64_t *values, const int32_t *limits)
+{
+  int32_t scale = ALLOCATION_Q15_ONE;
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    int64_t magnitude = (values[i] < 0) ? -values[i] : values[i];
+
+    if (magnitude > limits[i])
+    {
+      /* Rounded down, so the scaled value never exceeds the limit */
+      int32_t candidate = (int32_t)(((int64_t)limits[i] << 15) / magnitude);
+
+      if (candidate < scale)
+      {
+        scale = candidate;
+      }
+    }
+  }
+
+  return scale;
+}
+
+void allocation_init(const allocation_config_t *new_config)
+{
+  if (new_config == NULL)
+  {
+    new_config = &default_config;
+  }
+
+  memcpy(&config, new_config, sizeof(config));
+
+  float largest = 0.0f;
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      float magnitude = (config.matrix[i][j] < 0.0f) ? -config.matrix[i][j] : config.matrix[i][j];
+
+      if (magnitude > largest)
+      {
+        largest = magnitude;
+      }
+    }
+  }
+
+  /* Entries must be strictly below one after the shift, 1.0 itself does not fit Q15 */
+  shift = 0;
+
+  while (shift < ALLOCATION_MAX_SHIFT && largest >= (float)(1u << shift) * (32767.0f / 32768.0f))
+  {
+    shift++;
+  }
+
+  double one_q15 = 32768.0 / (double)(1u << shift);
+  double one_q31 = 2147483648.0 / (double)(1u << shift);
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    for (uint32_t j = 0; j < ALLOCATION_PAIRS; j++)
+    {
+      int16_t low = (int16_t)allocation_to_fixed(config.matrix[i][2u * j], one_q15, INT16_MAX);
+      int16_t high = (int16_t)allocation_to_fixed(config.matrix[i][2u * j + 1u], one_q15, INT16_MAX);
+      matrix_q15[i][j] = allocation_pack(low, high);
+    }
+
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      matrix_q31[i][j] = allocation_to_fixed(config.matrix[i][j], one_q31, INT32_MAX);
+    }
+
+    float limit = config.limit[i];
+    limit = (limit < 0.0f) ? 0.0f : limit;
+    limit_q15[i] = allocation_to_fixed(limit, 32768.0, INT16_MAX);
+    limit_q31[i] = allocation_to_fixed(limit, 2147483648.0, INT32_MAX);
+  }
+}
+
+const allocation_config_t *allocation_get_config(void)
+{
+  return &config;
+}
+
+float allocation_solve_f32(const float wrench[ALLOCATION_AXES], float thrust[ALLOCATION_THRUSTERS])
+{
+  float scale = 1.0f;
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    const float *row = config.matrix[i];
+    float sum = 0.0f;
+
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      sum += row[j] * wrench[j];
+    }
+
+    thrust[i] = sum;
+
+    float magnitude = (sum < 0.0f) ? -sum : sum;
+
+    if (magnitude > config.limit[i] && config.limit[i] / magnitude < scale)
+    {
+      scale = config.limit[i] / magnitude;
+    }
+  }
+
+  if (scale < 1.0f)
+  {
+    for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+    {
+      thrust[i] *= scale;
+    }
+  }
+
+  return scale;
+}
+
+int32_t allocation_solve_q15(const int16_t wrench[ALLOCATION_AXES], int16_t thrust[ALLOCATION_THRUSTERS])
+{
+  uint32_t packed[ALLOCATION_PAIRS];
+  int64_t values[ALLOCATION_THRUSTERS];
+
+  for (uint32_t j = 0; j < ALLOCATION_PAIRS; j++)
+  {
+    packed[j] = allocation_pack(wrench[2u * j], wrench[2u * j + 1u]);
+  }
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    const uint32_t *row = matrix_q15[i];
+
+#ifdef ALLOCATION_SMLALD
+    int64_t sum = (int64_t)__SMLALD(row[0], packed[0], 0u);
+    sum = (int64_t)__SMLALD(row[1], packed[1], (uint64_t)sum);
+    sum = (int64_t)__SMLALD(row[2], packed[2], (uint64_t)sum);
+#else
+    int64_t sum = 0;
+
+    for (uint32_t j = 0; j < ALLOCATION_PAIRS; j++)
+    {
+      sum += (int32_t)(int16_t)(row[j] & 0xFFFFu) * (int32_t)(int16_t)(packed[j] & 0xFFFFu);
+      sum += (int32_t)(int16_t)(row[j] >> 16) * (int32_t)(int16_t)(packed[j] >> 16);
+    }
+#endif
+
+    /* Q30 of the shifted matrix to Q15 */
+    values[i] = sum >> (15u - shift);
+  }
+
+  int32_t scale = allocation_fixed_scale(values, limit_q15);
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    int64_t value = (scale < ALLOCATION_Q15_ONE) ? (values[i] * scale) >> 15 : values[i];
+    thrust[i] = (int16_t)((value > INT16_MAX) ? INT16_MAX : (value < INT16_MIN) ? INT16_MIN : value);
+  }
+
+  return scale;
+}
+
+int32_t allocation_solve_q31(const int32_t wrench[ALLOCATION_AXES], int32_t thrust[ALLOCATION_THRUSTERS])
+{
+  int64_t values[ALLOCATION_THRUSTERS];
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    const int32_t *row = matrix_q31[i];
+    int64_t sum = 0;
+
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      sum += ((int64_t)row[j] * wrench[j]) >> ALLOCATION_Q31_HEADROOM;
+    }
+
+    /* Q62 less the headroom, of the shifted matrix, to Q31 */
+    values[i] = sum >> (31u - ALLOCATION_Q31_HEADROOM - shift);
+  }
+
+  int32_t scale = allocation_fixed_scale(values, limit_q31);
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    int64_t value = (scale < ALLOCATION_Q15_ONE) ? (values[i] * scale) >> 15 : values[i];
+    thrust[i] = (int32_t)((value > INT32_MAX) ? INT32_MAX : (value < INT32_MIN) ? INT32_MIN : value);
+  }
+
+  return scale;
+}
@@ -0,0 +1,213 @@
+/**
+  ******************************************************************************
+  * @file    comm.c
+  * @brief   Host link over USB CDC.
+  *
+  *          Frames are decoded straight out of the USB receive buffer in the
+  *          OUT endpoint interrupt, so no copy of the raw stream is kept.
+  *          Outgoing frames are appended to one half of a double buffer while
+  *          the other half is on the wire, which lets several small telemetry
+  *          messages share a single USB transfer.
+  ******************************************************************************
+  */
+
+#include "comm.h"
+
+#include <string.h>
+
+#include "main.h"
+#include "timestamp.h"
+#include "usbd_cdc_if.h"
+
+#define COMM_TX_BUFFER_SIZE 512u
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+typedef struct
+{
+  uint8_t data[COMM_TX_BUFFER_SIZE];
+  uint16_t length;
+} comm_tx_buffer_t;
+
+static protocol_decoder_t decoder;
+
+/* Latest command, written in the USB interrupt and copied out with interrupts masked */
+static protocol_command_t command;
+static uint32_t command_tick;
+static bool command_valid;
+
+static comm_tx_buffer_t tx_buffers[2];
+static uint8_t tx_fill;               /* Buffer being appended to */
+static bool tx_busy;                  /* The other buffer is being transmitted */
+static uint8_t tx_seq;
+
+static uint32_t irq_save(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static void irq_restore(uint32_t primask)
+{
+  __set_PRIMASK(primask);
+}
+
+void comm_init(void)
+{
+  uint32_t primask = irq_save();
+
+  protocol_decoder_init(&decoder);
+  memset(&command, 0, sizeof(command));
+  command_valid = false;
+
+  memset(tx_buffers, 0, sizeof(tx_buffers));
+  tx_fill = 0;
+  tx_busy = false;
+
+  irq_restore(primask);
+}
+
+/* Hands the fill buffer to USB if nothing is in flight. Interrupts must be masked. */
+static void comm_kick(void)
+{
+  comm_tx_buffer_t *buffer = &tx_buffers[tx_fill];
+
+  if (tx_busy || buffer->length == 0 || hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED)
+  {
+    return;
+  }
+
+  if (CDC_Transmit_FS(buffer->data, buffer->length) != USBD_OK)
+  {
+    return;
+  }
+
+  tx_busy = true;
+  tx_fill ^= 1u;
+  tx_buffers[tx_fill].length = 0;
+}
+
+void comm_receive(const uint8_t *data, uint32_t len)
+{
+  /* Arrival of the USB packet, as close to the wire as the CDC class gets */
+  uint32_t rx_time = timestamp_us();
+  size_t offset = 0;
+
+  while (offset < len)
+  {
+    size_t consumed = 0;
+    protocol_frame_t frame;
+
+    protocol_result_t result = protocol_decode(&decoder, data + offset, len - offset, &consumed, &frame);
+    offset += consumed;
+
+    if (result != PROTOCOL_FRAME)
+    {
+      continue;
+    }
+
+    const protocol_command_t *received = PROTOCOL_PAYLOAD(&frame, protocol_command_t, PROTOCOL_ID_COMMAND);
+    const protocol_ping_t *ping = PROTOCOL_PAYLOAD(&frame, protocol_ping_t, PROTOCOL_ID_PING);
+
+    if (received != NULL)
+    {
+      comm_set_command(received);
+    }
+
+    /* Answer pings straight away so the turnaround is short and measured */
+    if (ping != NULL)
+    {
+      protocol_pong_t pong;
+      pong.host_time_us = ping->host_time_us;
+      pong.rx_time_us = rx_time;
+      pong.tx_time_us = timestamp_us();
+
+      comm_send(PROTOCOL_ID_PONG, &pong, sizeof(pong));
+    }
+  }
+}
+
+void comm_transmit_complete(void)
+{
+  uint32_t primask = irq_save();
+
+  tx_busy = false;
+  comm_kick();
+
+  irq_restore(primask);
+}
+
+bool comm_send(uint8_t id, const void *payload, uint8_t len)
+{
+  uint8_t frame[PROTOCOL_MAX_ENCODED];
+  bool queued = false;
+
+  uint32_t primask = irq_save();
+
+  /* Encoded under the mask so sequence numbers match the order frames are queued in */
+  size_t size = protocol_encode(id, tx_seq, payload, len, frame, sizeof(frame));
+  comm_tx_buffer_t *buffer = &tx_buffers[tx_fill];
+
+  if (size != 0 && buffer->length + size <= COMM_TX_BUFFER_SIZE)
+  {
+    memcpy(&buffer->data[buffer->length], frame, size);
+    buffer->length = (uint16_t)(buffer->length + size);
+    tx_seq++;
+    queued = true;
+
+    comm_kick();
+  }
+
+  irq_restore(primask);
+
+  return queued;
+}
+
+bool comm_send_status(void)
+{
+  protocol_status_t status;
+  uint32_t now = HAL_GetTick();
+
+  uint32_t primask = irq_save();
+
+  status.time_us = timestamp_us();
+  status.uptime_ms = now;
+  status.rx_frames = (uint16_t)decoder.frames;
+  status.rx_errors = (uint16_t)decoder.errors;
+  status.command_age_ms = command_valid ? (uint16_t)((now - command_tick) > 0xFFFFu ? 0xFFFFu : (now - command_tick)) : 0xFFFFu;
+  status.flags = 0;
+
+  irq_restore(primask);
+
+  return comm_send(PROTOCOL_ID_STATUS, &status, sizeof(status));
+}
+
+bool comm_get_command(protocol_command_t *out, uint32_t *age_ms)
+{
+  uint32_t primask = irq_save();
+
+  bool valid = command_valid;
+  memcpy(out, &command, sizeof(*out));
+  uint32_t tick = command_tick;
+
+  irq_restore(primask);
+
+  if (age_ms != NULL)
+  {
+    *age_ms = HAL_GetTick() - tick;
+  }
+
+  return valid;
+}
+
+void comm_set_command(const protocol_command_t *received)
+{
+  uint32_t primask = irq_save();
+
+  memcpy(&command, received, sizeof(command));
+  command_tick = HAL_GetTick();
+  command_valid = true;
+
+  irq_restore(primask);
+}
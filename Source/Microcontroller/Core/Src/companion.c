@@ -0,0 +1,277 @@
+/**
+  ******************************************************************************
+  * @file    companion.c
+  * @brief   SPI2 slave link to the companion computer.
+  *
+  *          Both DMA streams run in double-buffer mode, which is circular, so
+  *          they never stop and need no interrupt. Each frame ends with NSS
+  *          going high, and the EXTI interrupt on that edge is the only place
+  *          the link is serviced:
+  *
+  *          - The receive stream has just switched buffers. The one it left
+  *            holds the frame from the companion and is checked in place.
+  *          - The transmit stream switched a byte earlier, when it handed the
+  *            last byte to the shift register, and the first byte of the next
+  *            frame already sits in the data register. The buffer it left is
+  *            pointed at the next queued frame, which goes out the time after.
+  *
+  *          Transmit buffers are the slots of a ring that messages are built
+  *          in, so nothing is copied on either side. A slot stays taken until
+  *          the edge after it has gone out.
+  *
+  *          If a transaction was not a whole frame the receive count is off,
+  *          and if the transmit stream was ever late for a byte it is a byte
+  *          behind and its count is off, though it still switched buffers.
+  *          Either way the two sides no longer agree where frames start. The
+  *          peripheral is reset and both streams restarted, and the frames
+  *          that were on their way out are lost.
+  *
+  *          The edge interrupt is at
+  *          configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY. Tasks mask
+  *          interrupts while they take or count slots, so the interrupt never
+  *          sees the ring half updated.
+  *
+  *          The registers are written through the ops, companion_stm32.c on
+  *          the vehicle.
+  ******************************************************************************
+  */
+
+#include "companion.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "comm.h"
+#include "crc.h"
+
+#define COMPANION_FRAME_SIZE sizeof(companion_frame_t)
+#define COMPANION_CRC_SIZE offsetof(companion_frame_t, crc)
+
+static const companion_ops_t *ops;
+
+static companion_frame_t rx_frames[2];
+
+/* Sent whenever nothing is queued */
+static companion_frame_t idle_frame;
+
+static companion_frame_t tx_slots[COMPANION_TX_SLOTS];
+static volatile bool tx_ready[COMPANION_TX_SLOTS];
+static uint32_t tx_acquired;          /* Slots handed out, counts wrap */
+static uint32_t tx_sent;              /* Slots given to the stream */
+static uint32_t tx_released;          /* Slots free again */
+static uint8_t tx_seq;
+
+/* Whether the two frames the transmit stream holds, oldest first, are ring slots */
+static bool tx_in_flight[2];
+
+/* Buffer each stream was on at the last edge */
+static uint32_t rx_target;
+static uint32_t tx_target;
+
+static companion_stats_t stats;
+
+static void companion_seal(companion_frame_t *frame)
+{
+  frame->crc = crc16((const uint8_t *)frame, COMPANION_CRC_SIZE);
+}
+
+/* Restarts both streams on frame boundaries. Interrupts must be masked or at link priority. */
+static void companion_start(void)
+{
+  /* Whatever was on its way out is lost */
+  tx_released = tx_sent;
+  tx_in_flight[0] = false;
+  tx_in_flight[1] = false;
+
+  rx_target = 0;
+  tx_target = 0;
+
+  ops->start(rx_frames, &idle_frame);
+}
+
+/* Acts on a frame from the companion, where DMA left it */
+static void companion_receive(const companion_frame_t *frame, uint32_t rx_time)
+{
+  /* A companion with nothing to say may clock out zeros */
+  if (frame->id == 0u)
+  {
+    return;
+  }
+
+  if (crc16((const uint8_t *)frame, COMPANION_CRC_SIZE) != frame->crc)
+  {
+    stats.errors++;
+    return;
+  }
+
+  if (frame->id == PROTOCOL_ID_COMMAND)
+  {
+    comm_set_command((const protocol_command_t *)frame->payload);
+  }
+  else if (frame->id == PROTOCOL_ID_PING)
+  {
+    const protocol_ping_t *ping = (const protocol_ping_t *)frame->payload;
+    protocol_pong_t pong;
+
+    pong.host_time_us = ping->host_time_us;
+    pong.rx_time_us = rx_time;
+    pong.tx_time_us = ops->time_us();
+
+    companion_send(PROTOCOL_ID_PONG, &pong, sizeof(pong));
+  }
+  else
+  {
+    stats.errors++;
+    return;
+  }
+
+  stats.frames++;
+}
+
+/* Points the buffer the transmit stream just left at the next frame to go out */
+static void companion_refill(uint32_t buffer)
+{
+  if (tx_in_flight[0])
+  {
+    tx_released++;
+  }
+
+  tx_in_flight[0] = tx_in_flight[1];
+
+  uint32_t slot = tx_sent % COMPANION_TX_SLOTS;
+
+  if (tx_sent != tx_acquired && tx_ready[slot])
+  {
+    tx_ready[slot] = false;
+    tx_sent++;
+    tx_in_flight[1] = true;
+    ops->load(buffer, &tx_slots[slot]);
+  }
+  else
+  {
+    stats.idle++;
+    tx_in_flight[1] = false;
+    ops->load(buffer, &idle_frame);
+  }
+}
+
+void companion_nss_edge(uint32_t rx_time, uint32_t rx_now, uint32_t tx_now, uint32_t rx_remaining, uint32_t tx_remaining)
+{
+  /* The transmit stream is a byte into the next frame */
+  if (rx_remaining != COMPANION_FRAME_SIZE || tx_remaining != COMPANION_FRAME_SIZE - 1u)
+  {
+    stats.resyncs++;
+    companion_start();
+    return;
+  }
+
+  /* A glitch on NSS with no clocks */
+  if (rx_now == rx_target && tx_now == tx_target)
+  {
+    return;
+  }
+
+  /* One stream finished a frame and the other did not; the two are out of step */
+  if (rx_now == rx_target || tx_now == tx_target)
+  {
+    stats.resyncs++;
+    companion_start();
+    return;
+  }
+
+  rx_target = rx_now;
+  tx_target = tx_now;
+
+  companion_receive(rx_now != 0u ? &rx_frames[0] : &rx_frames[1], rx_time);
+  companion_refill(tx_now != 0u ? 0u : 1u);
+}
+
+void companion_init(const companion_ops_t *new_ops)
+{
+  ops = new_ops;
+
+  for (uint32_t i = 0; i < COMPANION_TX_SLOTS; i++)
+  {
+    tx_ready[i] = false;
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  tx_acquired = 0;
+  tx_sent = 0;
+  tx_seq = 0;
+
+  memset(&idle_frame, 0, sizeof(idle_frame));
+  companion_seal(&idle_frame);
+
+  ops->init();
+  companion_start();
+  ops->enable();
+}
+
+companion_frame_t *companion_acquire(void)
+{
+  companion_frame_t *frame = NULL;
+
+  uint32_t state = ops->lock();
+
+  if (tx_acquired - tx_released < COMPANION_TX_SLOTS)
+  {
+    uint32_t slot = tx_acquired % COMPANION_TX_SLOTS;
+
+    tx_ready[slot] = false;
+    tx_acquired++;
+
+    /* Numbered in the order slots go out */
+    frame = &tx_slots[slot];
+    frame->seq = tx_seq++;
+  }
+  else
+  {
+    stats.dropped++;
+  }
+
+  ops->unlock(state);
+
+  return frame;
+}
+
+void companion_commit(companion_frame_t *frame, uint8_t id)
+{
+  frame->id = id;
+  companion_seal(frame);
+
+  /* The frame is complete in memory before the edge interrupt can see it */
+  atomic_thread_fence(memory_order_release);
+  tx_ready[frame - tx_slots] = true;
+}
+
+bool companion_send(uint8_t id, const void *payload, uint8_t length)
+{
+  if (length > PROTOCOL_MAX_PAYLOAD)
+  {
+    return false;
+  }
+
+  companion_frame_t *frame = companion_acquire();
+
+  if (frame == NULL)
+  {
+    return false;
+  }
+
+  memcpy(frame->payload, payload, length);
+  memset(&frame->payload[length], 0, PROTOCOL_MAX_PAYLOAD - length);
+  companion_commit(frame, id);
+
+  return true;
+}
+
+void companion_get_stats(companion_stats_t *out)
+{
+  uint32_t state = ops->lock();
+
+  *out = stats;
+
+  ops->unlock(state);
+}
@@ -0,0 +1,142 @@
+/**
+  ******************************************************************************
+  * @file    companion_stm32.c
+  * @brief   Companion link operations on SPI2 and DMA1, and the NSS edge
+  *          interrupt that services the link.
+  *
+  *          Both streams run in double-buffer mode, which is circular, so
+  *          they never stop and need no interrupt. The buffer each stream is
+  *          on is its CT bit.
+  *
+  *          SPI2_RX is DMA1 stream 3 channel 0, SPI2_TX DMA1 stream 4 channel 0.
+  ******************************************************************************
+  */
+
+#include "companion.h"
+
+#include "main.h"
+#include "FreeRTOS.h"
+
+#include "timestamp.h"
+
+/* NSS is PB9 */
+#define COMPANION_NSS_LINE 9u
+
+/* The streams' flags in LIFCR and HIFCR */
+#define COMPANION_RX_FLAGS (0x3Du << 22)
+#define COMPANION_TX_FLAGS (0x3Du << 0)
+
+/* Channel 0, byte transfers, high priority, double buffered */
+#define COMPANION_DMA_CR (DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_DBM)
+
+static void companion_stm32_stop_stream(DMA_Stream_TypeDef *stream)
+{
+  stream->CR &= ~DMA_SxCR_EN;
+
+  while ((stream->CR & DMA_SxCR_EN) != 0u)
+  {
+  }
+}
+
+static uint32_t companion_stm32_lock(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static void companion_stm32_unlock(uint32_t primask)
+{
+  __set_PRIMASK(primask);
+}
+
+static void companion_stm32_init(void)
+{
+  __HAL_RCC_DMA1_CLK_ENABLE();
+}
+
+static void companion_stm32_start(companion_frame_t rx[2], const companion_frame_t *tx)
+{
+  companion_stm32_stop_stream(DMA1_Stream3);
+  companion_stm32_stop_stream(DMA1_Stream4);
+
+  /* A reset empties the shift and data registers; the reset values of CR1 are the slave setup CubeMX made */
+  RCC->APB1RSTR |= RCC_APB1RSTR_SPI2RST;
+  RCC->APB1RSTR &= ~RCC_APB1RSTR_SPI2RST;
+
+  DMA1->LIFCR = COMPANION_RX_FLAGS;
+  DMA1->HIFCR = COMPANION_TX_FLAGS;
+
+  DMA1_Stream3->PAR = (uint32_t)&SPI2->DR;
+  DMA1_Stream3->M0AR = (uint32_t)&rx[0];
+  DMA1_Stream3->M1AR = (uint32_t)&rx[1];
+  DMA1_Stream3->NDTR = sizeof(companion_frame_t);
+  DMA1_Stream3->CR = COMPANION_DMA_CR;
+
+  DMA1_Stream4->PAR = (uint32_t)&SPI2->DR;
+  DMA1_Stream4->M0AR = (uint32_t)tx;
+  DMA1_Stream4->M1AR = (uint32_t)tx;
+  DMA1_Stream4->NDTR = sizeof(companion_frame_t);
+  DMA1_Stream4->CR = COMPANION_DMA_CR | DMA_SxCR_DIR_0;
+
+  /* In the order the reference manual gives: receive requests, streams, transmit requests, then the peripheral */
+  SPI2->CR2 = SPI_CR2_RXDMAEN;
+  DMA1_Stream3->CR |= DMA_SxCR_EN;
+  DMA1_Stream4->CR |= DMA_SxCR_EN;
+  SPI2->CR2 |= SPI_CR2_TXDMAEN;
+  SPI2->CR1 |= SPI_CR1_SPE;
+}
+
+static void companion_stm32_load(uint32_t buffer, const companion_frame_t *frame)
+{
+  if (buffer == 0u)
+  {
+    DMA1_Stream4->M0AR = (uint32_t)frame;
+  }
+  else
+  {
+    DMA1_Stream4->M1AR = (uint32_t)frame;
+  }
+}
+
+static void companion_stm32_enable(void)
+{
+  /* Rising edge of PB9, which stays in its SPI2_NSS alternate function */
+  SYSCFG->EXTICR[COMPANION_NSS_LINE / 4u] = (SYSCFG->EXTICR[COMPANION_NSS_LINE / 4u] & ~SYSCFG_EXTICR3_EXTI9) | SYSCFG_EXTICR3_EXTI9_PB;
+  EXTI->RTSR |= 1u << COMPANION_NSS_LINE;
+  EXTI->FTSR &= ~(1u << COMPANION_NSS_LINE);
+  EXTI->PR = 1u << COMPANION_NSS_LINE;
+  EXTI->IMR |= 1u << COMPANION_NSS_LINE;
+
+  HAL_NVIC_ClearPendingIRQ(EXTI9_5_IRQn);
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+}
+
+static uint32_t companion_stm32_time_us(void)
+{
+  return timestamp_us();
+}
+
+const companion_ops_t companion_stm32_ops =
+{
+  .lock = companion_stm32_lock,
+  .unlock = companion_stm32_unlock,
+  .init = companion_stm32_init,
+  .start = companion_stm32_start,
+  .load = companion_stm32_load,
+  .enable = companion_stm32_enable,
+  .time_us = companion_stm32_time_us,
+};
+
+void EXTI9_5_IRQHandler(void)
+{
+  uint32_t time_us = timestamp_us();
+
+  EXTI->PR = 1u << COMPANION_NSS_LINE;
+
+  uint32_t rx_buffer = ((DMA1_Stream3->CR & DMA_SxCR_CT) != 0u) ? 1u : 0u;
+  uint32_t tx_buffer = ((DMA1_Stream4->CR & DMA_SxCR_CT) != 0u) ? 1u : 0u;
+
+  companion_nss_edge(time_us, rx_buffer, tx_buffer, DMA1_Stream3->NDTR, DMA1_Stream4->NDTR);
+}
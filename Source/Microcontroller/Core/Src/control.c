@@ -0,0 +1,303 @@
+/**
+  ******************************************************************************
+  * @file    control.c
+  * @brief   Fixed rate control loop on TIM7.
+  *
+  *          TIM7 counts microseconds and its update interrupt gives the control
+  *          task a notification, at configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+  *          so it may call into the kernel. The task runs at the highest
+  *          priority, so it is never held off by another task, only by
+  *          interrupts and kernel critical sections. Notifications that pile
+  *          up while a step runs long are counted as overruns.
+  *
+  *          Each step first runs the attitude filter over the IMU samples
+  *          queued since the previous one, using the samples' own times, so
+  *          FIFO batches are absorbed without losing the per-sample steps.
+  *
+  *          Both measurements use the DWT cycle counter. Jitter is the
+  *          difference between the time from one wake-up to the next and the
+  *          nominal period, execution time runs from the wake-up to the end of
+  *          the step.
+  ******************************************************************************
+  */
+
+#include "control.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "allocation_qp.h"
+#include "attitude.h"
+#include "comm.h"
+#include "imu.h"
+#include "thrusters.h"
+#include "timestamp.h"
+
+/* Words of stack, the allocation and the attitude filter keep small float arrays on it */
+#define CONTROL_STACK_WORDS 512u
+
+/* TIM7 counts microseconds in a 16-bit register */
+#define CONTROL_RATE_MIN 16u
+#define CONTROL_RATE_MAX 10000u
+
+/* Thrusters go to neutral when the pilot's commands stop for this long */
+#define CONTROL_COMMAND_TIMEOUT_MS 500u
+
+#define CONTROL_ATTITUDE_FILTER ATTITUDE_EKF
+
+/* IMU samples taken from the queue at a time, a FIFO batch and some slack */
+#define CONTROL_IMU_SAMPLES 16u
+
+/* Longest step between IMU samples the filter integrates, s */
+#define CONTROL_IMU_MAX_DT 0.05f
+
+static StaticTask_t control_tcb;
+static StackType_t control_stack[CONTROL_STACK_WORDS];
+static TaskHandle_t control_task;
+
+static uint32_t rate;
+static uint32_t period_cycles;
+static uint32_t cycles_per_us;
+
+static attitude_t attitude;
+static imu_sample_t imu_samples[CONTROL_IMU_SAMPLES];
+static uint32_t imu_last_time;
+static bool imu_started;
+
+/* Written by the control task, read by control_get_attitude in a critical section */
+static protocol_attitude_t estimate;
+
+/* Written by the control task, read and cleared by control_get_timing in a critical section */
+static uint16_t jitter_bins[PROTOCOL_TIMING_BINS];
+static uint16_t execution_bins[PROTOCOL_TIMING_BINS];
+static uint32_t jitter_max;
+static uint32_t execution_max;
+static uint16_t overruns;
+
+void TIM7_IRQHandler(void)
+{
+  BaseType_t woken = pdFALSE;
+
+  /* Status bits are cleared by writing zero, ones are ignored */
+  TIM7->SR = (uint32_t)~TIM_SR_UIF;
+
+  vTaskNotifyGiveFromISR(control_task, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+static void control_start_timer(void)
+{
+  /* APB1 timers run at twice PCLK1 whenever the APB1 prescaler divides */
+  uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+  {
+    clock *= 2u;
+  }
+
+  __HAL_RCC_TIM7_CLK_ENABLE();
+
+  TIM7->CR1 = 0;
+  TIM7->PSC = (clock / 1000000u) - 1u;
+  TIM7->ARR = (1000000u / rate) - 1u;
+  TIM7->CNT = 0;
+
+  /* Load the prescaler now, without raising an interrupt for it */
+  TIM7->EGR = TIM_EGR_UG;
+  TIM7->SR = 0;
+  TIM7->DIER = TIM_DIER_UIE;
+
+  HAL_NVIC_SetPriority(TIM7_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM7_IRQn);
+
+  TIM7->CR1 = TIM_CR1_CEN;
+}
+
+/* Bin 0 is under 1 us, bin n is [2^(n-1), 2^n) us, the last bin takes the rest */
+static void control_record(uint16_t *bins, uint32_t *max, uint32_t cycles)
+{
+  uint32_t us = cycles / cycles_per_us;
+  uint32_t bin = (us == 0u) ? 0u : 32u - __CLZ(us);
+
+  if (bin >= PROTOCOL_TIMING_BINS)
+  {
+    bin = PROTOCOL_TIMING_BINS - 1u;
+  }
+
+  if (bins[bin] < UINT16_MAX)
+  {
+    bins[bin]++;
+  }
+
+  if (cycles > *max)
+  {
+    *max = cycles;
+  }
+}
+
+static void control_estimate(void)
+{
+  uint32_t count;
+  bool fresh = false;
+
+  while ((count = imu_read(imu_samples, CONTROL_IMU_SAMPLES)) > 0u)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const imu_sample_t *sample = &imu_samples[i];
+      float dt = (float)(sample->time_us - imu_last_time) * 1e-6f;
+
+      /* The first sample and any after a gap only set the time */
+      if (imu_started && dt > 0.0f && dt < CONTROL_IMU_MAX_DT)
+      {
+        attitude_update(&attitude, sample->gyro, sample->accel, dt);
+      }
+
+      imu_started = true;
+      imu_last_time = sample->time_us;
+    }
+
+    fresh = true;
+  }
+
+  if (!fresh)
+  {
+    return;
+  }
+
+  taskENTER_CRITICAL();
+
+  estimate.time_us = imu_last_time;
+  memcpy(estimate.q, attitude.q, sizeof(estimate.q));
+  memcpy(estimate.rate, attitude.rate, sizeof(estimate.rate));
+
+  taskEXIT_CRITICAL();
+}
+
+static void control_step(void)
+{
+  protocol_command_t command;
+  uint32_t age_ms;
+  float wrench[ALLOCATION_AXES] = {0.0f};
+  float thrust[ALLOCATION_THRUSTERS] = {0.0f};
+
+  bool live = comm_get_command(&command, &age_ms) && age_ms < CONTROL_COMMAND_TIMEOUT_MS &&
+              (command.flags & PROTOCOL_COMMAND_GAMEPAD) != 0u;
+
+  if (live)
+  {
+    /* Left stick heave and yaw, right stick surge and sway. Stick Y axes are positive down. */
+    wrench[0] = -(float)command.axes[3] / 32767.0f;
+    wrench[1] = (float)command.axes[2] / 32767.0f;
+    wrench[2] = (float)command.axes[1] / 32767.0f;
+    wrench[5] = (float)command.axes[0] / 32767.0f;
+
+    allocation_solve_qp(wrench, thrust);
+  }
+  else
+  {
+    /* Start from neutral when the pilot comes back */
+    allocation_qp_reset();
+  }
+
+  uint16_t pulse_us[THRUSTER_COUNT];
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    float offset = thrust[i] * (float)(THRUSTER_PULSE_MAX - THRUSTER_PULSE_NEUTRAL);
+    pulse_us[i] = (uint16_t)((int32_t)THRUSTER_PULSE_NEUTRAL + (int32_t)(offset + ((offset < 0.0f) ? -0.5f : 0.5f)));
+  }
+
+  thrusters_write(pulse_us);
+}
+
+static void control_task_main(void *argument)
+{
+  (void)argument;
+
+  control_start_timer();
+
+  uint32_t last_wake = 0;
+  bool first = true;
+
+  for (;;)
+  {
+    uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t wake = timestamp_cycles();
+
+    if (pending > 1u)
+    {
+      overruns += (uint16_t)(pending - 1u);
+    }
+
+    if (!first)
+    {
+      uint32_t elapsed = wake - last_wake;
+      uint32_t error = (elapsed > period_cycles) ? elapsed - period_cycles : period_cycles - elapsed;
+
+      control_record(jitter_bins, &jitter_max, error);
+    }
+
+    first = false;
+    last_wake = wake;
+
+    control_estimate();
+    control_step();
+
+    control_record(execution_bins, &execution_max, timestamp_cycles() - wake);
+  }
+}
+
+void control_init(uint32_t rate_hz)
+{
+  rate = (rate_hz < CONTROL_RATE_MIN) ? CONTROL_RATE_MIN : (rate_hz > CONTROL_RATE_MAX) ? CONTROL_RATE_MAX : rate_hz;
+  period_cycles = SystemCoreClock / rate;
+  cycles_per_us = SystemCoreClock / 1000000u;
+
+  allocation_init(NULL);
+  allocation_qp_init(NULL);
+  attitude_init(&attitude, CONTROL_ATTITUDE_FILTER);
+
+  control_task = xTaskCreateStatic(control_task_main, "control", CONTROL_STACK_WORDS, NULL, configMAX_PRIORITIES - 1, control_stack, &control_tcb);
+}
+
+void control_get_attitude(protocol_attitude_t *out)
+{
+  taskENTER_CRITICAL();
+
+  *out = estimate;
+
+  taskEXIT_CRITICAL();
+}
+
+void control_get_timing(protocol_timing_t *timing)
+{
+  uint16_t jitter[PROTOCOL_TIMING_BINS];
+  uint16_t execution[PROTOCOL_TIMING_BINS];
+
+  taskENTER_CRITICAL();
+
+  memcpy(jitter, jitter_bins, sizeof(jitter));
+  memcpy(execution, execution_bins, sizeof(execution));
+  uint32_t jitter_us = jitter_max / cycles_per_us;
+  uint32_t execution_us = execution_max / cycles_per_us;
+  uint16_t missed = overruns;
+
+  memset(jitter_bins, 0, sizeof(jitter_bins));
+  memset(execution_bins, 0, sizeof(execution_bins));
+  jitter_max = 0;
+  execution_max = 0;
+
+  taskEXIT_CRITICAL();
+
+  timing->time_us = timestamp_us();
+  timing->rate_hz = (uint16_t)rate;
+  timing->overruns = missed;
+  timing->jitter_max_us = (uint16_t)((jitter_us > UINT16_MAX) ? UINT16_MAX : jitter_us);
+  timing->execution_max_us = (uint16_t)((execution_us > UINT16_MAX) ? UINT16_MAX : execution_us);
+  memcpy(timing->jitter, jitter, sizeof(jitter));
+  memcpy(timing->execution, execution, sizeof(execution));
+}
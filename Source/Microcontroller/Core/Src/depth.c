@@ -0,0 +1,422 @@
+/**
+  ******************************************************************************
+  * @file    depth.c
+  * @brief   MS5837-30BA depth sensor driven by TIM14 and the I2C1 queue.
+  *
+  *          Every TIM14 tick advances one step: reset, calibration read,
+  *          conversion command or result read. The result read's handler
+  *          starts the next conversion straight away, so one conversion runs
+  *          per tick and the tick period covers the conversion time. All of
+  *          it runs in the timer and I2C interrupts at
+  *          configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, so the steps never
+  *          preempt each other. A failed step restarts the cycle from the
+  *          conversion, or from the reset before calibration, and one still
+  *          pending after a few ticks is aborted.
+  *
+  *          Depth is filtered with a constant velocity Kalman filter, driven
+  *          by white acceleration, at the time each pressure conversion was
+  *          taken, half way through it.
+  ******************************************************************************
+  */
+
+#include "depth.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "i2c_bus.h"
+#include "timestamp.h"
+
+#define DEPTH_ADDRESS             0x76u
+#define DEPTH_CMD_RESET           0x1Eu
+#define DEPTH_CMD_PRESSURE        0x48u     /* D1, OSR 4096 */
+#define DEPTH_CMD_TEMPERATURE     0x58u     /* D2, OSR 4096 */
+#define DEPTH_CMD_ADC             0x00u
+#define DEPTH_CMD_PROM            0xA0u
+#define DEPTH_PROM_WORDS          7u
+
+/* Longest OSR 4096 conversion, under the tick period */
+#define DEPTH_CONVERSION_US       9040u
+
+#define DEPTH_TEMPERATURE_EVERY   10u
+#define DEPTH_TIMEOUT_TICKS       5u
+
+/* Fresh water */
+#define DEPTH_DENSITY             997.0f
+#define DEPTH_GRAVITY             9.80665f
+
+/* Kalman filter: depth measurement noise in m, acceleration noise density in m/s^2/sqrt(Hz) */
+#define DEPTH_MEASUREMENT_NOISE   0.01f
+#define DEPTH_ACCEL_NOISE         0.5f
+
+/* Longest gap between pressure samples the filter predicts across, s */
+#define DEPTH_MAX_DT              0.5f
+
+typedef enum
+{
+  DEPTH_RESET,
+  DEPTH_CALIBRATE,
+  DEPTH_CONVERT,
+  DEPTH_READ
+} depth_state_t;
+
+/* Only touched from the TIM14 and I2C1 interrupts, except the estimate */
+static depth_state_t state;
+static bool busy;
+static uint32_t busy_ticks;
+
+static const uint8_t command_reset = DEPTH_CMD_RESET;
+static const uint8_t command_adc = DEPTH_CMD_ADC;
+static const uint8_t command_prom[DEPTH_PROM_WORDS] =
+{
+  DEPTH_CMD_PROM + 0u, DEPTH_CMD_PROM + 2u, DEPTH_CMD_PROM + 4u, DEPTH_CMD_PROM + 6u,
+  DEPTH_CMD_PROM + 8u, DEPTH_CMD_PROM + 10u, DEPTH_CMD_PROM + 12u
+};
+static const uint8_t command_pressure = DEPTH_CMD_PRESSURE;
+static const uint8_t command_temperature = DEPTH_CMD_TEMPERATURE;
+
+static uint8_t prom_raw[DEPTH_PROM_WORDS][2];
+static bool prom_failed;
+static uint16_t prom[DEPTH_PROM_WORDS];
+
+static uint8_t adc_raw[3];
+static bool converting_temperature;
+static uint32_t conversion_time;
+static uint32_t conversions;
+static uint32_t temperature_raw;
+static bool have_temperature;
+
+static bool have_surface;
+static float surface_pa;
+
+static bool filter_started;
+static uint32_t filter_time;
+static float x[2];                      /* Depth and velocity, positive down */
+static float p[2][2];
+
+/* Written from the I2C interrupt, read by depth_get with interrupts masked */
+static protocol_depth_t estimate;
+
+static void depth_submit(const uint8_t *tx, uint8_t *rx, uint16_t rx_length, i2c_bus_handler_t handler, void *context)
+{
+  i2c_bus_transfer_t transfer =
+  {
+    .address = DEPTH_ADDRESS,
+    .tx = tx,
+    .tx_length = 1u,
+    .rx = rx,
+    .rx_length = rx_length,
+    .handler = handler,
+    .context = context,
+  };
+
+  i2c_bus_submit(&transfer);
+}
+
+/* The 4-bit CRC in the top of the first word, over the seven words with an eighth of zero */
+static bool depth_check_prom(void)
+{
+  uint16_t words[DEPTH_PROM_WORDS + 1u];
+  uint16_t remainder = 0;
+
+  for (uint32_t i = 0; i < DEPTH_PROM_WORDS; i++)
+  {
+    words[i] = prom[i];
+  }
+
+  words[0] &= 0x0FFFu;
+  words[DEPTH_PROM_WORDS] = 0;
+
+  for (uint32_t i = 0; i < 16u; i++)
+  {
+    remainder ^= ((i & 1u) != 0u) ? (uint16_t)(words[i >> 1] & 0x00FFu) : (uint16_t)(words[i >> 1] >> 8);
+
+    for (uint32_t bit = 0; bit < 8u; bit++)
+    {
+      remainder = ((remainder & 0x8000u) != 0u) ? (uint16_t)((remainder << 1) ^ 0x3000u) : (uint16_t)(remainder << 1);
+    }
+  }
+
+  return ((remainder >> 12) & 0x000Fu) == (prom[0] >> 12);
+}
+
+/* Second order compensation from the datasheet, pressure in Pa and temperature in degrees Celsius */
+static void depth_compensate(uint32_t d1, uint32_t d2, float *pressure, float *temperature)
+{
+  int64_t dt = (int64_t)d2 - ((int64_t)prom[5] << 8);
+  int64_t temp = 2000 + ((dt * prom[6]) >> 23);
+  int64_t off = ((int64_t)prom[2] << 16) + ((prom[4] * dt) >> 7);
+  int64_t sens = ((int64_t)prom[1] << 15) + ((prom[3] * dt) >> 8);
+  int64_t ti;
+  int64_t offi;
+  int64_t sensi;
+
+  if (temp < 2000)
+  {
+    ti = (3 * dt * dt) >> 33;
+    offi = (3 * (temp - 2000) * (temp - 2000)) >> 1;
+    sensi = (5 * (temp - 2000) * (temp - 2000)) >> 3;
+
+    if (temp < -1500)
+    {
+      offi += 7 * (temp + 1500) * (temp + 1500);
+      sensi += 4 * (temp + 1500) * (temp + 1500);
+    }
+  }
+  else
+  {
+    ti = (2 * dt * dt) >> 37;
+    offi = ((temp - 2000) * (temp - 2000)) >> 4;
+    sensi = 0;
+  }
+
+  off -= offi;
+  sens -= sensi;
+
+  /* 0.1 mbar, which is 10 Pa */
+  int64_t tenths = ((((int64_t)d1 * sens) >> 21) - off) >> 13;
+
+  *pressure = (float)tenths * 10.0f;
+  *temperature = (float)(temp - ti) / 100.0f;
+}
+
+static void depth_filter(float depth, uint32_t time_us)
+{
+  float dt = (float)(time_us - filter_time) * 1e-6f;
+
+  if (!filter_started || !(dt > 0.0f) || dt > DEPTH_MAX_DT)
+  {
+    x[0] = depth;
+    x[1] = 0.0f;
+    p[0][0] = DEPTH_MEASUREMENT_NOISE * DEPTH_MEASUREMENT_NOISE;
+    p[0][1] = 0.0f;
+    p[1][0] = 0.0f;
+    p[1][1] = 1.0f;
+    filter_started = true;
+    filter_time = time_us;
+    return;
+  }
+
+  filter_time = time_us;
+
+  /* Predict with F = [1 dt; 0 1] and the white acceleration process noise */
+  float q = DEPTH_ACCEL_NOISE * DEPTH_ACCEL_NOISE;
+  float p00 = p[0][0] + dt * (p[1][0] + p[0][1]) + dt * dt * p[1][1] + q * dt * dt * dt / 3.0f;
+  float p01 = p[0][1] + dt * p[1][1] + q * dt * dt / 2.0f;
+  float p11 = p[1][1] + q * dt;
+
+  x[0] += x[1] * dt;
+
+  /* Correct with the measured depth, H = [1 0] */
+  float s = p00 + DEPTH_MEASUREMENT_NOISE * DEPTH_MEASUREMENT_NOISE;
+  float k0 = p00 / s;
+  float k1 = p01 / s;
+  float innovation = depth - x[0];
+
+  x[0] += k0 * innovation;
+  x[1] += k1 * innovation;
+
+  p[0][0] = (1.0f - k0) * p00;
+  p[0][1] = (1.0f - k0) * p01;
+  p[1][0] = p[0][1];
+  p[1][1] = p11 - k1 * p01;
+}
+
+static void depth_converted(bool ok, void *context)
+{
+  (void)context;
+
+  busy = false;
+
+  if (ok)
+  {
+    conversion_time = timestamp_us();
+    state = DEPTH_READ;
+  }
+  else
+  {
+    state = DEPTH_CONVERT;
+  }
+}
+
+static void depth_convert(void)
+{
+  converting_temperature = !have_temperature || (conversions % DEPTH_TEMPERATURE_EVERY) == 0u;
+  conversions++;
+
+  busy = true;
+  busy_ticks = 0;
+  depth_submit(converting_temperature ? &command_temperature : &command_pressure, NULL, 0, depth_converted, NULL);
+}
+
+static void depth_read(bool ok, void *context)
+{
+  (void)context;
+
+  if (!ok)
+  {
+    busy = false;
+    state = DEPTH_CONVERT;
+    return;
+  }
+
+  uint32_t raw = ((uint32_t)adc_raw[0] << 16) | ((uint32_t)adc_raw[1] << 8) | adc_raw[2];
+
+  /* A read before the conversion finished returns zero */
+  if (raw != 0u)
+  {
+    if (converting_temperature)
+    {
+      temperature_raw = raw;
+      have_temperature = true;
+    }
+    else if (have_temperature)
+    {
+      float pressure;
+      float temperature;
+
+      depth_compensate(raw, temperature_raw, &pressure, &temperature);
+
+      if (!have_surface)
+      {
+        surface_pa = pressure;
+        have_surface = true;
+      }
+
+      uint32_t time_us = conversion_time + DEPTH_CONVERSION_US / 2u;
+
+      depth_filter((pressure - surface_pa) / (DEPTH_DENSITY * DEPTH_GRAVITY), time_us);
+
+      estimate.time_us = time_us;
+      estimate.depth_m = x[0];
+      estimate.velocity_mps = x[1];
+      estimate.pressure_pa = pressure;
+      estimate.temperature_c = temperature;
+    }
+  }
+
+  depth_convert();
+}
+
+static void depth_calibrated(bool ok, void *context)
+{
+  uint32_t word = (uint32_t)(uintptr_t)context;
+
+  if (!ok)
+  {
+    prom_failed = true;
+  }
+
+  prom[word] = (uint16_t)(((uint16_t)prom_raw[word][0] << 8) | prom_raw[word][1]);
+
+  if (word + 1u < DEPTH_PROM_WORDS)
+  {
+    return;
+  }
+
+  busy = false;
+  state = (!prom_failed && depth_check_prom()) ? DEPTH_CONVERT : DEPTH_RESET;
+}
+
+static void depth_reset(bool ok, void *context)
+{
+  (void)context;
+
+  busy = false;
+
+  /* Calibration is read on the next tick, well after the 2.8 ms reload */
+  if (ok)
+  {
+    state = DEPTH_CALIBRATE;
+  }
+}
+
+void TIM8_TRG_COM_TIM14_IRQHandler(void)
+{
+  /* Status bits are cleared by writing zero, ones are ignored */
+  TIM14->SR = (uint32_t)~TIM_SR_UIF;
+
+  if (busy)
+  {
+    /* Failed handlers pick the step to retry, and a step that never got queued is retried as is */
+    if (++busy_ticks >= DEPTH_TIMEOUT_TICKS)
+    {
+      i2c_bus_abort();
+      busy = false;
+    }
+
+    return;
+  }
+
+  busy = true;
+  busy_ticks = 0;
+
+  switch (state)
+  {
+    case DEPTH_RESET:
+      depth_submit(&command_reset, NULL, 0, depth_reset, NULL);
+      break;
+
+    case DEPTH_CALIBRATE:
+      prom_failed = false;
+
+      for (uint32_t i = 0; i < DEPTH_PROM_WORDS; i++)
+      {
+        depth_submit(&command_prom[i], prom_raw[i], 2u, depth_calibrated, (void *)(uintptr_t)i);
+      }
+      break;
+
+    case DEPTH_CONVERT:
+      depth_convert();
+      break;
+
+    case DEPTH_READ:
+    default:
+      depth_submit(&command_adc, adc_raw, sizeof(adc_raw), depth_read, NULL);
+      break;
+  }
+}
+
+void depth_init(void)
+{
+  /* APB1 timers run at twice PCLK1 whenever the APB1 prescaler divides */
+  uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+  {
+    clock *= 2u;
+  }
+
+  state = DEPTH_RESET;
+  busy = false;
+
+  __HAL_RCC_TIM14_CLK_ENABLE();
+
+  TIM14->CR1 = 0;
+  TIM14->PSC = (clock / 1000000u) - 1u;
+  TIM14->ARR = (1000000u / DEPTH_RATE_HZ) - 1u;
+  TIM14->CNT = 0;
+
+  /* Load the prescaler now, without raising an interrupt for it */
+  TIM14->EGR = TIM_EGR_UG;
+  TIM14->SR = 0;
+  TIM14->DIER = TIM_DIER_UIE;
+
+  HAL_NVIC_SetPriority(TIM8_TRG_COM_TIM14_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM8_TRG_COM_TIM14_IRQn);
+
+  TIM14->CR1 = TIM_CR1_CEN;
+}
+
+void depth_get(protocol_depth_t *out)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  *out = estimate;
+
+  __set_PRIMASK(primask);
+}
@@ -0,0 +1,341 @@
+/**
+  ******************************************************************************
+  * @file    i2c_bus.c
+  * @brief   I2C1 master transactions driven by interrupts and DMA1.
+  *
+  *          The event interrupt walks each transaction through start,
+  *          address, data and stop. Written bytes are fed on TXE; they are
+  *          few, usually a command or register, so DMA would cost more to set
+  *          up than it saves. Reads of two bytes or more go to DMA with LAST
+  *          set, so the peripheral sends the final NACK by itself and the
+  *          stop is requested from the DMA completion interrupt. A single
+  *          byte read needs the NACK and stop set up while the address is
+  *          acknowledged, as the reference manual describes, and is read on
+  *          RXNE.
+  *
+  *          The I2C event and error interrupts and the DMA interrupt are all
+  *          at configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, so one never
+  *          runs in the middle of another. Tasks mask interrupts around the
+  *          queue.
+  *
+  *          I2C1_RX is DMA1 stream 0 channel 1.
+  ******************************************************************************
+  */
+
+#include "i2c_bus.h"
+
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+
+/* The stream's flags in LIFCR */
+#define I2C_BUS_RX_FLAGS (0x3Du << 0)
+
+#define I2C_BUS_ERRORS (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_AF | I2C_SR1_OVR | I2C_SR1_TIMEOUT)
+
+/* A stop takes a bit time or two, 400 kHz is about 420 cycles a bit */
+#define I2C_BUS_STOP_SPINS 2000u
+
+static i2c_bus_transfer_t queue[I2C_BUS_QUEUE];
+static uint32_t queue_head;
+static uint32_t queue_count;
+
+/* The head of the queue is on the bus */
+static bool active;
+static bool reading;
+static bool aborting;
+static uint32_t written;
+
+static i2c_bus_stats_t stats;
+
+static void i2c_bus_stop_stream(void)
+{
+  DMA1_Stream0->CR &= ~DMA_SxCR_EN;
+
+  while ((DMA1_Stream0->CR & DMA_SxCR_EN) != 0u)
+  {
+  }
+
+  DMA1->LIFCR = I2C_BUS_RX_FLAGS;
+}
+
+/* Acknowledges received bytes and, for two or more, hands them to DMA. Before the start condition. */
+static void i2c_bus_arm_read(const i2c_bus_transfer_t *transfer)
+{
+  reading = true;
+  I2C1->CR1 |= I2C_CR1_ACK;
+
+  if (transfer->rx_length >= 2u)
+  {
+    DMA1->LIFCR = I2C_BUS_RX_FLAGS;
+    DMA1_Stream0->M0AR = (uint32_t)transfer->rx;
+    DMA1_Stream0->NDTR = transfer->rx_length;
+    DMA1_Stream0->CR |= DMA_SxCR_EN;
+
+    I2C1->CR2 |= I2C_CR2_DMAEN | I2C_CR2_LAST;
+  }
+}
+
+/* Starts the transaction at the head of the queue. Interrupts must be masked or at bus priority. */
+static void i2c_bus_next(void)
+{
+  if (active || aborting || queue_count == 0u)
+  {
+    return;
+  }
+
+  const i2c_bus_transfer_t *transfer = &queue[queue_head];
+
+  /* The stop ending the previous transaction may still be on the bus */
+  for (uint32_t i = 0; i < I2C_BUS_STOP_SPINS && (I2C1->CR1 & I2C_CR1_STOP) != 0u; i++)
+  {
+  }
+
+  active = true;
+  reading = false;
+  written = 0;
+
+  if (transfer->tx_length == 0u)
+  {
+    i2c_bus_arm_read(transfer);
+  }
+
+  I2C1->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+  I2C1->CR1 |= I2C_CR1_START;
+}
+
+/* Ends the active transaction and starts the next */
+static void i2c_bus_finish(bool ok)
+{
+  /* Copied out, the handler may queue another transaction into this slot */
+  i2c_bus_transfer_t transfer = queue[queue_head];
+
+  I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITERREN | I2C_CR2_ITBUFEN | I2C_CR2_DMAEN | I2C_CR2_LAST);
+
+  queue_head = (queue_head + 1u) % I2C_BUS_QUEUE;
+  queue_count--;
+  active = false;
+
+  if (ok)
+  {
+    stats.transfers++;
+  }
+  else
+  {
+    stats.errors++;
+  }
+
+  if (transfer.handler != NULL)
+  {
+    transfer.handler(ok, transfer.context);
+  }
+
+  i2c_bus_next();
+}
+
+void I2C1_EV_IRQHandler(void)
+{
+  uint32_t sr1 = I2C1->SR1;
+
+  if (!active)
+  {
+    I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN);
+    return;
+  }
+
+  const i2c_bus_transfer_t *transfer = &queue[queue_head];
+
+  if ((sr1 & I2C_SR1_SB) != 0u)
+  {
+    I2C1->DR = ((uint32_t)transfer->address << 1) | (reading ? 1u : 0u);
+  }
+  else if ((sr1 & I2C_SR1_ADDR) != 0u)
+  {
+    if (!reading)
+    {
+      (void)I2C1->SR2;
+      I2C1->DR = transfer->tx[written++];
+      I2C1->CR2 |= I2C_CR2_ITBUFEN;
+    }
+    else if (transfer->rx_length == 1u)
+    {
+      /* NACK and stop are set before ADDR is cleared, so they apply to the only byte */
+      I2C1->CR1 &= ~I2C_CR1_ACK;
+      (void)I2C1->SR2;
+      I2C1->CR1 |= I2C_CR1_STOP;
+      I2C1->CR2 |= I2C_CR2_ITBUFEN;
+    }
+    else
+    {
+      /* DMA takes it from here */
+      (void)I2C1->SR2;
+    }
+  }
+  else if (!reading)
+  {
+    if ((sr1 & I2C_SR1_TXE) != 0u && written < transfer->tx_length)
+    {
+      I2C1->DR = transfer->tx[written++];
+    }
+    else if ((sr1 & I2C_SR1_BTF) != 0u)
+    {
+      /* Last byte acknowledged */
+      I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+
+      if (transfer->rx_length > 0u)
+      {
+        i2c_bus_arm_read(transfer);
+        I2C1->CR1 |= I2C_CR1_START;
+      }
+      else
+      {
+        I2C1->CR1 |= I2C_CR1_STOP;
+        i2c_bus_finish(true);
+      }
+    }
+    else
+    {
+      /* Everything is written, only BTF is left to wait for */
+      I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+    }
+  }
+  else if (transfer->rx_length == 1u && (sr1 & I2C_SR1_RXNE) != 0u)
+  {
+    transfer->rx[0] = (uint8_t)I2C1->DR;
+    i2c_bus_finish(true);
+  }
+}
+
+void I2C1_ER_IRQHandler(void)
+{
+  uint32_t errors = I2C1->SR1 & I2C_BUS_ERRORS;
+
+  /* Error flags are cleared by writing zero, ones are ignored */
+  I2C1->SR1 = (uint32_t)~errors & 0xFFFFu;
+
+  if (!active || errors == 0u)
+  {
+    return;
+  }
+
+  /* After a lost arbitration the peripheral is no longer master and must not send a stop */
+  if ((errors & I2C_SR1_ARLO) == 0u)
+  {
+    I2C1->CR1 |= I2C_CR1_STOP;
+  }
+
+  if (reading && (DMA1_Stream0->CR & DMA_SxCR_EN) != 0u)
+  {
+    i2c_bus_stop_stream();
+  }
+
+  i2c_bus_finish(false);
+}
+
+void DMA1_Stream0_IRQHandler(void)
+{
+  uint32_t flags = DMA1->LISR & I2C_BUS_RX_FLAGS;
+
+  DMA1->LIFCR = flags;
+
+  if (!active || !reading || (flags & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)) == 0u)
+  {
+    return;
+  }
+
+  /* The peripheral has already sent the NACK after the last byte */
+  I2C1->CR1 |= I2C_CR1_STOP;
+  i2c_bus_finish((flags & DMA_LISR_TEIF0) == 0u);
+}
+
+void i2c_bus_init(void)
+{
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  i2c_bus_stop_stream();
+
+  /* Byte transfers from the data register into the read buffer, with an interrupt at the end */
+  DMA1_Stream0->PAR = (uint32_t)&I2C1->DR;
+  DMA1_Stream0->CR = (1u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_0 | DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+  I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITERREN | I2C_CR2_ITBUFEN | I2C_CR2_DMAEN | I2C_CR2_LAST);
+
+  HAL_NVIC_SetPriority(I2C1_EV_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+  HAL_NVIC_SetPriority(I2C1_ER_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
+  HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+
+  I2C1->CR1 |= I2C_CR1_PE;
+}
+
+bool i2c_bus_submit(const i2c_bus_transfer_t *transfer)
+{
+  if ((transfer->tx_length == 0u && transfer->rx_length == 0u) ||
+      (transfer->tx_length > 0u && transfer->tx == NULL) ||
+      (transfer->rx_length > 0u && transfer->rx == NULL))
+  {
+    return false;
+  }
+
+  bool queued = false;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (queue_count < I2C_BUS_QUEUE)
+  {
+    queue[(queue_head + queue_count) % I2C_BUS_QUEUE] = *transfer;
+    queue_count++;
+    queued = true;
+
+    i2c_bus_next();
+  }
+  else
+  {
+    stats.dropped++;
+  }
+
+  __set_PRIMASK(primask);
+
+  return queued;
+}
+
+void i2c_bus_abort(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITERREN | I2C_CR2_ITBUFEN | I2C_CR2_DMAEN | I2C_CR2_LAST);
+  i2c_bus_stop_stream();
+
+  if (active)
+  {
+    I2C1->CR1 |= I2C_CR1_STOP;
+  }
+
+  /* Only the transactions queued now fail, any the handlers queue run afterwards */
+  uint32_t count = queue_count;
+  aborting = true;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    i2c_bus_finish(false);
+  }
+
+  aborting = false;
+  i2c_bus_next();
+
+  __set_PRIMASK(primask);
+}
+
+void i2c_bus_get_stats(i2c_bus_stats_t *out)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  *out = stats;
+
+  __set_PRIMASK(primask);
+}
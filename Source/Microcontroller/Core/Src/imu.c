@@ -0,0 +1,379 @@
+/**
+  ******************************************************************************
+  * @file    imu.c
+  * @brief   ICM-42688-P driver on the SPI1 sensor bus.
+  *
+  *          In FIFO mode the sensor stores 16-byte packets of accelerometer,
+  *          gyroscope, temperature and timestamp and pulses INT1 once the
+  *          watermark is reached. The read registered on the bus starts at
+  *          INT_STATUS, so one burst returns the status, the FIFO count and
+  *          then the packets themselves; it is sized for two packets more
+  *          than the watermark, and packets past the end of the FIFO come
+  *          back with an invalid header and are skipped.
+  *
+  *          The data-ready input latches the time of the interrupt, which is
+  *          when the newest packet counted by the FIFO count was written.
+  *          Older packets are placed one sample period before it, and packets
+  *          written during the transfer one period after. The period is
+  *          measured between interrupts, so the sensor's clock error does not
+  *          pile up across a batch.
+  *
+  *          Samples are parsed in the bus completion interrupt and queued for
+  *          a single reader. The bus counters cover every read on SPI1, which
+  *          is only this one for now.
+  ******************************************************************************
+  */
+
+#include "imu.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "spi_bus.h"
+#include "timestamp.h"
+
+#define IMU_DEVICE  0u
+#define IMU_TRIGGER 0u          /* INT1 on PC0 */
+
+/* Bank 0 registers */
+#define IMU_REG_DEVICE_CONFIG     0x11u
+#define IMU_REG_INT_CONFIG        0x14u
+#define IMU_REG_FIFO_CONFIG       0x16u
+#define IMU_REG_TEMP_DATA1        0x1Du
+#define IMU_REG_INT_STATUS        0x2Du
+#define IMU_REG_SIGNAL_PATH_RESET 0x4Bu
+#define IMU_REG_INTF_CONFIG0      0x4Cu
+#define IMU_REG_PWR_MGMT0         0x4Eu
+#define IMU_REG_GYRO_CONFIG0      0x4Fu
+#define IMU_REG_ACCEL_CONFIG0     0x50u
+#define IMU_REG_FIFO_CONFIG1      0x5Fu
+#define IMU_REG_FIFO_CONFIG2      0x60u
+#define IMU_REG_FIFO_CONFIG3      0x61u
+#define IMU_REG_INT_CONFIG0       0x63u
+#define IMU_REG_INT_CONFIG1       0x64u
+#define IMU_REG_INT_SOURCE0       0x65u
+#define IMU_REG_WHO_AM_I          0x75u
+
+#define IMU_WHO_AM_I       0x47u
+#define IMU_FIFO_FULL_INT  0x02u
+
+/* Status and count, then the packets */
+#define IMU_PACKET_LENGTH  16u
+#define IMU_FIFO_PACKETS   (IMU_BATCH + 2u)
+#define IMU_FIFO_LENGTH    (3u + IMU_FIFO_PACKETS * IMU_PACKET_LENGTH)
+
+/* Temperature, accelerometer and gyroscope registers */
+#define IMU_DATA_LENGTH    14u
+
+/* Full scale 16 g and 2000 dps */
+#define IMU_ACCEL_SCALE    (9.80665f / 2048.0f)
+#define IMU_GYRO_SCALE     (3.14159265f / 180.0f / 16.4f)
+
+/* Power of two */
+#define IMU_QUEUE_SIZE     64u
+
+/* Weight of each new period measurement, and how far it may stray from nominal */
+#define IMU_PERIOD_GAIN    0.125f
+#define IMU_PERIOD_RANGE   0.1f
+
+static imu_mode_t imu_mode;
+static int32_t imu_read_handle = -1;
+static uint8_t storage[SPI_BUS_STORAGE(IMU_FIFO_LENGTH)];
+
+/* Written by the bus interrupt only */
+static float period_us;
+static uint32_t sample_index;           /* Samples seen, including dropped ones */
+static uint32_t anchor_index;
+static uint32_t anchor_time;
+static bool anchored;
+static uint32_t overruns;
+
+/* Single producer in the bus interrupt, single reader */
+static imu_sample_t queue[IMU_QUEUE_SIZE];
+static volatile uint32_t queue_head;
+static volatile uint32_t queue_tail;
+
+/* Previous imu_get_status call */
+static spi_bus_stats_t last_stats;
+static uint32_t last_time;
+static uint32_t last_index;
+
+static void imu_write(uint8_t reg, uint8_t value)
+{
+  uint8_t tx[2] = {reg, value};
+
+  spi_bus_transfer(IMU_DEVICE, tx, NULL, sizeof(tx));
+}
+
+static uint8_t imu_read_register(uint8_t reg)
+{
+  uint8_t tx[2] = {SPI_BUS_READ(reg), 0};
+  uint8_t rx[2];
+
+  spi_bus_transfer(IMU_DEVICE, tx, rx, sizeof(tx));
+  return rx[1];
+}
+
+static int16_t imu_int16(const uint8_t *data)
+{
+  return (int16_t)(((uint16_t)data[0] << 8) | data[1]);
+}
+
+static void imu_push(uint32_t time_us, const uint8_t *accel, const uint8_t *gyro, float temperature)
+{
+  uint32_t head = queue_head;
+
+  if (head - queue_tail >= IMU_QUEUE_SIZE)
+  {
+    overruns++;
+    return;
+  }
+
+  imu_sample_t *sample = &queue[head % IMU_QUEUE_SIZE];
+
+  sample->time_us = time_us;
+
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    sample->accel[i] = (float)imu_int16(&accel[2u * i]) * IMU_ACCEL_SCALE;
+    sample->gyro[i] = (float)imu_int16(&gyro[2u * i]) * IMU_GYRO_SCALE;
+  }
+
+  sample->temperature = temperature;
+
+  /* The sample must be complete before the reader sees the new head */
+  __DMB();
+  queue_head = head + 1u;
+}
+
+/* Moves the period towards the time between this interrupt and the previous one */
+static void imu_anchor(uint32_t time_us, uint32_t index)
+{
+  if (anchored && index != anchor_index)
+  {
+    float nominal = 1000000.0f / (float)IMU_RATE_HZ;
+    float measured = (float)(time_us - anchor_time) / (float)(index - anchor_index);
+
+    period_us += (measured - period_us) * IMU_PERIOD_GAIN;
+
+    if (period_us < nominal * (1.0f - IMU_PERIOD_RANGE))
+    {
+      period_us = nominal * (1.0f - IMU_PERIOD_RANGE);
+    }
+    else if (period_us > nominal * (1.0f + IMU_PERIOD_RANGE))
+    {
+      period_us = nominal * (1.0f + IMU_PERIOD_RANGE);
+    }
+  }
+
+  anchored = true;
+  anchor_time = time_us;
+  anchor_index = index;
+}
+
+static void imu_parse_fifo(const uint8_t *data, uint32_t time_us)
+{
+  const uint8_t *packets = data + 3;
+  uint32_t valid = 0;
+
+  if ((data[0] & IMU_FIFO_FULL_INT) != 0u)
+  {
+    overruns++;
+  }
+
+  /* Header bit 7 marks an empty FIFO, bits 6 and 5 an accelerometer and gyroscope packet */
+  while (valid < IMU_FIFO_PACKETS && (packets[valid * IMU_PACKET_LENGTH] & 0xE0u) == 0x60u)
+  {
+    valid++;
+  }
+
+  if (valid == 0u)
+  {
+    return;
+  }
+
+  uint32_t counted = (uint32_t)(uint16_t)imu_int16(&data[1]);
+
+  if (counted == 0u || counted > valid)
+  {
+    counted = valid;
+  }
+
+  imu_anchor(time_us, sample_index + counted - 1u);
+
+  for (uint32_t i = 0; i < valid; i++)
+  {
+    const uint8_t *packet = &packets[i * IMU_PACKET_LENGTH];
+    float offset = (float)((int32_t)i - (int32_t)(counted - 1u)) * period_us;
+    uint32_t time = time_us + (uint32_t)(int32_t)(offset + ((offset < 0.0f) ? -0.5f : 0.5f));
+
+    imu_push(time, &packet[1], &packet[7], (float)(int8_t)packet[13] / 2.07f + 25.0f);
+  }
+
+  sample_index += valid;
+}
+
+static void imu_parse_data(const uint8_t *data, uint32_t time_us)
+{
+  imu_anchor(time_us, sample_index);
+  imu_push(time_us, &data[2], &data[8], (float)imu_int16(&data[0]) / 132.48f + 25.0f);
+  sample_index++;
+}
+
+/* Bus completion interrupt */
+static void imu_complete(int32_t read, void *context)
+{
+  (void)context;
+
+  uint32_t time_us;
+  const uint8_t *data = spi_bus_acquire(read, &time_us, NULL);
+
+  if (data == NULL)
+  {
+    return;
+  }
+
+  if (imu_mode == IMU_MODE_FIFO)
+  {
+    imu_parse_fifo(data, time_us);
+  }
+  else
+  {
+    imu_parse_data(data, time_us);
+  }
+
+  spi_bus_release(read);
+}
+
+bool imu_init(imu_mode_t mode)
+{
+  imu_mode = mode;
+  period_us = 1000000.0f / (float)IMU_RATE_HZ;
+
+  imu_write(IMU_REG_DEVICE_CONFIG, 0x01u);
+  HAL_Delay(2);
+
+  if (imu_read_register(IMU_REG_WHO_AM_I) != IMU_WHO_AM_I)
+  {
+    return false;
+  }
+
+  /* ODR code, 2000 dps and 16 g full scale in the top bits are zero */
+  uint8_t odr = (IMU_RATE_HZ >= 8000u) ? 0x03u : (IMU_RATE_HZ >= 4000u) ? 0x04u : (IMU_RATE_HZ >= 2000u) ? 0x05u : 0x06u;
+
+  /* INT1 push-pull, active high, pulsed. Pulses must be short from 4 kHz on. */
+  imu_write(IMU_REG_INT_CONFIG, 0x03u);
+  imu_write(IMU_REG_INT_CONFIG1, (IMU_RATE_HZ >= 4000u) ? 0x60u : 0x00u);
+  imu_write(IMU_REG_INT_CONFIG0, 0x28u);
+
+  /* FIFO count in packets, count and data big endian */
+  imu_write(IMU_REG_INTF_CONFIG0, 0x70u);
+  imu_write(IMU_REG_GYRO_CONFIG0, odr);
+  imu_write(IMU_REG_ACCEL_CONFIG0, odr);
+
+  uint16_t length;
+
+  if (mode == IMU_MODE_FIFO)
+  {
+    /* Stream mode with accelerometer, gyroscope and temperature. The watermark
+       interrupt repeats every sample while the FIFO stays above it, so a
+       missed one does not stall the batches. */
+    imu_write(IMU_REG_FIFO_CONFIG, 0x40u);
+    imu_write(IMU_REG_FIFO_CONFIG1, 0x27u);
+    imu_write(IMU_REG_FIFO_CONFIG2, (uint8_t)IMU_BATCH);
+    imu_write(IMU_REG_FIFO_CONFIG3, (uint8_t)(IMU_BATCH >> 8));
+    imu_write(IMU_REG_INT_SOURCE0, 0x04u);
+    length = IMU_FIFO_LENGTH;
+  }
+  else
+  {
+    imu_write(IMU_REG_FIFO_CONFIG, 0x00u);
+    imu_write(IMU_REG_INT_SOURCE0, 0x08u);
+    length = IMU_DATA_LENGTH;
+  }
+
+  /* Both sensors in low noise mode, the gyroscope takes about 45 ms to settle */
+  imu_write(IMU_REG_PWR_MGMT0, 0x0Fu);
+  HAL_Delay(50);
+
+  imu_write(IMU_REG_SIGNAL_PATH_RESET, 0x02u);
+
+  spi_bus_read_t read =
+  {
+    .device = IMU_DEVICE,
+    .command = SPI_BUS_READ((mode == IMU_MODE_FIFO) ? IMU_REG_INT_STATUS : IMU_REG_TEMP_DATA1),
+    .length = length,
+    .trigger = IMU_TRIGGER,
+    .storage = storage,
+    .handler = imu_complete,
+    .context = NULL,
+  };
+
+  imu_read_handle = spi_bus_add_read(&read);
+
+  spi_bus_get_stats(&last_stats);
+  last_time = timestamp_us();
+
+  return imu_read_handle >= 0;
+}
+
+uint32_t imu_read(imu_sample_t *samples, uint32_t max)
+{
+  uint32_t tail = queue_tail;
+  uint32_t available = queue_head - tail;
+  uint32_t count = (available < max) ? available : max;
+
+  /* Read the samples only after seeing the head that covers them */
+  __DMB();
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    samples[i] = queue[(tail + i) % IMU_QUEUE_SIZE];
+  }
+
+  __DMB();
+  queue_tail = tail + count;
+
+  return count;
+}
+
+void imu_get_status(protocol_imu_t *status)
+{
+  spi_bus_stats_t stats;
+  spi_bus_get_stats(&stats);
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint32_t index = sample_index;
+  uint32_t lost = overruns;
+
+  __set_PRIMASK(primask);
+
+  uint32_t now = timestamp_us();
+  uint32_t elapsed = now - last_time;
+
+  status->time_us = now;
+  status->samples = index;
+  status->overruns = (uint16_t)lost;
+  status->mode = (uint8_t)imu_mode;
+  status->batch = (uint8_t)((imu_mode == IMU_MODE_FIFO) ? IMU_BATCH : 1u);
+  status->sample_rate_hz = 0;
+  status->interrupt_rate_hz = 0;
+  status->cpu_load = 0;
+
+  if (elapsed > 0u)
+  {
+    uint64_t busy = (uint64_t)(stats.cycles - last_stats.cycles) * 10000u;
+    uint64_t total = (uint64_t)elapsed * (SystemCoreClock / 1000000u);
+    uint64_t load = busy / total;
+
+    status->sample_rate_hz = (uint16_t)(((uint64_t)(index - last_index) * 1000000u + elapsed / 2u) / elapsed);
+    status->interrupt_rate_hz = (uint16_t)(((uint64_t)(stats.interrupts - last_stats.interrupts) * 1000000u + elapsed / 2u) / elapsed);
+    status->cpu_load = (uint16_t)((load > 10000u) ? 10000u : load);
+  }
+
+  last_stats = stats;
+  last_time = now;
+  last_index = index;
+}
@@ -23,7 +23,17 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include <string.h>
+
+#include "comm.h"
+#include "companion.h"
+#include "control.h"
+#include "depth.h"
+#include "i2c_bus.h"
+#include "imu.h"
+#include "spi_bus.h"
+#include "thrusters.h"
+#include "timestamp.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -58,7 +68,7 @@ UART_HandleTypeDef huart5;
 osThreadId_t defaultTaskHandle;
 const osThreadAttr_t defaultTask_attributes = {
   .name = "defaultTask",
-  .stack_size = 128 * 4,
+  .stack_size = 256 * 4,
   .priority = (osPriority_t) osPriorityNormal,
 };
 /* USER CODE BEGIN PV */
@@ -125,7 +135,14 @@ int main(void)
   MX_SPI2_Init();
   MX_UART5_Init();
   /* USER CODE BEGIN 2 */
-
+  timestamp_init();
+  thrusters_init(&thrusters_stm32_ops);
+  spi_bus_init(&spi_bus_stm32_ops);
+  imu_init(IMU_MODE_FIFO);
+  spi_bus_start();
+  i2c_bus_init();
+  depth_init();
+  companion_init(&companion_stm32_ops);
   /* USER CODE END 2 */
 
   /* Init scheduler */
@@ -153,6 +170,7 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_THREADS */
   /* add threads, ... */
+  control_init(CONTROL_RATE_HZ);
   /* USER CODE END RTOS_THREADS */
 
   /* USER CODE BEGIN RTOS_EVENTS */
@@ -353,7 +371,7 @@ static void MX_TIM2_Init(void)
   htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
   htim2.Init.Period = 19999;
   htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
   if (HAL_TIM_PWM_Init(&htim2) != HAL_OK)
   {
     Error_Handler();
@@ -414,7 +432,7 @@ static void MX_TIM3_Init(void)
   htim3.Init.CounterMode = TIM_COUNTERMODE_UP;
   htim3.Init.Period = 19999;
   htim3.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-  htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
   if (HAL_TIM_PWM_Init(&htim3) != HAL_OK)
   {
     Error_Handler();
@@ -583,7 +601,7 @@ static void MX_GPIO_Init(void)
   HAL_GPIO_WritePin(LED_Output_GPIO_Port, LED_Output_Pin, GPIO_PIN_RESET);
 
   /*Configure GPIO pin Output Level */
-  HAL_GPIO_WritePin(GPIOC, SPI1_CS0_Pin|SPI1_CS1_Pin|SPI1_CS2_Pin|SPI1_CS3_Pin, GPIO_PIN_RESET);
+  HAL_GPIO_WritePin(GPIOC, SPI1_CS0_Pin|SPI1_CS1_Pin|SPI1_CS2_Pin|SPI1_CS3_Pin, GPIO_PIN_SET);
 
   /*Configure GPIO pins : PC0 PC1 PC2 */
   GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_1|GPIO_PIN_2;
@@ -626,10 +644,38 @@ void StartDefaultTask(void *argument)
   /* init code for USB_DEVICE */
   MX_USB_DEVICE_Init();
   /* USER CODE BEGIN 5 */
+  comm_init();
+
   /* Infinite loop */
   for(;;)
   {
-    osDelay(1);
+    uint16_t pulse_us[THRUSTER_COUNT];
+    protocol_thrusters_t outputs;
+    protocol_timing_t timing;
+    protocol_attitude_t attitude;
+    protocol_depth_t depth;
+    protocol_imu_t imu;
+
+    thrusters_get(pulse_us);
+    outputs.time_us = timestamp_us();
+    memcpy(outputs.pulse_us, pulse_us, sizeof(pulse_us));
+
+    control_get_timing(&timing);
+    control_get_attitude(&attitude);
+    depth_get(&depth);
+    imu_get_status(&imu);
+
+    comm_send_status();
+    comm_send(PROTOCOL_ID_THRUSTERS, &outputs, sizeof(outputs));
+    comm_send(PROTOCOL_ID_TIMING, &timing, sizeof(timing));
+    comm_send(PROTOCOL_ID_ATTITUDE, &attitude, sizeof(attitude));
+    comm_send(PROTOCOL_ID_DEPTH, &depth, sizeof(depth));
+    comm_send(PROTOCOL_ID_IMU, &imu, sizeof(imu));
+
+    companion_send(PROTOCOL_ID_ATTITUDE, &attitude, sizeof(attitude));
+    companion_send(PROTOCOL_ID_DEPTH, &depth, sizeof(depth));
+    companion_send(PROTOCOL_ID_THRUSTERS, &outputs, sizeof(outputs));
+    osDelay(100);
   }
   /* USER CODE END 5 */
 }
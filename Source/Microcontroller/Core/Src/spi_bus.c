@@ -0,0 +1,334 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus.c
+  * @brief   SPI1 sensor bus queue.
+  *
+  *          A read is the command byte followed by length dummy bytes, all
+  *          length + 1 received bytes landing in the slot's back buffer.
+  *          Only the RX stream interrupts: when it completes the last byte
+  *          has been clocked in, so the chip select can be raised there and
+  *          the next queued read started straight away.
+  *
+  *          The data-ready inputs and the DMA completion interrupt share
+  *          priority configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, so neither
+  *          preempts the other. Calls from tasks mask interrupts.
+  *
+  *          The registers are written through the ops, spi_bus_stm32.c on
+  *          the vehicle.
+  ******************************************************************************
+  */
+
+#include "spi_bus.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define SPI_BUS_NONE 0xFFu
+
+/* Exception entry and return, not seen by the cycle counter reads in the handlers */
+#define SPI_BUS_ENTRY_CYCLES 24u
+
+typedef struct
+{
+  spi_bus_read_t read;
+  uint8_t front;                /* Buffer with the newest completed read */
+  uint8_t held;                 /* Buffer taken by a consumer, or SPI_BUS_NONE */
+  bool queued;
+  bool complete;                /* At least one read has completed */
+  uint32_t request_time;
+  uint32_t time_us[2];
+  uint32_t sequence;
+} spi_bus_slot_t;
+
+static const spi_bus_ops_t *ops;
+
+static spi_bus_slot_t slots[SPI_BUS_MAX_READS];
+static uint32_t slot_count;
+static int8_t triggers[SPI_BUS_TRIGGERS];
+
+/* Reads waiting, each at most once, so the ring never overflows */
+static uint8_t queue[SPI_BUS_MAX_READS];
+static uint32_t queue_head;
+static uint32_t queue_count;
+
+static volatile int32_t active = -1;
+static volatile bool running;
+
+static spi_bus_stats_t stats;
+
+static uint8_t *spi_bus_buffer(const spi_bus_slot_t *slot, uint32_t index)
+{
+  return slot->read.storage + index * (slot->read.length + 1u);
+}
+
+/* Starts the next queued read that has a free buffer. Interrupts must be masked or at bus priority. */
+static void spi_bus_next(void)
+{
+  while (queue_count > 0u)
+  {
+    int32_t read = queue[queue_head];
+    queue_head = (queue_head + 1u) % SPI_BUS_MAX_READS;
+    queue_count--;
+
+    spi_bus_slot_t *slot = &slots[read];
+    slot->queued = false;
+
+    uint32_t target = slot->front ^ 1u;
+
+    /* A consumer kept the previous buffer across a swap */
+    if (slot->held == target)
+    {
+      stats.dropped++;
+      continue;
+    }
+
+    active = read;
+
+    ops->select(slot->read.device, true);
+    ops->start(slot->read.command, spi_bus_buffer(slot, target), slot->read.length);
+
+    return;
+  }
+
+  active = -1;
+}
+
+/* Interrupts must be masked or at bus priority */
+static bool spi_bus_queue(int32_t read, uint32_t time_us)
+{
+  spi_bus_slot_t *slot = &slots[read];
+
+  if (slot->queued || slot->held == (slot->front ^ 1u))
+  {
+    stats.dropped++;
+    return false;
+  }
+
+  slot->queued = true;
+  slot->request_time = time_us;
+
+  queue[(queue_head + queue_count) % SPI_BUS_MAX_READS] = (uint8_t)read;
+  queue_count++;
+
+  if (active < 0)
+  {
+    spi_bus_next();
+  }
+
+  return true;
+}
+
+void spi_bus_trigger(uint32_t line)
+{
+  uint32_t start = ops->cycles();
+  uint32_t time_us = ops->time_us();
+
+  stats.interrupts++;
+
+  if (line < SPI_BUS_TRIGGERS && triggers[line] >= 0)
+  {
+    spi_bus_queue(triggers[line], time_us);
+  }
+
+  stats.cycles += ops->cycles() - start + SPI_BUS_ENTRY_CYCLES;
+}
+
+void spi_bus_complete(bool error)
+{
+  uint32_t start = ops->cycles();
+
+  stats.interrupts++;
+
+  if (active >= 0)
+  {
+    spi_bus_slot_t *slot = &slots[active];
+
+    ops->finish(error);
+    ops->select(slot->read.device, false);
+
+    /* Hand the filled buffer over, a failed read keeps the previous one */
+    if (!error)
+    {
+      uint32_t target = slot->front ^ 1u;
+
+      slot->time_us[target] = slot->request_time;
+      slot->front = (uint8_t)target;
+      slot->complete = true;
+      slot->sequence++;
+      stats.transfers++;
+
+      if (slot->read.handler != NULL)
+      {
+        slot->read.handler(active, slot->read.context);
+      }
+    }
+
+    spi_bus_next();
+  }
+
+  stats.cycles += ops->cycles() - start + SPI_BUS_ENTRY_CYCLES;
+}
+
+void spi_bus_init(const spi_bus_ops_t *new_ops)
+{
+  ops = new_ops;
+
+  memset(slots, 0, sizeof(slots));
+  memset(&stats, 0, sizeof(stats));
+  slot_count = 0;
+  queue_head = 0;
+  queue_count = 0;
+  active = -1;
+  running = false;
+
+  for (uint32_t i = 0; i < SPI_BUS_TRIGGERS; i++)
+  {
+    triggers[i] = -1;
+  }
+
+  ops->init();
+}
+
+int32_t spi_bus_add_read(const spi_bus_read_t *read)
+{
+  if (running || slot_count >= SPI_BUS_MAX_READS || read->device >= SPI_BUS_DEVICES ||
+      read->length == 0u || read->storage == NULL)
+  {
+    return -1;
+  }
+
+  if (read->trigger != SPI_BUS_NO_TRIGGER && (read->trigger >= SPI_BUS_TRIGGERS || triggers[read->trigger] >= 0))
+  {
+    return -1;
+  }
+
+  int32_t handle = (int32_t)slot_count;
+  spi_bus_slot_t *slot = &slots[handle];
+
+  slot->read = *read;
+  slot->front = 1;
+  slot->held = SPI_BUS_NONE;
+  slot->queued = false;
+  slot->complete = false;
+  slot->sequence = 0;
+
+  if (read->trigger != SPI_BUS_NO_TRIGGER)
+  {
+    triggers[read->trigger] = (int8_t)handle;
+  }
+
+  slot_count++;
+  return handle;
+}
+
+void spi_bus_start(void)
+{
+  running = true;
+
+  for (uint32_t i = 0; i < SPI_BUS_TRIGGERS; i++)
+  {
+    if (triggers[i] >= 0)
+    {
+      ops->enable_trigger(i, true);
+    }
+  }
+}
+
+void spi_bus_stop(void)
+{
+  for (uint32_t i = 0; i < SPI_BUS_TRIGGERS; i++)
+  {
+    ops->enable_trigger(i, false);
+  }
+
+  /* Requests already queued run to completion */
+  while (active >= 0)
+  {
+  }
+
+  running = false;
+}
+
+bool spi_bus_request(int32_t read)
+{
+  if (read < 0 || read >= (int32_t)slot_count)
+  {
+    return false;
+  }
+
+  uint32_t state = ops->lock();
+
+  bool queued = spi_bus_queue(read, ops->time_us());
+
+  ops->unlock(state);
+
+  return queued;
+}
+
+const uint8_t *spi_bus_acquire(int32_t read, uint32_t *time_us, uint32_t *sequence)
+{
+  if (read < 0 || read >= (int32_t)slot_count)
+  {
+    return NULL;
+  }
+
+  spi_bus_slot_t *slot = &slots[read];
+  const uint8_t *data = NULL;
+
+  uint32_t state = ops->lock();
+
+  if (slot->complete)
+  {
+    slot->held = slot->front;
+    data = spi_bus_buffer(slot, slot->front) + 1;
+
+    if (time_us != NULL)
+    {
+      *time_us = slot->time_us[slot->front];
+    }
+
+    if (sequence != NULL)
+    {
+      *sequence = slot->sequence;
+    }
+  }
+
+  ops->unlock(state);
+
+  return data;
+}
+
+void spi_bus_release(int32_t read)
+{
+  if (read < 0 || read >= (int32_t)slot_count)
+  {
+    return;
+  }
+
+  uint32_t state = ops->lock();
+
+  slots[read].held = SPI_BUS_NONE;
+
+  ops->unlock(state);
+}
+
+void spi_bus_transfer(uint8_t device, const uint8_t *tx, uint8_t *rx, uint16_t length)
+{
+  if (running || device >= SPI_BUS_DEVICES)
+  {
+    return;
+  }
+
+  ops->select(device, true);
+  ops->exchange(tx, rx, length);
+  ops->select(device, false);
+}
+
+void spi_bus_get_stats(spi_bus_stats_t *out)
+{
+  uint32_t state = ops->lock();
+
+  *out = stats;
+
+  ops->unlock(state);
+}
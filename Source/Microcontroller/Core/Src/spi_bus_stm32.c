@@ -0,0 +1,217 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus_stm32.c
+  * @brief   SPI1 sensor bus operations on DMA2, the chip select pins and
+  *          EXTI lines 0-2, and the interrupt handlers that drive the queue.
+  *
+  *          The CPU writes the command into DR, then the TX stream clocks out
+  *          the dummies from a single zero byte without incrementing, while
+  *          the RX stream stores every received byte.
+  *
+  *          SPI1_RX is DMA2 stream 0 channel 3, SPI1_TX is DMA2 stream 3
+  *          channel 3.
+  ******************************************************************************
+  */
+
+#include "spi_bus.h"
+
+#include "main.h"
+#include "FreeRTOS.h"
+
+#include "timestamp.h"
+
+/* The streams' flags in LIFCR */
+#define SPI_BUS_RX_FLAGS (0x3Du << 0)
+#define SPI_BUS_TX_FLAGS (0x3Du << 22)
+
+static GPIO_TypeDef *const cs_ports[SPI_BUS_DEVICES] =
+{
+  SPI1_CS0_GPIO_Port, SPI1_CS1_GPIO_Port, SPI1_CS2_GPIO_Port, SPI1_CS3_GPIO_Port
+};
+
+static const uint16_t cs_pins[SPI_BUS_DEVICES] =
+{
+  SPI1_CS0_Pin, SPI1_CS1_Pin, SPI1_CS2_Pin, SPI1_CS3_Pin
+};
+
+static const IRQn_Type trigger_irqs[SPI_BUS_TRIGGERS] = {EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn};
+
+/* Sent for every byte after the command */
+static const uint8_t dummy = 0;
+
+static void spi_bus_stm32_stop_stream(DMA_Stream_TypeDef *stream)
+{
+  stream->CR &= ~DMA_SxCR_EN;
+
+  while ((stream->CR & DMA_SxCR_EN) != 0u)
+  {
+  }
+}
+
+static uint32_t spi_bus_stm32_lock(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static void spi_bus_stm32_unlock(uint32_t primask)
+{
+  __set_PRIMASK(primask);
+}
+
+static void spi_bus_stm32_init(void)
+{
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    cs_ports[i]->BSRR = cs_pins[i];
+  }
+
+  spi_bus_stm32_stop_stream(DMA2_Stream0);
+  spi_bus_stm32_stop_stream(DMA2_Stream3);
+
+  /* Byte transfers, RX into the back buffer with an interrupt, TX from the dummy byte */
+  DMA2_Stream0->PAR = (uint32_t)&SPI1->DR;
+  DMA2_Stream0->CR = (3u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+  DMA2_Stream3->PAR = (uint32_t)&SPI1->DR;
+  DMA2_Stream3->M0AR = (uint32_t)&dummy;
+  DMA2_Stream3->CR = (3u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_0 | DMA_SxCR_DIR_0;
+
+  DMA2->LIFCR = SPI_BUS_RX_FLAGS | SPI_BUS_TX_FLAGS;
+
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+  SPI1->CR1 |= SPI_CR1_SPE;
+}
+
+static void spi_bus_stm32_select(uint8_t device, bool selected)
+{
+  /* Active low */
+  cs_ports[device]->BSRR = selected ? (uint32_t)cs_pins[device] << 16 : cs_pins[device];
+}
+
+static void spi_bus_stm32_start(uint8_t command, uint8_t *rx, uint16_t length)
+{
+  DMA2->LIFCR = SPI_BUS_RX_FLAGS | SPI_BUS_TX_FLAGS;
+
+  DMA2_Stream0->M0AR = (uint32_t)rx;
+  DMA2_Stream0->NDTR = length + 1u;
+  DMA2_Stream3->NDTR = length;
+
+  /* Receive first so no byte is missed, then the command, then the dummies behind it */
+  DMA2_Stream0->CR |= DMA_SxCR_EN;
+  SPI1->CR2 |= SPI_CR2_RXDMAEN;
+  *(volatile uint8_t *)&SPI1->DR = command;
+  DMA2_Stream3->CR |= DMA_SxCR_EN;
+  SPI1->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+static void spi_bus_stm32_finish(bool error)
+{
+  SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+
+  if (error)
+  {
+    spi_bus_stm32_stop_stream(DMA2_Stream3);
+  }
+}
+
+static void spi_bus_stm32_exchange(const uint8_t *tx, uint8_t *rx, uint16_t length)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    while ((SPI1->SR & SPI_SR_TXE) == 0u)
+    {
+    }
+
+    *(volatile uint8_t *)&SPI1->DR = tx[i];
+
+    while ((SPI1->SR & SPI_SR_RXNE) == 0u)
+    {
+    }
+
+    uint8_t value = *(volatile uint8_t *)&SPI1->DR;
+
+    if (rx != NULL)
+    {
+      rx[i] = value;
+    }
+  }
+
+  while ((SPI1->SR & SPI_SR_BSY) != 0u)
+  {
+  }
+}
+
+static void spi_bus_stm32_enable_trigger(uint32_t line, bool enable)
+{
+  if (enable)
+  {
+    EXTI->PR = 1u << line;
+    HAL_NVIC_ClearPendingIRQ(trigger_irqs[line]);
+    HAL_NVIC_SetPriority(trigger_irqs[line], configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(trigger_irqs[line]);
+  }
+  else
+  {
+    HAL_NVIC_DisableIRQ(trigger_irqs[line]);
+  }
+}
+
+static uint32_t spi_bus_stm32_time_us(void)
+{
+  return timestamp_us();
+}
+
+static uint32_t spi_bus_stm32_cycles(void)
+{
+  return timestamp_cycles();
+}
+
+const spi_bus_ops_t spi_bus_stm32_ops =
+{
+  .lock = spi_bus_stm32_lock,
+  .unlock = spi_bus_stm32_unlock,
+  .init = spi_bus_stm32_init,
+  .select = spi_bus_stm32_select,
+  .start = spi_bus_stm32_start,
+  .finish = spi_bus_stm32_finish,
+  .exchange = spi_bus_stm32_exchange,
+  .enable_trigger = spi_bus_stm32_enable_trigger,
+  .time_us = spi_bus_stm32_time_us,
+  .cycles = spi_bus_stm32_cycles,
+};
+
+void EXTI0_IRQHandler(void)
+{
+  EXTI->PR = 1u << 0;
+  spi_bus_trigger(0);
+}
+
+void EXTI1_IRQHandler(void)
+{
+  EXTI->PR = 1u << 1;
+  spi_bus_trigger(1);
+}
+
+void EXTI2_IRQHandler(void)
+{
+  EXTI->PR = 1u << 2;
+  spi_bus_trigger(2);
+}
+
+void DMA2_Stream0_IRQHandler(void)
+{
+  uint32_t flags = DMA2->LISR & SPI_BUS_RX_FLAGS;
+
+  DMA2->LIFCR = flags;
+
+  if ((flags & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)) != 0u)
+  {
+    spi_bus_complete((flags & DMA_LISR_TEIF0) != 0u);
+  }
+}
@@ -0,0 +1,260 @@
+/**
+  ******************************************************************************
+  * @file    thrusters.c
+  * @brief   Thruster ESC outputs with update-triggered DMA bursts.
+  *
+  *          Each timer has its CCR1-CCR4 written through the DMA burst
+  *          register (DMAR), with DCR pointing it at CCR1 for four transfers.
+  *          The stream is armed with the new command and fires on the next
+  *          update event, so the four compare values are written back to back
+  *          just after a period starts. With output compare preload enabled
+  *          they then take effect together at the following update, and TIM3
+  *          is started by TIM2's trigger output so both timers share that
+  *          update.
+  *
+  *          In the pulse modes a command is one burst per timer. In the DShot
+  *          modes a timer period is one bit, and a command is a frame of 16
+  *          bursts plus one that leaves the lines low, sent by a single stream
+  *          transfer of 68 words, so the CPU cost of a write is the same in
+  *          every mode.
+  *
+  *          Everything here is worked out in ticks and burst words; the
+  *          registers are written through the ops, thrusters_stm32.c on the
+  *          vehicle.
+  ******************************************************************************
+  */
+
+#include "thrusters.h"
+
+#include <string.h>
+
+/* Burst of CCR1-CCR4: DBL is the transfer count less one, DBA the word offset of CCR1 from CR1 */
+#define THRUSTER_BURST_LENGTH  THRUSTER_TIMER_OUTPUTS
+#define THRUSTER_DMA_BASE_CCR1 13u
+#define THRUSTER_DCR           (((THRUSTER_BURST_LENGTH - 1u) << 8) | THRUSTER_DMA_BASE_CCR1)
+
+_Static_assert(THRUSTER_COUNT == THRUSTER_TIMERS * THRUSTER_TIMER_OUTPUTS, "every thruster needs a timer output");
+
+/* DShot frame bits, then one period held low */
+#define THRUSTER_DSHOT_BITS   16u
+#define THRUSTER_FRAME_LENGTH (THRUSTER_DSHOT_BITS + 1u)
+
+/* Microseconds either side of an update event a pulse command is never armed in */
+#define THRUSTER_ARM_GUARD_US 20u
+
+/* Pulse offset from neutral below which a DShot output is stopped */
+#define THRUSTER_DSHOT_DEADBAND_US 25u
+
+typedef struct
+{
+  uint16_t prescaler;
+  uint16_t period;
+  uint8_t ticks_per_us;             /* 0 for DShot, where a period is one bit */
+  uint8_t frame_length;             /* Bursts per command */
+  uint16_t bit_one;                 /* DShot high time of a 1 and of a 0, in ticks */
+  uint16_t bit_zero;
+} thruster_timing_t;
+
+/*
+ * The timer clock is 84 MHz. Pulse modes count microseconds (OneShot125 quarter
+ * microseconds), DShot counts the timer clock with 75% and 37.5% duty bits.
+ */
+static const thruster_timing_t timings[] =
+{
+  [THRUSTER_MODE_PWM50]      = {83, 19999, 1, 1, 0, 0},
+  [THRUSTER_MODE_PWM400]     = {83, 2499, 1, 1, 0, 0},
+  [THRUSTER_MODE_ONESHOT125] = {20, 1999, 4, 1, 0, 0},
+  [THRUSTER_MODE_DSHOT300]   = {0, 279, 0, THRUSTER_FRAME_LENGTH, 210, 105},
+  [THRUSTER_MODE_DSHOT600]   = {0, 139, 0, THRUSTER_FRAME_LENGTH, 105, 53},
+};
+
+/* Burst words per timer, read by its stream */
+static uint32_t bursts[THRUSTER_TIMERS][THRUSTER_FRAME_LENGTH * THRUSTER_BURST_LENGTH];
+
+static const thrusters_ops_t *ops;
+static thruster_mode_t mode;
+static uint16_t pulses[THRUSTER_COUNT];
+
+static uint16_t thrusters_clamp(uint16_t pulse_us)
+{
+  if (pulse_us < THRUSTER_PULSE_MIN)
+  {
+    return THRUSTER_PULSE_MIN;
+  }
+
+  if (pulse_us > THRUSTER_PULSE_MAX)
+  {
+    return THRUSTER_PULSE_MAX;
+  }
+
+  return pulse_us;
+}
+
+uint16_t thrusters_dshot_frame(uint16_t value, bool telemetry)
+{
+  uint16_t packet = (uint16_t)(((value & 0x7FFu) << 1) | (telemetry ? 1u : 0u));
+  uint16_t crc = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0xFu;
+
+  return (uint16_t)((packet << 4) | crc);
+}
+
+uint16_t thrusters_dshot_throttle(uint16_t pulse_us)
+{
+  int32_t offset = (int32_t)thrusters_clamp(pulse_us) - (int32_t)THRUSTER_PULSE_NEUTRAL;
+  int32_t range = (int32_t)(THRUSTER_PULSE_MAX - THRUSTER_PULSE_NEUTRAL);
+
+  if (offset > -(int32_t)THRUSTER_DSHOT_DEADBAND_US && offset < (int32_t)THRUSTER_DSHOT_DEADBAND_US)
+  {
+    return 0;
+  }
+
+  /* 3D mode: 1048-2047 forward and 48-1047 reverse, each from slowest to full */
+  if (offset > 0)
+  {
+    return (uint16_t)(1048 + (offset * 999) / range);
+  }
+
+  return (uint16_t)(48 + (-offset * 999) / range);
+}
+
+/* True while the timers are close enough to an update that a burst could straddle it */
+static bool thrusters_near_update(void)
+{
+  uint32_t guard = THRUSTER_ARM_GUARD_US * timings[mode].ticks_per_us;
+  uint32_t count = ops->count();
+
+  return count < guard || count > timings[mode].period - guard;
+}
+
+/* Fills the burst buffers from the pulses for the current mode */
+static void thrusters_fill(void)
+{
+  const thruster_timing_t *timing = &timings[mode];
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    uint32_t *burst = bursts[i / THRUSTER_BURST_LENGTH];
+    uint32_t channel = i % THRUSTER_BURST_LENGTH;
+
+    if (timing->ticks_per_us != 0u)
+    {
+      /* OneShot125 pulses are an eighth of the standard width, scaled after converting so no resolution is lost */
+      uint32_t ticks = (uint32_t)pulses[i] * timing->ticks_per_us;
+      burst[channel] = (mode == THRUSTER_MODE_ONESHOT125) ? ticks / 8u : ticks;
+      continue;
+    }
+
+    uint16_t frame = thrusters_dshot_frame(thrusters_dshot_throttle(pulses[i]), false);
+
+    /* Most significant bit first, one burst per bit */
+    for (uint32_t bit = 0; bit < THRUSTER_DSHOT_BITS; bit++)
+    {
+      bool one = (frame & (0x8000u >> bit)) != 0u;
+      burst[bit * THRUSTER_BURST_LENGTH + channel] = one ? timing->bit_one : timing->bit_zero;
+    }
+
+    burst[THRUSTER_DSHOT_BITS * THRUSTER_BURST_LENGTH + channel] = 0;
+  }
+}
+
+void thrusters_init(const thrusters_ops_t *thruster_ops)
+{
+  ops = thruster_ops;
+  ops->init(THRUSTER_DCR);
+
+  thrusters_set_mode(THRUSTER_MODE_PWM50);
+}
+
+void thrusters_set_mode(thruster_mode_t new_mode)
+{
+  if ((uint32_t)new_mode >= sizeof(timings) / sizeof(timings[0]))
+  {
+    return;
+  }
+
+  uint32_t state = ops->lock();
+
+  ops->stop();
+
+  mode = new_mode;
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    pulses[i] = THRUSTER_PULSE_NEUTRAL;
+  }
+
+  thrusters_fill();
+
+  /* A pulse mode starts at neutral, a DShot line idles low until the first frame */
+  static const uint32_t low[THRUSTER_TIMER_OUTPUTS] = {0};
+  bool pulse_mode = timings[mode].ticks_per_us != 0u;
+
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    ops->load(i, timings[mode].prescaler, timings[mode].period, pulse_mode ? bursts[i] : low);
+  }
+
+  ops->start();
+
+  ops->unlock(state);
+}
+
+thruster_mode_t thrusters_get_mode(void)
+{
+  return mode;
+}
+
+bool thrusters_write(const uint16_t pulse_us[THRUSTER_COUNT])
+{
+  uint32_t state;
+
+  for (;;)
+  {
+    state = ops->lock();
+
+    /* A DShot frame is never cut short, the ESC would reject it */
+    if (timings[mode].ticks_per_us == 0u)
+    {
+      if (ops->busy())
+      {
+        ops->unlock(state);
+        return false;
+      }
+
+      break;
+    }
+
+    /* Both timers must be armed inside the same period, wait out the few microseconds around an update */
+    if (!thrusters_near_update())
+    {
+      break;
+    }
+
+    ops->unlock(state);
+  }
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    pulses[i] = thrusters_clamp(pulse_us[i]);
+  }
+
+  thrusters_fill();
+
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    ops->arm(i, bursts[i], (uint32_t)timings[mode].frame_length * THRUSTER_BURST_LENGTH);
+  }
+
+  ops->unlock(state);
+
+  return true;
+}
+
+void thrusters_get(uint16_t pulse_us[THRUSTER_COUNT])
+{
+  uint32_t state = ops->lock();
+
+  memcpy(pulse_us, pulses, sizeof(pulses));
+
+  ops->unlock(state);
+}
@@ -0,0 +1,161 @@
+/**
+  ******************************************************************************
+  * @file    thrusters_stm32.c
+  * @brief   Thruster timer and DMA operations on TIM2 and TIM3.
+  *
+  *          Configured directly rather than through the HAL, which would need
+  *          a DMA interrupt to finish each burst. The streams run in normal
+  *          mode with no interrupts: a stream is done when it disables
+  *          itself.
+  *
+  *          TIM2_UP is DMA1 stream 1 channel 3, TIM3_UP is DMA1 stream 2
+  *          channel 5.
+  ******************************************************************************
+  */
+
+#include "thrusters.h"
+
+#include "main.h"
+
+typedef struct
+{
+  TIM_TypeDef *timer;
+  DMA_Stream_TypeDef *stream;
+  uint32_t channel;                 /* Request channel, DMA_SxCR_CHSEL field */
+  volatile uint32_t *flag_clear;    /* LIFCR or HIFCR */
+  uint32_t flags;                   /* The stream's flags in that register */
+} thrusters_stm32_output_t;
+
+static const thrusters_stm32_output_t outputs[THRUSTER_TIMERS] =
+{
+  {TIM2, DMA1_Stream1, 3u << DMA_SxCR_CHSEL_Pos, &DMA1->LIFCR, 0x3Du << 6},
+  {TIM3, DMA1_Stream2, 5u << DMA_SxCR_CHSEL_Pos, &DMA1->LIFCR, 0x3Du << 16},
+};
+
+static void thrusters_stm32_halt(const thrusters_stm32_output_t *output)
+{
+  DMA_Stream_TypeDef *stream = output->stream;
+
+  stream->CR &= ~DMA_SxCR_EN;
+
+  while ((stream->CR & DMA_SxCR_EN) != 0u)
+  {
+  }
+
+  *output->flag_clear = output->flags;
+}
+
+static uint32_t thrusters_stm32_lock(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static void thrusters_stm32_unlock(uint32_t primask)
+{
+  __set_PRIMASK(primask);
+}
+
+static void thrusters_stm32_init(uint32_t dcr)
+{
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    const thrusters_stm32_output_t *output = &outputs[i];
+    TIM_TypeDef *timer = output->timer;
+
+    /* Period and compare values only change at an update event */
+    timer->CR1 |= TIM_CR1_ARPE;
+    timer->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+    timer->CCMR2 |= TIM_CCMR2_OC3PE | TIM_CCMR2_OC4PE;
+    timer->CCER |= TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
+
+    timer->DCR = dcr;
+
+    /* Word transfers from the burst buffer into DMAR */
+    output->stream->CR = 0;
+
+    while ((output->stream->CR & DMA_SxCR_EN) != 0u)
+    {
+    }
+
+    output->stream->PAR = (uint32_t)&timer->DMAR;
+    output->stream->CR = output->channel | DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC | DMA_SxCR_DIR_0;
+  }
+
+  /* TIM2 enable is the trigger output, TIM3 starts on it (ITR1) in trigger mode */
+  TIM2->CR2 = (TIM2->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_0;
+  TIM3->SMCR = (TIM3->SMCR & ~(TIM_SMCR_TS | TIM_SMCR_SMS)) | TIM_SMCR_TS_0 | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1;
+}
+
+static void thrusters_stm32_stop(void)
+{
+  TIM2->CR1 &= ~TIM_CR1_CEN;
+  TIM3->CR1 &= ~TIM_CR1_CEN;
+}
+
+static void thrusters_stm32_load(uint32_t index, uint16_t prescaler, uint16_t period, const uint32_t compare[THRUSTER_TIMER_OUTPUTS])
+{
+  const thrusters_stm32_output_t *output = &outputs[index];
+  TIM_TypeDef *timer = output->timer;
+
+  thrusters_stm32_halt(output);
+
+  timer->DIER &= ~TIM_DIER_UDE;
+  timer->PSC = prescaler;
+  timer->ARR = period;
+  timer->CCR1 = compare[0];
+  timer->CCR2 = compare[1];
+  timer->CCR3 = compare[2];
+  timer->CCR4 = compare[3];
+
+  /* Load the preloaded registers before the first period */
+  timer->CNT = 0;
+  timer->EGR = TIM_EGR_UG;
+  timer->SR = 0;
+
+  timer->DIER |= TIM_DIER_UDE;
+}
+
+static void thrusters_stm32_start(void)
+{
+  /* Starts TIM3 too */
+  TIM2->CR1 |= TIM_CR1_CEN;
+}
+
+static void thrusters_stm32_arm(uint32_t index, const uint32_t *burst, uint32_t length)
+{
+  const thrusters_stm32_output_t *output = &outputs[index];
+  DMA_Stream_TypeDef *stream = output->stream;
+
+  thrusters_stm32_halt(output);
+
+  stream->M0AR = (uint32_t)burst;
+  stream->NDTR = length;
+  stream->CR |= DMA_SxCR_EN;
+}
+
+static bool thrusters_stm32_busy(void)
+{
+  return ((outputs[0].stream->CR | outputs[1].stream->CR) & DMA_SxCR_EN) != 0u;
+}
+
+static uint32_t thrusters_stm32_count(void)
+{
+  return TIM2->CNT;
+}
+
+const thrusters_ops_t thrusters_stm32_ops =
+{
+  .lock = thrusters_stm32_lock,
+  .unlock = thrusters_stm32_unlock,
+  .init = thrusters_stm32_init,
+  .stop = thrusters_stm32_stop,
+  .load = thrusters_stm32_load,
+  .start = thrusters_stm32_start,
+  .arm = thrusters_stm32_arm,
+  .busy = thrusters_stm32_busy,
+  .count = thrusters_stm32_count,
+};
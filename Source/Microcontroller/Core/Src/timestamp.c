@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file    timestamp.c
+  * @brief   TIM5 timestamp counter and the DWT cycle counter. Configured
+  *          directly rather than through CubeMX since they need no pins,
+  *          interrupts or HAL handle.
+  ******************************************************************************
+  */
+
+#include "timestamp.h"
+
+void timestamp_init(void)
+{
+  /* APB1 timers run at twice PCLK1 whenever the APB1 prescaler divides */
+  uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+  {
+    clock *= 2u;
+  }
+
+  __HAL_RCC_TIM5_CLK_ENABLE();
+
+  TIM5->CR1 = 0;
+  TIM5->PSC = (clock / 1000000u) - 1u;
+  TIM5->ARR = 0xFFFFFFFFu;
+  TIM5->CNT = 0;
+
+  /* Load the prescaler now instead of at the first overflow */
+  TIM5->EGR = TIM_EGR_UG;
+  TIM5->CR1 = TIM_CR1_CEN;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
@@ -0,0 +1,155 @@
+/**
+  ******************************************************************************
+  * @file    attitude_dive.c
+  * @brief   Synthetic dive for the attitude filters.
+  ******************************************************************************
+  */
+
+#include "attitude_dive.h"
+
+#include <math.h>
+
+#include "test.h"
+
+#define ATTITUDE_DIVE_SUBSTEPS 10u
+
+#define ATTITUDE_DIVE_GRAVITY 9.80665
+#define ATTITUDE_DIVE_PI 3.14159265358979323846
+#define ATTITUDE_DIVE_DEGREES (180.0 / ATTITUDE_DIVE_PI)
+
+static const float attitude_dive_bias[3] = {0.01f, -0.02f, 0.005f};
+
+static double attitude_dive_gaussian(uint32_t *state)
+{
+  double u = ((double)(test_random(state) >> 8) + 0.5) / 16777216.0;
+  double v = (double)(test_random(state) >> 8) / 16777216.0;
+
+  return sqrt(-2.0 * log(u)) * cos(2.0 * ATTITUDE_DIVE_PI * v);
+}
+
+/* Body rates of the dive, rad/s */
+static void attitude_dive_rates(double t, double w[3])
+{
+  w[0] = 0.6 * sin(0.7 * t);
+  w[1] = 0.4 * sin(0.5 * t + 1.0);
+  w[2] = 0.3 * sin(0.23 * t) + ((fmod(t, 20.0) < 3.0) ? 0.5 : 0.0);
+}
+
+/* q = q * exp((0, w) dt / 2), exact for a constant rate */
+static void attitude_dive_rotate(double q[4], const double w[3], double dt)
+{
+  double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * dt;
+  double s = (angle > 1e-12) ? sin(0.5 * angle) / (angle / dt) : 0.5 * dt;
+  double r[4] = {cos(0.5 * angle), w[0] * s, w[1] * s, w[2] * s};
+
+  double p[4] =
+  {
+    q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3],
+    q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2],
+    q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1],
+    q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0],
+  };
+
+  double norm = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2] + p[3] * p[3]);
+
+  for (uint32_t i = 0; i < 4u; i++)
+  {
+    q[i] = p[i] / norm;
+  }
+}
+
+/* World up in the body frame, R' [0 0 1]' */
+static void attitude_dive_up(const double q[4], double v[3])
+{
+  v[0] = 2.0 * (q[1] * q[3] - q[0] * q[2]);
+  v[1] = 2.0 * (q[2] * q[3] + q[0] * q[1]);
+  v[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+void attitude_dive_build(attitude_dive_sample_t *samples, bool thrusting)
+{
+  uint32_t state = 0xA771u;
+  double q[4] = {0.9914, 0.0872, -0.0872, 0.0};
+  double dt = 1.0 / ATTITUDE_DIVE_RATE_HZ;
+
+  for (uint32_t n = 0; n < ATTITUDE_DIVE_SAMPLES; n++)
+  {
+    double t = n * dt;
+    double w[3];
+
+    for (uint32_t k = 0; k < ATTITUDE_DIVE_SUBSTEPS; k++)
+    {
+      attitude_dive_rates(t + (k + 0.5) * dt / ATTITUDE_DIVE_SUBSTEPS, w);
+      attitude_dive_rotate(q, w, dt / ATTITUDE_DIVE_SUBSTEPS);
+    }
+
+    attitude_dive_rates(t + dt, w);
+
+    double up[3];
+    attitude_dive_up(q, up);
+
+    /* Surge and heave from the thrusters, in the body frame */
+    double surge = thrusting ? 0.8 * sin(0.31 * t) + ((fmod(t, 15.0) < 0.5) ? 1.5 : 0.0) : 0.0;
+    double heave = thrusting ? 0.3 * sin(0.17 * t) : 0.0;
+
+    attitude_dive_sample_t *sample = &samples[n];
+
+    for (uint32_t i = 0; i < 3u; i++)
+    {
+      sample->gyro[i] = (float)(w[i] + attitude_dive_bias[i] + 0.003 * attitude_dive_gaussian(&state));
+      sample->accel[i] = (float)(ATTITUDE_DIVE_GRAVITY * up[i] + 0.05 * attitude_dive_gaussian(&state));
+      sample->q[i] = q[i];
+    }
+
+    sample->accel[0] += (float)surge;
+    sample->accel[2] += (float)heave;
+    sample->q[3] = q[3];
+  }
+}
+
+void attitude_dive_run(const attitude_dive_sample_t *samples, attitude_filter_t filter, attitude_dive_errors_t *errors)
+{
+  static attitude_t attitude;
+  double tilt_squared = 0.0;
+
+  errors->tilt_max = 0.0;
+  errors->final_error = 0.0;
+  errors->norm_error = 0.0;
+
+  attitude_init(&attitude, filter);
+
+  for (uint32_t n = 0; n < ATTITUDE_DIVE_SAMPLES; n++)
+  {
+    attitude_update(&attitude, samples[n].gyro, samples[n].accel, 1.0f / ATTITUDE_DIVE_RATE_HZ);
+
+    double estimate[4] = {attitude.q[0], attitude.q[1], attitude.q[2], attitude.q[3]};
+    double truth_up[3];
+    double estimate_up[3];
+
+    attitude_dive_up(samples[n].q, truth_up);
+    attitude_dive_up(estimate, estimate_up);
+
+    double dot = truth_up[0] * estimate_up[0] + truth_up[1] * estimate_up[1] + truth_up[2] * estimate_up[2];
+    double norm = sqrt(estimate_up[0] * estimate_up[0] + estimate_up[1] * estimate_up[1] + estimate_up[2] * estimate_up[2]);
+    double tilt = acos(fmin(fmax(dot / norm, -1.0), 1.0)) * ATTITUDE_DIVE_DEGREES;
+
+    if (n >= ATTITUDE_DIVE_SETTLE)
+    {
+      tilt_squared += tilt * tilt;
+      errors->tilt_max = fmax(errors->tilt_max, tilt);
+    }
+
+    double length = sqrt(estimate[0] * estimate[0] + estimate[1] * estimate[1] +
+                         estimate[2] * estimate[2] + estimate[3] * estimate[3]);
+    errors->norm_error = fmax(errors->norm_error, fabs(length - 1.0));
+
+    if (n == ATTITUDE_DIVE_SAMPLES - 1u)
+    {
+      double inner = fabs(samples[n].q[0] * estimate[0] + samples[n].q[1] * estimate[1] +
+                          samples[n].q[2] * estimate[2] + samples[n].q[3] * estimate[3]) / length;
+      errors->final_error = 2.0 * acos(fmin(inner, 1.0)) * ATTITUDE_DIVE_DEGREES;
+    }
+  }
+
+  errors->tilt_rms = sqrt(tilt_squared / (ATTITUDE_DIVE_SAMPLES - ATTITUDE_DIVE_SETTLE));
+}
@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file    attitude_dive.h
+  * @brief   Synthetic dive for the attitude filters: a minute of rolling,
+  *          pitching and turning sampled at 1 kHz, with a constant gyroscope
+  *          bias and white noise on both sensors. Holding station the
+  *          accelerometer sees only gravity; thrusting it also sees surge and
+  *          heave accelerations, which are within the accelerometer gate and
+  *          so lean every filter's gravity estimate. The true attitude is
+  *          integrated in double alongside.
+  ******************************************************************************
+  */
+
+#ifndef __ATTITUDE_DIVE_H
+#define __ATTITUDE_DIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attitude.h"
+
+#define ATTITUDE_DIVE_RATE_HZ 1000u
+#define ATTITUDE_DIVE_SECONDS 60u
+#define ATTITUDE_DIVE_SAMPLES (ATTITUDE_DIVE_RATE_HZ * ATTITUDE_DIVE_SECONDS)
+
+/* Samples left out of the tilt error while the filters settle */
+#define ATTITUDE_DIVE_SETTLE (2u * ATTITUDE_DIVE_RATE_HZ)
+
+typedef struct
+{
+  float gyro[3];
+  float accel[3];
+  double q[4];                  /* True attitude after the sample */
+} attitude_dive_sample_t;
+
+/**
+  * @brief  How far a filter's estimate was from the truth over a dive.
+  *         Tilt error is the angle between the true and estimated gravity
+  *         directions. Heading is unobservable without a magnetometer, so
+  *         the total attitude error at the end shows the gyroscope bias left
+  *         in the heading.
+  */
+typedef struct
+{
+  double tilt_rms;              /* Degrees, after settling */
+  double tilt_max;
+  double final_error;           /* Degrees, whole attitude at the last sample */
+  double norm_error;            /* Largest distance of the estimate's norm from 1 */
+} attitude_dive_errors_t;
+
+/**
+  * @brief  Generates the dive, the same every time.
+  * @param  samples: Set to ATTITUDE_DIVE_SAMPLES samples
+  * @param  thrusting: Whether the thrusters accelerate the vehicle
+  */
+void attitude_dive_build(attitude_dive_sample_t *samples, bool thrusting);
+
+/**
+  * @brief  Runs a filter from initialisation through the dive.
+  * @param  samples: Dive from attitude_dive_build
+  * @param  filter: Filter to run
+  * @param  errors: Set to the errors against the truth
+  */
+void attitude_dive_run(const attitude_dive_sample_t *samples, attitude_filter_t filter, attitude_dive_errors_t *errors);
+
+#endif /* __ATTITUDE_DIVE_H */
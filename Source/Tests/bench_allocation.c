@@ -0,0 +1,217 @@
+/**
+  ******************************************************************************
+  * @file    bench_allocation.c
+  * @brief   Time per allocation in float, Q15 and Q31 with the default
+  *          matrix, over a set of random wrenches of which about half
+  *          saturate, and per constrained solve from cold and when tracking
+  *          a slowly moving wrench. Each figure is the best of several runs.
+  *          On the host the Q15 variant takes the plain C path; on the
+  *          Cortex-M4 it uses SMLALD, so the ratios here are only a guide to
+  *          the target.
+  ******************************************************************************
+  */
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "allocation.h"
+#include "allocation_qp.h"
+#include "test.h"
+
+#define BENCH_WRENCHES 1024u
+#define BENCH_REPEATS 2000u
+#define BENCH_RUNS 5u
+
+/* The constrained solve is a few hundred times slower */
+#define BENCH_QP_REPEATS 20u
+
+static float wrenches[BENCH_WRENCHES][ALLOCATION_AXES];
+static int16_t wrenches_q15[BENCH_WRENCHES][ALLOCATION_AXES];
+static int32_t wrenches_q31[BENCH_WRENCHES][ALLOCATION_AXES];
+static float track[BENCH_WRENCHES][ALLOCATION_AXES];
+
+/* Keeps the results alive */
+static volatile int64_t sink;
+
+static void bench_report(const char *name, double best, uint32_t saturated)
+{
+  double solves = (double)BENCH_WRENCHES * BENCH_REPEATS;
+
+  printf("%-11s %8.1f ns/solve %8.2f M solves/s %5.1f%% saturated\n", name,
+         best / solves * 1e9, solves / best * 1e-6, 100.0 * saturated / BENCH_WRENCHES);
+}
+
+static void bench_f32(void)
+{
+  double best = 1e9;
+  uint32_t saturated = 0;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    float total = 0.0f;
+    saturated = 0;
+
+    double start = test_seconds();
+
+    for (uint32_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+      for (uint32_t n = 0; n < BENCH_WRENCHES; n++)
+      {
+        float thrust[ALLOCATION_THRUSTERS];
+        float scale = allocation_solve_f32(wrenches[n], thrust);
+
+        total += thrust[n % ALLOCATION_THRUSTERS];
+        saturated += (scale < 1.0f) ? 1u : 0u;
+      }
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+    sink = (int64_t)total;
+  }
+
+  bench_report("f32", best, saturated / BENCH_REPEATS);
+}
+
+static void bench_q15(void)
+{
+  double best = 1e9;
+  uint32_t saturated = 0;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    int64_t total = 0;
+    saturated = 0;
+
+    double start = test_seconds();
+
+    for (uint32_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+      for (uint32_t n = 0; n < BENCH_WRENCHES; n++)
+      {
+        int16_t thrust[ALLOCATION_THRUSTERS];
+        int32_t scale = allocation_solve_q15(wrenches_q15[n], thrust);
+
+        total += thrust[n % ALLOCATION_THRUSTERS];
+        saturated += (scale < ALLOCATION_Q15_ONE) ? 1u : 0u;
+      }
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+    sink = total;
+  }
+
+  bench_report("q15", best, saturated / BENCH_REPEATS);
+}
+
+static void bench_q31(void)
+{
+  double best = 1e9;
+  uint32_t saturated = 0;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    int64_t total = 0;
+    saturated = 0;
+
+    double start = test_seconds();
+
+    for (uint32_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+      for (uint32_t n = 0; n < BENCH_WRENCHES; n++)
+      {
+        int32_t thrust[ALLOCATION_THRUSTERS];
+        int32_t scale = allocation_solve_q31(wrenches_q31[n], thrust);
+
+        total += thrust[n % ALLOCATION_THRUSTERS];
+        saturated += (scale < ALLOCATION_Q15_ONE) ? 1u : 0u;
+      }
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+    sink = total;
+  }
+
+  bench_report("q31", best, saturated / BENCH_REPEATS);
+}
+
+/* Cold starts every solve from zero, tracking follows a 1 kHz manoeuvre from the last solution */
+static void bench_qp(const char *name, bool tracking)
+{
+  double best = 1e9;
+  uint32_t iterations = 0;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    float total = 0.0f;
+    iterations = 0;
+
+    allocation_qp_reset();
+
+    double start = test_seconds();
+
+    for (uint32_t repeat = 0; repeat < BENCH_QP_REPEATS; repeat++)
+    {
+      for (uint32_t n = 0; n < BENCH_WRENCHES; n++)
+      {
+        float thrust[ALLOCATION_THRUSTERS];
+
+        if (!tracking)
+        {
+          allocation_qp_reset();
+        }
+
+        iterations += allocation_solve_qp(tracking ? track[n] : wrenches[n], thrust);
+        total += thrust[n % ALLOCATION_THRUSTERS];
+      }
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+    sink = (int64_t)total;
+  }
+
+  double solves = (double)BENCH_WRENCHES * BENCH_QP_REPEATS;
+
+  printf("%-11s %8.1f ns/solve %8.1f ns/iteration %5.1f iterations\n", name,
+         best / solves * 1e9, best / iterations * 1e9, iterations / solves);
+}
+
+int main(void)
+{
+  uint32_t state = 0x13579BDu;
+
+  allocation_init(NULL);
+
+  for (uint32_t n = 0; n < BENCH_WRENCHES; n++)
+  {
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      float value = test_uniform(&state, -0.6f, 0.6f);
+
+      wrenches[n][j] = value;
+      wrenches_q15[n][j] = (int16_t)lroundf(value * 32768.0f);
+      wrenches_q31[n][j] = (int32_t)llround((double)value * 2147483648.0);
+    }
+
+    float t = (float)n * 0.001f;
+    float moving[ALLOCATION_AXES] = {0.9f * sinf(t * 1.3f), 0.6f * cosf(t * 0.7f), 0.5f * sinf(t * 2.1f),
+                                     0.2f * cosf(t * 1.1f), 0.3f * sinf(t * 0.9f), 0.8f * cosf(t * 1.7f)};
+    memcpy(track[n], moving, sizeof(moving));
+  }
+
+  printf("%u wrenches, %u times each\n", BENCH_WRENCHES, BENCH_REPEATS);
+
+  bench_f32();
+  bench_q15();
+  bench_q31();
+
+  allocation_qp_init(NULL);
+  bench_qp("qp cold", false);
+  bench_qp("qp tracking", true);
+
+  return test_result();
+}
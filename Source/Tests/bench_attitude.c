@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file    bench_attitude.c
+  * @brief   Time per update and accuracy of the three attitude filters on the
+  *          synthetic dive in attitude_dive.h, holding station and
+  *          thrusting. Each time is the best of several runs; test_attitude
+  *          checks the accuracy.
+  ******************************************************************************
+  */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "attitude_dive.h"
+#include "test.h"
+
+#define BENCH_RUNS 5u
+
+static attitude_dive_sample_t *samples;
+
+static void bench_filter(const char *name, attitude_filter_t filter)
+{
+  static attitude_t attitude;
+  double best = 1e9;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    float dt = 1.0f / ATTITUDE_DIVE_RATE_HZ;
+
+    attitude_init(&attitude, filter);
+
+    double start = test_seconds();
+
+    for (uint32_t n = 0; n < ATTITUDE_DIVE_SAMPLES; n++)
+    {
+      attitude_update(&attitude, samples[n].gyro, samples[n].accel, dt);
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+
+  /* Once more for the errors, outside the timing */
+  attitude_dive_errors_t errors;
+  attitude_dive_run(samples, filter, &errors);
+
+  printf("  %-13s %7.1f ns/update %6.3f deg tilt rms %6.3f deg tilt max %7.2f deg total at end\n", name,
+         best / ATTITUDE_DIVE_SAMPLES * 1e9, errors.tilt_rms, errors.tilt_max, errors.final_error);
+}
+
+int main(void)
+{
+  samples = malloc(ATTITUDE_DIVE_SAMPLES * sizeof(attitude_dive_sample_t));
+
+  for (uint32_t thrusting = 0; thrusting < 2u; thrusting++)
+  {
+    attitude_dive_build(samples, thrusting != 0u);
+
+    printf("%u s at %u Hz, %s\n", ATTITUDE_DIVE_SECONDS, ATTITUDE_DIVE_RATE_HZ, thrusting ? "thrusting" : "holding station");
+
+    bench_filter("complementary", ATTITUDE_COMPLEMENTARY);
+    bench_filter("madgwick", ATTITUDE_MADGWICK);
+    bench_filter("ekf", ATTITUDE_EKF);
+  }
+
+  free(samples);
+
+  return 0;
+}
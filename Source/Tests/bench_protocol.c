@@ -0,0 +1,118 @@
+/**
+  ******************************************************************************
+  * @file    bench_protocol.c
+  * @brief   Encode and parse throughput of the wire protocol.
+  *
+  *          The stream is a second's worth of the vehicle's telemetry, many
+  *          times over: status, thrusters, timing, attitude, depth and IMU
+  *          messages in the mix the firmware sends them. It is parsed whole,
+  *          in 64-byte USB packets and a byte at a time, the worst case for a
+  *          UART, and each figure is the best of several runs.
+  ******************************************************************************
+  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "test.h"
+
+#define BENCH_REPEATS 20000u
+#define BENCH_RUNS 5u
+
+static const uint8_t bench_ids[] = {PROTOCOL_ID_STATUS, PROTOCOL_ID_THRUSTERS, PROTOCOL_ID_TIMING,
+                                    PROTOCOL_ID_ATTITUDE, PROTOCOL_ID_DEPTH, PROTOCOL_ID_IMU};
+
+#define BENCH_MESSAGES (sizeof(bench_ids) * BENCH_REPEATS)
+
+static uint8_t *stream;
+static size_t stream_size;
+
+/* Encodes the stream, returning the best time */
+static double bench_build(void)
+{
+  uint32_t state = 0x1234567u;
+  uint8_t payload[PROTOCOL_MAX_PAYLOAD] = {0};
+
+  stream = malloc(BENCH_MESSAGES * PROTOCOL_MAX_ENCODED);
+  stream_size = 0;
+
+  double best = 1e9;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    stream_size = 0;
+    double start = test_seconds();
+
+    for (uint32_t i = 0; i < BENCH_MESSAGES; i++)
+    {
+      uint8_t id = bench_ids[i % sizeof(bench_ids)];
+      size_t length = (size_t)protocol_payload_size(id);
+
+      /* Float and counter fields, which have zeros in them about this often */
+      payload[i % length] = (uint8_t)test_random(&state);
+
+      stream_size += protocol_encode(id, (uint8_t)i, payload, length, &stream[stream_size], PROTOCOL_MAX_ENCODED);
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+
+  return best;
+}
+
+static void bench_decode(const char *name, size_t chunk)
+{
+  double best = 1e9;
+  uint32_t frames = 0;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++)
+  {
+    protocol_decoder_t decoder;
+    protocol_decoder_init(&decoder);
+
+    double start = test_seconds();
+
+    for (size_t begin = 0; begin < stream_size; begin += chunk)
+    {
+      size_t piece = (stream_size - begin < chunk) ? stream_size - begin : chunk;
+      size_t offset = 0;
+
+      while (offset < piece)
+      {
+        size_t consumed;
+        protocol_frame_t frame;
+
+        protocol_decode(&decoder, &stream[begin + offset], piece - offset, &consumed, &frame);
+        offset += consumed;
+      }
+    }
+
+    double elapsed = test_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+    frames = decoder.frames;
+  }
+
+  TEST_CHECK_EQUAL(frames, BENCH_MESSAGES);
+
+  printf("decode %-8s %8.1f MB/s %8.2f M frames/s %6.1f ns/frame\n", name,
+         (double)stream_size / best * 1e-6, (double)BENCH_MESSAGES / best * 1e-6, best / (double)BENCH_MESSAGES * 1e9);
+}
+
+int main(void)
+{
+  double best = bench_build();
+
+  printf("%zu messages, %zu bytes\n", (size_t)BENCH_MESSAGES, stream_size);
+  printf("encode          %8.1f MB/s %8.2f M frames/s %6.1f ns/frame\n",
+         (double)stream_size / best * 1e-6, (double)BENCH_MESSAGES / best * 1e-6, best / (double)BENCH_MESSAGES * 1e9);
+
+  bench_decode("whole", stream_size);
+  bench_decode("64 B", 64u);
+  bench_decode("1 B", 1u);
+
+  free(stream);
+
+  return test_result();
+}
@@ -0,0 +1,89 @@
+/**
+  ******************************************************************************
+  * @file    companion_master.c
+  * @brief   Reference companion computer for the SPI link.
+  ******************************************************************************
+  */
+
+#include "companion_master.h"
+
+#include <string.h>
+
+#include "companion_mock.h"
+
+uint16_t companion_master_crc(const uint8_t *data, size_t length)
+{
+  uint16_t crc = 0xFFFFu;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= (uint16_t)(data[i] << 8);
+
+    for (uint32_t bit = 0; bit < 8u; bit++)
+    {
+      crc = (crc & 0x8000u) ? (uint16_t)((crc << 1) ^ 0x1021u) : (uint16_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+void companion_master_build(uint8_t frame[COMPANION_MASTER_FRAME], uint8_t id, uint8_t seq, const void *payload, size_t length)
+{
+  memset(frame, 0, COMPANION_MASTER_FRAME);
+
+  frame[0] = id;
+  frame[1] = seq;
+
+  if (length > 0u)
+  {
+    memcpy(&frame[2], payload, length);
+  }
+
+  uint16_t crc = companion_master_crc(frame, COMPANION_MASTER_FRAME - 2u);
+  frame[COMPANION_MASTER_FRAME - 2u] = (uint8_t)crc;
+  frame[COMPANION_MASTER_FRAME - 1u] = (uint8_t)(crc >> 8);
+}
+
+companion_master_result_t companion_master_receive(companion_master_t *master, const uint8_t frame[COMPANION_MASTER_FRAME],
+                                                   companion_master_message_t *message)
+{
+  uint16_t crc = (uint16_t)(frame[COMPANION_MASTER_FRAME - 2u] | (frame[COMPANION_MASTER_FRAME - 1u] << 8));
+
+  if (companion_master_crc(frame, COMPANION_MASTER_FRAME - 2u) != crc)
+  {
+    master->bad_crc++;
+    return COMPANION_MASTER_BAD_CRC;
+  }
+
+  if (frame[0] == 0u)
+  {
+    master->idle++;
+    return COMPANION_MASTER_IDLE;
+  }
+
+  message->id = frame[0];
+  message->seq = frame[1];
+  memcpy(message->payload, &frame[2], PROTOCOL_MAX_PAYLOAD);
+
+  if (master->synced)
+  {
+    master->lost += (uint8_t)(message->seq - master->next_seq);
+  }
+
+  master->synced = true;
+  master->next_seq = (uint8_t)(message->seq + 1u);
+  master->messages++;
+
+  return COMPANION_MASTER_MESSAGE;
+}
+
+void companion_master_transact(const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    miso[i] = companion_mock_clock(mosi[i]);
+  }
+
+  companion_mock_nss_rise();
+}
@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * @file    companion_master.h
+  * @brief   Reference companion computer for the SPI link, written from the
+  *          frame layout in companion.h rather than from the firmware: a
+  *          frame is the identifier, the sequence number, the payload zero
+  *          padded to PROTOCOL_MAX_PAYLOAD and a CRC-16/CCITT-FALSE of those,
+  *          little-endian. It clocks transactions through the simulated
+  *          slave and checks what comes back.
+  ******************************************************************************
+  */
+
+#ifndef __COMPANION_MASTER_H
+#define __COMPANION_MASTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define COMPANION_MASTER_FRAME (2u + PROTOCOL_MAX_PAYLOAD + 2u)
+
+typedef enum
+{
+  COMPANION_MASTER_IDLE,
+  COMPANION_MASTER_MESSAGE,
+  COMPANION_MASTER_BAD_CRC
+} companion_master_result_t;
+
+typedef struct
+{
+  uint8_t id;
+  uint8_t seq;
+  uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+} companion_master_message_t;
+
+typedef struct
+{
+  bool synced;                  /* The next sequence number is known */
+  uint8_t next_seq;
+  uint32_t messages;
+  uint32_t idle;
+  uint32_t bad_crc;
+  uint32_t lost;                /* Messages missing from the sequence */
+} companion_master_t;
+
+/**
+  * @brief  CRC-16/CCITT-FALSE, bit by bit.
+  */
+uint16_t companion_master_crc(const uint8_t *data, size_t length);
+
+/**
+  * @brief  Lays out a frame.
+  * @param  frame: Set to the frame
+  * @param  id: Message identifier, 0 for idle
+  * @param  seq: Sequence number
+  * @param  payload: Payload bytes, may be NULL if length is 0
+  * @param  length: Payload size, at most PROTOCOL_MAX_PAYLOAD
+  */
+void companion_master_build(uint8_t frame[COMPANION_MASTER_FRAME], uint8_t id, uint8_t seq, const void *payload, size_t length);
+
+/**
+  * @brief  Checks a frame from the slave and follows its sequence numbers.
+  * @param  master: Receive state
+  * @param  frame: Frame as clocked in
+  * @param  message: Set to the message if there is one
+  */
+companion_master_result_t companion_master_receive(companion_master_t *master, const uint8_t frame[COMPANION_MASTER_FRAME],
+                                                   companion_master_message_t *message);
+
+/**
+  * @brief  One transaction: lowers NSS, clocks the bytes each way and raises
+  *         NSS, which runs the slave's edge interrupt.
+  * @param  mosi: Bytes to send
+  * @param  miso: Set to the bytes received
+  * @param  length: Bytes each way, COMPANION_MASTER_FRAME for a whole frame
+  */
+void companion_master_transact(const uint8_t *mosi, uint8_t *miso, size_t length);
+
+#endif /* __COMPANION_MASTER_H */
@@ -0,0 +1,160 @@
+/**
+  ******************************************************************************
+  * @file    companion_mock.c
+  * @brief   Companion link operations on the in-memory SPI slave.
+  ******************************************************************************
+  */
+
+#include "companion_mock.h"
+
+#include <string.h>
+
+#define COMPANION_MOCK_FRAME sizeof(companion_frame_t)
+
+companion_mock_t companion_mock;
+
+void companion_mock_reset(void)
+{
+  memset(&companion_mock, 0, sizeof(companion_mock));
+}
+
+/* One transfer of a circular double-buffered stream, switching buffers after the last */
+static uint32_t companion_mock_advance(companion_mock_stream_t *stream)
+{
+  uint32_t index = COMPANION_MOCK_FRAME - stream->remaining;
+
+  if (--stream->remaining == 0u)
+  {
+    stream->remaining = COMPANION_MOCK_FRAME;
+    stream->target ^= 1u;
+  }
+
+  return index;
+}
+
+/* The transmit stream answers TXE by writing the next byte into the data register */
+static void companion_mock_fill(void)
+{
+  companion_mock_stream_t *tx = &companion_mock.tx;
+  uint32_t target = tx->target;
+  uint32_t index = companion_mock_advance(tx);
+
+  companion_mock.data = tx->memory[target][index];
+  companion_mock.data_full = true;
+}
+
+uint8_t companion_mock_clock(uint8_t mosi)
+{
+  uint8_t miso = 0;
+
+  if (companion_mock.data_full)
+  {
+    miso = companion_mock.data;
+    companion_mock.data_full = false;
+
+    if (companion_mock.stall)
+    {
+      companion_mock.stall = false;
+    }
+    else
+    {
+      companion_mock_fill();
+    }
+  }
+  else
+  {
+    companion_mock.underruns++;
+    companion_mock_fill();
+  }
+
+  companion_mock_stream_t *rx = &companion_mock.rx;
+  uint32_t target = rx->target;
+  uint32_t index = companion_mock_advance(rx);
+
+  companion_mock.rx_memory[target][index] = mosi;
+
+  return miso;
+}
+
+void companion_mock_stall(void)
+{
+  companion_mock.stall = true;
+}
+
+void companion_mock_nss_rise(void)
+{
+  if (companion_mock.edge_enabled)
+  {
+    companion_mock.edges++;
+    companion_nss_edge(companion_mock.time_us, companion_mock.rx.target, companion_mock.tx.target,
+                       companion_mock.rx.remaining, companion_mock.tx.remaining);
+  }
+}
+
+static uint32_t companion_mock_lock(void)
+{
+  return (uint32_t)companion_mock.lock_depth++;
+}
+
+static void companion_mock_unlock(uint32_t state)
+{
+  companion_mock.lock_depth = (int)state;
+}
+
+static void companion_mock_init(void)
+{
+  companion_mock.inits++;
+}
+
+static void companion_mock_start(companion_frame_t rx[2], const companion_frame_t *tx)
+{
+  companion_mock.starts++;
+
+  companion_mock.rx_memory[0] = (uint8_t *)&rx[0];
+  companion_mock.rx_memory[1] = (uint8_t *)&rx[1];
+  companion_mock.rx.memory[0] = companion_mock.rx_memory[0];
+  companion_mock.rx.memory[1] = companion_mock.rx_memory[1];
+  companion_mock.rx.target = 0;
+  companion_mock.rx.remaining = COMPANION_MOCK_FRAME;
+
+  companion_mock.tx.memory[0] = (const uint8_t *)tx;
+  companion_mock.tx.memory[1] = (const uint8_t *)tx;
+  companion_mock.tx.target = 0;
+  companion_mock.tx.remaining = COMPANION_MOCK_FRAME;
+
+  /* The reset emptied the data register, which the stream fills as soon as it is enabled */
+  companion_mock.data_full = false;
+  companion_mock_fill();
+}
+
+static void companion_mock_load(uint32_t buffer, const companion_frame_t *frame)
+{
+  if (buffer == companion_mock.tx.target)
+  {
+    companion_mock.bad_loads++;
+    return;
+  }
+
+  companion_mock.tx.memory[buffer] = (const uint8_t *)frame;
+}
+
+static void companion_mock_enable(void)
+{
+  companion_mock.edge_enabled = true;
+}
+
+static uint32_t companion_mock_time_us(void)
+{
+  return ++companion_mock.time_us;
+}
+
+const companion_ops_t companion_mock_ops =
+{
+  .lock = companion_mock_lock,
+  .unlock = companion_mock_unlock,
+  .init = companion_mock_init,
+  .start = companion_mock_start,
+  .load = companion_mock_load,
+  .enable = companion_mock_enable,
+  .time_us = companion_mock_time_us,
+};
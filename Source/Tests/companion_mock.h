@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file    companion_mock.h
+  * @brief   SPI slave with circular double-buffered DMA on both directions,
+  *          in memory, as the companion link's hardware. Each byte the master
+  *          clocks moves the data register into the shift register and lets
+  *          the transmit stream refill it, so that stream runs a byte ahead
+  *          and switches buffers one byte before the end of a frame, as on
+  *          the STM32. The receive stream stores the byte from the master.
+  *          Raising NSS runs the edge interrupt. Each read of the clock
+  *          takes a microsecond.
+  ******************************************************************************
+  */
+
+#ifndef __COMPANION_MOCK_H
+#define __COMPANION_MOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "companion.h"
+
+typedef struct
+{
+  const uint8_t *memory[2];     /* M0AR and M1AR */
+  uint32_t target;              /* CT */
+  uint32_t remaining;           /* NDTR */
+} companion_mock_stream_t;
+
+typedef struct
+{
+  companion_mock_stream_t rx;
+  companion_mock_stream_t tx;
+  uint8_t *rx_memory[2];        /* The receive buffers, writable */
+  uint32_t bad_loads;           /* Address writes to the buffer the stream is on, which the DMA ignores */
+
+  uint8_t data;                 /* Transmit data register */
+  bool data_full;
+  bool stall;                   /* The transmit stream misses the next request */
+  uint32_t underruns;           /* Bytes clocked with the data register empty */
+
+  bool edge_enabled;
+  uint32_t edges;               /* Edge interrupts run */
+  uint32_t starts;
+  uint32_t time_us;
+
+  int lock_depth;
+  uint32_t inits;
+} companion_mock_t;
+
+extern companion_mock_t companion_mock;
+extern const companion_ops_t companion_mock_ops;
+
+/**
+  * @brief  Clears the peripheral and both streams.
+  */
+void companion_mock_reset(void);
+
+/**
+  * @brief  Clocks one byte each way.
+  * @param  mosi: Byte from the master
+  * @retval Byte to the master
+  */
+uint8_t companion_mock_clock(uint8_t mosi);
+
+/**
+  * @brief  Makes the transmit stream late for the next byte, as when the
+  *         bus is busy: the data register is empty at the clock after, so
+  *         that byte underruns and the stream falls a byte behind.
+  */
+void companion_mock_stall(void);
+
+/**
+  * @brief  Rising edge of NSS. Runs the edge interrupt if it is enabled.
+  */
+void companion_mock_nss_rise(void);
+
+#endif /* __COMPANION_MOCK_H */
@@ -0,0 +1,281 @@
+/**
+  ******************************************************************************
+  * @file    fuzz_protocol.c
+  * @brief   Fuzz target for protocol_decode.
+  *
+  *          Each input is decoded three ways: in one call, a byte at a time,
+  *          and in 64-byte pieces, the size of a full-speed USB packet. The
+  *          decoder works on a byte stream, so all three must report the same
+  *          frames and errors, and every frame must be one the protocol
+  *          allows.
+  *
+  *          Built with TESTS_LIBFUZZER this is a libFuzzer target. Otherwise
+  *          main feeds it a fixed set of random streams, random streams mostly
+  *          made of delimiters, and valid frames with bytes flipped, dropped
+  *          and spliced, and checks that clean frames in between all survive.
+  ******************************************************************************
+  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "protocol.h"
+#include "test.h"
+
+#define FUZZ_MAX_INPUT 4096u
+#define FUZZ_ITERATIONS 20000u
+
+typedef struct
+{
+  protocol_result_t result;
+  uint8_t id;
+  uint8_t seq;
+  uint8_t length;
+  uint32_t crc;                 /* Of the payload, so payloads compare cheaply */
+} fuzz_event_t;
+
+typedef struct
+{
+  fuzz_event_t events[FUZZ_MAX_INPUT];
+  size_t count;
+  uint32_t frames;
+  uint32_t errors;
+} fuzz_run_t;
+
+/* Decodes data in pieces of at most chunk bytes, recording every frame and error */
+static void fuzz_decode(const uint8_t *data, size_t size, size_t chunk, fuzz_run_t *run)
+{
+  protocol_decoder_t decoder;
+  protocol_decoder_init(&decoder);
+  run->count = 0;
+
+  for (size_t start = 0; start < size; start += chunk)
+  {
+    size_t piece = (size - start < chunk) ? size - start : chunk;
+    size_t offset = 0;
+
+    while (offset < piece)
+    {
+      size_t consumed = 0;
+      protocol_frame_t frame;
+
+      protocol_result_t result = protocol_decode(&decoder, data + start + offset, piece - offset, &consumed, &frame);
+
+      if (!TEST_CHECK(consumed > 0 && consumed <= piece - offset))
+      {
+        abort();
+      }
+
+      offset += consumed;
+
+      if (result == PROTOCOL_INCOMPLETE)
+      {
+        TEST_CHECK(offset == piece);
+        continue;
+      }
+
+      fuzz_event_t *event = &run->events[run->count++];
+      memset(event, 0, sizeof(*event));
+      event->result = result;
+
+      if (result == PROTOCOL_FRAME)
+      {
+        int expected = protocol_payload_size(frame.id);
+
+        TEST_CHECK(frame.length <= PROTOCOL_MAX_PAYLOAD);
+        TEST_CHECK(expected < 0 || expected == frame.length);
+        TEST_CHECK(frame.payload == &decoder.buffer[PROTOCOL_HEADER_SIZE]);
+
+        event->id = frame.id;
+        event->seq = frame.seq;
+        event->length = frame.length;
+        event->crc = crc32(frame.payload, frame.length);
+      }
+    }
+  }
+
+  run->frames = decoder.frames;
+  run->errors = decoder.errors;
+}
+
+static int fuzz_same(const fuzz_run_t *a, const fuzz_run_t *b)
+{
+  return a->count == b->count && a->frames == b->frames && a->errors == b->errors &&
+         memcmp(a->events, b->events, a->count * sizeof(fuzz_event_t)) == 0;
+}
+
+static fuzz_run_t whole;
+static fuzz_run_t bytes;
+static fuzz_run_t packets;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (size > FUZZ_MAX_INPUT)
+  {
+    return 0;
+  }
+
+  fuzz_decode(data, size, size > 0 ? size : 1, &whole);
+  fuzz_decode(data, size, 1, &bytes);
+  fuzz_decode(data, size, 64, &packets);
+
+  TEST_CHECK(fuzz_same(&whole, &bytes));
+  TEST_CHECK(fuzz_same(&whole, &packets));
+  TEST_CHECK(whole.count == (size_t)whole.frames + whole.errors);
+
+  return 0;
+}
+
+#ifndef TESTS_LIBFUZZER
+
+/* A valid frame with a random known message, or one the decoder has never heard of */
+static size_t fuzz_frame(uint32_t *state, uint8_t *out, fuzz_event_t *event)
+{
+  static const uint8_t ids[] = {PROTOCOL_ID_COMMAND, PROTOCOL_ID_PING, PROTOCOL_ID_STATUS, PROTOCOL_ID_ATTITUDE,
+                                PROTOCOL_ID_DEPTH, PROTOCOL_ID_THRUSTERS, PROTOCOL_ID_PONG, PROTOCOL_ID_TIMING,
+                                PROTOCOL_ID_IMU, 0x7F};
+  uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+
+  uint8_t id = ids[test_random(state) % sizeof(ids)];
+  int length = protocol_payload_size(id);
+
+  if (length < 0)
+  {
+    length = (int)(test_random(state) % (PROTOCOL_MAX_PAYLOAD + 1u));
+  }
+
+  /* Plenty of zeros, so the stuffing is exercised */
+  for (int i = 0; i < length; i++)
+  {
+    payload[i] = (test_random(state) & 3u) == 0u ? 0u : (uint8_t)test_random(state);
+  }
+
+  uint8_t seq = (uint8_t)test_random(state);
+
+  memset(event, 0, sizeof(*event));
+  event->result = PROTOCOL_FRAME;
+  event->id = id;
+  event->seq = seq;
+  event->length = (uint8_t)length;
+  event->crc = crc32(payload, (size_t)length);
+
+  return protocol_encode(id, seq, payload, (size_t)length, out, PROTOCOL_MAX_ENCODED);
+}
+
+/* Random bytes, with zeros as often as the stream wants them */
+static size_t fuzz_noise(uint32_t *state, uint8_t *out, size_t size, uint32_t zero_one_in)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    out[i] = (test_random(state) % zero_one_in) == 0u ? 0u : (uint8_t)test_random(state);
+  }
+
+  return size;
+}
+
+static uint8_t input[FUZZ_MAX_INPUT];
+static fuzz_event_t expected[FUZZ_MAX_INPUT];
+
+/* Clean frames after a delimiter must decode exactly, whatever garbage came before */
+static void fuzz_recovery(uint32_t *state)
+{
+  size_t size = fuzz_noise(state, input, test_random(state) % 200u, 8u);
+  size_t count = 0;
+
+  input[size++] = 0;
+
+  while (size + PROTOCOL_MAX_ENCODED <= FUZZ_MAX_INPUT && count < 16u)
+  {
+    size += fuzz_frame(state, &input[size], &expected[count++]);
+  }
+
+  LLVMFuzzerTestOneInput(input, size);
+
+  /* The noise may add errors and even frames of its own, the clean frames come last */
+  size_t decoded = 0;
+
+  for (size_t i = 0; i < whole.count; i++)
+  {
+    if (whole.events[i].result == PROTOCOL_FRAME)
+    {
+      decoded++;
+    }
+  }
+
+  if (TEST_CHECK(decoded >= count))
+  {
+    const fuzz_event_t *last = &whole.events[whole.count - count];
+    TEST_CHECK(memcmp(last, expected, count * sizeof(fuzz_event_t)) == 0);
+  }
+}
+
+/* Valid frames damaged the ways a serial line damages them */
+static void fuzz_damaged(uint32_t *state)
+{
+  size_t size = 0;
+  fuzz_event_t ignored;
+
+  while (size + PROTOCOL_MAX_ENCODED <= FUZZ_MAX_INPUT && (test_random(state) % 24u) != 0u)
+  {
+    size_t length = fuzz_frame(state, &input[size], &ignored);
+    uint32_t damage = test_random(state) % 4u;
+
+    if (damage == 0u)
+    {
+      input[size + test_random(state) % length] ^= (uint8_t)(1u << (test_random(state) % 8u));
+    }
+    else if (damage == 1u)
+    {
+      /* Dropped tail, the next frame runs into it */
+      length -= test_random(state) % length;
+    }
+    else if (damage == 2u)
+    {
+      /* Dropped byte */
+      size_t at = test_random(state) % length;
+      memmove(&input[size + at], &input[size + at + 1u], length - at - 1u);
+      length--;
+    }
+
+    size += length;
+  }
+
+  LLVMFuzzerTestOneInput(input, size);
+}
+
+int main(void)
+{
+  uint32_t state = 0x2545F491u;
+
+  for (uint32_t i = 0; i < FUZZ_ITERATIONS; i++)
+  {
+    switch (i % 4u)
+    {
+      case 0:
+        LLVMFuzzerTestOneInput(input, fuzz_noise(&state, input, test_random(&state) % FUZZ_MAX_INPUT, 256u));
+        break;
+
+      case 1:
+        LLVMFuzzerTestOneInput(input, fuzz_noise(&state, input, test_random(&state) % FUZZ_MAX_INPUT, 3u));
+        break;
+
+      case 2:
+        fuzz_damaged(&state);
+        break;
+
+      default:
+        fuzz_recovery(&state);
+        break;
+    }
+  }
+
+  /* Longest possible runs without a delimiter, and nothing at all */
+  memset(input, 0xFF, sizeof(input));
+  LLVMFuzzerTestOneInput(input, sizeof(input));
+  LLVMFuzzerTestOneInput(input, 0);
+
+  return test_result();
+}
+
+#endif /* TESTS_LIBFUZZER */
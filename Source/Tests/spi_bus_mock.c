@@ -0,0 +1,172 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus_mock.c
+  * @brief   SPI sensor bus operations on the in-memory bus.
+  ******************************************************************************
+  */
+
+#include "spi_bus_mock.h"
+
+#include <stddef.h>
+#include <string.h>
+
+spi_bus_mock_t spi_bus_mock;
+
+void spi_bus_mock_reset(void)
+{
+  memset(&spi_bus_mock, 0, sizeof(spi_bus_mock));
+}
+
+uint8_t spi_bus_mock_byte(uint32_t transfer, uint32_t index)
+{
+  return (uint8_t)(transfer * 37u + index + 1u);
+}
+
+bool spi_bus_mock_data_ready(uint32_t line)
+{
+  if (!spi_bus_mock.trigger_enabled[line])
+  {
+    return false;
+  }
+
+  spi_bus_trigger(line);
+  return true;
+}
+
+bool spi_bus_mock_complete(bool error)
+{
+  if (!spi_bus_mock.dma)
+  {
+    return false;
+  }
+
+  const spi_bus_mock_transfer_t *transfer = &spi_bus_mock.current;
+  uint32_t number = spi_bus_mock.started - 1u;
+  uint32_t received = error ? (transfer->length + 1u) / 2u : transfer->length + 1u;
+
+  /* The byte clocked in with the command is whatever the device had, then the data */
+  for (uint32_t i = 0; i < received; i++)
+  {
+    transfer->rx[i] = (i == 0u) ? 0xA5u : spi_bus_mock_byte(number, i - 1u);
+  }
+
+  if (!spi_bus_mock.selected[transfer->device])
+  {
+    spi_bus_mock.unselected++;
+  }
+
+  spi_bus_complete(error);
+  return true;
+}
+
+static uint32_t spi_bus_mock_lock(void)
+{
+  return (uint32_t)spi_bus_mock.lock_depth++;
+}
+
+static void spi_bus_mock_unlock(uint32_t state)
+{
+  spi_bus_mock.lock_depth = (int)state;
+}
+
+static void spi_bus_mock_init(void)
+{
+  spi_bus_mock.inits++;
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    spi_bus_mock.selected[i] = false;
+  }
+}
+
+static void spi_bus_mock_select(uint8_t device, bool selected)
+{
+  if (selected && !spi_bus_mock.selected[device])
+  {
+    for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+    {
+      if (spi_bus_mock.selected[i])
+      {
+        spi_bus_mock.overlaps++;
+      }
+    }
+
+    spi_bus_mock.selections[device]++;
+  }
+
+  spi_bus_mock.selected[device] = selected;
+}
+
+static void spi_bus_mock_start(uint8_t command, uint8_t *rx, uint16_t length)
+{
+  spi_bus_mock_transfer_t transfer = {SPI_BUS_DEVICES, command, rx, length};
+
+  /* The device is the one selected */
+  for (uint8_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    if (spi_bus_mock.selected[i])
+    {
+      transfer.device = i;
+    }
+  }
+
+  if (transfer.device == SPI_BUS_DEVICES)
+  {
+    spi_bus_mock.unselected++;
+    transfer.device = 0;
+  }
+
+  spi_bus_mock.current = transfer;
+  spi_bus_mock.history[spi_bus_mock.started % SPI_BUS_MOCK_HISTORY] = transfer;
+  spi_bus_mock.started++;
+  spi_bus_mock.dma = true;
+}
+
+static void spi_bus_mock_finish(bool error)
+{
+  spi_bus_mock.dma = false;
+
+  if (error)
+  {
+    spi_bus_mock.tx_stops++;
+  }
+}
+
+/* Devices echo what they are sent, inverted */
+static void spi_bus_mock_exchange(const uint8_t *tx, uint8_t *rx, uint16_t length)
+{
+  for (uint32_t i = 0; i < length && rx != NULL; i++)
+  {
+    rx[i] = (uint8_t)~tx[i];
+  }
+}
+
+static void spi_bus_mock_enable_trigger(uint32_t line, bool enable)
+{
+  spi_bus_mock.trigger_enabled[line] = enable;
+}
+
+static uint32_t spi_bus_mock_time_us(void)
+{
+  return spi_bus_mock.time_us;
+}
+
+static uint32_t spi_bus_mock_cycles(void)
+{
+  spi_bus_mock.cycles += 10u;
+  return spi_bus_mock.cycles;
+}
+
+const spi_bus_ops_t spi_bus_mock_ops =
+{
+  .lock = spi_bus_mock_lock,
+  .unlock = spi_bus_mock_unlock,
+  .init = spi_bus_mock_init,
+  .select = spi_bus_mock_select,
+  .start = spi_bus_mock_start,
+  .finish = spi_bus_mock_finish,
+  .exchange = spi_bus_mock_exchange,
+  .enable_trigger = spi_bus_mock_enable_trigger,
+  .time_us = spi_bus_mock_time_us,
+  .cycles = spi_bus_mock_cycles,
+};
@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus_mock.h
+  * @brief   SPI sensor bus hardware in memory: chip select levels, one DMA
+  *          read at a time, the data-ready interrupt enables and the clocks.
+  *          Devices answer every read with bytes numbered by the transfer, so
+  *          a buffer shows which transfer last wrote it. The interrupts are
+  *          raised by the test, which runs them to completion as the NVIC
+  *          would at one priority.
+  ******************************************************************************
+  */
+
+#ifndef __SPI_BUS_MOCK_H
+#define __SPI_BUS_MOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spi_bus.h"
+
+#define SPI_BUS_MOCK_HISTORY 64u
+
+/* A DMA read as the bus started it */
+typedef struct
+{
+  uint8_t device;
+  uint8_t command;
+  uint8_t *rx;
+  uint16_t length;
+} spi_bus_mock_transfer_t;
+
+typedef struct
+{
+  bool selected[SPI_BUS_DEVICES];           /* Chip select low */
+  uint32_t selections[SPI_BUS_DEVICES];     /* Falling edges */
+  uint32_t overlaps;                        /* Selects while another device was selected */
+
+  bool dma;                                 /* A DMA read is running */
+  spi_bus_mock_transfer_t current;
+  spi_bus_mock_transfer_t history[SPI_BUS_MOCK_HISTORY];
+  uint32_t started;                         /* DMA reads started, index into history modulo its size */
+  uint32_t unselected;                      /* DMA reads started or ended with their chip select high */
+  uint32_t tx_stops;                        /* Finishes after an error */
+
+  bool trigger_enabled[SPI_BUS_TRIGGERS];
+
+  uint32_t time_us;
+  uint32_t cycles;                          /* Advanced each read */
+
+  int lock_depth;
+  uint32_t inits;
+} spi_bus_mock_t;
+
+extern spi_bus_mock_t spi_bus_mock;
+extern const spi_bus_ops_t spi_bus_mock_ops;
+
+/**
+  * @brief  Clears the bus, every chip select high.
+  */
+void spi_bus_mock_reset(void);
+
+/**
+  * @brief  The byte a device sends at a position of a transfer.
+  * @param  transfer: Transfer number, from 0
+  * @param  index: Byte after the command, from 0
+  */
+uint8_t spi_bus_mock_byte(uint32_t transfer, uint32_t index);
+
+/**
+  * @brief  Data-ready edge. Runs the interrupt if it is enabled.
+  * @param  line: Data-ready input
+  * @retval true if the interrupt ran
+  */
+bool spi_bus_mock_data_ready(uint32_t line);
+
+/**
+  * @brief  Clocks the running DMA read to its end, filling its buffer, and
+  *         runs the completion interrupt.
+  * @param  error: End it with a transfer error instead, halfway through
+  * @retval false if no read was running
+  */
+bool spi_bus_mock_complete(bool error);
+
+#endif /* __SPI_BUS_MOCK_H */
@@ -0,0 +1,113 @@
+/**
+  ******************************************************************************
+  * @file    test.h
+  * @brief   Checks, timing and random numbers for the host tests. A failed
+  *          check prints where it failed and the test carries on, so one run
+  *          reports every failure; main returns test_result().
+  ******************************************************************************
+  */
+
+#ifndef __TEST_H
+#define __TEST_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int test_failures;
+static int test_checks;
+
+#define TEST_CHECK(condition) \
+  test_check((condition), #condition, __FILE__, __LINE__)
+
+#define TEST_CHECK_EQUAL(actual, expected) \
+  test_check_equal((long long)(actual), (long long)(expected), #actual, __FILE__, __LINE__)
+
+#define TEST_CHECK_NEAR(actual, expected, tolerance) \
+  test_check_near((double)(actual), (double)(expected), (double)(tolerance), #actual, __FILE__, __LINE__)
+
+static inline int test_check(int passed, const char *text, const char *file, int line)
+{
+  test_checks++;
+
+  if (!passed)
+  {
+    test_failures++;
+    printf("%s:%d: check failed: %s\n", file, line, text);
+  }
+
+  return passed;
+}
+
+static inline int test_check_equal(long long actual, long long expected, const char *text, const char *file, int line)
+{
+  test_checks++;
+
+  if (actual != expected)
+  {
+    test_failures++;
+    printf("%s:%d: %s is %lld, expected %lld\n", file, line, text, actual, expected);
+    return 0;
+  }
+
+  return 1;
+}
+
+static inline int test_check_near(double actual, double expected, double tolerance, const char *text, const char *file, int line)
+{
+  test_checks++;
+
+  if (!(fabs(actual - expected) <= tolerance))
+  {
+    test_failures++;
+    printf("%s:%d: %s is %g, expected %g within %g\n", file, line, text, actual, expected, tolerance);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+  * @brief  Prints the totals.
+  * @retval Exit code for main, non-zero if any check failed
+  */
+static inline int test_result(void)
+{
+  printf("%d of %d checks passed\n", test_checks - test_failures, test_checks);
+  return test_failures != 0;
+}
+
+/**
+  * @brief  Monotonic time for benchmarks.
+  */
+static inline double test_seconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/**
+  * @brief  xorshift32, so every run sees the same inputs.
+  * @param  state: Non-zero generator state
+  */
+static inline uint32_t test_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+  * @brief  Uniform in [low, high).
+  */
+static inline float test_uniform(uint32_t *state, float low, float high)
+{
+  return low + (high - low) * (float)(test_random(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif /* __TEST_H */
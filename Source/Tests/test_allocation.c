@@ -0,0 +1,195 @@
+/**
+  ******************************************************************************
+  * @file    test_allocation.c
+  * @brief   Thrust allocation: the Q15 and Q31 variants against the float
+  *          one over random wrenches, with the default matrix and with a
+  *          configuration that needs shifting and has uneven limits, in and
+  *          out of saturation.
+  ******************************************************************************
+  */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "allocation.h"
+#include "test.h"
+
+#define TEST_WRENCHES 20000u
+
+/* A few LSB of rounding in the wrench and in each product */
+#define TEST_Q15_TOLERANCE (8.0 / 32768.0)
+#define TEST_Q31_TOLERANCE 1e-6
+
+/*
+ * Both fixed point variants scale by a Q15 factor rounded down, which is off by
+ * up to an LSB of the scale, so a saturated Q31 result is only good to Q15
+ * relative to the scale.
+ */
+#define TEST_SCALED_TOLERANCE(thrust, scale) ((1.0 + fabs(thrust) / (scale)) * 2.0 / 32768.0)
+
+/* Entries up to 2.5 so the fixed point matrices are shifted, limits below full range */
+static const allocation_config_t test_config =
+{
+  .matrix =
+  {
+    {0.9f, -1.1f, 0.0f, 0.1f, 0.0f, -2.5f},
+    {0.9f, 1.1f, 0.0f, -0.1f, 0.0f, 2.5f},
+    {1.2f, 0.8f, 0.05f, 0.0f, 0.0f, -1.7f},
+    {1.2f, -0.8f, -0.05f, 0.0f, 0.0f, 1.7f},
+    {0.0f, 0.0f, 1.0f, 1.3f, -0.6f, 0.0f},
+    {0.0f, 0.0f, 1.0f, -1.3f, -0.6f, 0.0f},
+    {0.0f, 0.1f, -1.0f, 0.7f, 1.9f, 0.0f},
+    {0.0f, -0.1f, -1.0f, -0.7f, 1.9f, 0.0f},
+  },
+  .limit = {1.0f, 1.0f, 0.8f, 0.8f, 0.5f, 0.5f, 0.95f, 0.95f},
+};
+
+static int16_t test_q15(float value)
+{
+  return (int16_t)lroundf(fminf(fmaxf(value, -1.0f), 32767.0f / 32768.0f) * 32768.0f);
+}
+
+static int32_t test_q31(float value)
+{
+  double scaled = round((double)value * 2147483648.0);
+  return (int32_t)fmin(fmax(scaled, -2147483648.0), 2147483647.0);
+}
+
+/* Solves one wrench all three ways, the fixed point inputs rounded from the float one */
+static void test_compare(const float wrench[ALLOCATION_AXES], uint32_t *saturated)
+{
+  const allocation_config_t *config = allocation_get_config();
+
+  int16_t wrench_q15[ALLOCATION_AXES];
+  int32_t wrench_q31[ALLOCATION_AXES];
+  float quantized[ALLOCATION_AXES];
+
+  for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+  {
+    wrench_q15[j] = test_q15(wrench[j]);
+    wrench_q31[j] = test_q31(wrench[j]);
+    quantized[j] = (float)wrench_q31[j] / 2147483648.0f;
+  }
+
+  float thrust[ALLOCATION_THRUSTERS];
+  int16_t thrust_q15[ALLOCATION_THRUSTERS];
+  int32_t thrust_q31[ALLOCATION_THRUSTERS];
+
+  float scale = allocation_solve_f32(quantized, thrust);
+  int32_t scale_q15 = allocation_solve_q15(wrench_q15, thrust_q15);
+  int32_t scale_q31 = allocation_solve_q31(wrench_q31, thrust_q31);
+
+  TEST_CHECK(scale > 0.0f && scale <= 1.0f);
+  TEST_CHECK_NEAR(scale_q15 / 32768.0, scale, TEST_Q15_TOLERANCE);
+  TEST_CHECK_NEAR(scale_q31 / 32768.0, scale, 2.0 / 32768.0);
+
+  if (scale < 1.0f)
+  {
+    (*saturated)++;
+  }
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    TEST_CHECK_NEAR(thrust_q15[i] / 32768.0, thrust[i], TEST_Q15_TOLERANCE);
+    TEST_CHECK_NEAR(thrust_q31[i] / 2147483648.0, thrust[i], (scale < 1.0f) ? TEST_SCALED_TOLERANCE(thrust[i], scale) : TEST_Q31_TOLERANCE);
+
+    /* Rounding never takes a thruster past its limit, as loaded in each format */
+    TEST_CHECK(fabsf(thrust[i]) <= config->limit[i] * (1.0f + 1e-6f));
+    TEST_CHECK(abs(thrust_q15[i]) <= test_q15(config->limit[i]));
+    TEST_CHECK(llabs(thrust_q31[i]) <= test_q31(config->limit[i]));
+  }
+}
+
+static void test_random_wrenches(const allocation_config_t *config, float range)
+{
+  uint32_t state = 0x2468ACEu;
+  uint32_t saturated = 0;
+
+  allocation_init(config);
+
+  for (uint32_t n = 0; n < TEST_WRENCHES; n++)
+  {
+    float wrench[ALLOCATION_AXES];
+
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      wrench[j] = test_uniform(&state, -range, range);
+    }
+
+    test_compare(wrench, &saturated);
+  }
+
+  /* Both sides of the limit are exercised */
+  TEST_CHECK(saturated > TEST_WRENCHES / 10u);
+  TEST_CHECK(saturated < TEST_WRENCHES);
+}
+
+/* Full scale on every axis, the largest sums the accumulators see */
+static void test_extremes(const allocation_config_t *config)
+{
+  uint32_t saturated = 0;
+
+  allocation_init(config);
+
+  for (uint32_t signs = 0; signs < (1u << ALLOCATION_AXES); signs++)
+  {
+    float wrench[ALLOCATION_AXES];
+
+    for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+    {
+      wrench[j] = ((signs >> j) & 1u) ? -1.0f : 32767.0f / 32768.0f;
+    }
+
+    test_compare(wrench, &saturated);
+  }
+
+  TEST_CHECK_EQUAL(saturated, 1u << ALLOCATION_AXES);
+}
+
+/* Within the limits nothing is scaled, and the result is the matrix product */
+static void test_unsaturated(void)
+{
+  allocation_init(NULL);
+
+  float wrench[ALLOCATION_AXES] = {0.25f, -0.125f, 0.5f, 0.0625f, -0.25f, 0.125f};
+  float thrust[ALLOCATION_THRUSTERS];
+
+  TEST_CHECK_EQUAL(allocation_solve_f32(wrench, thrust), 1);
+
+  float expected[ALLOCATION_THRUSTERS] = {0.25f, 0.25f, 0.0f, 0.5f, 0.8125f, 0.6875f, 0.3125f, 0.1875f};
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    TEST_CHECK_NEAR(thrust[i], expected[i], 1e-6);
+  }
+
+  int16_t wrench_q15[ALLOCATION_AXES];
+  int16_t thrust_q15[ALLOCATION_THRUSTERS];
+
+  for (uint32_t j = 0; j < ALLOCATION_AXES; j++)
+  {
+    wrench_q15[j] = test_q15(wrench[j]);
+  }
+
+  /* Exact binary fractions through a unit matrix come out exactly */
+  TEST_CHECK_EQUAL(allocation_solve_q15(wrench_q15, thrust_q15), ALLOCATION_Q15_ONE);
+
+  for (uint32_t i = 0; i < ALLOCATION_THRUSTERS; i++)
+  {
+    TEST_CHECK_EQUAL(thrust_q15[i], test_q15(expected[i]));
+  }
+}
+
+int main(void)
+{
+  test_unsaturated();
+
+  test_random_wrenches(NULL, 1.0f);
+  test_random_wrenches(&test_config, 1.0f);
+  test_random_wrenches(&test_config, 0.4f);
+
+  test_extremes(NULL);
+  test_extremes(&test_config);
+
+  return test_result();
+}
@@ -0,0 +1,597 @@
+/**
+  ******************************************************************************
+  * @file    test_allocation_qp.c
+  * @brief   Constrained allocation against a reference solution of the same
+  *          quadratic program, found in double by trying every active set
+  *          until one meets the KKT conditions. Covers wrenches in and out of
+  *          saturation, failed thrusters, the iteration bound and warm starts.
+  ******************************************************************************
+  */
+
+#include <math.h>
+#include <string.h>
+
+#include "allocation_qp.h"
+#include "test.h"
+
+#define TEST_N ALLOCATION_THRUSTERS
+#define TEST_M ALLOCATION_AXES
+
+/* Settings the firmware runs with and the matrix of the default layout */
+static const allocation_qp_config_t *const test_default = NULL;
+
+/* Converged far enough that only float rounding separates it from the reference */
+static const allocation_qp_config_t test_tight =
+{
+  .axis_weight = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f},
+  .thrust_weight = 0.001f,
+  .penalty = 0.2f,
+  .tolerance = 1e-6f,
+  .max_iterations = 5000u,
+};
+
+/* Quadratic program in double, 1/2 u' H u - f' u within the box */
+static double test_hessian[TEST_N][TEST_N];
+static double test_effect[TEST_M][TEST_N];   /* B */
+static double test_weight[TEST_M];
+
+/* Gaussian elimination with partial pivoting, a is n by n with row stride n, b is overwritten with x */
+static int test_linear_solve(double *a, double *b, uint32_t n)
+{
+  for (uint32_t j = 0; j < n; j++)
+  {
+    uint32_t pivot = j;
+
+    for (uint32_t i = j + 1u; i < n; i++)
+    {
+      if (fabs(a[i * n + j]) > fabs(a[pivot * n + j]))
+      {
+        pivot = i;
+      }
+    }
+
+    if (fabs(a[pivot * n + j]) < 1e-12)
+    {
+      return 0;
+    }
+
+    for (uint32_t k = 0; k < n; k++)
+    {
+      double swap = a[j * n + k];
+      a[j * n + k] = a[pivot * n + k];
+      a[pivot * n + k] = swap;
+    }
+
+    double swap = b[j];
+    b[j] = b[pivot];
+    b[pivot] = swap;
+
+    for (uint32_t i = j + 1u; i < n; i++)
+    {
+      double ratio = a[i * n + j] / a[j * n + j];
+
+      for (uint32_t k = j; k < n; k++)
+      {
+        a[i * n + k] -= ratio * a[j * n + k];
+      }
+
+      b[i] -= ratio * b[j];
+    }
+  }
+
+  for (uint32_t i = n; i-- > 0u;)
+  {
+    double sum = b[i];
+
+    for (uint32_t k = i + 1u; k < n; k++)
+    {
+      sum -= a[i * n + k] * b[k];
+    }
+
+    b[i] = sum / a[i * n + i];
+  }
+
+  return 1;
+}
+
+/* Builds B = (A' A)^-1 A' and H = B' W B + e I from the allocation in use */
+static void test_reference_init(const allocation_qp_config_t *qp_config)
+{
+  const allocation_config_t *config = allocation_get_config();
+  double thrust_weight = (qp_config != NULL) ? qp_config->thrust_weight : 0.001;
+
+  for (uint32_t i = 0; i < TEST_M; i++)
+  {
+    test_weight[i] = (qp_config != NULL) ? qp_config->axis_weight[i] : 1.0;
+  }
+
+  for (uint32_t k = 0; k < TEST_N; k++)
+  {
+    double normal[TEST_M * TEST_M];
+    double column[TEST_M];
+
+    for (uint32_t i = 0; i < TEST_M; i++)
+    {
+      for (uint32_t j = 0; j < TEST_M; j++)
+      {
+        double sum = 0.0;
+
+        for (uint32_t t = 0; t < TEST_N; t++)
+        {
+          sum += (double)config->matrix[t][i] * config->matrix[t][j];
+        }
+
+        normal[i * TEST_M + j] = sum;
+      }
+
+      column[i] = config->matrix[k][i];
+    }
+
+    TEST_CHECK(test_linear_solve(normal, column, TEST_M));
+
+    for (uint32_t i = 0; i < TEST_M; i++)
+    {
+      test_effect[i][k] = column[i];
+    }
+  }
+
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    for (uint32_t j = 0; j < TEST_N; j++)
+    {
+      double sum = (i == j) ? thrust_weight : 0.0;
+
+      for (uint32_t k = 0; k < TEST_M; k++)
+      {
+        sum += test_effect[k][i] * test_weight[k] * test_effect[k][j];
+      }
+
+      test_hessian[i][j] = sum;
+    }
+  }
+}
+
+static void test_linear_term(const float wrench[TEST_M], double f[TEST_N])
+{
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    f[i] = 0.0;
+
+    for (uint32_t k = 0; k < TEST_M; k++)
+    {
+      f[i] += test_effect[k][i] * test_weight[k] * wrench[k];
+    }
+  }
+}
+
+/* The objective as the header states it, (B u - w)' W (B u - w) + e u' u */
+static double test_cost(const float wrench[TEST_M], const double u[TEST_N])
+{
+  double f[TEST_N];
+  double cost = 0.0;
+
+  test_linear_term(wrench, f);
+
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    double hu = 0.0;
+
+    for (uint32_t j = 0; j < TEST_N; j++)
+    {
+      hu += test_hessian[i][j] * u[j];
+    }
+
+    cost += u[i] * hu - 2.0 * f[i] * u[i];
+  }
+
+  for (uint32_t k = 0; k < TEST_M; k++)
+  {
+    cost += test_weight[k] * (double)wrench[k] * wrench[k];
+  }
+
+  return cost;
+}
+
+/*
+ * Each thruster is free, at its lower bound or at its upper bound, and a failed
+ * one is fixed at zero. With the bounds fixed, the free thrusters solve a linear
+ * system, and the program is strictly convex, so the one set whose solution is
+ * inside the box with gradients pointing out of it is the optimum.
+ */
+static int test_reference(const float wrench[TEST_M], uint8_t failed, double u[TEST_N])
+{
+  const allocation_config_t *config = allocation_get_config();
+  double f[TEST_N];
+
+  test_linear_term(wrench, f);
+
+  uint32_t sets = 1;
+
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    sets *= 3u;
+  }
+
+  for (uint32_t set = 0; set < sets; set++)
+  {
+    int state[TEST_N];
+    uint32_t code = set;
+    int skip = 0;
+
+    for (uint32_t i = 0; i < TEST_N; i++)
+    {
+      /* 0 free, 1 at the lower bound, 2 at the upper bound */
+      state[i] = (int)(code % 3u);
+      code /= 3u;
+
+      if ((failed & (1u << i)) != 0u && state[i] != 2)
+      {
+        skip = 1;
+      }
+    }
+
+    if (skip)
+    {
+      continue;
+    }
+
+    uint32_t free_index[TEST_N];
+    uint32_t free_count = 0;
+
+    for (uint32_t i = 0; i < TEST_N; i++)
+    {
+      double bound = ((failed & (1u << i)) != 0u) ? 0.0 : config->limit[i];
+      u[i] = (state[i] == 1) ? -bound : bound;
+
+      if (state[i] == 0)
+      {
+        free_index[free_count++] = i;
+      }
+    }
+
+    double a[TEST_N * TEST_N];
+    double b[TEST_N];
+
+    for (uint32_t r = 0; r < free_count; r++)
+    {
+      uint32_t i = free_index[r];
+      b[r] = f[i];
+
+      for (uint32_t j = 0; j < TEST_N; j++)
+      {
+        if (state[j] != 0)
+        {
+          b[r] -= test_hessian[i][j] * u[j];
+        }
+      }
+
+      for (uint32_t c = 0; c < free_count; c++)
+      {
+        a[r * free_count + c] = test_hessian[i][free_index[c]];
+      }
+    }
+
+    if (free_count > 0u && !test_linear_solve(a, b, free_count))
+    {
+      continue;
+    }
+
+    int optimal = 1;
+
+    for (uint32_t r = 0; r < free_count; r++)
+    {
+      u[free_index[r]] = b[r];
+    }
+
+    for (uint32_t i = 0; i < TEST_N && optimal; i++)
+    {
+      double gradient = -f[i];
+
+      for (uint32_t j = 0; j < TEST_N; j++)
+      {
+        gradient += test_hessian[i][j] * u[j];
+      }
+
+      if ((failed & (1u << i)) != 0u)
+      {
+        continue;
+      }
+
+      double bound = config->limit[i];
+
+      if (state[i] == 0)
+      {
+        optimal = fabs(u[i]) <= bound + 1e-12;
+      }
+      else if (state[i] == 1)
+      {
+        optimal = gradient >= -1e-12;
+      }
+      else
+      {
+        optimal = gradient <= 1e-12;
+      }
+    }
+
+    if (optimal)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void test_random_wrench(uint32_t *state, float range, float wrench[TEST_M])
+{
+  for (uint32_t k = 0; k < TEST_M; k++)
+  {
+    wrench[k] = test_uniform(state, -range, range);
+  }
+}
+
+/* Thrust within the limits, failed thrusters at zero */
+static void test_feasible(const float thrust[TEST_N], uint8_t failed)
+{
+  const allocation_config_t *config = allocation_get_config();
+
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    if ((failed & (1u << i)) != 0u)
+    {
+      TEST_CHECK_EQUAL(thrust[i], 0);
+    }
+    else
+    {
+      TEST_CHECK(fabsf(thrust[i]) <= config->limit[i]);
+    }
+  }
+}
+
+/*
+ * Solves from cold and compares with the reference. The solution must be within
+ * thrust_tolerance of it and cost no more than cost_tolerance extra, and the
+ * iteration count must stay at or under the bound.
+ */
+static void test_against_reference(const allocation_qp_config_t *qp_config, uint8_t failed, uint32_t count, float range,
+                                   double thrust_tolerance, double cost_tolerance, uint32_t *saturated)
+{
+  uint32_t state = 0x5EED1u + failed;
+  uint32_t bound = (qp_config != NULL) ? qp_config->max_iterations : 50u;
+
+  TEST_CHECK(allocation_qp_init(qp_config));
+  test_reference_init(qp_config);
+  allocation_qp_set_failed(failed);
+
+  for (uint32_t n = 0; n < count; n++)
+  {
+    float wrench[TEST_M];
+    float thrust[TEST_N];
+    double reference[TEST_N];
+    double solved[TEST_N];
+
+    test_random_wrench(&state, range, wrench);
+
+    allocation_qp_reset();
+    uint32_t iterations = allocation_solve_qp(wrench, thrust);
+
+    TEST_CHECK(iterations >= 1u && iterations <= bound);
+    test_feasible(thrust, failed);
+
+    if (!TEST_CHECK(test_reference(wrench, failed, reference)))
+    {
+      continue;
+    }
+
+    int at_limit = 0;
+
+    for (uint32_t i = 0; i < TEST_N; i++)
+    {
+      solved[i] = thrust[i];
+      TEST_CHECK_NEAR(thrust[i], reference[i], thrust_tolerance);
+
+      if ((failed & (1u << i)) == 0u && fabs(reference[i]) >= allocation_get_config()->limit[i] - 1e-9)
+      {
+        at_limit = 1;
+      }
+    }
+
+    *saturated += (uint32_t)at_limit;
+
+    double optimum = test_cost(wrench, reference);
+    TEST_CHECK(test_cost(wrench, solved) <= optimum + cost_tolerance);
+  }
+
+  allocation_qp_set_failed(0);
+}
+
+/* Within the limits the optimum is the unconstrained least squares, A w, less a little for the thrust weight */
+static void test_unsaturated(void)
+{
+  uint32_t state = 0xBEEFu;
+
+  allocation_init(NULL);
+  TEST_CHECK(allocation_qp_init(&test_tight));
+
+  for (uint32_t n = 0; n < 200u; n++)
+  {
+    float wrench[TEST_M];
+    float thrust[TEST_N];
+    float expected[TEST_N];
+
+    test_random_wrench(&state, 0.3f, wrench);
+
+    allocation_solve_f32(wrench, expected);
+    allocation_solve_qp(wrench, thrust);
+
+    for (uint32_t i = 0; i < TEST_N; i++)
+    {
+      TEST_CHECK_NEAR(thrust[i], expected[i], 0.01);
+    }
+  }
+}
+
+static void test_saturation(void)
+{
+  uint32_t saturated = 0;
+
+  allocation_init(NULL);
+
+  /* The firmware's settings stop at a residual of 0.001, the tight ones converge */
+  test_against_reference(test_default, 0, 300u, 1.0f, 0.02, 1e-3, &saturated);
+  test_against_reference(&test_tight, 0, 300u, 1.0f, 2e-4, 1e-6, &saturated);
+  test_against_reference(&test_tight, 0, 100u, 3.0f, 2e-4, 1e-6, &saturated);
+
+  /* Most of the large wrenches reach a limit */
+  TEST_CHECK(saturated > 300u);
+}
+
+/* Every single failure and some pairs, including a whole corner and both yaw thrusters on one side */
+static void test_failed(void)
+{
+  static const uint8_t pairs[] = {0x03u, 0x05u, 0x09u, 0x30u, 0x41u, 0x90u, 0xC0u, 0x0Fu};
+  uint32_t saturated = 0;
+
+  allocation_init(NULL);
+
+  for (uint32_t i = 0; i < TEST_N; i++)
+  {
+    test_against_reference(test_default, (uint8_t)(1u << i), 40u, 0.8f, 0.02, 1e-3, &saturated);
+    test_against_reference(&test_tight, (uint8_t)(1u << i), 40u, 0.8f, 2e-4, 1e-6, &saturated);
+  }
+
+  for (uint32_t i = 0; i < sizeof(pairs); i++)
+  {
+    test_against_reference(&test_tight, pairs[i], 40u, 0.8f, 2e-4, 1e-6, &saturated);
+  }
+
+  TEST_CHECK(saturated > 0u);
+}
+
+/* A non-uniform matrix, uneven limits and axis weights */
+static void test_config(void)
+{
+  static const allocation_config_t config =
+  {
+    .matrix =
+    {
+      {0.9f, -1.1f, 0.0f, 0.1f, 0.0f, -2.5f},
+      {0.9f, 1.1f, 0.0f, -0.1f, 0.0f, 2.5f},
+      {1.2f, 0.8f, 0.05f, 0.0f, 0.0f, -1.7f},
+      {1.2f, -0.8f, -0.05f, 0.0f, 0.0f, 1.7f},
+      {0.0f, 0.0f, 1.0f, 1.3f, -0.6f, 0.0f},
+      {0.0f, 0.0f, 1.0f, -1.3f, -0.6f, 0.0f},
+      {0.0f, 0.1f, -1.0f, 0.7f, 1.9f, 0.0f},
+      {0.0f, -0.1f, -1.0f, -0.7f, 1.9f, 0.0f},
+    },
+    .limit = {1.0f, 1.0f, 0.8f, 0.8f, 0.5f, 0.5f, 0.95f, 0.95f},
+  };
+
+  allocation_qp_config_t qp_config = test_tight;
+  qp_config.axis_weight[2] = 4.0f;
+  qp_config.axis_weight[5] = 0.5f;
+
+  uint32_t saturated = 0;
+
+  allocation_init(&config);
+  test_against_reference(&qp_config, 0, 200u, 1.0f, 5e-4, 1e-6, &saturated);
+  test_against_reference(&qp_config, 0x24u, 100u, 1.0f, 5e-4, 1e-6, &saturated);
+
+  TEST_CHECK(saturated > 0u);
+}
+
+/* Cut short, the solve still returns feasible thrust and never runs over */
+static void test_iteration_bound(void)
+{
+  uint32_t state = 0xC0FFEEu;
+
+  allocation_init(NULL);
+
+  for (uint32_t bound = 1; bound <= 4u; bound++)
+  {
+    allocation_qp_config_t qp_config = test_tight;
+    qp_config.max_iterations = bound;
+
+    TEST_CHECK(allocation_qp_init(&qp_config));
+    allocation_qp_set_failed(0x21u);
+
+    for (uint32_t n = 0; n < 100u; n++)
+    {
+      float wrench[TEST_M];
+      float thrust[TEST_N];
+
+      test_random_wrench(&state, 2.0f, wrench);
+
+      TEST_CHECK_EQUAL(allocation_solve_qp(wrench, thrust), bound);
+      test_feasible(thrust, 0x21u);
+    }
+  }
+
+  allocation_qp_set_failed(0);
+}
+
+/*
+ * With the firmware's settings: from cold almost every solve converges well
+ * inside the bound, and tracking a slowly moving wrench from the previous
+ * solution takes fewer iterations than starting over.
+ */
+static void test_iterations(void)
+{
+  uint32_t state = 0xFACADEu;
+  uint32_t cold_total = 0;
+  uint32_t cold_capped = 0;
+  uint32_t warm_total = 0;
+  uint32_t warm_capped = 0;
+  const uint32_t solves = 2000u;
+
+  allocation_init(NULL);
+  TEST_CHECK(allocation_qp_init(NULL));
+
+  for (uint32_t n = 0; n < solves; n++)
+  {
+    float wrench[TEST_M];
+    float thrust[TEST_N];
+
+    test_random_wrench(&state, 1.0f, wrench);
+    allocation_qp_reset();
+
+    uint32_t iterations = allocation_solve_qp(wrench, thrust);
+    cold_total += iterations;
+    cold_capped += (iterations == 50u) ? 1u : 0u;
+  }
+
+  allocation_qp_reset();
+
+  for (uint32_t n = 0; n < solves; n++)
+  {
+    /* A 1 kHz loop following a few seconds of manoeuvring */
+    float t = (float)n * 0.001f;
+    float wrench[TEST_M] = {0.9f * sinf(t * 1.3f), 0.6f * cosf(t * 0.7f), 0.5f * sinf(t * 2.1f),
+                            0.2f * cosf(t * 1.1f), 0.3f * sinf(t * 0.9f), 0.8f * cosf(t * 1.7f)};
+    float thrust[TEST_N];
+
+    uint32_t iterations = allocation_solve_qp(wrench, thrust);
+    warm_total += iterations;
+    warm_capped += (iterations == 50u) ? 1u : 0u;
+  }
+
+  printf("iterations: %.1f cold, %.1f tracking, %u and %u of %u at the bound\n",
+         (double)cold_total / solves, (double)warm_total / solves, cold_capped, warm_capped, solves);
+
+  TEST_CHECK((double)cold_total / solves < 25.0);
+  TEST_CHECK((double)warm_total / solves < (double)cold_total / solves);
+  TEST_CHECK(cold_capped < solves / 20u);
+  TEST_CHECK(warm_capped < solves / 100u);
+}
+
+int main(void)
+{
+  test_unsaturated();
+  test_saturation();
+  test_failed();
+  test_config();
+  test_iteration_bound();
+  test_iterations();
+
+  return test_result();
+}
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    test_attitude.c
+  * @brief   Accuracy of the three attitude filters on the synthetic dive in
+  *          attitude_dive.h. Holding station each filter must track tilt to
+  *          within a couple of degrees. Thrusting they lean by about the
+  *          ratio of the thrust to gravity, which is physical, so the limit
+  *          there only catches a filter that has come apart. The estimate
+  *          must stay a unit quaternion throughout.
+  ******************************************************************************
+  */
+
+#include <stdlib.h>
+
+#include "attitude_dive.h"
+#include "test.h"
+
+/* Holding station, degrees */
+#define TEST_TILT_RMS 2.0
+#define TEST_TILT_MAX 3.0
+
+/* Thrusting, degrees */
+#define TEST_THRUST_TILT_RMS 5.0
+#define TEST_THRUST_TILT_MAX 10.0
+
+#define TEST_NORM_ERROR 1e-3
+
+static attitude_dive_sample_t *samples;
+
+static void test_filter(attitude_filter_t filter, bool thrusting)
+{
+  attitude_dive_errors_t errors;
+  attitude_dive_run(samples, filter, &errors);
+
+  TEST_CHECK_NEAR(errors.tilt_rms, 0.0, thrusting ? TEST_THRUST_TILT_RMS : TEST_TILT_RMS);
+  TEST_CHECK_NEAR(errors.tilt_max, 0.0, thrusting ? TEST_THRUST_TILT_MAX : TEST_TILT_MAX);
+  TEST_CHECK_NEAR(errors.norm_error, 0.0, TEST_NORM_ERROR);
+}
+
+int main(void)
+{
+  samples = malloc(ATTITUDE_DIVE_SAMPLES * sizeof(attitude_dive_sample_t));
+
+  for (uint32_t thrusting = 0; thrusting < 2u; thrusting++)
+  {
+    attitude_dive_build(samples, thrusting != 0u);
+
+    test_filter(ATTITUDE_COMPLEMENTARY, thrusting != 0u);
+    test_filter(ATTITUDE_MADGWICK, thrusting != 0u);
+    test_filter(ATTITUDE_EKF, thrusting != 0u);
+  }
+
+  free(samples);
+
+  return test_result();
+}
@@ -0,0 +1,595 @@
+/**
+  ******************************************************************************
+  * @file    test_companion.c
+  * @brief   Companion link against the reference master on the simulated
+  *          slave: idle frames, the NSS edge buffer swap and when a queued
+  *          frame goes out, sequence numbers and CRCs both ways, commands and
+  *          pings, transmit slots held and exhausted, resynchronisation after
+  *          a short transaction or a late transmit byte, and a long random
+  *          run against a model of what the master should see.
+  ******************************************************************************
+  */
+
+#include <string.h>
+
+#include "comm.h"
+#include "companion.h"
+#include "companion_master.h"
+#include "companion_mock.h"
+#include "test.h"
+
+/* Commands the link hands to comm */
+static protocol_command_t commands_last;
+static uint32_t commands;
+
+void comm_set_command(const protocol_command_t *command)
+{
+  commands_last = *command;
+  commands++;
+}
+
+static companion_master_t master;
+
+static void test_start(void)
+{
+  companion_mock_reset();
+  memset(&master, 0, sizeof(master));
+  master.synced = true;           /* The link numbers from zero */
+  memset(&commands_last, 0, sizeof(commands_last));
+  commands = 0;
+
+  companion_init(&companion_mock_ops);
+}
+
+/* The slave never ran dry, never had the buffer it was sending repointed, and every lock was undone */
+static void test_link_clean(void)
+{
+  TEST_CHECK_EQUAL(companion_mock.underruns, 0);
+  TEST_CHECK_EQUAL(companion_mock.bad_loads, 0);
+  TEST_CHECK_EQUAL(companion_mock.lock_depth, 0);
+}
+
+/* One whole frame each way; mosi may be NULL for zeros */
+static companion_master_result_t test_transaction(const uint8_t *mosi, companion_master_message_t *message)
+{
+  static const uint8_t zeros[COMPANION_MASTER_FRAME];
+  uint8_t miso[COMPANION_MASTER_FRAME];
+
+  companion_master_transact(mosi != NULL ? mosi : zeros, miso, COMPANION_MASTER_FRAME);
+
+  return companion_master_receive(&master, miso, message);
+}
+
+/* A message whose payload is its number, little-endian */
+static bool test_send(uint32_t number)
+{
+  uint8_t payload[4] = {(uint8_t)number, (uint8_t)(number >> 8), (uint8_t)(number >> 16), (uint8_t)(number >> 24)};
+
+  return companion_send(PROTOCOL_ID_STATUS, payload, sizeof(payload));
+}
+
+static uint32_t test_number(const companion_master_message_t *message)
+{
+  return (uint32_t)message->payload[0] | ((uint32_t)message->payload[1] << 8) |
+         ((uint32_t)message->payload[2] << 16) | ((uint32_t)message->payload[3] << 24);
+}
+
+/* The next transaction carries message number, and nothing else is in the payload */
+static void test_expect(uint32_t number)
+{
+  companion_master_message_t message;
+
+  if (!TEST_CHECK_EQUAL(test_transaction(NULL, &message), COMPANION_MASTER_MESSAGE))
+  {
+    return;
+  }
+
+  TEST_CHECK_EQUAL(message.id, PROTOCOL_ID_STATUS);
+  TEST_CHECK_EQUAL(test_number(&message), number);
+
+  for (uint32_t i = 4; i < PROTOCOL_MAX_PAYLOAD; i++)
+  {
+    TEST_CHECK_EQUAL(message.payload[i], 0);
+  }
+}
+
+static void test_expect_idle(void)
+{
+  companion_master_message_t message;
+
+  TEST_CHECK_EQUAL(test_transaction(NULL, &message), COMPANION_MASTER_IDLE);
+}
+
+/* The frame layout the master builds matches the firmware's, CRC included */
+static void test_layout(void)
+{
+  static const uint8_t check[] = "123456789";
+
+  TEST_CHECK_EQUAL(companion_master_crc(check, 9), 0x29B1u);
+  TEST_CHECK_EQUAL(sizeof(companion_frame_t), COMPANION_MASTER_FRAME);
+
+  uint8_t payload[3] = {0xA5u, 0x5Au, 0x01u};
+  uint8_t frame[COMPANION_MASTER_FRAME];
+
+  companion_master_build(frame, 0x42u, 0x17u, payload, sizeof(payload));
+
+  companion_frame_t firmware;
+  memcpy(&firmware, frame, sizeof(firmware));
+
+  TEST_CHECK_EQUAL(firmware.id, 0x42u);
+  TEST_CHECK_EQUAL(firmware.seq, 0x17u);
+  TEST_CHECK_EQUAL(firmware.payload[2], 0x01u);
+  TEST_CHECK_EQUAL(firmware.crc, crc16(frame, offsetof(companion_frame_t, crc)));
+}
+
+/* With nothing queued every frame is a sealed idle frame, and zeros from the master are ignored */
+static void test_idle(void)
+{
+  test_start();
+
+  TEST_CHECK_EQUAL(companion_mock.inits, 1);
+  TEST_CHECK_EQUAL(companion_mock.starts, 1);
+  TEST_CHECK(companion_mock.edge_enabled);
+
+  for (uint32_t i = 0; i < 5u; i++)
+  {
+    test_expect_idle();
+  }
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(companion_mock.edges, 5);
+  TEST_CHECK_EQUAL(master.idle, 5);
+  TEST_CHECK_EQUAL(stats.idle, 5);
+  TEST_CHECK_EQUAL(stats.frames, 0);
+  TEST_CHECK_EQUAL(stats.errors, 0);
+  TEST_CHECK_EQUAL(stats.resyncs, 0);
+
+  test_link_clean();
+}
+
+/*
+ * The edge after a transaction loads the buffer the transmit stream left, and
+ * the stream is already on the other one, so a frame queued before a
+ * transaction goes out in the third transaction from then.
+ */
+static void test_latency(void)
+{
+  test_start();
+
+  TEST_CHECK(test_send(1));
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(1);
+
+  TEST_CHECK(test_send(2));
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(2);
+
+  /* Back to back once the pipeline is full */
+  TEST_CHECK(test_send(3));
+  TEST_CHECK(test_send(4));
+  TEST_CHECK(test_send(5));
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(3);
+  test_expect(4);
+  test_expect(5);
+  test_expect_idle();
+
+  TEST_CHECK_EQUAL(master.messages, 5);
+  TEST_CHECK_EQUAL(master.lost, 0);
+  TEST_CHECK_EQUAL(master.bad_crc, 0);
+
+  test_link_clean();
+}
+
+/* Sequence numbers count every frame acquired and wrap, and every CRC checks */
+static void test_sequence(void)
+{
+  test_start();
+
+  companion_master_message_t message;
+  uint32_t sent = 0;
+  uint32_t received = 0;
+
+  for (uint32_t transaction = 0; transaction < 1000u && received < 600u; transaction++)
+  {
+    if (sent < 600u)
+    {
+      TEST_CHECK(test_send(sent));
+      sent++;
+    }
+
+    if (test_transaction(NULL, &message) == COMPANION_MASTER_MESSAGE)
+    {
+      TEST_CHECK_EQUAL(message.seq, received & 0xFFu);
+      TEST_CHECK_EQUAL(test_number(&message), received);
+      received++;
+    }
+  }
+
+  TEST_CHECK_EQUAL(received, 600);
+  TEST_CHECK_EQUAL(master.lost, 0);
+  TEST_CHECK_EQUAL(master.bad_crc, 0);
+
+  test_link_clean();
+}
+
+/* Commands go to comm, pings are answered, and damaged or unknown frames are counted and dropped */
+static void test_receive(void)
+{
+  test_start();
+
+  protocol_command_t command;
+  memset(&command, 0, sizeof(command));
+  command.time_us = 123456u;
+  command.axes[2] = -321;
+  command.buttons = 0x8001u;
+  command.flags = PROTOCOL_COMMAND_GAMEPAD;
+
+  uint8_t frame[COMPANION_MASTER_FRAME];
+  companion_master_message_t message;
+
+  companion_master_build(frame, PROTOCOL_ID_COMMAND, 0, &command, sizeof(command));
+  test_transaction(frame, &message);
+
+  TEST_CHECK_EQUAL(commands, 1);
+  TEST_CHECK(memcmp(&commands_last, &command, sizeof(command)) == 0);
+
+  /* A bit flipped anywhere, the CRC included. One that leaves the identifier zero makes an idle frame, which is not checked. */
+  uint32_t errors = 1;
+
+  for (uint32_t bit = 0; bit < COMPANION_MASTER_FRAME * 8u; bit += 37u)
+  {
+    companion_master_build(frame, PROTOCOL_ID_COMMAND, 1, &command, sizeof(command));
+    frame[bit / 8u] ^= (uint8_t)(1u << (bit % 8u));
+
+    if (frame[0] != 0u)
+    {
+      errors++;
+    }
+
+    test_transaction(frame, &message);
+  }
+
+  companion_master_build(frame, 0x7Fu, 2, &command, sizeof(command));
+  test_transaction(frame, &message);
+
+  TEST_CHECK_EQUAL(commands, 1);
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.frames, 1);
+  TEST_CHECK_EQUAL(stats.errors, errors);
+
+  /* The pong carries the time of the edge the ping arrived at and the time it was queued, and goes out two transactions later */
+  protocol_ping_t ping = {.host_time_us = 0x0123456789ABCDEFull};
+
+  companion_master_build(frame, PROTOCOL_ID_PING, 3, &ping, sizeof(ping));
+  companion_mock.time_us = 5000u;
+  TEST_CHECK_EQUAL(test_transaction(frame, &message), COMPANION_MASTER_IDLE);
+
+  TEST_CHECK_EQUAL(test_transaction(NULL, &message), COMPANION_MASTER_IDLE);
+  TEST_CHECK_EQUAL(test_transaction(NULL, &message), COMPANION_MASTER_MESSAGE);
+
+  protocol_pong_t pong;
+  memcpy(&pong, message.payload, sizeof(pong));
+
+  TEST_CHECK_EQUAL(message.id, PROTOCOL_ID_PONG);
+  TEST_CHECK(pong.host_time_us == ping.host_time_us);
+  TEST_CHECK_EQUAL(pong.rx_time_us, 5000u);
+  TEST_CHECK_EQUAL(pong.tx_time_us, 5001u);
+
+  companion_get_stats(&stats);
+  TEST_CHECK_EQUAL(stats.frames, 2);
+
+  test_link_clean();
+}
+
+/* Slots go out in the order taken: one still being built holds back those after it */
+static void test_slots(void)
+{
+  test_start();
+
+  companion_frame_t *held = companion_acquire();
+  TEST_CHECK(held != NULL);
+  TEST_CHECK(test_send(2));
+
+  for (uint32_t i = 0; i < 4u; i++)
+  {
+    test_expect_idle();
+  }
+
+  memset(held->payload, 0, sizeof(held->payload));
+  held->payload[0] = 1;
+  companion_commit(held, PROTOCOL_ID_STATUS);
+
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(1);
+  test_expect(2);
+
+  /* Every slot taken: the ninth is refused until the edge after the first went out */
+  for (uint32_t i = 0; i < COMPANION_TX_SLOTS; i++)
+  {
+    TEST_CHECK(test_send(10u + i));
+  }
+
+  TEST_CHECK(!test_send(99));
+  TEST_CHECK(companion_acquire() == NULL);
+
+  test_expect_idle();
+  test_expect_idle();
+  TEST_CHECK(!test_send(99));
+  test_expect(10);
+  TEST_CHECK(test_send(18));
+  TEST_CHECK(!test_send(99));
+
+  for (uint32_t i = 11; i <= 18u; i++)
+  {
+    test_expect(i);
+  }
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.dropped, 4);
+  TEST_CHECK_EQUAL(master.lost, 0);
+  TEST_CHECK(!companion_send(PROTOCOL_ID_STATUS, NULL, PROTOCOL_MAX_PAYLOAD + 1u));
+
+  test_link_clean();
+}
+
+/* A short transaction restarts both streams; the frames in flight are lost and the rest follow */
+static void test_resync(void)
+{
+  test_start();
+
+  TEST_CHECK(test_send(0));
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(0);
+
+  TEST_CHECK(test_send(1));
+  TEST_CHECK(test_send(2));
+  TEST_CHECK(test_send(3));
+
+  test_expect_idle();
+  test_expect_idle();
+
+  /* Frame 1 is going out and frame 2 is loaded behind it when the master stops early */
+  protocol_command_t command = {.time_us = 1};
+  uint8_t frame[COMPANION_MASTER_FRAME];
+  uint8_t miso[COMPANION_MASTER_FRAME];
+
+  companion_master_build(frame, PROTOCOL_ID_COMMAND, 0, &command, sizeof(command));
+  companion_master_transact(frame, miso, 10);
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.resyncs, 1);
+  TEST_CHECK_EQUAL(companion_mock.starts, 2);
+  TEST_CHECK_EQUAL(commands, 0);
+
+  /* A glitch on NSS with no clocks changes nothing */
+  companion_mock_nss_rise();
+  companion_get_stats(&stats);
+  TEST_CHECK_EQUAL(stats.resyncs, 1);
+  TEST_CHECK_EQUAL(companion_mock.starts, 2);
+
+  /* Only frame 3 is still taken */
+  for (uint32_t i = 0; i < COMPANION_TX_SLOTS - 1u; i++)
+  {
+    TEST_CHECK(test_send(4u + i));
+  }
+
+  TEST_CHECK(!test_send(99));
+
+  /* Received in step again from the first whole frame */
+  companion_master_message_t message;
+  TEST_CHECK_EQUAL(test_transaction(frame, &message), COMPANION_MASTER_IDLE);
+  TEST_CHECK_EQUAL(commands, 1);
+  TEST_CHECK_EQUAL(commands_last.time_us, 1);
+
+  test_expect_idle();
+
+  for (uint32_t i = 3; i < 4u + COMPANION_TX_SLOTS - 1u; i++)
+  {
+    test_expect(i);
+  }
+
+  test_expect_idle();
+
+  TEST_CHECK_EQUAL(master.lost, 2);
+  TEST_CHECK_EQUAL(master.bad_crc, 0);
+
+  test_link_clean();
+}
+
+/* A late transmit stream leaves it a byte behind the receive stream, which a whole frame does not put right */
+static void test_stall(void)
+{
+  test_start();
+
+  TEST_CHECK(test_send(0));
+  TEST_CHECK(test_send(1));
+  test_expect_idle();
+  test_expect_idle();
+
+  /* Frame 0 goes out with a byte missing, and frame 1 behind it is lost with it */
+  uint8_t mosi[COMPANION_MASTER_FRAME] = {0};
+  uint8_t miso[COMPANION_MASTER_FRAME];
+
+  companion_mock_stall();
+  companion_master_transact(mosi, miso, COMPANION_MASTER_FRAME);
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(companion_mock.underruns, 1);
+  TEST_CHECK_EQUAL(stats.resyncs, 1);
+  TEST_CHECK_EQUAL(companion_mock.starts, 2);
+
+  companion_master_message_t message;
+  TEST_CHECK(companion_master_receive(&master, miso, &message) == COMPANION_MASTER_BAD_CRC);
+
+  TEST_CHECK(test_send(2));
+  test_expect_idle();
+  test_expect_idle();
+  test_expect(2);
+
+  TEST_CHECK_EQUAL(master.lost, 2);
+  TEST_CHECK_EQUAL(companion_mock.bad_loads, 0);
+  TEST_CHECK_EQUAL(companion_mock.lock_depth, 0);
+}
+
+/*
+ * Random sends, held slots, commands with and without damage, short
+ * transactions, late transmit bytes and NSS glitches. Messages must arrive in the order queued,
+ * numbered by seq, and a gap in the sequence is only allowed after a resync
+ * and only for the two frames each resync found in flight.
+ */
+static void test_random_run(void)
+{
+  uint32_t state = 0xC0FFEEu;
+  uint32_t queued = 0;
+  uint32_t expected = 0;
+  uint32_t lost = 0;
+  uint32_t good = 0;
+  uint32_t bad = 0;
+  uint32_t resyncs = 0;
+  uint32_t losable = 0;
+  companion_frame_t *held = NULL;
+  uint32_t held_number = 0;
+
+  test_start();
+
+  for (uint32_t step = 0; step < 100000u; step++)
+  {
+    uint32_t action = test_random(&state) % 16u;
+
+    companion_mock.time_us += 13u;
+
+    if (action < 4u)
+    {
+      if (test_send(queued))
+      {
+        queued++;
+      }
+    }
+    else if (action == 4u)
+    {
+      if (held == NULL)
+      {
+        held = companion_acquire();
+        held_number = queued;
+
+        if (held != NULL)
+        {
+          queued++;
+        }
+      }
+      else
+      {
+        memset(held->payload, 0, sizeof(held->payload));
+        memcpy(held->payload, &held_number, sizeof(held_number));
+        companion_commit(held, PROTOCOL_ID_STATUS);
+        held = NULL;
+      }
+    }
+    else if (action == 5u)
+    {
+      uint8_t mosi[COMPANION_MASTER_FRAME] = {0};
+      uint8_t miso[COMPANION_MASTER_FRAME];
+
+      if (test_random(&state) % 2u == 0u)
+      {
+        companion_master_transact(mosi, miso, 1u + test_random(&state) % (COMPANION_MASTER_FRAME - 1u));
+      }
+      else
+      {
+        companion_mock_stall();
+        companion_master_transact(mosi, miso, COMPANION_MASTER_FRAME);
+      }
+
+      resyncs++;
+      losable += 2u;
+    }
+    else if (action == 6u)
+    {
+      companion_mock_nss_rise();
+    }
+    else
+    {
+      uint8_t frame[COMPANION_MASTER_FRAME];
+      protocol_command_t command = {.time_us = step};
+
+      companion_master_build(frame, PROTOCOL_ID_COMMAND, (uint8_t)step, &command, sizeof(command));
+
+      if (test_random(&state) % 8u == 0u)
+      {
+        frame[2u + test_random(&state) % (COMPANION_MASTER_FRAME - 2u)] ^= 0x10u;
+        bad++;
+      }
+      else
+      {
+        good++;
+      }
+
+      companion_master_message_t message;
+      companion_master_result_t result = test_transaction(frame, &message);
+
+      TEST_CHECK(result != COMPANION_MASTER_BAD_CRC);
+
+      if (result == COMPANION_MASTER_MESSAGE)
+      {
+        uint32_t number = test_number(&message);
+
+        TEST_CHECK_EQUAL(message.seq, number & 0xFFu);
+
+        if (!TEST_CHECK(number >= expected))
+        {
+          break;
+        }
+
+        TEST_CHECK(number - expected <= losable);
+        lost += number - expected;
+
+        expected = number + 1u;
+        losable = 0;
+      }
+    }
+  }
+
+  companion_stats_t stats;
+  companion_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.resyncs, resyncs);
+  TEST_CHECK_EQUAL(stats.frames, good);
+  TEST_CHECK_EQUAL(stats.errors, bad);
+  TEST_CHECK_EQUAL(commands, good);
+  TEST_CHECK_EQUAL(master.lost, lost);
+  TEST_CHECK(master.messages > 10000u);
+  TEST_CHECK_EQUAL(companion_mock.bad_loads, 0);
+  TEST_CHECK_EQUAL(companion_mock.lock_depth, 0);
+}
+
+int main(void)
+{
+  test_layout();
+  test_idle();
+  test_latency();
+  test_sequence();
+  test_receive();
+  test_slots();
+  test_resync();
+  test_stall();
+  test_random_run();
+
+  return test_result();
+}
@@ -0,0 +1,367 @@
+/**
+  ******************************************************************************
+  * @file    test_serial_link.cpp
+  * @brief   Host serial transport end to end against a pseudo-terminal pair,
+  *          the test holding the master side as the vehicle: writes queued
+  *          together going out in one syscall, reads arriving in chunks with
+  *          a handler that holds back partial frames, the receive ring
+  *          overflowing behind a handler that consumes nothing, and the peer
+  *          closing.
+  ******************************************************************************
+  */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <unistd.h>
+
+#include "SerialLink.hpp"
+#include "test.h"
+
+/* Frames the handler consumes whole */
+#define TEST_FRAME 4u
+
+/* SerialLink's receive ring, already a page multiple */
+#define TEST_RING (64u * 1024u)
+
+/* Both ends of a pseudo-terminal, the link opening the slave by name */
+struct test_pty
+{
+  int master;
+  char name[128];
+};
+
+static bool test_open(test_pty &pty)
+{
+  int slave = -1;
+
+  if (!TEST_CHECK(openpty(&pty.master, &slave, pty.name, nullptr, nullptr) == 0))
+  {
+    return false;
+  }
+
+  /* The link opens its own descriptor, so closing the master hangs it up */
+  close(slave);
+  fcntl(pty.master, F_SETFL, O_NONBLOCK);
+
+  return true;
+}
+
+template <typename Predicate>
+static bool test_wait(Predicate Done)
+{
+  for (int i = 0; i < 2000; i++)
+  {
+    if (Done())
+    {
+      return true;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return Done();
+}
+
+/* Everything written from the vehicle side, waiting for room as a device would */
+static void test_send(int master, const uint8_t *data, size_t size, size_t chunk)
+{
+  size_t offset = 0;
+
+  for (int stalls = 0; offset < size && stalls < 2000;)
+  {
+    size_t length = std::min(size - offset, chunk);
+    ssize_t written = write(master, data + offset, length);
+
+    if (written > 0)
+    {
+      offset += static_cast<size_t>(written);
+      stalls = 0;
+
+      /* Gives the link a read per chunk */
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    else
+    {
+      pollfd writable = {master, POLLOUT, 0};
+      poll(&writable, 1, 1);
+      stalls++;
+    }
+  }
+
+  TEST_CHECK_EQUAL(offset, size);
+}
+
+/* Reads from the vehicle side until size bytes arrived or nothing more comes */
+static std::vector<uint8_t> test_receive(int master, size_t size)
+{
+  std::vector<uint8_t> received;
+  uint8_t buffer[4096];
+
+  while (received.size() < size)
+  {
+    pollfd readable = {master, POLLIN, 0};
+
+    if (poll(&readable, 1, 2000) <= 0)
+    {
+      break;
+    }
+
+    ssize_t length = read(master, buffer, sizeof(buffer));
+
+    if (length <= 0)
+    {
+      break;
+    }
+
+    received.insert(received.end(), buffer, buffer + length);
+  }
+
+  return received;
+}
+
+static uint8_t test_byte(size_t index)
+{
+  return static_cast<uint8_t>(index * 7u + (index >> 8));
+}
+
+/* Commands queued before the transfer thread runs leave in fewer write() calls than Write() calls, intact and in order */
+static void test_coalesce(void)
+{
+  test_pty pty;
+
+  if (!test_open(pty))
+  {
+    return;
+  }
+
+  SerialLink Link(pty.name, 115200);
+  TEST_CHECK(Link.IsOpen());
+
+  const size_t writes = 100;
+  const size_t size = 26;
+  std::vector<uint8_t> sent;
+
+  for (size_t i = 0; i < writes; i++)
+  {
+    uint8_t command[size];
+
+    for (size_t j = 0; j < size; j++)
+    {
+      command[j] = test_byte(sent.size() + j);
+    }
+
+    TEST_CHECK_EQUAL(Link.Write(command, size), 0);
+    sent.insert(sent.end(), command, command + size);
+  }
+
+  Link.StartTransferLoop();
+
+  std::vector<uint8_t> received = test_receive(pty.master, sent.size());
+  TEST_CHECK(received == sent);
+
+  test_wait([&] { return Link.GetStatistics().BytesSent == sent.size(); });
+
+  SerialStatistics Statistics = Link.GetStatistics();
+
+  TEST_CHECK_EQUAL(Statistics.BytesSent, sent.size());
+  TEST_CHECK(Statistics.WriteCalls >= 1u);
+  TEST_CHECK(Statistics.WriteCalls < writes);
+  TEST_CHECK_EQUAL(Statistics.DroppedBytes, 0);
+
+  /* Writes from a running link still arrive whole */
+  sent.clear();
+
+  for (size_t i = 0; i < writes; i++)
+  {
+    uint8_t command[size];
+    memset(command, static_cast<int>(i), size);
+
+    TEST_CHECK_EQUAL(Link.Write(command, size), 0);
+    sent.insert(sent.end(), command, command + size);
+  }
+
+  received = test_receive(pty.master, sent.size());
+  TEST_CHECK(received == sent);
+
+  close(pty.master);
+}
+
+/*
+ * Telemetry clocked in 37 bytes at a time, against a handler that only takes
+ * whole frames. Whatever it leaves must be offered again at the start of the
+ * next call, so the frames it takes join up into exactly what was sent.
+ */
+static void test_partial(void)
+{
+  test_pty pty;
+
+  if (!test_open(pty))
+  {
+    return;
+  }
+
+  SerialLink Link(pty.name, 115200);
+
+  std::mutex Mutex;
+  std::string consumed;
+  std::string held;
+  size_t calls = 0;
+  size_t partial = 0;
+  size_t mismatched = 0;
+
+  Link.SetReceiveHandler([&](const uint8_t *Data, size_t Size) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    if (Size < held.size() || memcmp(Data, held.data(), held.size()) != 0)
+    {
+      mismatched++;
+    }
+
+    size_t frames = Size / TEST_FRAME * TEST_FRAME;
+
+    consumed.append(reinterpret_cast<const char *>(Data), frames);
+    held.assign(reinterpret_cast<const char *>(Data) + frames, Size - frames);
+
+    calls++;
+    partial += (frames != Size) ? 1u : 0u;
+
+    return frames;
+  });
+
+  Link.StartTransferLoop();
+
+  std::vector<uint8_t> sent(10000u * TEST_FRAME);
+
+  for (size_t i = 0; i < sent.size(); i++)
+  {
+    sent[i] = test_byte(i);
+  }
+
+  test_send(pty.master, sent.data(), sent.size(), 37);
+
+  TEST_CHECK(test_wait([&] {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return consumed.size() == sent.size();
+  }));
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  SerialStatistics Statistics = Link.GetStatistics();
+
+  TEST_CHECK(consumed.size() == sent.size() && memcmp(consumed.data(), sent.data(), sent.size()) == 0);
+  TEST_CHECK(held.empty());
+  TEST_CHECK_EQUAL(mismatched, 0);
+  TEST_CHECK(partial > 0u);
+  TEST_CHECK(calls > 1u);
+  TEST_CHECK_EQUAL(Statistics.ReadCalls, calls);
+  TEST_CHECK_EQUAL(Statistics.BytesReceived, sent.size());
+  TEST_CHECK_EQUAL(Statistics.OverflowBytes, 0);
+
+  close(pty.master);
+}
+
+/* A handler that never consumes lets the ring fill; the whole ring is discarded once, and the rest kept */
+static void test_overflow(void)
+{
+  test_pty pty;
+
+  if (!test_open(pty))
+  {
+    return;
+  }
+
+  SerialLink Link(pty.name, 115200);
+
+  std::atomic<size_t> largest{0};
+  std::atomic<size_t> last{0};
+
+  Link.SetReceiveHandler([&](const uint8_t *Data, size_t Size) {
+    (void) Data;
+
+    if (Size > largest)
+    {
+      largest = Size;
+    }
+
+    last = Size;
+    return static_cast<size_t>(0);
+  });
+
+  Link.StartTransferLoop();
+
+  const size_t extra = 1000;
+  std::vector<uint8_t> sent(TEST_RING + extra);
+
+  for (size_t i = 0; i < sent.size(); i++)
+  {
+    sent[i] = test_byte(i);
+  }
+
+  test_send(pty.master, sent.data(), sent.size(), 4096);
+
+  TEST_CHECK(test_wait([&] { return Link.GetStatistics().BytesReceived == sent.size(); }));
+
+  SerialStatistics Statistics = Link.GetStatistics();
+
+  TEST_CHECK_EQUAL(Statistics.OverflowBytes, TEST_RING);
+  TEST_CHECK_EQUAL(largest.load(), TEST_RING);
+  TEST_CHECK_EQUAL(last.load(), extra);
+
+  close(pty.master);
+}
+
+/* Closing the vehicle side hangs the link up, and writes are refused after */
+static void test_hangup(void)
+{
+  test_pty pty;
+
+  if (!test_open(pty))
+  {
+    return;
+  }
+
+  SerialLink Link(pty.name, 115200);
+  Link.StartTransferLoop();
+
+  TEST_CHECK(Link.IsOpen());
+
+  close(pty.master);
+
+  TEST_CHECK(test_wait([&] { return !Link.IsOpen(); }));
+
+  uint8_t command[4] = {1, 2, 3, 4};
+  TEST_CHECK_EQUAL(Link.Write(command, sizeof(command)), -1);
+}
+
+/* A device that is not there leaves the link closed */
+static void test_missing(void)
+{
+  SerialLink Link("/dev/null/none", 115200);
+
+  TEST_CHECK(!Link.IsOpen());
+  Link.StartTransferLoop();
+
+  uint8_t command[1] = {0};
+  TEST_CHECK_EQUAL(Link.Write(command, sizeof(command)), -1);
+}
+
+int main(void)
+{
+  test_coalesce();
+  test_partial();
+  test_overflow();
+  test_hangup();
+  test_missing();
+
+  return test_result();
+}
@@ -0,0 +1,565 @@
+/**
+  ******************************************************************************
+  * @file    test_spi_bus.c
+  * @brief   SPI sensor bus queue on the simulated bus: registering reads,
+  *          queueing by data-ready and request, back to back DMA reads with
+  *          their chip selects, the double buffer swap while consumers hold
+  *          a buffer, transfer errors, and a long random run of all of these
+  *          against a model of which buffer each read should land in.
+  ******************************************************************************
+  */
+
+#include <string.h>
+
+#include "spi_bus.h"
+#include "spi_bus_mock.h"
+#include "test.h"
+
+#define TEST_READS 3u
+
+/* An IMU FIFO on data-ready 0, a magnetometer on data-ready 1 and a polled sensor */
+static const uint16_t test_lengths[TEST_READS] = {14u, 6u, 3u};
+static const uint8_t test_devices[TEST_READS] = {0u, 3u, 1u};
+static const uint8_t test_triggers[TEST_READS] = {0u, 1u, SPI_BUS_NO_TRIGGER};
+
+static uint8_t storage0[SPI_BUS_STORAGE(14)];
+static uint8_t storage1[SPI_BUS_STORAGE(6)];
+static uint8_t storage2[SPI_BUS_STORAGE(3)];
+static uint8_t *const storages[TEST_READS] = {storage0, storage1, storage2};
+
+static int32_t handles[TEST_READS];
+static uint32_t handled[TEST_READS];
+static int contexts[TEST_READS];
+
+static void test_handler(int32_t read, void *context)
+{
+  TEST_CHECK(read >= 0 && read < (int32_t)TEST_READS);
+  TEST_CHECK(context == &contexts[read]);
+
+  /* Called after the chip select is raised, before the next read starts */
+  TEST_CHECK(!spi_bus_mock.dma);
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    TEST_CHECK(!spi_bus_mock.selected[i]);
+  }
+
+  handled[read]++;
+}
+
+static uint8_t *test_buffer(uint32_t read, uint32_t index)
+{
+  return storages[read] + index * (test_lengths[read] + 1u);
+}
+
+/* Registers the three reads and starts the bus */
+static void test_start(void)
+{
+  spi_bus_mock_reset();
+  spi_bus_init(&spi_bus_mock_ops);
+
+  memset(handled, 0, sizeof(handled));
+
+  for (uint32_t i = 0; i < TEST_READS; i++)
+  {
+    spi_bus_read_t read =
+    {
+      .device = test_devices[i],
+      .command = SPI_BUS_READ(0x1Du + i),
+      .length = test_lengths[i],
+      .trigger = test_triggers[i],
+      .storage = storages[i],
+      .handler = test_handler,
+      .context = &contexts[i],
+    };
+
+    memset(storages[i], 0, SPI_BUS_STORAGE(test_lengths[i]));
+    handles[i] = spi_bus_add_read(&read);
+    TEST_CHECK_EQUAL(handles[i], i);
+  }
+
+  spi_bus_start();
+}
+
+/* No chip select was ever lowered alongside another or left high through a read */
+static void test_bus_clean(void)
+{
+  TEST_CHECK_EQUAL(spi_bus_mock.overlaps, 0);
+  TEST_CHECK_EQUAL(spi_bus_mock.unselected, 0);
+  TEST_CHECK_EQUAL(spi_bus_mock.lock_depth, 0);
+}
+
+/* The running read is read i into its buffer index, with its device alone selected */
+static void test_running(uint32_t read, uint32_t index)
+{
+  TEST_CHECK(spi_bus_mock.dma);
+  TEST_CHECK_EQUAL(spi_bus_mock.current.device, test_devices[read]);
+  TEST_CHECK_EQUAL(spi_bus_mock.current.command, SPI_BUS_READ(0x1Du + read));
+  TEST_CHECK_EQUAL(spi_bus_mock.current.length, test_lengths[read]);
+  TEST_CHECK(spi_bus_mock.current.rx == test_buffer(read, index));
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    TEST_CHECK_EQUAL(spi_bus_mock.selected[i], i == test_devices[read]);
+  }
+}
+
+/* The data of transfer number came back intact */
+static void test_data(const uint8_t *data, uint32_t read, uint32_t transfer)
+{
+  for (uint32_t i = 0; i < test_lengths[read]; i++)
+  {
+    TEST_CHECK_EQUAL(data[i], spi_bus_mock_byte(transfer, i));
+  }
+}
+
+static void test_add_read(void)
+{
+  spi_bus_mock_reset();
+  spi_bus_init(&spi_bus_mock_ops);
+
+  TEST_CHECK_EQUAL(spi_bus_mock.inits, 1);
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    TEST_CHECK(!spi_bus_mock.selected[i]);
+  }
+
+  spi_bus_read_t read = {.device = 0, .command = 0x80u, .length = 14u, .trigger = 0u, .storage = storage0};
+
+  spi_bus_read_t bad = read;
+  bad.device = SPI_BUS_DEVICES;
+  TEST_CHECK_EQUAL(spi_bus_add_read(&bad), -1);
+
+  bad = read;
+  bad.length = 0;
+  TEST_CHECK_EQUAL(spi_bus_add_read(&bad), -1);
+
+  bad = read;
+  bad.storage = NULL;
+  TEST_CHECK_EQUAL(spi_bus_add_read(&bad), -1);
+
+  bad = read;
+  bad.trigger = SPI_BUS_TRIGGERS;
+  TEST_CHECK_EQUAL(spi_bus_add_read(&bad), -1);
+
+  TEST_CHECK_EQUAL(spi_bus_add_read(&read), 0);
+
+  /* One read per data-ready input */
+  TEST_CHECK_EQUAL(spi_bus_add_read(&read), -1);
+
+  read.trigger = SPI_BUS_NO_TRIGGER;
+
+  for (int32_t i = 1; i < (int32_t)SPI_BUS_MAX_READS; i++)
+  {
+    TEST_CHECK_EQUAL(spi_bus_add_read(&read), i);
+  }
+
+  TEST_CHECK_EQUAL(spi_bus_add_read(&read), -1);
+
+  /* Nothing runs until asked, and only the input with a read is enabled */
+  spi_bus_start();
+
+  TEST_CHECK(spi_bus_mock.trigger_enabled[0]);
+  TEST_CHECK(!spi_bus_mock.trigger_enabled[1]);
+  TEST_CHECK(!spi_bus_mock.trigger_enabled[2]);
+  TEST_CHECK(!spi_bus_mock.dma);
+
+  spi_bus_init(&spi_bus_mock_ops);
+  TEST_CHECK_EQUAL(spi_bus_add_read(&read), 0);
+  spi_bus_start();
+
+  /* Not while running */
+  TEST_CHECK_EQUAL(spi_bus_add_read(&read), -1);
+  TEST_CHECK(!spi_bus_request(-1));
+  TEST_CHECK(!spi_bus_request(1));
+  TEST_CHECK(spi_bus_acquire(1, NULL, NULL) == NULL);
+}
+
+/* A data-ready edge on an idle bus starts the read straight away, into the back buffer */
+static void test_single(void)
+{
+  test_start();
+
+  spi_bus_mock.time_us = 1000u;
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+
+  test_running(0, 0);
+  TEST_CHECK(spi_bus_acquire(handles[0], NULL, NULL) == NULL);
+
+  spi_bus_mock.time_us = 1100u;
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  TEST_CHECK(!spi_bus_mock.dma);
+  TEST_CHECK(!spi_bus_mock.selected[test_devices[0]]);
+  TEST_CHECK_EQUAL(spi_bus_mock.selections[test_devices[0]], 1);
+  TEST_CHECK_EQUAL(handled[0], 1);
+
+  uint32_t time_us = 0;
+  uint32_t sequence = 0;
+  const uint8_t *data = spi_bus_acquire(handles[0], &time_us, &sequence);
+
+  /* The command byte's slot is skipped, and the time is the request's */
+  TEST_CHECK(data == test_buffer(0, 0) + 1);
+  TEST_CHECK_EQUAL(data[-1], 0xA5u);
+  test_data(data, 0, 0);
+  TEST_CHECK_EQUAL(time_us, 1000u);
+  TEST_CHECK_EQUAL(sequence, 1);
+
+  spi_bus_release(handles[0]);
+
+  spi_bus_stats_t stats;
+  spi_bus_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.interrupts, 2);
+  TEST_CHECK_EQUAL(stats.transfers, 1);
+  TEST_CHECK_EQUAL(stats.dropped, 0);
+  TEST_CHECK(stats.cycles > 0u);
+
+  test_bus_clean();
+}
+
+/* Requests during a read wait their turn in order, each chip select raised before the next is lowered */
+static void test_queue(void)
+{
+  test_start();
+
+  TEST_CHECK(spi_bus_request(handles[2]));
+  TEST_CHECK(spi_bus_mock_data_ready(1));
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+
+  /* Already queued, or already running and queued again once */
+  TEST_CHECK(!spi_bus_request(handles[1]));
+  TEST_CHECK(spi_bus_request(handles[2]));
+  TEST_CHECK(!spi_bus_request(handles[2]));
+
+  test_running(2, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+  test_running(1, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+  test_running(0, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  /* The second read of 2 goes into its other buffer */
+  test_running(2, 1);
+  TEST_CHECK(spi_bus_mock_complete(false));
+  TEST_CHECK(!spi_bus_mock.dma);
+  TEST_CHECK(!spi_bus_mock_complete(false));
+
+  TEST_CHECK_EQUAL(spi_bus_mock.started, 4);
+  TEST_CHECK_EQUAL(handled[0], 1);
+  TEST_CHECK_EQUAL(handled[1], 1);
+  TEST_CHECK_EQUAL(handled[2], 2);
+
+  uint32_t sequence = 0;
+  const uint8_t *data = spi_bus_acquire(handles[2], NULL, &sequence);
+  TEST_CHECK(data == test_buffer(2, 1) + 1);
+  test_data(data, 2, 3);
+  TEST_CHECK_EQUAL(sequence, 2);
+  spi_bus_release(handles[2]);
+
+  for (uint32_t i = 0; i < SPI_BUS_DEVICES; i++)
+  {
+    TEST_CHECK(!spi_bus_mock.selected[i]);
+  }
+
+  spi_bus_stats_t stats;
+  spi_bus_get_stats(&stats);
+  TEST_CHECK_EQUAL(stats.transfers, 4);
+  TEST_CHECK_EQUAL(stats.dropped, 2);
+
+  test_bus_clean();
+}
+
+/*
+ * Data-ready back to back, each edge arriving as the previous read completes:
+ * the reads alternate buffers, and a consumer holding one keeps it unchanged
+ * while the bus drops edges rather than write it.
+ */
+static void test_swap(void)
+{
+  test_start();
+
+  uint32_t transfer = 0;
+
+  for (uint32_t i = 0; i < 6u; i++)
+  {
+    TEST_CHECK(spi_bus_mock_data_ready(0));
+    test_running(0, i % 2u);
+    TEST_CHECK(spi_bus_mock_complete(false));
+    transfer++;
+
+    const uint8_t *data = spi_bus_acquire(handles[0], NULL, NULL);
+    TEST_CHECK(data == test_buffer(0, i % 2u) + 1);
+    test_data(data, 0, transfer - 1u);
+    spi_bus_release(handles[0]);
+  }
+
+  /* Take the newest, buffer 1, then the next edge still has buffer 0 to fill */
+  uint32_t sequence = 0;
+  const uint8_t *held = spi_bus_acquire(handles[0], NULL, &sequence);
+  uint8_t copy[14];
+  memcpy(copy, held, sizeof(copy));
+
+  TEST_CHECK(held == test_buffer(0, 1) + 1);
+  TEST_CHECK_EQUAL(sequence, 6);
+
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  test_running(0, 0);
+
+  /* An edge while it runs queues one more read behind it */
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  TEST_CHECK(spi_bus_mock_complete(false));
+  transfer++;
+
+  /* Buffer 0 is now the newest, and the queued read would need buffer 1, which is held */
+  TEST_CHECK(!spi_bus_mock.dma);
+  TEST_CHECK_EQUAL(spi_bus_mock.started, 7);
+
+  for (uint32_t i = 0; i < 4u; i++)
+  {
+    TEST_CHECK(spi_bus_mock_data_ready(0));
+    TEST_CHECK(!spi_bus_mock.dma);
+  }
+
+  TEST_CHECK(memcmp(held, copy, sizeof(copy)) == 0);
+  test_data(held, 0, 5);
+
+  /* A second acquire moves the hold to the newest buffer, so the other is free again */
+  const uint8_t *newest = spi_bus_acquire(handles[0], NULL, &sequence);
+  TEST_CHECK(newest == test_buffer(0, 0) + 1);
+  test_data(newest, 0, transfer - 1u);
+  TEST_CHECK_EQUAL(sequence, 7);
+
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  test_running(0, 1);
+  TEST_CHECK(spi_bus_mock_complete(false));
+  transfer++;
+
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  TEST_CHECK(!spi_bus_mock.dma);
+
+  spi_bus_release(handles[0]);
+
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  test_running(0, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+  transfer++;
+
+  spi_bus_stats_t stats;
+  spi_bus_get_stats(&stats);
+
+  /* The queued edge, four edges while buffer 1 was held and one while buffer 0 was */
+  TEST_CHECK_EQUAL(stats.transfers, transfer);
+  TEST_CHECK_EQUAL(stats.dropped, 6);
+  TEST_CHECK_EQUAL(handled[0], transfer);
+
+  /* A request says so when it cannot have a buffer */
+  TEST_CHECK(spi_bus_request(handles[2]));
+  TEST_CHECK(spi_bus_mock_complete(false));
+  TEST_CHECK(spi_bus_acquire(handles[2], NULL, NULL) == test_buffer(2, 0) + 1);
+  TEST_CHECK(spi_bus_request(handles[2]));
+  TEST_CHECK(spi_bus_mock_complete(false));
+  TEST_CHECK(!spi_bus_request(handles[2]));
+  TEST_CHECK(!spi_bus_mock.dma);
+  spi_bus_release(handles[2]);
+  TEST_CHECK(spi_bus_request(handles[2]));
+  test_running(2, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  test_bus_clean();
+}
+
+/* A failed read keeps the previous buffer and does not stall the queue */
+static void test_error(void)
+{
+  test_start();
+
+  TEST_CHECK(spi_bus_mock_data_ready(1));
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  TEST_CHECK(spi_bus_mock_data_ready(1));
+  TEST_CHECK(spi_bus_request(handles[2]));
+  test_running(1, 1);
+  TEST_CHECK(spi_bus_mock_complete(true));
+
+  TEST_CHECK_EQUAL(spi_bus_mock.tx_stops, 1);
+  TEST_CHECK(!spi_bus_mock.selected[test_devices[1]]);
+  test_running(2, 0);
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  uint32_t sequence = 0;
+  const uint8_t *data = spi_bus_acquire(handles[1], NULL, &sequence);
+  TEST_CHECK(data == test_buffer(1, 0) + 1);
+  test_data(data, 1, 0);
+  TEST_CHECK_EQUAL(sequence, 1);
+  TEST_CHECK_EQUAL(handled[1], 1);
+  spi_bus_release(handles[1]);
+
+  /* The retry goes into the same buffer the failed read used */
+  TEST_CHECK(spi_bus_mock_data_ready(1));
+  test_running(1, 1);
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  test_bus_clean();
+}
+
+/* Stopping masks the inputs; polled transfers select the device around the bytes and only while stopped */
+static void test_stop_and_transfer(void)
+{
+  test_start();
+
+  TEST_CHECK(spi_bus_mock_data_ready(0));
+  TEST_CHECK(spi_bus_mock_complete(false));
+
+  spi_bus_stop();
+
+  for (uint32_t i = 0; i < SPI_BUS_TRIGGERS; i++)
+  {
+    TEST_CHECK(!spi_bus_mock.trigger_enabled[i]);
+  }
+
+  TEST_CHECK(!spi_bus_mock_data_ready(0));
+
+  uint8_t tx[3] = {0x75u, 0x00u, 0x00u};
+  uint8_t rx[3] = {0};
+  uint32_t before = spi_bus_mock.selections[2];
+
+  spi_bus_transfer(2, tx, rx, sizeof(tx));
+
+  TEST_CHECK_EQUAL(spi_bus_mock.selections[2], before + 1u);
+  TEST_CHECK(!spi_bus_mock.selected[2]);
+  TEST_CHECK_EQUAL(rx[0], 0x8Au);
+  TEST_CHECK_EQUAL(rx[2], 0xFFu);
+
+  spi_bus_transfer(SPI_BUS_DEVICES, tx, rx, sizeof(tx));
+
+  spi_bus_start();
+  spi_bus_transfer(2, tx, rx, sizeof(tx));
+  TEST_CHECK_EQUAL(spi_bus_mock.selections[2], before + 1u);
+
+  test_bus_clean();
+}
+
+/*
+ * Random data-ready edges, requests, completions, errors, acquires and
+ * releases. A model of each read tracks its newest buffer and the transfer in
+ * it; every DMA read must go into the buffer the consumer does not hold, and
+ * every acquire must return the newest completed data.
+ */
+static void test_random_run(void)
+{
+  uint32_t state = 0x51B05u;
+  uint32_t front[TEST_READS] = {1u, 1u, 1u};
+  uint32_t front_transfer[TEST_READS] = {0};
+  uint32_t completed[TEST_READS] = {0};
+  int32_t held[TEST_READS] = {-1, -1, -1};
+
+  test_start();
+
+  for (uint32_t step = 0; step < 200000u; step++)
+  {
+    uint32_t action = test_random(&state) % 10u;
+    uint32_t read = test_random(&state) % TEST_READS;
+
+    spi_bus_mock.time_us += 7u;
+
+    if (action < 3u)
+    {
+      if (test_triggers[read] != SPI_BUS_NO_TRIGGER)
+      {
+        spi_bus_mock_data_ready(test_triggers[read]);
+      }
+      else
+      {
+        spi_bus_request(handles[read]);
+      }
+    }
+    else if (action < 6u)
+    {
+      bool error = (test_random(&state) % 16u) == 0u;
+
+      if (spi_bus_mock.dma)
+      {
+        uint32_t number = spi_bus_mock.started - 1u;
+        uint32_t active = TEST_READS;
+
+        for (uint32_t i = 0; i < TEST_READS; i++)
+        {
+          if (spi_bus_mock.current.rx == test_buffer(i, 0) || spi_bus_mock.current.rx == test_buffer(i, 1))
+          {
+            active = i;
+          }
+        }
+
+        if (!TEST_CHECK(active < TEST_READS))
+        {
+          break;
+        }
+
+        uint32_t target = (spi_bus_mock.current.rx == test_buffer(active, 0)) ? 0u : 1u;
+
+        /* Never the newest completed buffer nor the one a consumer holds */
+        TEST_CHECK_EQUAL(target, front[active] ^ 1u);
+        TEST_CHECK(held[active] != (int32_t)target);
+
+        spi_bus_mock_complete(error);
+
+        if (!error)
+        {
+          front[active] = target;
+          front_transfer[active] = number;
+          completed[active]++;
+        }
+      }
+    }
+    else if (action < 8u)
+    {
+      uint32_t sequence = 0;
+      const uint8_t *data = spi_bus_acquire(handles[read], NULL, &sequence);
+
+      if (completed[read] == 0u)
+      {
+        TEST_CHECK(data == NULL);
+      }
+      else if (TEST_CHECK(data == test_buffer(read, front[read]) + 1))
+      {
+        TEST_CHECK_EQUAL(sequence, completed[read]);
+        test_data(data, read, front_transfer[read]);
+        held[read] = (int32_t)front[read];
+      }
+    }
+    else
+    {
+      spi_bus_release(handles[read]);
+      held[read] = -1;
+    }
+  }
+
+  for (uint32_t i = 0; i < TEST_READS; i++)
+  {
+    TEST_CHECK(completed[i] > 1000u);
+    TEST_CHECK_EQUAL(handled[i], completed[i]);
+  }
+
+  spi_bus_stats_t stats;
+  spi_bus_get_stats(&stats);
+
+  TEST_CHECK_EQUAL(stats.transfers, completed[0] + completed[1] + completed[2]);
+  TEST_CHECK(stats.dropped > 0u);
+
+  test_bus_clean();
+}
+
+int main(void)
+{
+  test_add_read();
+  test_single();
+  test_queue();
+  test_swap();
+  test_error();
+  test_stop_and_transfer();
+  test_random_run();
+
+  return test_result();
+}
@@ -0,0 +1,448 @@
+/**
+  ******************************************************************************
+  * @file    test_thrusters.c
+  * @brief   Thruster driver against the mock timers: the DMA burst setup,
+  *          which compare register each of the eight thrusters' commands
+  *          lands in and when, OneShot125 resolution, and the DShot encoding
+  *          and bit timing against the DShot specification.
+  ******************************************************************************
+  */
+
+#include <math.h>
+
+#include "test.h"
+#include "thrusters.h"
+#include "thrusters_mock.h"
+
+static void test_start(void)
+{
+  thrusters_mock_reset();
+  thrusters_init(&thrusters_mock_ops);
+}
+
+/* Writes a command, which must be taken straight away and leave interrupts as they were */
+static void test_write(const uint16_t pulse_us[THRUSTER_COUNT])
+{
+  TEST_CHECK(thrusters_write(pulse_us));
+  TEST_CHECK_EQUAL(thrusters_mock.lock_depth, 0);
+}
+
+static void test_init(void)
+{
+  test_start();
+
+  TEST_CHECK_EQUAL(thrusters_mock.inits, 1);
+  TEST_CHECK_EQUAL(thrusters_get_mode(), THRUSTER_MODE_PWM50);
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    const thrusters_mock_timer_t *timer = &thrusters_mock.timers[t];
+
+    /* DCR: four transfers (DBL = 3) from CCR1 (DBA = 13), the reference manual's encoding */
+    TEST_CHECK_EQUAL(timer->registers[THRUSTERS_MOCK_DCR] & 0x1Fu, THRUSTERS_MOCK_CCR1);
+    TEST_CHECK_EQUAL((timer->registers[THRUSTERS_MOCK_DCR] >> 8) & 0x1Fu, THRUSTER_TIMER_OUTPUTS - 1u);
+    TEST_CHECK_EQUAL(timer->registers[THRUSTERS_MOCK_DCR], 0x30Du);
+
+    /* 84 MHz / 84 counts microseconds, 20 ms period */
+    TEST_CHECK_EQUAL(timer->registers[THRUSTERS_MOCK_PSC], 83);
+    TEST_CHECK_EQUAL(timer->registers[THRUSTERS_MOCK_ARR], 19999);
+    TEST_CHECK(timer->running);
+    TEST_CHECK(!timer->armed);
+  }
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), THRUSTER_PULSE_NEUTRAL);
+  }
+
+  TEST_CHECK_EQUAL(thrusters_mock.lock_depth, 0);
+}
+
+/* Every thruster gets its own width, so a command in the wrong channel shows */
+static void test_burst(void)
+{
+  test_start();
+
+  uint16_t pulses[THRUSTER_COUNT];
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    pulses[i] = (uint16_t)(1150u + 90u * i);
+  }
+
+  test_write(pulses);
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    /* One four-word burst per timer, waiting for the update */
+    TEST_CHECK(thrusters_mock.timers[t].armed);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].length, THRUSTER_TIMER_OUTPUTS);
+  }
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), THRUSTER_PULSE_NEUTRAL);
+  }
+
+  /* The burst goes in just after the update, the outputs change at the next */
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), pulses[i]);
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), THRUSTER_PULSE_NEUTRAL);
+  }
+
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), pulses[i]);
+  }
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].bursts, 1);
+    TEST_CHECK(!thrusters_mock.timers[t].armed);
+
+    /* Nothing outside CCR1-CCR4 is touched */
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_ARR], 19999);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_CCR1 + THRUSTER_TIMER_OUTPUTS], 0);
+  }
+
+  uint16_t queued[THRUSTER_COUNT];
+  thrusters_get(queued);
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(queued[i], pulses[i]);
+  }
+}
+
+/* A newer command replaces one still waiting for its update */
+static void test_rearm(void)
+{
+  test_start();
+
+  uint16_t first[THRUSTER_COUNT] = {1200, 1200, 1200, 1200, 1200, 1200, 1200, 1200};
+  uint16_t second[THRUSTER_COUNT] = {1800, 1700, 1600, 1500, 1400, 1300, 1200, 1100};
+
+  test_write(first);
+  test_write(second);
+  thrusters_mock_update();
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), second[i]);
+  }
+
+  TEST_CHECK_EQUAL(thrusters_mock.timers[0].bursts + thrusters_mock.timers[1].bursts, 2);
+}
+
+static void test_clamp(void)
+{
+  test_start();
+
+  uint16_t pulses[THRUSTER_COUNT] = {0, 900, 1099, 1100, 1900, 1901, 2500, 65535};
+  uint16_t expected[THRUSTER_COUNT] = {1100, 1100, 1100, 1100, 1900, 1900, 1900, 1900};
+
+  test_write(pulses);
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), expected[i]);
+  }
+}
+
+static void test_pwm400(void)
+{
+  test_start();
+  thrusters_set_mode(THRUSTER_MODE_PWM400);
+
+  TEST_CHECK_EQUAL(thrusters_get_mode(), THRUSTER_MODE_PWM400);
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    /* 2.5 ms period, and DCR survives the mode change */
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_PSC], 83);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_ARR], 2499);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_DCR], 0x30Du);
+  }
+
+  uint16_t pulses[THRUSTER_COUNT] = {1100, 1250, 1400, 1550, 1700, 1850, 1900, 1500};
+
+  test_write(pulses);
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), pulses[i]);
+  }
+}
+
+/* A command is not armed within 20 us of an update, where one timer could take it a period late */
+static void test_guard(void)
+{
+  static const uint32_t starts[] = {0, 5, 19, 19981, 19999};
+  uint16_t pulses[THRUSTER_COUNT] = {1300, 1300, 1300, 1300, 1300, 1300, 1300, 1300};
+
+  for (uint32_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++)
+  {
+    test_start();
+
+    thrusters_mock.counter = starts[i];
+    thrusters_mock.step = 3;
+    thrusters_mock.count_reads = 0;
+
+    test_write(pulses);
+
+    /* The last read is the one that let the write through */
+    uint32_t armed_at = (thrusters_mock.counter + 20000u - 3u) % 20000u;
+
+    TEST_CHECK(thrusters_mock.count_reads > 1u);
+    TEST_CHECK(armed_at >= 20u && armed_at <= 19999u - 20u);
+  }
+
+  test_start();
+
+  thrusters_mock.counter = 10000;
+  thrusters_mock.count_reads = 0;
+
+  test_write(pulses);
+
+  TEST_CHECK_EQUAL(thrusters_mock.count_reads, 1);
+}
+
+/* Half a microsecond per tick at 4 MHz, every two microseconds of command is a distinct width */
+static void test_oneshot125(void)
+{
+  test_start();
+  thrusters_set_mode(THRUSTER_MODE_ONESHOT125);
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    /* 84 MHz / 21 is 4 MHz, 500 us period for 2 kHz */
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_PSC], 20);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_ARR], 1999);
+  }
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), 750);
+  }
+
+  uint32_t widths = 0;
+  uint32_t last = 0;
+
+  for (uint32_t pulse = THRUSTER_PULSE_MIN; pulse <= THRUSTER_PULSE_MAX; pulse++)
+  {
+    uint16_t pulses[THRUSTER_COUNT];
+
+    for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+    {
+      pulses[i] = (uint16_t)pulse;
+    }
+
+    /* Well clear of the update guard */
+    thrusters_mock.counter = 1000;
+    test_write(pulses);
+    thrusters_mock_update();
+
+    /* An eighth of the pulse, in quarter microseconds */
+    for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+    {
+      TEST_CHECK_EQUAL(thrusters_mock_ccr(i), pulse * 4u / 8u);
+    }
+
+    if (thrusters_mock_ccr(0) != last)
+    {
+      widths++;
+      last = thrusters_mock_ccr(0);
+    }
+  }
+
+  TEST_CHECK_EQUAL(widths, (THRUSTER_PULSE_MAX - THRUSTER_PULSE_MIN) / 2u + 1u);
+
+  uint16_t fine[THRUSTER_COUNT] = {1100, 1101, 1102, 1104, 1106, 1500, 1898, 1900};
+  uint32_t expected[THRUSTER_COUNT] = {550, 550, 551, 552, 553, 750, 949, 950};
+
+  thrusters_mock.counter = 1000;
+  test_write(fine);
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), expected[i]);
+  }
+}
+
+/* Frames worked out by hand from the specification: value, telemetry bit, then the XOR of the three nibbles */
+static void test_dshot_frame(void)
+{
+  static const struct
+  {
+    uint16_t value;
+    bool telemetry;
+    uint16_t frame;
+  } vectors[] =
+  {
+    {0, false, 0x0000},         /* Disarmed, the checksum of nothing is nothing */
+    {0, true, 0x0011},
+    {1, true, 0x0033},          /* Beep command with telemetry */
+    {47, false, 0x05EB},        /* Last command */
+    {48, false, 0x0606},        /* Lowest throttle */
+    {1046, false, 0x82C6},      /* The specification's worked example, 1000001011000110 */
+    {1047, false, 0x82E4},
+    {1048, false, 0x830B},
+    {2047, false, 0xFFEE},      /* Full throttle */
+    {2047, true, 0xFFFF},
+  };
+
+  for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+  {
+    uint16_t frame = thrusters_dshot_frame(vectors[i].value, vectors[i].telemetry);
+
+    TEST_CHECK_EQUAL(frame, vectors[i].frame);
+
+    /* Value in the top eleven bits, telemetry next, checksum last */
+    TEST_CHECK_EQUAL(frame >> 5, vectors[i].value);
+    TEST_CHECK_EQUAL((frame >> 4) & 1u, vectors[i].telemetry ? 1u : 0u);
+    TEST_CHECK_EQUAL(frame & 0xFu, ((frame >> 4) ^ (frame >> 8) ^ (frame >> 12)) & 0xFu);
+  }
+
+  /* Only eleven bits of value fit */
+  TEST_CHECK_EQUAL(thrusters_dshot_frame(2048, false), thrusters_dshot_frame(0, false));
+}
+
+static void test_dshot_throttle(void)
+{
+  static const struct
+  {
+    uint16_t pulse;
+    uint16_t throttle;
+  } vectors[] =
+  {
+    {1500, 0},                  /* Neutral and the deadband either side stop */
+    {1476, 0},
+    {1524, 0},
+    {1475, 48 + 25 * 999 / 400},
+    {1525, 1048 + 25 * 999 / 400},
+    {1100, 1047},               /* Full reverse */
+    {1900, 2047},               /* Full forward */
+    {1000, 1047},               /* Clamped */
+    {2000, 2047},
+  };
+
+  for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_dshot_throttle(vectors[i].pulse), vectors[i].throttle);
+  }
+
+  /* Never a command value, and monotonic within each direction */
+  for (uint32_t pulse = THRUSTER_PULSE_MIN; pulse <= THRUSTER_PULSE_MAX; pulse++)
+  {
+    uint16_t throttle = thrusters_dshot_throttle((uint16_t)pulse);
+    TEST_CHECK(throttle == 0u || (throttle >= 48u && throttle <= 2047u));
+
+    if (pulse > 1525u)
+    {
+      TEST_CHECK(throttle >= thrusters_dshot_throttle((uint16_t)(pulse - 1u)));
+    }
+    else if (pulse < 1475u)
+    {
+      TEST_CHECK(throttle >= thrusters_dshot_throttle((uint16_t)(pulse + 1u)));
+    }
+  }
+}
+
+/* One period per bit: a 1 is high for 75% of it, a 0 for 37.5%, then the line is held low */
+static void test_dshot_mode(thruster_mode_t mode, uint32_t bitrate)
+{
+  test_start();
+  thrusters_set_mode(mode);
+
+  uint32_t period = thrusters_mock.timers[0].registers[THRUSTERS_MOCK_ARR] + 1u;
+
+  for (uint32_t t = 0; t < THRUSTER_TIMERS; t++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_PSC], 0);
+    TEST_CHECK_EQUAL(thrusters_mock.timers[t].registers[THRUSTERS_MOCK_ARR] + 1u, period);
+  }
+
+  TEST_CHECK_EQUAL(84000000u / period, bitrate);
+  TEST_CHECK_EQUAL(84000000u % period, 0);
+
+  /* Idle low until the first frame */
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_active(i), 0);
+  }
+
+  uint32_t bit_one = (uint32_t)lround(period * 0.75);
+  uint32_t bit_zero = (uint32_t)lround(period * 0.375);
+
+  TEST_CHECK_EQUAL(bit_one, mode == THRUSTER_MODE_DSHOT300 ? 210 : 105);
+  TEST_CHECK_EQUAL(bit_zero, mode == THRUSTER_MODE_DSHOT300 ? 105 : 53);
+
+  uint16_t pulses[THRUSTER_COUNT] = {1500, 1900, 1100, 2000, 1000, 1524, 1476, 1900};
+  uint16_t frames[THRUSTER_COUNT] = {0x0000, 0xFFEE, 0x82E4, 0xFFEE, 0x82E4, 0x0000, 0x0000, 0xFFEE};
+
+  TEST_CHECK(thrusters_write(pulses));
+
+  /* Sixteen bits and the low period, in one stream transfer per timer */
+  TEST_CHECK_EQUAL(thrusters_mock.timers[0].length, 17u * THRUSTER_TIMER_OUTPUTS);
+  TEST_CHECK_EQUAL(thrusters_mock.timers[1].length, 17u * THRUSTER_TIMER_OUTPUTS);
+
+  uint16_t received[THRUSTER_COUNT] = {0};
+
+  for (uint32_t bit = 0; bit < 16u; bit++)
+  {
+    /* A frame is never cut short */
+    TEST_CHECK(!thrusters_write(pulses));
+
+    thrusters_mock_update();
+
+    for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+    {
+      uint32_t high = thrusters_mock_ccr(i);
+
+      TEST_CHECK(high == bit_one || high == bit_zero);
+      received[i] = (uint16_t)((received[i] << 1) | (high == bit_one ? 1u : 0u));
+    }
+  }
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(received[i], frames[i]);
+  }
+
+  thrusters_mock_update();
+
+  for (uint32_t i = 0; i < THRUSTER_COUNT; i++)
+  {
+    TEST_CHECK_EQUAL(thrusters_mock_ccr(i), 0);
+  }
+
+  TEST_CHECK_EQUAL(thrusters_mock.timers[0].bursts, 17);
+  TEST_CHECK(thrusters_write(pulses));
+  TEST_CHECK_EQUAL(thrusters_mock.lock_depth, 0);
+}
+
+int main(void)
+{
+  test_init();
+  test_burst();
+  test_rearm();
+  test_clamp();
+  test_pwm400();
+  test_guard();
+  test_oneshot125();
+  test_dshot_frame();
+  test_dshot_throttle();
+  test_dshot_mode(THRUSTER_MODE_DSHOT300, 300000);
+  test_dshot_mode(THRUSTER_MODE_DSHOT600, 600000);
+
+  return test_result();
+}
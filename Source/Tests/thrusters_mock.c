@@ -0,0 +1,165 @@
+/**
+  ******************************************************************************
+  * @file    thrusters_mock.c
+  * @brief   Thruster timer and DMA operations on the in-memory timers.
+  ******************************************************************************
+  */
+
+#include "thrusters_mock.h"
+
+#include <string.h>
+
+thrusters_mock_t thrusters_mock;
+
+void thrusters_mock_reset(void)
+{
+  memset(&thrusters_mock, 0, sizeof(thrusters_mock));
+  thrusters_mock.step = 1;
+}
+
+/* A DMAR access goes to the register DBA words past CR1, plus one per access in the burst */
+static void thrusters_mock_dmar(thrusters_mock_timer_t *timer, uint32_t access, uint32_t value)
+{
+  uint32_t base = timer->registers[THRUSTERS_MOCK_DCR] & 0x1Fu;
+  uint32_t offset = base + access;
+
+  if (offset < THRUSTERS_MOCK_REGISTERS && offset != THRUSTERS_MOCK_DMAR)
+  {
+    timer->registers[offset] = value;
+  }
+}
+
+void thrusters_mock_update(void)
+{
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    thrusters_mock_timer_t *timer = &thrusters_mock.timers[i];
+
+    if (!timer->running)
+    {
+      continue;
+    }
+
+    memcpy(timer->compare, &timer->registers[THRUSTERS_MOCK_CCR1], sizeof(timer->compare));
+
+    if (!timer->armed)
+    {
+      continue;
+    }
+
+    uint32_t transfers = ((timer->registers[THRUSTERS_MOCK_DCR] >> 8) & 0x1Fu) + 1u;
+
+    for (uint32_t access = 0; access < transfers && timer->position < timer->length; access++)
+    {
+      thrusters_mock_dmar(timer, access, timer->burst[timer->position++]);
+    }
+
+    timer->bursts++;
+
+    /* Normal mode, the stream disables itself at the end */
+    if (timer->position == timer->length)
+    {
+      timer->armed = false;
+    }
+  }
+}
+
+uint32_t thrusters_mock_ccr(uint32_t thruster)
+{
+  const thrusters_mock_timer_t *timer = &thrusters_mock.timers[thruster / THRUSTER_TIMER_OUTPUTS];
+  return timer->registers[THRUSTERS_MOCK_CCR1 + thruster % THRUSTER_TIMER_OUTPUTS];
+}
+
+uint32_t thrusters_mock_active(uint32_t thruster)
+{
+  return thrusters_mock.timers[thruster / THRUSTER_TIMER_OUTPUTS].compare[thruster % THRUSTER_TIMER_OUTPUTS];
+}
+
+static uint32_t thrusters_mock_lock(void)
+{
+  return (uint32_t)thrusters_mock.lock_depth++;
+}
+
+static void thrusters_mock_unlock(uint32_t state)
+{
+  thrusters_mock.lock_depth = (int)state;
+}
+
+static void thrusters_mock_init(uint32_t dcr)
+{
+  thrusters_mock.inits++;
+
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    thrusters_mock.timers[i].registers[THRUSTERS_MOCK_DCR] = dcr;
+  }
+}
+
+static void thrusters_mock_stop(void)
+{
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    thrusters_mock.timers[i].running = false;
+  }
+}
+
+static void thrusters_mock_load(uint32_t index, uint16_t prescaler, uint16_t period, const uint32_t compare[THRUSTER_TIMER_OUTPUTS])
+{
+  thrusters_mock_timer_t *timer = &thrusters_mock.timers[index];
+
+  timer->armed = false;
+  timer->registers[THRUSTERS_MOCK_PSC] = prescaler;
+  timer->registers[THRUSTERS_MOCK_ARR] = period;
+  memcpy(&timer->registers[THRUSTERS_MOCK_CCR1], compare, sizeof(timer->compare));
+
+  /* The update generated by UG loads the preloaded values straight away */
+  memcpy(timer->compare, compare, sizeof(timer->compare));
+}
+
+static void thrusters_mock_start(void)
+{
+  /* Timer 1 is started by timer 0's trigger output */
+  for (uint32_t i = 0; i < THRUSTER_TIMERS; i++)
+  {
+    thrusters_mock.timers[i].running = true;
+  }
+}
+
+static void thrusters_mock_arm(uint32_t index, const uint32_t *burst, uint32_t length)
+{
+  thrusters_mock_timer_t *timer = &thrusters_mock.timers[index];
+
+  timer->burst = burst;
+  timer->length = length;
+  timer->position = 0;
+  timer->armed = length > 0u;
+}
+
+static bool thrusters_mock_busy(void)
+{
+  return thrusters_mock.timers[0].armed || thrusters_mock.timers[1].armed;
+}
+
+static uint32_t thrusters_mock_count(void)
+{
+  uint32_t count = thrusters_mock.counter;
+  uint32_t period = thrusters_mock.timers[0].registers[THRUSTERS_MOCK_ARR] + 1u;
+
+  thrusters_mock.count_reads++;
+  thrusters_mock.counter = (thrusters_mock.counter + thrusters_mock.step) % period;
+
+  return count;
+}
+
+const thrusters_ops_t thrusters_mock_ops =
+{
+  .lock = thrusters_mock_lock,
+  .unlock = thrusters_mock_unlock,
+  .init = thrusters_mock_init,
+  .stop = thrusters_mock_stop,
+  .load = thrusters_mock_load,
+  .start = thrusters_mock_start,
+  .arm = thrusters_mock_arm,
+  .busy = thrusters_mock_busy,
+  .count = thrusters_mock_count,
+};
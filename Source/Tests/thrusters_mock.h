@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file    thrusters_mock.h
+  * @brief   Two timers and their update DMA streams for the thruster driver,
+  *          in memory. Registers are kept at their word offsets from CR1, so
+  *          a burst through DMAR lands wherever DCR points it, as on the
+  *          STM32, and compare values take effect at the update after they
+  *          are written, as with preload.
+  ******************************************************************************
+  */
+
+#ifndef __THRUSTERS_MOCK_H
+#define __THRUSTERS_MOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "thrusters.h"
+
+/* Word offsets from CR1 */
+#define THRUSTERS_MOCK_PSC       10u
+#define THRUSTERS_MOCK_ARR       11u
+#define THRUSTERS_MOCK_CCR1      13u
+#define THRUSTERS_MOCK_DCR       18u
+#define THRUSTERS_MOCK_DMAR      19u
+#define THRUSTERS_MOCK_REGISTERS 20u
+
+typedef struct
+{
+  uint32_t registers[THRUSTERS_MOCK_REGISTERS];
+  uint32_t compare[THRUSTER_TIMER_OUTPUTS];   /* Active compare values, what the outputs show */
+  bool running;
+
+  const uint32_t *burst;                      /* Armed stream */
+  uint32_t length;
+  uint32_t position;
+  bool armed;
+  uint32_t bursts;                            /* Update requests served */
+} thrusters_mock_timer_t;
+
+typedef struct
+{
+  thrusters_mock_timer_t timers[THRUSTER_TIMERS];
+
+  uint32_t counter;                           /* Timer 0 counter, advanced by step each read */
+  uint32_t step;
+  uint32_t count_reads;
+
+  int lock_depth;
+  uint32_t inits;
+} thrusters_mock_t;
+
+extern thrusters_mock_t thrusters_mock;
+extern const thrusters_ops_t thrusters_mock_ops;
+
+/**
+  * @brief  Clears every register and counter.
+  */
+void thrusters_mock_reset(void);
+
+/**
+  * @brief  Update event on both timers: preloaded compare values become
+  *         active, then each armed stream writes one burst through DMAR.
+  */
+void thrusters_mock_update(void);
+
+/**
+  * @brief  Gets the compare value a thruster's channel was last written.
+  * @param  thruster: 0-7
+  */
+uint32_t thrusters_mock_ccr(uint32_t thruster);
+
+/**
+  * @brief  Gets the compare value a thruster's output is running with.
+  * @param  thruster: 0-7
+  */
+uint32_t thrusters_mock_active(uint32_t thruster);
+
+#endif /* __THRUSTERS_MOCK_H */